@@ -16,6 +16,9 @@ SUPER_DEBUG_ARGS="-lasan -ggdb -fsanitize=pointer-compare \
 # DEBUG_ARGS="${DEBUG_ARGS} -DDEBUG_BUFFERS=ON"
 # DEBUG_ARGS="${DEBUG_ARGS} -DDEBUG_QUIT=ON"
 # DEBUG_ARGS="${DEBUG_ARGS} -DDEBUG_UNDO=ON"
+# DEBUG_ARGS="${DEBUG_ARGS} -DDEBUG_KERNELS=ON"
+# DEBUG_ARGS="${DEBUG_ARGS} -DDEBUG_MEMORY=ON"
+# DEBUG_ARGS="${DEBUG_ARGS} -DDEBUG_PROFILE=ON"
 ADDITIONAL_FILES=""
 old_pwd=${PWD}
 (cd /usr/share/fonts/TTF/liberation/;
@@ -23,6 +26,13 @@ old_pwd=${PWD}
 ADDITIONAL_FILES="${ADDITIONAL_FILES} liberation_mono.o"
 DEBUG_ARGS="${DEBUG_ARGS} -DDEBUG_GDB=ON"
 ARGS="-Wall -Wextra -pedantic -fpic -lSDL3_ttf -lSDL3 -Wno-missing-braces"
+if [ "${1:-}" = "bench" ]; then
+    # Headless benchmarks: ./editor_bench [-o results.jsonl] [-s corpus MB] [-l log MB] [-f canvas frames] [-b canvas buffers] [-k rendered frames] [filter]
+    # ./build.sh bench -DDEBUG_PROFILE=ON adds phases and draw calls to canvas/render
+    shift
+    gcc -o editor_bench editor.c ${ADDITIONAL_FILES} -O2 ${ARGS} -DNO_MAIN=ON -DDISABLE_LOG_BUFFER=ON "${@}"
+    exit
+fi
 ARGS="${DEBUG_ARGS} ${ARGS}"
 ARGS="${ARGS} -DDISABLE_LOG_BUFFER=ON"
 gcc -o editor editor.c ${ADDITIONAL_FILES} ${ARGS} "${@}"
@@ -1,5 +1,5 @@
 /*
-	Each frame stores non-unique pointer for buffers.
+	Each frame stores non-unique handle for buffers.
 	Each buffer stores unique pointer for text. For each file there should be only one buffer.
 	There's a global list of frames inside ctx.
 	Althrough ctx stores dynamic array of frames, frames shouldn't be moved or resized into smaller size.
@@ -33,6 +33,12 @@ DEFINE_GDB_SCRIPT("gdb.py")
 #endif
 #include <SDL3/SDL.h>
 #include <SDL3_ttf/SDL_ttf.h>
+#ifdef SDL_PLATFORM_LINUX
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
 
 extern char _binary_LiberationMono_Regular_ttf_end[];
 extern char _binary_LiberationMono_Regular_ttf_size;
@@ -41,6 +47,78 @@ extern char _binary_LiberationMono_Regular_ttf_start[];
 #define TEXT_CHUNK_SIZE 256
 #define TAB_WIDTH 8
 #define UNDO_RING_SIZE 100
+#define MACRO_REPLAY_LIMIT 1000000 // Iterations of "until failure" replay
+#define LOAD_CHUNK_SIZE (4 << 20) // Bytes read and indexed by one job
+#define WORKERS_MAX 64
+#define LOG_RING_SIZE 1024 // Messages waiting for the next frame, must be a power of two
+#define LOG_MESSAGE_SIZE 256 // Longer ones are cut
+#define LOG_BUDGET (1 << 20) // Default size of log buffer, EDITOR_LOG_BUDGET overrides it
+#define COMMAND_CHUNK_SIZE (256 << 10)
+#define COMMAND_CHUNKS 16 // Reader waits when all are full, so the process is slowed down, not the ui
+#define COMMAND_BUDGET (8 << 20) // Older output is cut from the command buffer
+#define COMMAND_TREE_MAX 256 // Processes killed with the command, the rest are left running
+#define FOLLOW_READ_SIZE (4 << 20) // Per frame, rest is read on the next ones
+#define WATCH_POLL_MS 250 // Without inotify or while watched file is missing
+#define DIFF_MAX_COST 1024 // Changed lines before diff gives up and replaces the changed range
+#define FRAME_ARENA_SIZE (64 << 10) // First block, grows to the largest tick seen
+#define ARENA_ALIGN 16
+#define GLYPH_CACHE_MIN 256 // Must be a power of two
+#define GLYPH_ATLAS_SIZE 1024 // Side of an atlas page, glyphs go in rows
+#define GLYPH_ATLAS_PAGES 8 // Glyphs that don't fit are drawn as blanks
+#define GLYPH_BATCH 128 // Quads sent to the renderer at once
+#define PACK_MIN_SIZE (16 << 10) // Smaller buffers are never compressed
+#define PACK_IDLE_MS (60 * 1000) // Buffer no frame on screen shows is compressed after that
+#define PACK_BUDGET (64 << 20) // Resident text over it compresses idle buffers early, EDITOR_PACK_BUDGET overrides it
+#define PACK_SWEEP_MS 100 // One buffer is compressed per sweep, so big sessions don't stall a frame
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define MEMORY_BLOCKS_MIN 1024 // Must be a power of two
+#define PROFILE_HISTORY 240 // Rendered frames kept for percentiles and the graph
+#define PROFILE_BUDGET_MS 16.0
+#define TRACE_BUFFER_EVENTS 4096 // Per thread buffer, a thread takes the next one when it fills up
+#define TRACE_FLUSH_MS 100
+#define TRACE_PATH_SIZE 256
+#define TRACE_DEFAULT_PATH "trace.json"
+#define REPLAY_MAGIC "EDREPLAY"
+#define REPLAY_VERSION 1
+#define REPLAY_TEXT_SIZE 256 // Longer text input is recorded as several events
+#define REPLAY_PENDING_MAX 256
+#define SYNTAX_SPANS_MAX 128 // Per line, the rest of a longer line keeps the last color
+#define SYNTAX_BUDGET (128 << 10) // Bytes the highlighter may lex per tick to catch up, ~0.5ms
+#define SYNTAX_LOOKAHEAD 4096 // Lines lexed ahead of frames on screen while idle
+#define WORDS_LENGTH_MIN 3 // Shorter words aren't worth completing
+#define WORDS_LENGTH_MAX 64
+#define WORDS_MAX (1 << 20) // Distinct words of all buffers, new ones are ignored after that
+#define WORDS_BUDGET (32 << 10) // Bytes indexed per idle tick, ~1ms
+#define WORDS_UNSORTED_MAX 1024 // New words searched linearly until they are merged into the sorted list
+#define WORDS_BLOCK 64 // Sorted words per block with a known highest count
+#define WORDS_DEAD_MIN 4096 // Words no buffer has anymore before the table is rebuilt without them, once they're a quarter of it too
+#define COMPLETION_MAX 8
+#define STRUCTURE_BLOCK 256 // Marks per block, an edit rewrites the blocks it touches and shifts the rest through a tree
+#define STRUCTURE_BUDGET (1 << 18) // Bytes indexed per idle tick, ~1ms of C source
+#define TAGS_PATH ".editor_tags" // Definitions of the tree under the current directory, indexing starts at launch if it's there
+#define TAGS_MAGIC 0x31474154 // "TAG1"
+#define TAGS_FILES_MAX (1 << 18) // Files past it aren't indexed
+#define TAGS_DEPTH_MAX 32 // Deeper directories are skipped, so symlink loops end
+#define TAGS_LIST_STEP 512 // Directory entries checked per idle tick, a bigger directory is listed whole
+#define TAGS_LEX_STEP 32 // Files lexed on the pool per idle tick
+#define TAGS_RESCAN_MS (10 * 1000) // Tree is checked for changed files this long after a scan
+#define TAGS_NAME_MAX 128
+#define JUMPS_MAX 64
+#define BENCH_MIN_MS 300 // Each benchmark runs at least this long
+#define BENCH_BATCH_MAX 4096 // Operations between timer reads
+#define BENCH_CORPUS_MB 16
+#define BENCH_LOG_MB 1024
+#define BENCH_COLUMNS 80
+#define BENCH_VISLINES 256
+#define BENCH_NEEDLE "zqxjv"
+#define BENCH_RENDER_FRAMES 100
+#define BENCH_RENDER_BUFFERS 8
+#define BENCH_RENDER_COUNT 240 // Rendered frames after the warmup one
+#define BENCH_RENDER_BUFFER_MB 1
+#define BENCH_RENDER_W 1920
+#define BENCH_RENDER_H 1080
+#define BENCH_RENDER_SEARCH "ctx"
 
 #define lerp(from, to, value) ((from) + ((to) - (from)) * (value))
 
@@ -53,6 +131,7 @@ typedef enum {
 	Undo_Type_none = 0, // We probably should panic here
 	Undo_Type_insert,
 	Undo_Type_delete,
+	Undo_Type_batch,
 } Undo_Type;
 
 typedef enum {
@@ -61,24 +140,153 @@ typedef enum {
 	Undo_Group_clipboard,
 } Undo_Group;
 
+// One replacement inside of a batch. Positions are in coordinates of the text before the batch,
+// edits are sorted and don't overlap. Offsets point into the batch data, so identical
+// replacements (typing with many cursors) can share the same bytes.
+typedef struct Buffer_Edit {
+	Uint32 pos;
+	Uint32 del_len;
+	Uint32 ins_len;
+	Uint32 del_off;
+	Uint32 ins_off;
+} Buffer_Edit;
+
 typedef struct Undo_Operation {
 	Undo_Type type;
 	Undo_Group group;
 	Uint32 pos;
 	Uint32 len;
-	char *data;
+	char *data; // For batch it stores deleted bytes
+	// Batch only
+	Uint32 edits_count;
+	Buffer_Edit *edits;
+	char *ins_data;
 } Undo_Operation;
 
+// Built when a file is loaded and dropped on the first edit
+typedef struct Line_Index {
+	bool valid;
+	bool utf8_valid;
+	bool has_tabs;
+	Uint32 longest_line; // In visual columns, can be a bit more on broken utf8
+	Uint32 tail_columns; // Of the last line without a codepoint cut by the end, appends continue it
+	size_t utf8_checked; // Unfinished codepoint at the end is checked on the next append
+	size_t lines_count;
+	size_t starts_capacity;
+	size_t *starts; // Offset of every line, starts[0] is 0
+} Line_Index;
+
+// Lexer state at the start of every line. States below clean_lines are right, the rest are from
+// before an edit, shifted to their new lines, and are trusted again once lexing from the edit
+// gets past dirty_until with the same state
+typedef struct Syntax_Cache {
+	const struct Syntax *syntax; // NULL for plain text
+	const char *detected_name; // Syntax is picked again when the buffer name changes
+	Uint32 *states;
+	size_t states_capacity;
+	size_t lines;
+	size_t clean_lines;
+	size_t dirty_until;
+	size_t anchor_line; // Known start of a line at or before the last clean one
+	size_t anchor_offset;
+} Syntax_Cache;
+
+// Occurrences of a word of ctx->words in one buffer
+typedef struct Word_Count {
+	Uint32 word; // 0 for an empty slot
+	Uint32 count;
+} Word_Count;
+
+// Words are counted up to indexed, which is never inside of a word. Edits take the words they touch
+// out and put them back from the new text
+typedef struct Buffer_Words {
+	Word_Count *slots; // Open addressing by word, power of two
+	Uint32 capacity;
+	Uint32 used;
+	size_t indexed;
+	size_t edit_start; // Word bounds around the edit in progress
+	size_t edit_end;
+	size_t edit_size; // Of the text before it
+} Buffer_Words;
+
+typedef enum Bracket {
+	Bracket_round = 0,
+	Bracket_square,
+	Bracket_curly,
+	Bracket_count,
+} Bracket;
+
+// Sorted positions split into blocks, so an edit doesn't move every position after it
+typedef struct Mark_Block {
+	Uint32 base; // Of the first mark, with the shifts of its tree path, the rest are offsets from it
+	Uint32 count;
+	Sint32 depth[Bracket_count]; // Opening minus closing brackets of the block
+	Sint32 depth_min[Bracket_count]; // Lowest depth over its prefixes with the empty one, bracket searches skip blocks by it
+	Uint32 offsets[STRUCTURE_BLOCK];
+	Uint8 kinds[STRUCTURE_BLOCK]; // Bracket << 1, low bit is set for closing ones
+} Mark_Block;
+
+// Segment tree node over a power of two range of blocks, empty past the last block
+typedef struct Mark_Node {
+	Uint32 shift; // Not yet added to the bases of its blocks, wraps around like the positions
+	Uint32 last; // Mark, with its own shift but not the ones above
+	Sint32 depth[Bracket_count];
+	Sint32 depth_min[Bracket_count];
+} Mark_Node;
+
+typedef struct Mark_Set {
+	Mark_Block **blocks;
+	Uint32 blocks_count;
+	Uint32 blocks_capacity;
+	Mark_Node *tree; // Root is 1 and the leaf of a block is leaves + block, so the leaves move with the blocks
+	Uint32 leaves;
+} Mark_Set;
+
+typedef struct Mark_List {
+	Uint32 *positions;
+	Uint8 *kinds;
+	Uint32 count;
+	Uint32 capacity;
+} Mark_List;
+
+// Blank lines and brackets, indexed over idle ticks and kept up to date by edits
+typedef struct Buffer_Structure {
+	size_t built; // Text before it is indexed, a line start for buffers with a syntax
+	const struct Syntax *syntax; // Brackets in its strings and comments aren't marked, NULL marks all of them
+	Mark_Set paragraphs; // Second newline of every blank line
+	Mark_Set brackets;
+	Mark_Set states; // Line starts where the lexer state isn't zero, it's the kind, so edits lex again from their line
+} Buffer_Structure;
+
+// Index plus the generation of the slot, so it survives buffers growth and detects reuse
+typedef struct Buffer_Handle {
+	Uint32 index;
+	Uint32 generation;
+} Buffer_Handle;
+
 typedef struct {
 	char *name;
 	// If < 0, considered untaken
 	Sint32 refcount; // Must be changed by end receive function, not by allocate_buffer
+	Uint32 generation; // Bumped every time the slot is reused
+	bool prompt; // Ask or search input, released into ctx->prompt_buffers with its text block
 	size_t text_size;
 	size_t text_capacity;
 	size_t undos_size;
 	size_t undos_cursor; // Stores position to check if redo is possible
 	Undo_Operation undos[UNDO_RING_SIZE];
-	char *text;
+	char *text; // NULL while packed, text_size stays
+	char *packed; // Compressed text of idle buffer, unpacked on the first access
+	size_t packed_size;
+	bool lost; // Packed text was corrupted, saving the empty buffer would wipe its file
+	bool saved; // Text is the same as its file's since open or save, only such buffers are packed
+	bool registered; // Has had an entry in ctx->files, another buffer may have taken it since
+	Uint32 file_hash; // Of that entry, so it's found without a scan
+	Uint64 last_access; // In ctx->ticks
+	Line_Index line_index;
+	Syntax_Cache syntax;
+	Buffer_Words words;
+	Buffer_Structure structure;
 } TextBuffer;
 
 typedef enum {
@@ -96,23 +304,23 @@ typedef enum {
 typedef enum {
 	Ask_Option_open = 0,
 	Ask_Option_save,
+	Ask_Option_replace,
+	Ask_Option_macro,
+	Ask_Option_command,
 } Ask_Option;
 
+typedef struct Frame_Handle {
+	Uint32 index;
+	Uint32 generation;
+} Frame_Handle;
+
+// Read by render and hit tests every frame, rest lives in Frame_Cold
 typedef struct Frame {
 	bool taken;
 	bool is_global;
 	bool scroll_lock;
 	Frame_Type frame_type;
-	Uint32 parent_frame;
-	bool searching_mode;
-	Uint32 search_frame;
-	Uint32 search_cursor;
-	String last_search;
-	bool search_backwards;
-	Search_Status search_status;
-	Ask_Option ask_option;
-	char *filename;
-	char *line_prefix;
+	Uint32 generation; // Bumped every time the slot is reused
 	SDL_FRect bounds_interp;
 	SDL_FRect bounds;
 	SDL_FPoint scroll_interp;
@@ -121,9 +329,355 @@ typedef struct Frame {
 	Uint32 cursor;
 	Uint32 selection;
 	bool active_selection;
-	TextBuffer *buffer;
+	// Additional cursors, sorted, unique and never equal to the main one
+	Uint32 *cursors;
+	Uint32 cursors_count;
+	Uint32 cursors_capacity;
+	Buffer_Handle buffer;
 } Frame;
 
+// Same index as in ctx->frames
+typedef struct Frame_Cold {
+	Frame_Handle parent_frame;
+	bool searching_mode;
+	Frame_Handle search_frame;
+	Uint32 search_cursor;
+	String last_search;
+	bool search_backwards;
+	Search_Status search_status;
+	Ask_Option ask_option;
+	char *filename;
+	char *line_prefix;
+} Frame_Cold;
+
+// Bump allocator, everything in it dies at once on reset
+typedef struct Arena_Block {
+	struct Arena_Block *next;
+	size_t capacity;
+	size_t used;
+	char data[];
+} Arena_Block;
+
+typedef struct Arena {
+	Arena_Block *head; // Newest block, the older ones only exist until reset
+	size_t used;
+	size_t high_water;
+} Arena;
+
+// Rendered once in white into an atlas page, tinted on every draw
+typedef struct Glyph {
+	bool taken;
+	Uint8 page;
+	Uint32 codepoint;
+	int advance;
+	SDL_Rect rect; // Empty when font has nothing to draw
+} Glyph;
+
+typedef void (*Parallel_Job)(void *userdata, Uint32 index);
+
+// Threads sleep until parallel_for hands them a batch of jobs
+typedef struct Worker_Pool {
+	bool started;
+	bool quit;
+	Uint32 threads_count;
+	SDL_Thread **threads;
+	SDL_Mutex *lock;
+	SDL_Condition *wake;
+	SDL_Condition *done;
+	Uint32 generation; // Bumped for every batch
+	Uint32 busy; // Workers that took the current batch
+	bool open; // Workers may join the batch, parallel_for closes it before waiting for them
+	Parallel_Job job;
+	void *userdata;
+	Uint32 jobs_count;
+	SDL_AtomicInt next_job;
+} Worker_Pool;
+
+#ifndef DISABLE_LOG_BUFFER
+typedef struct Log_Slot {
+	SDL_AtomicInt sequence; // Equal to position when free, position + 1 when written
+	Uint32 length;
+	char text[LOG_MESSAGE_SIZE];
+} Log_Slot;
+
+// Bounded queue after Dmitry Vyukov, any thread pushes, main thread drains once per frame
+typedef struct Log_Ring {
+	SDL_AtomicInt push_position;
+	SDL_AtomicInt dropped;
+	Uint32 pop_position;
+	Log_Slot slots[LOG_RING_SIZE];
+} Log_Ring;
+#endif
+
+typedef struct Command_Chunk {
+	size_t size;
+	char data[COMMAND_CHUNK_SIZE];
+} Command_Chunk;
+
+// Reader thread fills chunks from the process output, main thread appends them once per frame
+typedef struct Command_Runner {
+	SDL_Process *process;
+	SDL_Thread *reader;
+	SDL_Semaphore *free_chunks;
+	SDL_AtomicInt push_position; // Written only by reader
+	SDL_AtomicInt done; // Reader won't push anymore
+	SDL_AtomicInt cancel;
+	Uint32 pop_position;
+	Command_Chunk *chunks;
+	char *batch; // Whole ring fits
+} Command_Runner;
+
+// Same file opened by different paths has the same id, files that don't exist yet have only a path
+typedef struct File_Id {
+	bool valid;
+	Uint64 device;
+	Uint64 inode;
+} File_Id;
+
+typedef struct Buffer_File {
+	bool taken;
+	bool removed; // Tombstone, keeps probing going
+	Uint32 buffer;
+	File_Id id;
+	char *path;
+} Buffer_File;
+
+// File behind a buffer, changes are diffed into it or, when followed, appended to the end
+typedef struct File_Watch {
+	bool taken;
+	bool follow;
+	bool changed;
+	bool reopen; // Moved or deleted, wait for the new one on the same path
+	Uint32 buffer;
+	char *path;
+	Sint64 offset; // Followed, bytes of the file already in buffer
+	Sint64 size; // Of the version in buffer
+	SDL_Time modify_time;
+	int watch; // -1 when polled
+	Uint64 next_poll;
+} File_Watch;
+
+// Owner of an allocation, set by memory_tag_set around the first allocation of a block, reallocations keep it
+typedef enum {
+	Memory_Tag_other = 0,
+	Memory_Tag_text,
+	Memory_Tag_undo,
+	Memory_Tag_layout, // Line indexes, cursors, render arena
+	Memory_Tag_glyphs,
+	Memory_Tag_log,
+	Memory_Tag_count,
+} Memory_Tag;
+
+static const char *memory_tag_names[Memory_Tag_count] __attribute__((unused)) = {"other", "text", "undo", "layout", "glyphs", "log"};
+
+// Phases overlap, layout and glyphs are measured inside of render_frame, render_frame inside of render
+typedef enum {
+	Profile_Phase_events,
+	Profile_Phase_render,
+	Profile_Phase_render_frame,
+	Profile_Phase_layout,
+	Profile_Phase_glyphs, // Rasterization of glyphs missing from the cache
+	Profile_Phase_present,
+	Profile_Phase_count,
+} Profile_Phase;
+
+typedef enum {
+	Profile_Counter_draw_calls, // Only the ones that scale with text: glyphs, whitespace, highlights
+	Profile_Counter_textures,
+	Profile_Counter_bytes_scanned, // By layout and line counting
+	Profile_Counter_count,
+} Profile_Counter;
+
+static const char *profile_phase_names[Profile_Phase_count] __attribute__((unused)) = {"events", "render", "render_frame", "layout", "glyphs", "present"};
+static const char *profile_counter_names[Profile_Counter_count] __attribute__((unused)) = {"draw calls", "textures", "bytes scanned"};
+
+#ifdef DEBUG_PROFILE
+typedef struct Profile_Frame {
+	Uint64 total; // Events since the previous rendered frame and the whole iteration that rendered
+	Uint64 phases[Profile_Phase_count];
+	Uint64 counters[Profile_Counter_count];
+	Uint64 slowest_time; // Of the slowest render_frame
+	Uint32 slowest_frame;
+	Buffer_Handle slowest_buffer;
+} Profile_Frame;
+
+typedef struct Profiler {
+	bool hud; // F11
+	Uint64 tick_start;
+	Profile_Frame current;
+	Uint32 frames_count;
+	Uint32 position; // Ring of the last PROFILE_HISTORY rendered frames
+	Profile_Frame frames[PROFILE_HISTORY];
+} Profiler;
+#endif
+
+// Input recorded into a file or replayed from it, in both latency from input to present is measured
+typedef struct Replay {
+	SDL_IOStream *record;
+	Uint64 record_last; // Time of the previously recorded event, ns
+	SDL_IOStream *input;
+	Uint64 input_start; // When replay started, ns
+	Uint64 next_time; // Of the next event, relative to input_start
+	SDL_Event next;
+	SDL_Keymod next_keymod;
+	char next_text[REPLAY_TEXT_SIZE];
+	bool has_next;
+	Uint32 pending_count; // Inputs not presented yet
+	Uint64 pending[REPLAY_PENDING_MAX];
+	Uint32 latencies_count;
+	Uint32 latencies_capacity;
+	Uint64 *latencies;
+} Replay;
+
+// Events of one tick that are handled as one: consecutive text inputs are inserted at once,
+// key repeats of one arrow move the cursor count times but scroll once
+typedef struct Input_Batch {
+	SDL_Event event; // First batched one, type is 0 when empty
+	SDL_Keymod keymod;
+	Uint32 count;
+	char *text; // Concatenated text inputs, null terminated
+	Uint32 text_size;
+	Uint32 text_capacity;
+} Input_Batch;
+
+typedef struct Word {
+	Uint32 offset; // In chars
+	Uint32 length;
+	Uint32 hash;
+	Uint32 count; // In all buffers
+} Word;
+
+// Words of all buffers merged for completion. Ones whose count dropped to zero, like prefixes typed on the way
+// to a word, stay until words_index rebuilds the table
+typedef struct Word_Table {
+	Word *words; // Id 0 is unused, so zero means no word
+	Uint32 words_count;
+	Uint32 words_capacity;
+	Uint32 dead; // Words with zero count
+	Uint32 *slots; // Open addressing by hash, power of two
+	Uint32 slots_capacity;
+	char *chars;
+	size_t chars_size;
+	size_t chars_capacity;
+	Uint32 *sorted; // Ids 1 to sorted_count in byte order, newer ones aren't there yet
+	Uint32 sorted_count;
+	Uint32 sorted_capacity;
+	Uint32 *sorted_positions; // By id
+	Uint32 *blocks_max; // Count no word of the block is above, exact until counts drop
+} Word_Table;
+
+// Alt-/ replaces the word before the cursor with candidates in turn, typing more narrows them
+typedef struct Completion {
+	bool active;
+	Frame_Handle frame;
+	Uint32 start; // Of the completed word
+	Uint32 end; // Cursor after the last step, completion is over once it moves
+	char prefix[WORDS_LENGTH_MAX];
+	Uint32 prefix_length;
+	Uint32 candidates[COMPLETION_MAX]; // Word ids, most frequent first
+	Uint32 count;
+	Uint32 selected; // 0 for the typed prefix
+} Completion;
+
+// Definition index image, the same bytes on disk and in memory.
+// Header is followed by files sorted by path, tags sorted by name and NUL terminated strings
+typedef struct Tags_Header {
+	Uint32 magic;
+	Uint32 files_count;
+	Uint32 tags_count;
+	Uint32 strings_size;
+} Tags_Header;
+
+typedef struct Tags_File {
+	Sint64 modify_time; // File is lexed again when it or size changes
+	Uint64 size;
+	Uint32 path; // Offset in strings, relative to the current directory
+	Uint32 unused;
+} Tags_File;
+
+typedef struct Tag {
+	Uint32 name; // Offset in strings, or in chars of a scan before the merge
+	Uint32 file;
+	Uint32 line; // From zero
+} Tag;
+
+// File found by the running scan
+typedef struct Tags_Scanned {
+	char *path;
+	Sint64 modify_time;
+	Uint64 size;
+	Uint32 old; // Same file in the image, (Uint32)-1 if it's new or changed
+} Tags_Scanned;
+
+// One file lexed on a worker
+typedef struct Tags_Lex_Job {
+	const char *path;
+	Uint32 file; // In scanned
+	Tag *tags;
+	Uint32 tags_count;
+	Uint32 tags_capacity;
+	char *chars;
+	Uint32 chars_size;
+	Uint32 chars_capacity;
+} Tags_Lex_Job;
+
+// Scans walk the tree over idle ticks, lex new and changed files and merge them into a new image
+typedef struct Tag_Index {
+	bool started;
+	bool scanning;
+	Uint64 next_scan;
+	void *image; // NULL until the first scan ends or TAGS_PATH is loaded
+	size_t image_size;
+	const Tags_Header *header;
+	const Tags_File *files;
+	const Tag *tags;
+	const char *strings;
+	char **dirs; // Left to list, "" is the current directory
+	Uint32 dirs_count;
+	Uint32 dirs_capacity;
+	Tags_Scanned *scanned;
+	Uint32 scanned_count;
+	Uint32 scanned_capacity;
+	Uint32 lexed; // Scanned files before it are lexed or kept from the image
+	Uint32 kept;
+	Tag *added; // Of lexed files, file is the scanned one
+	Uint32 added_count;
+	Uint32 added_capacity;
+	char *chars;
+	Uint32 chars_size;
+	Uint32 chars_capacity;
+	Uint32 *saved_files; // Image files saved since it was made, lookups skip their tags in it
+	Uint32 saved_files_count;
+	Uint32 saved_files_capacity;
+	Tag *saved; // Definitions of those files sorted by name, names are in saved_chars
+	Uint32 saved_count;
+	Uint32 saved_capacity;
+	char *saved_chars;
+	Uint32 saved_chars_size;
+	Uint32 saved_chars_capacity;
+} Tag_Index;
+
+typedef struct Jump {
+	Buffer_Handle buffer; // Holds a reference, so edits aren't lost when the jump replaces it in the frame
+	char *filename; // Of the frame it was in, NULL for buffers without file
+	Uint32 cursor;
+} Jump;
+
+// Alt-. pushes where it jumped from, Alt-, goes back
+typedef struct Jumps {
+	Jump stack[JUMPS_MAX];
+	Uint32 count;
+	char name[TAGS_NAME_MAX]; // Of the last jump, Alt-. on the spot it landed goes to the next definition
+	Uint32 match;
+	Frame_Handle frame;
+	Uint32 cursor;
+} Jumps;
+
+typedef struct Macro_Event {
+	SDL_Event event; // Text of text input is owned by the macro
+	SDL_Keymod keymod;
+} Macro_Event;
+
 typedef struct Ctx {
 	SDL_Renderer *renderer;
 	SDL_Window *window;
@@ -135,23 +689,44 @@ typedef struct Ctx {
 	SDL_Texture *space_texture;
 	SDL_Texture *tab_texture;
 	SDL_Texture *overflow_cursor_texture;
+	Glyph *glyphs; // Open addressing by codepoint
+	Uint32 glyphs_used;
+	Uint32 glyphs_capacity;
+	SDL_Texture *atlas[GLYPH_ATLAS_PAGES]; // Only the last page takes new glyphs
+	Uint32 atlas_pages;
+	int atlas_x, atlas_y, atlas_row_h; // Where the next glyph goes on the last page
+	Arena frame_arena; // Transient render data, reset at the end of every SDL_AppIterate
 	int win_w, win_h;
 	bool keys[SDL_SCANCODE_COUNT];
-	TextBuffer *log_buffer;
+	Buffer_Handle log_buffer;
+#ifndef DISABLE_LOG_BUFFER
+	Log_Ring *log_ring;
+	char *log_batch; // Whole ring fits, so it never grows
+	size_t log_budget;
+#endif
 	SDL_Keymod keymod;
 	SDL_FPoint mouse_pos;
 	double deltatime;
 	double perf_freq;
 	Uint64 last_render;
+	Uint64 ticks; // SDL_GetTicks at the start of the frame
+	Uint64 next_pack_sweep;
+	size_t pack_budget;
+	size_t syntax_budget; // Left for this tick
 	bool should_render;
 	bool moving_col; // When cursor was just moving up and down
+	bool moving_extra_cursors; // Don't scroll to the cursor, it's not the main one
 	Uint32 buffers_count;
 	Uint32 buffers_capacity;
 	TextBuffer *buffers;
 	Uint32 frames_count;
 	Uint32 frames_capacity;
 	Frame *frames;
+	Frame_Cold *frames_cold;
 	Uint32 *sorted_frames;
+	Uint32 *free_frames; // Closed slots, reused before the array grows
+	Uint32 free_frames_count;
+	Uint32 free_frames_capacity;
 	Uint32 focused_frame;
 #ifdef DEBUG_RENDER_FAN
 	int render_rotate_fan;
@@ -160,9 +735,42 @@ typedef struct Ctx {
 	SDL_FRect debug_screen_rect;
 	Uint64 last_middle_click;
 	SDL_FPoint active_cursor_pos;
+	bool macro_recording;
+	bool macro_replaying; // Scrolling, autoscroll and search visuals are done once after replay
+	bool macro_search_failed;
+	Uint32 macro_buffer; // Its undo ops are glued into one during replay
+	Uint32 macro_events_count;
+	Uint32 macro_events_capacity;
+	Macro_Event *macro_events;
+	Worker_Pool pool;
+	Command_Runner *command;
+	Uint32 command_buffer; // (Uint32)-1 until the first command
+	int inotify; // -1 if not available
+	Uint32 watches_count;
+	Uint32 watches_capacity;
+	File_Watch *watches;
+	Uint32 *free_buffers; // Slots whose refcount dropped to zero
+	Uint32 free_buffers_count;
+	Uint32 free_buffers_capacity;
+	Uint32 *prompt_buffers; // Released prompt buffers, reused only for prompts
+	Uint32 prompt_buffers_count;
+	Uint32 prompt_buffers_capacity;
+	Buffer_File *files; // Open addressing hash table of buffers by file, power of two
+	Uint32 files_used; // With tombstones
+	Uint32 files_capacity;
+	Replay replay;
+	Input_Batch input_batch;
+	bool batching_moves; // All but the last move of a batch don't scroll
+	Word_Table words;
+	Completion completion;
+	Tag_Index tags;
+	Jumps jumps;
 #ifdef DEBUG
 	int draw_text_back_color;
 #endif
+#ifdef DEBUG_PROFILE
+	Profiler profiler;
+#endif
 } Ctx;
 
 static const SDL_Color text_color = {0xe6, 0xe6, 0xe6, SDL_ALPHA_OPAQUE};
@@ -173,10 +781,62 @@ static const SDL_Color current_line_background_color = {0x20, 0x20, 0x20, 0x80};
 static const SDL_Color line_number_color = {0xe6 / 2, 0xe6 / 2, 0xe6 / 2, SDL_ALPHA_OPAQUE};
 static const SDL_Color line_number_dimmed_color = {0xe6 / 4, 0xe6 / 4, 0xe6 / 4, SDL_ALPHA_OPAQUE};
 static const SDL_Color search_background_color = {0x63, 0x63, 0x24, SDL_ALPHA_OPAQUE};
+static const SDL_Color block_color = {0x86, 0x86, 0xf6, SDL_ALPHA_OPAQUE / 2};
 static const SDL_Color background_color = {0x04, 0x04, 0x04, SDL_ALPHA_OPAQUE};
 static const SDL_Color background_color_error = {0x63, 0x24, 0x24, SDL_ALPHA_OPAQUE};
 static const SDL_Color background_lines_color = {0x00, 0x30, 0x00, SDL_ALPHA_OPAQUE};
 
+typedef enum {
+	Syntax_Color_text,
+	Syntax_Color_keyword,
+	Syntax_Color_type,
+	Syntax_Color_string,
+	Syntax_Color_number,
+	Syntax_Color_comment,
+	Syntax_Color_preprocessor,
+	Syntax_Color_debug,
+	Syntax_Color_info,
+	Syntax_Color_warning,
+	Syntax_Color_error,
+	Syntax_Color_count,
+} Syntax_Color;
+
+static const SDL_Color syntax_colors[Syntax_Color_count] = {
+	[Syntax_Color_text] = {0xe6, 0xe6, 0xe6, SDL_ALPHA_OPAQUE},
+	[Syntax_Color_keyword] = {0xe6, 0xb4, 0x5a, SDL_ALPHA_OPAQUE},
+	[Syntax_Color_type] = {0x7a, 0xc8, 0xe6, SDL_ALPHA_OPAQUE},
+	[Syntax_Color_string] = {0x9c, 0xd2, 0x6e, SDL_ALPHA_OPAQUE},
+	[Syntax_Color_number] = {0xd2, 0x8c, 0xd2, SDL_ALPHA_OPAQUE},
+	[Syntax_Color_comment] = {0x80, 0x80, 0x80, SDL_ALPHA_OPAQUE},
+	[Syntax_Color_preprocessor] = {0xc8, 0x96, 0x78, SDL_ALPHA_OPAQUE},
+	[Syntax_Color_debug] = {0x80, 0x80, 0x80, SDL_ALPHA_OPAQUE},
+	[Syntax_Color_info] = {0x86, 0xf6, 0x86, SDL_ALPHA_OPAQUE},
+	[Syntax_Color_warning] = {0xf0, 0xd2, 0x50, SDL_ALPHA_OPAQUE},
+	[Syntax_Color_error] = {0xf0, 0x5a, 0x5a, SDL_ALPHA_OPAQUE},
+};
+
+// Color from start up to the next span, offsets are from the start of the line
+typedef struct Syntax_Span {
+	Uint32 start;
+	Syntax_Color color;
+} Syntax_Span;
+
+typedef struct Syntax_Spans {
+	const char *line;
+	Uint32 count;
+	Syntax_Span spans[SYNTAX_SPANS_MAX];
+} Syntax_Spans;
+
+// Colors one line lexed from state into spans, which may be NULL when only the state is needed.
+// Returns the state at the start of the next line
+typedef Uint32 (*Syntax_Lex)(Uint32 state, const char *text, size_t size, Syntax_Spans *spans);
+
+typedef struct Syntax {
+	const char *name;
+	const char *extensions; // Space separated
+	Syntax_Lex lex_line;
+} Syntax;
+
 static const SDL_Color debug_red __attribute__((unused)) = {0xff, 0x00, 0x00, SDL_ALPHA_OPAQUE};
 static const SDL_Color debug_yellow __attribute__((unused)) = {0xff, 0xff, 0x00, SDL_ALPHA_OPAQUE};
 static const SDL_Color debug_green __attribute__((unused)) = {0x00, 0xff, 0x00, SDL_ALPHA_OPAQUE};
@@ -184,6 +844,495 @@ static const SDL_Color debug_blue __attribute__((unused)) = {0x00, 0x00, 0xff, S
 static const SDL_Color debug_purple __attribute__((unused)) = {0xff, 0x00, 0xff, SDL_ALPHA_OPAQUE};
 static const SDL_Color debug_black __attribute__((unused)) = {0x00, 0x00, 0x00, SDL_ALPHA_OPAQUE};
 
+#ifdef DEBUG_MEMORY
+typedef struct Memory_Block {
+	void *pointer; // NULL when free
+	size_t size;
+	Memory_Tag tag;
+} Memory_Block;
+
+// Every SDL allocation goes through these hooks, blocks are found by pointer in an open addressing table
+typedef struct Memory_Stats {
+	SDL_SpinLock lock; // Hooks can't use anything that allocates
+	SDL_malloc_func malloc;
+	SDL_calloc_func calloc;
+	SDL_realloc_func realloc;
+	SDL_free_func free;
+	Memory_Block *blocks; // Linear probing, deleted blocks shift the rest back
+	size_t blocks_used;
+	size_t blocks_capacity;
+	size_t bytes[Memory_Tag_count];
+	size_t peak[Memory_Tag_count];
+	size_t count[Memory_Tag_count];
+} Memory_Stats;
+
+static Memory_Stats memory_stats;
+static _Thread_local Memory_Tag memory_tag;
+
+static inline size_t memory_block_slot(void *pointer, size_t capacity) {
+	return ((Uint64)(uintptr_t)pointer >> 4) * 0x9E3779B97F4A7C15ull >> 32 & (capacity - 1);
+}
+
+static bool memory_blocks_grow(void) {
+	size_t new_cap = memory_stats.blocks_capacity == 0 ? MEMORY_BLOCKS_MIN : memory_stats.blocks_capacity * 2;
+	Memory_Block *blocks = memory_stats.calloc(new_cap, sizeof *blocks);
+	if (blocks == NULL) return false;
+	for (size_t i = 0; i < memory_stats.blocks_capacity; ++i) {
+		Memory_Block *block = &memory_stats.blocks[i];
+		if (block->pointer == NULL) continue;
+		size_t slot = memory_block_slot(block->pointer, new_cap);
+		while (blocks[slot].pointer != NULL) slot = (slot + 1) & (new_cap - 1);
+		blocks[slot] = *block;
+	}
+	memory_stats.free(memory_stats.blocks);
+	memory_stats.blocks = blocks;
+	memory_stats.blocks_capacity = new_cap;
+	return true;
+}
+
+// Called with the lock held
+static void memory_track(void *pointer, size_t size, Memory_Tag tag) {
+	if (memory_stats.blocks_used * 2 >= memory_stats.blocks_capacity && !memory_blocks_grow()) return;
+	size_t slot = memory_block_slot(pointer, memory_stats.blocks_capacity);
+	while (memory_stats.blocks[slot].pointer != NULL) slot = (slot + 1) & (memory_stats.blocks_capacity - 1);
+	memory_stats.blocks[slot] = (Memory_Block){pointer, size, tag};
+	memory_stats.blocks_used += 1;
+	memory_stats.bytes[tag] += size;
+	memory_stats.count[tag] += 1;
+	memory_stats.peak[tag] = SDL_max(memory_stats.peak[tag], memory_stats.bytes[tag]);
+}
+
+// Called with the lock held, -1 for blocks allocated before the hooks were installed
+static size_t memory_find(void *pointer) {
+	if (memory_stats.blocks_capacity == 0) return -1;
+	size_t slot = memory_block_slot(pointer, memory_stats.blocks_capacity);
+	while (memory_stats.blocks[slot].pointer != pointer) {
+		if (memory_stats.blocks[slot].pointer == NULL) return -1;
+		slot = (slot + 1) & (memory_stats.blocks_capacity - 1);
+	}
+	return slot;
+}
+
+// Called with the lock held
+static bool memory_untrack(void *pointer, Memory_Block *removed) {
+	size_t slot = memory_find(pointer);
+	if (slot == (size_t)-1) return false;
+	size_t mask = memory_stats.blocks_capacity - 1;
+	*removed = memory_stats.blocks[slot];
+	memory_stats.bytes[removed->tag] -= removed->size;
+	memory_stats.count[removed->tag] -= 1;
+	memory_stats.blocks_used -= 1;
+	// Backward shift, so probing never needs tombstones
+	size_t hole = slot;
+	for (size_t next = (hole + 1) & mask; memory_stats.blocks[next].pointer != NULL; next = (next + 1) & mask) {
+		size_t home = memory_block_slot(memory_stats.blocks[next].pointer, memory_stats.blocks_capacity);
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			memory_stats.blocks[hole] = memory_stats.blocks[next];
+			hole = next;
+		}
+	}
+	memory_stats.blocks[hole].pointer = NULL;
+	return true;
+}
+
+static void *SDLCALL memory_malloc(size_t size) {
+	void *pointer = memory_stats.malloc(size);
+	if (pointer == NULL) return NULL;
+	SDL_LockSpinlock(&memory_stats.lock);
+	memory_track(pointer, size, memory_tag);
+	SDL_UnlockSpinlock(&memory_stats.lock);
+	return pointer;
+}
+
+static void *SDLCALL memory_calloc(size_t count, size_t size) {
+	void *pointer = memory_stats.calloc(count, size);
+	if (pointer == NULL) return NULL;
+	SDL_LockSpinlock(&memory_stats.lock);
+	memory_track(pointer, count * size, memory_tag);
+	SDL_UnlockSpinlock(&memory_stats.lock);
+	return pointer;
+}
+
+// Lock is held over the call, otherwise the freed old pointer can be returned to another thread before it's untracked
+static void *SDLCALL memory_realloc(void *old, size_t size) {
+	SDL_LockSpinlock(&memory_stats.lock);
+	void *pointer = memory_stats.realloc(old, size);
+	if (pointer != NULL || size == 0) {
+		Memory_Block block = {.tag = memory_tag};
+		if (old != NULL) memory_untrack(old, &block);
+		if (pointer != NULL) memory_track(pointer, size, block.tag);
+	}
+	SDL_UnlockSpinlock(&memory_stats.lock);
+	return pointer;
+}
+
+static void SDLCALL memory_free(void *pointer) {
+	if (pointer == NULL) return;
+	SDL_LockSpinlock(&memory_stats.lock);
+	Memory_Block block;
+	memory_untrack(pointer, &block);
+	SDL_UnlockSpinlock(&memory_stats.lock);
+	memory_stats.free(pointer);
+}
+
+// Must be the first allocation, blocks allocated before are freed without being counted
+static bool memory_tracking_install(void) {
+	SDL_GetOriginalMemoryFunctions(&memory_stats.malloc, &memory_stats.calloc, &memory_stats.realloc, &memory_stats.free);
+	return SDL_SetMemoryFunctions(memory_malloc, memory_calloc, memory_realloc, memory_free);
+}
+
+// Copy of the counters, other threads keep allocating
+static Memory_Stats memory_stats_get(void) {
+	SDL_LockSpinlock(&memory_stats.lock);
+	Memory_Stats stats = memory_stats;
+	SDL_UnlockSpinlock(&memory_stats.lock);
+	return stats;
+}
+#endif
+
+// Tags allocations made by this thread, returns the previous tag to restore.
+// Does nothing without DEBUG_MEMORY
+static inline Memory_Tag memory_tag_set(Memory_Tag tag) {
+#ifdef DEBUG_MEMORY
+	Memory_Tag previous = memory_tag;
+	memory_tag = tag;
+	return previous;
+#else
+	(void) tag;
+	return Memory_Tag_other;
+#endif
+}
+
+// Hands a block to another subsystem, e.g. edit data that became an undo op
+static inline void memory_retag(void *pointer, Memory_Tag tag) {
+#ifdef DEBUG_MEMORY
+	if (pointer == NULL) return;
+	SDL_LockSpinlock(&memory_stats.lock);
+	size_t slot = memory_find(pointer);
+	if (slot != (size_t)-1) {
+		Memory_Block *block = &memory_stats.blocks[slot];
+		memory_stats.bytes[block->tag] -= block->size;
+		memory_stats.count[block->tag] -= 1;
+		block->tag = tag;
+		memory_stats.bytes[tag] += block->size;
+		memory_stats.count[tag] += 1;
+		memory_stats.peak[tag] = SDL_max(memory_stats.peak[tag], memory_stats.bytes[tag]);
+	}
+	SDL_UnlockSpinlock(&memory_stats.lock);
+#else
+	(void) pointer;
+	(void) tag;
+#endif
+}
+
+// Timers and counters do nothing without DEBUG_PROFILE
+static inline Uint64 profile_begin(void) {
+#ifdef DEBUG_PROFILE
+	return SDL_GetPerformanceCounter();
+#else
+	return 0;
+#endif
+}
+
+static inline void profile_end(Ctx *ctx, Profile_Phase phase, Uint64 start) {
+#ifdef DEBUG_PROFILE
+	ctx->profiler.current.phases[phase] += SDL_GetPerformanceCounter() - start;
+#else
+	(void) ctx;
+	(void) phase;
+	(void) start;
+#endif
+}
+
+static inline void profile_count(Ctx *ctx, Profile_Counter counter, Uint64 amount) {
+#ifdef DEBUG_PROFILE
+	ctx->profiler.current.counters[counter] += amount;
+#else
+	(void) ctx;
+	(void) counter;
+	(void) amount;
+#endif
+}
+
+typedef struct Trace_Event {
+	const char *name; // Static strings only, the writer reads them later
+	const char *arg_name; // NULL without argument
+	Sint64 arg;
+	Uint64 start;
+	Uint64 duration;
+} Trace_Event;
+
+// Only the owning thread appends, the writer reads events below count
+typedef struct Trace_Buffer {
+	struct Trace_Buffer *next;
+	SDL_ThreadID thread;
+	const char *thread_name;
+	Uint32 session;
+	Uint32 written; // Used by the writer
+	SDL_AtomicInt count;
+	SDL_AtomicInt sealed; // Owner took another buffer, writer frees it once written
+	Trace_Event events[TRACE_BUFFER_EVENTS];
+} Trace_Buffer;
+
+// Events are collected per thread and written into Chrome trace-event JSON by the writer thread
+typedef struct Trace {
+	SDL_AtomicInt session; // Zero when not recording
+	Uint32 sessions_count;
+	Uint64 start; // Of the recording session
+	SDL_Thread *writer;
+	SDL_Mutex *lock;
+	SDL_Condition *wake;
+	bool quit;
+	Trace_Buffer *buffers; // New ones are pushed at the head
+	char path[TRACE_PATH_SIZE];
+} Trace;
+
+static Trace trace;
+static _Thread_local Trace_Buffer *trace_local;
+static _Thread_local const char *trace_thread_name;
+
+// Zero when not recording, so an event started before recording is dropped
+static inline Uint64 trace_begin(void) {
+	if (SDL_GetAtomicInt(&trace.session) == 0) return 0;
+	return SDL_GetPerformanceCounter();
+}
+
+static void trace_end_arg(const char *name, Uint64 start, const char *arg_name, Sint64 arg) {
+	if (start == 0) return;
+	Uint32 session = (Uint32)SDL_GetAtomicInt(&trace.session);
+	if (session == 0 || start < trace.start) return;
+	Trace_Buffer *buffer = trace_local;
+	if (buffer == NULL || buffer->session != session || SDL_GetAtomicInt(&buffer->count) == TRACE_BUFFER_EVENTS) {
+		if (buffer != NULL) SDL_SetAtomicInt(&buffer->sealed, 1);
+		trace_local = NULL;
+		buffer = SDL_malloc(sizeof *buffer);
+		if (buffer == NULL) return;
+		buffer->thread = SDL_GetCurrentThreadID();
+		buffer->thread_name = trace_thread_name != NULL ? trace_thread_name : "thread";
+		buffer->session = session;
+		buffer->written = 0;
+		SDL_SetAtomicInt(&buffer->count, 0);
+		SDL_SetAtomicInt(&buffer->sealed, 0);
+		SDL_LockMutex(trace.lock);
+		buffer->next = trace.buffers;
+		trace.buffers = buffer;
+		SDL_UnlockMutex(trace.lock);
+		trace_local = buffer;
+	}
+	int count = SDL_GetAtomicInt(&buffer->count);
+	buffer->events[count] = (Trace_Event){name, arg_name, arg, start, SDL_GetPerformanceCounter() - start};
+	SDL_SetAtomicInt(&buffer->count, count + 1);
+}
+
+static inline void trace_end(const char *name, Uint64 start) {
+	trace_end_arg(name, start, NULL, 0);
+}
+
+// Threads that exit call it, or their last buffer is never freed
+static void trace_thread_exit(void) {
+	if (trace_local != NULL) SDL_SetAtomicInt(&trace_local->sealed, 1);
+	trace_local = NULL;
+}
+
+// Called by the writer without the lock, buffers are only unlinked by the writer
+static void trace_write_buffers(SDL_IOStream *file, Uint32 session, bool *first) {
+	SDL_LockMutex(trace.lock);
+	Trace_Buffer *buffer = trace.buffers;
+	SDL_UnlockMutex(trace.lock);
+	double scale = 1000000.0 / SDL_GetPerformanceFrequency();
+	for (; buffer != NULL; buffer = buffer->next) {
+		if (buffer->session != session) continue;
+		Uint32 count = (Uint32)SDL_GetAtomicInt(&buffer->count);
+		if (buffer->written == 0 && count > 0) {
+			SDL_IOprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%" SDL_PRIu64 ",\"args\":{\"name\":\"%s\"}}",
+				*first ? "\n" : ",\n", buffer->thread, buffer->thread_name);
+			*first = false;
+		}
+		for (; buffer->written < count; ++buffer->written) {
+			const Trace_Event *event = &buffer->events[buffer->written];
+			SDL_IOprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%" SDL_PRIu64 ",\"ts\":%.3f,\"dur\":%.3f",
+				event->name, buffer->thread, (event->start - trace.start) * scale, event->duration * scale);
+			if (event->arg_name != NULL) {
+				SDL_IOprintf(file, ",\"args\":{\"%s\":%" SDL_PRIs64 "}}", event->arg_name, event->arg);
+			} else {
+				SDL_IOprintf(file, "}");
+			}
+		}
+	}
+}
+
+// Frees buffers whose owners moved on, once they are written or belong to a finished session
+static void trace_free_buffers(Uint32 session) {
+	SDL_LockMutex(trace.lock);
+	Trace_Buffer **link = &trace.buffers;
+	while (*link != NULL) {
+		Trace_Buffer *buffer = *link;
+		if (SDL_GetAtomicInt(&buffer->sealed)
+			&& (buffer->session != session || buffer->written == (Uint32)SDL_GetAtomicInt(&buffer->count))) {
+			*link = buffer->next;
+			SDL_free(buffer);
+		} else {
+			link = &buffer->next;
+		}
+	}
+	SDL_UnlockMutex(trace.lock);
+}
+
+static int trace_writer_thread(void *data) {
+	(void) data;
+	trace_thread_name = "trace writer";
+	SDL_IOStream *file = NULL;
+	char path[TRACE_PATH_SIZE];
+	Uint32 session = 0;
+	bool first = true;
+	SDL_LockMutex(trace.lock);
+	while (true) {
+		bool quit = trace.quit;
+		Uint32 wanted = quit ? 0 : (Uint32)SDL_GetAtomicInt(&trace.session);
+		char wanted_path[TRACE_PATH_SIZE];
+		SDL_strlcpy(wanted_path, trace.path, sizeof wanted_path);
+		SDL_UnlockMutex(trace.lock);
+		if (file != NULL && wanted != session) {
+			trace_write_buffers(file, session, &first);
+			SDL_IOprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+			if (SDL_CloseIO(file)) SDL_LogInfo(0, "Trace saved to %s", path);
+			else SDL_LogWarn(0, "Can't write trace %s: %s", path, SDL_GetError());
+			file = NULL;
+			session = 0;
+		}
+		if (file == NULL && wanted != 0 && wanted != session) {
+			session = wanted;
+			first = true;
+			SDL_strlcpy(path, wanted_path, sizeof path);
+			file = SDL_IOFromFile(path, "w");
+			if (file == NULL) {
+				SDL_LogWarn(0, "Can't open trace %s: %s", path, SDL_GetError());
+			} else {
+				SDL_IOprintf(file, "{\"traceEvents\":[");
+			}
+		}
+		if (file != NULL) trace_write_buffers(file, session, &first);
+		trace_free_buffers(session);
+		SDL_LockMutex(trace.lock);
+		if (quit) break;
+		SDL_WaitConditionTimeout(trace.wake, trace.lock, TRACE_FLUSH_MS);
+	}
+	SDL_UnlockMutex(trace.lock);
+	return 0;
+}
+
+// Starts recording into path or finishes the recording, the file is written by the writer thread
+static void trace_toggle(const char *path) {
+	if (trace.writer == NULL) {
+		trace.lock = SDL_CreateMutex();
+		trace.wake = SDL_CreateCondition();
+		if (trace.lock == NULL || trace.wake == NULL) {
+			SDL_LogWarn(0, "Can't create trace writer: %s", SDL_GetError());
+			return;
+		}
+		trace.writer = SDL_CreateThread(trace_writer_thread, "trace writer", NULL);
+		if (trace.writer == NULL) {
+			SDL_LogWarn(0, "Can't create trace writer thread: %s", SDL_GetError());
+			return;
+		}
+	}
+	SDL_LockMutex(trace.lock);
+	if (SDL_GetAtomicInt(&trace.session) != 0) {
+		SDL_SetAtomicInt(&trace.session, 0);
+	} else {
+		SDL_strlcpy(trace.path, path, sizeof trace.path);
+		trace.start = SDL_GetPerformanceCounter();
+		trace.sessions_count += 1;
+		SDL_SetAtomicInt(&trace.session, (int)trace.sessions_count);
+		SDL_LogInfo(0, "Recording trace to %s", path);
+	}
+	SDL_SignalCondition(trace.wake);
+	SDL_UnlockMutex(trace.lock);
+}
+
+// Finishes the file if recording, other threads must not record anymore
+static void trace_shutdown(void) {
+	if (trace.writer == NULL) return;
+	SDL_SetAtomicInt(&trace.session, 0);
+	SDL_LockMutex(trace.lock);
+	trace.quit = true;
+	SDL_SignalCondition(trace.wake);
+	SDL_UnlockMutex(trace.lock);
+	SDL_WaitThread(trace.writer, NULL);
+	while (trace.buffers != NULL) {
+		Trace_Buffer *next = trace.buffers->next;
+		SDL_free(trace.buffers);
+		trace.buffers = next;
+	}
+	trace_local = NULL;
+	SDL_DestroyCondition(trace.wake);
+	SDL_DestroyMutex(trace.lock);
+	trace = (Trace){0};
+}
+
+static inline Buffer_Handle buffer_handle(Ctx *ctx, TextBuffer *buffer) {
+	return (Buffer_Handle){(Uint32)(buffer - ctx->buffers), buffer->generation};
+}
+
+// NULL if the buffer was released or its slot reused
+static inline TextBuffer *buffer_resolve(Ctx *ctx, Buffer_Handle handle) {
+	if (handle.index >= ctx->buffers_count) return NULL;
+	TextBuffer *buffer = &ctx->buffers[handle.index];
+	if (buffer->generation != handle.generation || buffer->refcount <= 0) return NULL;
+	return buffer;
+}
+
+static inline Memory_Tag buffer_memory_tag(Ctx *ctx, TextBuffer *buffer) {
+	return buffer_resolve(ctx, ctx->log_buffer) == buffer ? Memory_Tag_log : Memory_Tag_text;
+}
+
+static bool buffer_unpack(Ctx *ctx, TextBuffer *buffer);
+
+// Everything that reads or changes the text of a buffer no frame holds goes through here.
+// False when the text couldn't be unpacked, the caller drops what it was doing and says so
+static inline bool buffer_touch(Ctx *ctx, TextBuffer *buffer) {
+	buffer->last_access = ctx->ticks;
+	return buffer->packed == NULL || buffer_unpack(ctx, buffer);
+}
+
+// Frame holds a reference, so its handle is never stale.
+// The pointer is only good until the next allocate_buffer.
+// Buffers of frames are never packed, they're unpacked before a frame takes them
+static inline TextBuffer *frame_buffer(Ctx *ctx, Frame *frame) {
+	SDL_assert(frame->buffer.index < ctx->buffers_count);
+	SDL_assert(ctx->buffers[frame->buffer.index].generation == frame->buffer.generation);
+	TextBuffer *buffer = &ctx->buffers[frame->buffer.index];
+	SDL_assert(buffer->packed == NULL);
+	buffer->last_access = ctx->ticks;
+	return buffer;
+}
+
+static inline Frame_Cold *frame_cold(Ctx *ctx, Frame *frame) {
+	return &ctx->frames_cold[frame - ctx->frames];
+}
+
+static inline Frame_Handle frame_handle(Ctx *ctx, Uint32 framei) {
+	return (Frame_Handle){framei, ctx->frames[framei].generation};
+}
+
+// (Uint32)-1 if the frame was closed or its slot reused
+static inline Uint32 frame_resolve(Ctx *ctx, Frame_Handle handle) {
+	if (handle.index >= ctx->frames_count) return -1;
+	Frame *frame = &ctx->frames[handle.index];
+	if (!frame->taken || frame->generation != handle.generation) return -1;
+	return handle.index;
+}
+
+static Uint32 find_any_frame(Ctx *ctx);
+
+// Closing a frame closes its children, so this falls back only on a bug
+static inline Uint32 frame_parent(Ctx *ctx, Frame *frame) {
+	Uint32 parent = frame_resolve(ctx, frame_cold(ctx, frame)->parent_frame);
+	if (parent != (Uint32)-1) return parent;
+	SDL_LogWarn(0, "Frame %" SDL_PRIu32 " outlived its parent", (Uint32)(frame - ctx->frames));
+	return find_any_frame(ctx);
+}
+
 static inline SDL_Color hsv_to_rgb(SDL_Color hsv) {
 	SDL_Color rgb = {0, 0, 0, hsv.a};
 	float h = hsv.r / 255.0f * 360.0f;
@@ -214,1009 +1363,4370 @@ static inline SDL_Color hsv_to_rgb(SDL_Color hsv) {
 	return rgb;
 }
 
-static inline bool frame_has_line_numbers(Ctx *ctx, Uint32 frame) {
-	return (ctx->frames[frame].frame_type == Frame_Type_memory
-		|| ctx->frames[frame].frame_type == Frame_Type_file);
+// Text scanning kernels, picked once by text_kernels_init from what the CPU has.
+// The scalar versions are the reference, DEBUG_KERNELS checks the others against them.
+// Everything stops at the first '\0' like the old byte loops did, except utf8 ones.
+typedef struct Text_Kernels {
+	const char *name;
+	size_t (*count_newlines)(const char *text, size_t size);
+	size_t (*find_newline)(const char *text, size_t size); // First '\n' or '\0', size if none
+	size_t (*find_newline_back)(const char *text, size_t size); // Last '\n', SDL_SIZE_MAX if none
+	bool (*is_blank)(const char *text, size_t size);
+	// Shortest prefix reaching `limit` visual columns (tab is TAB_WIDTH), stops early at the end
+	size_t (*columns_prefix)(const char *text, size_t size, Uint32 limit, Uint32 *columns);
+	bool (*utf8_validate)(const char *text, size_t size);
+	size_t (*utf8_length)(const char *text, size_t size); // Codepoints of valid utf8
+} Text_Kernels;
+
+static size_t text_count_newlines_scalar(const char *text, size_t size) {
+	size_t count = 0;
+	for (size_t i = 0; i < size && text[i] != '\0'; ++i) {
+		if (text[i] == '\n') count += 1;
+	}
+	return count;
 }
 
-static inline bool frame_is_multiline(Ctx *ctx, Uint32 frame) {
-	return (ctx->frames[frame].frame_type == Frame_Type_memory
-		|| ctx->frames[frame].frame_type == Frame_Type_file);
+static size_t text_find_newline_scalar(const char *text, size_t size) {
+	size_t i;
+	for (i = 0; i < size; ++i) {
+		if (text[i] == '\n' || text[i] == '\0') break;
+	}
+	return i;
 }
 
-static inline Uint32 reverse_sorted_index(Ctx *ctx, Uint32 sorted_ind) {
-	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
-		if (ctx->sorted_frames[i] == sorted_ind) return i;
+static size_t text_find_newline_back_scalar(const char *text, size_t size) {
+	for (size_t i = size; i > 0; --i) {
+		if (text[i - 1] == '\n') return i - 1;
 	}
-	SDL_assert(!"Sorted index out of bounds");
-	return -1;
+	return SDL_SIZE_MAX;
 }
 
-static void undo_clear_after_cursor(Ctx *ctx, Uint32 buffer) {
-	SDL_assert(ctx->buffers[buffer].refcount > 0);
-	TextBuffer *buf = &ctx->buffers[buffer];
-	for (Uint32 i = buf->undos_cursor; i < buf->undos_size; ++i) {
-		SDL_free(buf->undos[i].data);
+static bool text_is_blank_scalar(const char *text, size_t size) {
+	for (size_t i = 0; i < size && text[i] != '\0'; ++i) {
+		if (text[i] != ' ' && text[i] != '\t' && text[i] != '\n') return false;
 	}
-	buf->undos_size = buf->undos_cursor;
+	return true;
 }
 
-// I will kill myself if one of the ops data won't be allocated with SDL_malloc
-static void push_undo_op(Ctx *ctx, Uint32 buffer, Undo_Operation op) {
-	SDL_assert(ctx->buffers[buffer].refcount > 0);
-	TextBuffer *buf = &ctx->buffers[buffer];
-	if (buf->undos_cursor > 0) {
-		Undo_Operation *prev_op = &buf->undos[buf->undos_cursor - 1];
-		if (op.type == Undo_Type_insert) {
-			if (op.type == prev_op->type && op.pos == (prev_op->pos + prev_op->len)) {
-				if ((op.data[0] == '\n') == (prev_op->data[prev_op->len - 1] == '\n')) {
-					undo_clear_after_cursor(ctx, buffer);
-					prev_op->data = SDL_realloc(prev_op->data, prev_op->len + op.len);
-					SDL_assert(prev_op->data != NULL);
-					SDL_memcpy(prev_op->data + prev_op->len, op.data, op.len);
-					SDL_free(op.data);
-					prev_op->len += op.len;
-					return;
-				}
-			}
-		} else if (op.type == Undo_Type_delete) {
-			if (op.type == prev_op->type && (op.pos + op.len) == prev_op->pos) {
-				undo_clear_after_cursor(ctx, buffer);
-				op.data = SDL_realloc(op.data, op.len + prev_op->len);
-				SDL_assert(op.data != NULL);
-				SDL_memcpy(op.data + op.len, prev_op->data, prev_op->len);
-				SDL_free(prev_op->data);
-				prev_op->data = op.data;
-				prev_op->pos = op.pos;
-				prev_op->len += op.len;
-				return;
-			}
-		}
+// Steps codepoints until `stop`, returns true when limit or the end of text is reached
+static inline bool text_columns_step(const char *text, size_t size, size_t *pos, Uint32 *columns, Uint32 limit, size_t stop) {
+	while (*pos < stop) {
+		if (*columns >= limit) return true;
+		const char *cur = text + *pos;
+		size_t left = size - *pos;
+		Uint32 cp = SDL_StepUTF8(&cur, &left);
+		if (cp == 0) return true;
+		*columns += cp == '\t' ? TAB_WIDTH : 1;
+		*pos = cur - text;
 	}
-	if (buf->undos_cursor >= UNDO_RING_SIZE) {
-		SDL_free(buf->undos[0].data);
-		SDL_memmove(buf->undos, buf->undos + 1, (UNDO_RING_SIZE - 1) * sizeof *buf->undos);
-		buf->undos_cursor -= 1;
+	return *pos >= size || *columns >= limit;
+}
+
+static size_t text_columns_prefix_scalar(const char *text, size_t size, Uint32 limit, Uint32 *columns) {
+	size_t pos = 0;
+	*columns = 0;
+	text_columns_step(text, size, &pos, columns, limit, size);
+	return pos;
+}
+
+// Length of the valid utf8 sequence at text, 0 if it's broken
+static inline size_t text_utf8_sequence(const Uint8 *text, size_t size) {
+	Uint8 lead = text[0];
+	size_t length;
+	Uint8 low = 0x80, high = 0xbf;
+	if (lead < 0x80) return 1;
+	else if (lead < 0xc2) return 0;
+	else if (lead < 0xe0) length = 2;
+	else if (lead < 0xf0) {
+		length = 3;
+		if (lead == 0xe0) low = 0xa0;
+		if (lead == 0xed) high = 0x9f;
+	} else if (lead < 0xf5) {
+		length = 4;
+		if (lead == 0xf0) low = 0x90;
+		if (lead == 0xf4) high = 0x8f;
+	} else return 0;
+	if (length > size) return 0;
+	if (text[1] < low || text[1] > high) return 0;
+	for (size_t i = 2; i < length; ++i) {
+		if ((text[i] & 0xc0) != 0x80) return 0;
 	}
-	// [][]
-	// SIZE = 2
-	// | 0
-	//   | 1
-	//     | 2
-	buf->undos[buf->undos_cursor] = op;
-	buf->undos_cursor += 1;
-	undo_clear_after_cursor(ctx, buffer);
+	return length;
 }
 
-static inline bool is_space_only(Ctx *ctx, size_t text_length, const char text[text_length]) {
-	(void) ctx;
-	if (text_length == 0) return true;
-	for (size_t i = 0; i < text_length; ++i) {
-		if (text[i] == '\0') return true;
-		if (text[i] != ' ' && text[i] != '\t' && text[i] != '\n') return false;
+static bool text_utf8_validate_scalar(const char *text, size_t size) {
+	const Uint8 *cur = (const Uint8 *)text;
+	while (size > 0) {
+		size_t length = text_utf8_sequence(cur, size);
+		if (length == 0) return false;
+		cur += length;
+		size -= length;
 	}
 	return true;
 }
 
-static inline void set_color(Ctx *ctx, SDL_Color color) {
-	SDL_SetRenderDrawColor(ctx->renderer, color.r, color.g, color.b, color.a);
+static size_t text_utf8_length_scalar(const char *text, size_t size) {
+	size_t count = 0;
+	for (size_t i = 0; i < size; ++i) {
+		if (((Uint8)text[i] & 0xc0) != 0x80) count += 1;
+	}
+	return count;
 }
 
-static inline void set_color_tinted(Ctx *ctx, SDL_Color color, float tint) {
-	SDL_SetRenderDrawColor(ctx->renderer, color.r * tint, color.g * tint, color.b * tint, color.a * tint);
+#ifdef SDL_SSE2_INTRINSICS
+static size_t SDL_TARGETING("sse2") text_count_newlines_sse2(const char *text, size_t size) {
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+	size_t count = 0, i = 0;
+	while (i + 16 <= size) {
+		// Byte counters overflow after 255 rounds, flush them into count before that
+		__m128i counters = zero;
+		size_t rounds_end = SDL_min(size, i + 255 * 16);
+		for (; i + 16 <= rounds_end; i += 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero)) != 0) break;
+			counters = _mm_sub_epi8(counters, _mm_cmpeq_epi8(chunk, newline));
+		}
+		__m128i sums = _mm_sad_epu8(counters, zero);
+		count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+		if (i + 16 <= rounds_end) break;
+	}
+	return count + text_count_newlines_scalar(text + i, size - i);
 }
 
-static void buffer_delete_text_no_undo(Ctx *ctx, Uint32 bufid, Uint32 from, Uint32 to) {
-	TextBuffer *buffer = &ctx->buffers[bufid];
-	SDL_assert(buffer->refcount > 0);
-	SDL_assert(to >= from);
-	SDL_memmove(buffer->text + from, buffer->text + to,
-		buffer->text_size - to + 1);
-	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
-		if (!ctx->frames[i].taken) continue;
-		if (ctx->frames[i].buffer != buffer) continue;
-		if (ctx->frames[i].cursor >= to) ctx->frames[i].cursor -= to - from;
-		if (ctx->frames[i].selection >= to) ctx->frames[i].selection -= to - from;
+static size_t SDL_TARGETING("sse2") text_find_newline_sse2(const char *text, size_t size) {
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+	size_t i;
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, newline), _mm_cmpeq_epi8(chunk, zero)));
+		if (mask != 0) return i + __builtin_ctz(mask);
 	}
-	buffer->text_size -= to - from;
-	ctx->should_render = true;
+	return i + text_find_newline_scalar(text + i, size - i);
 }
 
-static void buffer_delete_text(Ctx *ctx, Uint32 bufid, Uint32 from, Uint32 to, Undo_Group undo_group) {
-	TextBuffer *buffer = &ctx->buffers[bufid];
-	SDL_assert(buffer->refcount > 0);
-	SDL_assert(to >= from);
-	char *data = SDL_strndup(buffer->text + from, to - from);
-	buffer_delete_text_no_undo(ctx, bufid, from, to);
-	push_undo_op(ctx, bufid, (Undo_Operation) {
-		.type = Undo_Type_delete,
-		.group = undo_group,
-		.pos = from,
-		.len = to - from,
-		.data = data,
-	});
+static size_t SDL_TARGETING("sse2") text_find_newline_back_sse2(const char *text, size_t size) {
+	const __m128i newline = _mm_set1_epi8('\n');
+	size_t i;
+	for (i = size; i >= 16; i -= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(text + i - 16));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+		if (mask != 0) return i - 16 + 31 - __builtin_clz(mask);
+	}
+	return text_find_newline_back_scalar(text, i);
 }
 
-static inline Uint32 count_lines(Ctx *ctx, size_t text_size, char text[text_size]) {
-	Uint32 lines = 1;
-	(void) ctx;
-	if (text_size == 0) return 0;
-	for (Uint32 i = 0; i < text_size; ++i) {
-		if (text[i] == '\0') return lines;
-		if (text[i] == '\n') lines += 1;
+static bool SDL_TARGETING("sse2") text_is_blank_sse2(const char *text, size_t size) {
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+	size_t i;
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+		__m128i blank = _mm_or_si128(_mm_cmpeq_epi8(chunk, space),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, tab), _mm_cmpeq_epi8(chunk, newline)));
+		int other = ~_mm_movemask_epi8(blank) & 0xffff;
+		if (other == 0) continue;
+		int ends = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+		// Only what is before the first '\0' matters
+		if (ends == 0) return false;
+		int first_end = ends & -ends;
+		return (other & (first_end - 1)) == 0;
 	}
-	return lines;
+	return text_is_blank_scalar(text + i, size - i);
 }
 
-static void buffer_insert_text_no_undo(Ctx *ctx, TextBuffer *buffer, const char *in, size_t in_len, Uint32 pos) {
-	if (in_len == 0) return;
-	if (pos > buffer->text_size) pos = buffer->text_size;
-	size_t new_size = (size_t)buffer->text_size + in_len;
-	if (new_size + 1 > buffer->text_capacity) {
-		size_t new_capacity = ((new_size + 1 + TEXT_CHUNK_SIZE - 1) / TEXT_CHUNK_SIZE) * TEXT_CHUNK_SIZE;
-		char *new_buf = SDL_realloc(buffer->text, new_capacity);
-		if (!new_buf) {
-			SDL_Log("Error, failed to reallocate new buffer");
-			return;
+static size_t SDL_TARGETING("sse2") text_columns_prefix_sse2(const char *text, size_t size, Uint32 limit, Uint32 *columns) {
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i zero = _mm_setzero_si128();
+	size_t pos = 0;
+	*columns = 0;
+	while (pos + 16 <= size) {
+		__m128i chunk = _mm_loadu_si128((const __m128i *)(text + pos));
+		int special = _mm_movemask_epi8(chunk) | _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+		if (special == 0) {
+			Uint32 width = 16 + (TAB_WIDTH - 1) * __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, tab)));
+			if (*columns + width < limit) {
+				*columns += width;
+				pos += 16;
+				continue;
+			}
 		}
-		buffer->text = new_buf;
-		buffer->text_capacity = (Uint32)new_capacity;
+		// Non ascii or the limit is inside, do this chunk one codepoint at a time
+		if (text_columns_step(text, size, &pos, columns, limit, pos + 16)) return pos;
 	}
-	SDL_memmove(buffer->text + pos + in_len,
-		buffer->text + pos,
-		(size_t)buffer->text_size - (size_t)pos);
-	SDL_memcpy(buffer->text + pos, in, in_len);
-	buffer->text_size = (Uint32)new_size;
-	buffer->text[buffer->text_size] = '\0';
-	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
-		if (!ctx->frames[i].taken) continue;
-		if (ctx->frames[i].buffer == buffer) {
-			if (ctx->frames[i].cursor == buffer->text_size - 1) ctx->frames[i].scroll_lock = false;
-			if (ctx->frames[i].cursor >= pos) ctx->frames[i].cursor += in_len;
-			if (ctx->frames[i].selection >= pos) ctx->frames[i].selection += in_len;
-			if (frame_is_multiline(ctx, i)) {
-				if (!ctx->frames[i].scroll_lock) {
-					Sint32 text_lines = (Sint32)count_lines(ctx, buffer->text_size, buffer->text);
-					Sint32 buffer_last_line = (Sint32)SDL_ceil((ctx->frames[i].bounds.h - ctx->frames[i].scroll.y) / ctx->line_height);
-					if (text_lines >= buffer_last_line) {
-						ctx->frames[i].scroll.y = ctx->frames[i].bounds.h - (text_lines + 5.0) * ctx->line_height;
-					}
-				}
-			}
+	text_columns_step(text, size, &pos, columns, limit, size);
+	return pos;
+}
+
+static bool SDL_TARGETING("sse2") text_utf8_validate_sse2(const char *text, size_t size) {
+	const Uint8 *cur = (const Uint8 *)text;
+	while (size > 0) {
+		// Skip ascii runs, check the rest one sequence at a time
+		if (size >= 16 && _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)cur)) == 0) {
+			cur += 16;
+			size -= 16;
+			continue;
 		}
+		size_t length = text_utf8_sequence(cur, size);
+		if (length == 0) return false;
+		cur += length;
+		size -= length;
 	}
-	ctx->should_render = true;
+	return true;
 }
 
-static void buffer_insert_text(Ctx *ctx, TextBuffer *buffer, const char *in, size_t in_len, Uint32 pos, Undo_Group undo_group) {
-	buffer_insert_text_no_undo(ctx, buffer, in, in_len, pos);
-	push_undo_op(ctx, (buffer - &ctx->buffers[0]), (Undo_Operation) {
-		.type = Undo_Type_insert,
-		.group = undo_group,
-		.pos = pos,
-		.len = in_len,
-		.data = SDL_strndup(in, in_len),
-	});
+static size_t SDL_TARGETING("sse2") text_utf8_length_sse2(const char *text, size_t size) {
+	const __m128i continuation = _mm_set1_epi8(-65); // 0xbf, biggest continuation byte
+	const __m128i zero = _mm_setzero_si128();
+	size_t count = 0, i = 0;
+	while (i + 16 <= size) {
+		__m128i counters = zero;
+		size_t rounds_end = SDL_min(size, i + 255 * 16);
+		for (; i + 16 <= rounds_end; i += 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i *)(text + i));
+			counters = _mm_sub_epi8(counters, _mm_cmpgt_epi8(chunk, continuation));
+		}
+		__m128i sums = _mm_sad_epu8(counters, zero);
+		count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+	}
+	return count + text_utf8_length_scalar(text + i, size - i);
 }
+#endif
 
-static inline void debug_rect(Ctx *ctx, SDL_FRect *rect, SDL_Color color) {
-	set_color(ctx, color);
-	SDL_RenderRect(ctx->renderer, rect);
+#ifdef SDL_AVX2_INTRINSICS
+static inline Uint64 SDL_TARGETING("avx2") text_sum_bytes_avx2(__m256i counters) {
+	__m256i sums = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+	return _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+		+ _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
 }
 
-static inline Uint32 coords_to_text_index(Ctx *ctx, size_t text_length, char text[text_length], float pos) {
-	Uint32 visual_char, ind;
-	(void) ctx;
-	// [ ][ ][ ][ ][ ][ ][ ][ ][a][b][c]
-	//       | 2 before
-	// | 0 vis_char
-	//                      | 7 nvis_char
-	//                            | 9 after
-	visual_char = 0;
-	if (pos / ctx->font_width <= -0.4) return 0;
-	for (ind = 0; ind < text_length && text[ind] != '\0'; ++ind) {
-		float diff = (pos - (float)visual_char * ctx->font_width) / ctx->font_width;
-		if (text[ind] == '\t') {
-			visual_char += TAB_WIDTH;
-			if (diff <= TAB_WIDTH / 2) return ind;
-		} else {
-			visual_char += 1;
-			if (diff <= 0.6) return ind;
+static size_t SDL_TARGETING("avx2") text_count_newlines_avx2(const char *text, size_t size) {
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+	size_t count = 0, i = 0;
+	while (i + 32 <= size) {
+		__m256i counters = zero;
+		size_t rounds_end = SDL_min(size, i + 255 * 32);
+		for (; i + 32 <= rounds_end; i += 32) {
+			__m256i chunk = _mm256_loadu_si256((const __m256i *)(text + i));
+			if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero)) != 0) break;
+			counters = _mm256_sub_epi8(counters, _mm256_cmpeq_epi8(chunk, newline));
 		}
+		count += text_sum_bytes_avx2(counters);
+		if (i + 32 <= rounds_end) break;
 	}
-	return ind;
+	return count + text_count_newlines_scalar(text + i, size - i);
 }
 
-static inline Uint32 string_to_visual(Ctx *ctx, size_t text_length, const char text[text_length]) {
-	(void) ctx;
-	Uint32 visual_char = 0;
-	if (text_length == 0) return 0;
-	while (true) {
-		Uint32 ch = SDL_StepUTF8(&text, &text_length);
-		if (ch == '\0') break;
-		if (ch == '\t') {
-			visual_char += 8;
-		} else {
-			visual_char += 1;
-		}
+static size_t SDL_TARGETING("avx2") text_find_newline_avx2(const char *text, size_t size) {
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i;
+	for (i = 0; i + 32 <= size; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)(text + i));
+		Uint32 mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, newline), _mm256_cmpeq_epi8(chunk, zero)));
+		if (mask != 0) return i + __builtin_ctz(mask);
 	}
-	return visual_char;
+	return i + text_find_newline_scalar(text + i, size - i);
 }
 
-static inline void frame_scroll_to_line(Ctx *ctx, Uint32 frame, Sint32 line) {
-	ctx->frames[frame].scroll.y = -line * ctx->line_height;
+static size_t SDL_TARGETING("avx2") text_find_newline_back_avx2(const char *text, size_t size) {
+	const __m256i newline = _mm256_set1_epi8('\n');
+	size_t i;
+	for (i = size; i >= 32; i -= 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)(text + i - 32));
+		Uint32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+		if (mask != 0) return i - 32 + 31 - __builtin_clz(mask);
+	}
+	return text_find_newline_back_scalar(text, i);
 }
 
-static inline void frame_scroll_to_line_centered(Ctx *ctx, Uint32 frame, Sint32 line) {
-	line -= ctx->frames[frame].bounds.h / ctx->line_height / 2;
-	ctx->frames[frame].scroll.y = -line * ctx->line_height;
+static bool SDL_TARGETING("avx2") text_is_blank_avx2(const char *text, size_t size) {
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i newline = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i;
+	for (i = 0; i + 32 <= size; i += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)(text + i));
+		__m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, space),
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, tab), _mm256_cmpeq_epi8(chunk, newline)));
+		Uint32 other = ~(Uint32)_mm256_movemask_epi8(blank);
+		if (other == 0) continue;
+		Uint32 ends = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero));
+		if (ends == 0) return false;
+		Uint32 first_end = ends & -ends;
+		return (other & (first_end - 1)) == 0;
+	}
+	return text_is_blank_scalar(text + i, size - i);
 }
 
-static inline char *strnstr_r(char *start, size_t len, const char *needle) {
-	size_t needle_len = SDL_strlen(needle);
-	char *end = start + len - needle_len;
-	while (start < end) {
-		if (SDL_strncmp(end, needle, needle_len) == 0) return end;
-		end--;
+static size_t SDL_TARGETING("avx2") text_columns_prefix_avx2(const char *text, size_t size, Uint32 limit, Uint32 *columns) {
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i zero = _mm256_setzero_si256();
+	size_t pos = 0;
+	*columns = 0;
+	while (pos + 32 <= size) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i *)(text + pos));
+		Uint32 special = _mm256_movemask_epi8(chunk) | _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero));
+		if (special == 0) {
+			Uint32 width = 32 + (TAB_WIDTH - 1) * __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, tab)));
+			if (*columns + width < limit) {
+				*columns += width;
+				pos += 32;
+				continue;
+			}
+		}
+		if (text_columns_step(text, size, &pos, columns, limit, pos + 32)) return pos;
 	}
-	return NULL;
+	text_columns_step(text, size, &pos, columns, limit, size);
+	return pos;
 }
 
-static void update_search(Ctx *ctx, Uint32 search_frame) {
-	SDL_assert(ctx->frames[search_frame].taken);
-	Uint32 parent_frame = ctx->frames[search_frame].parent_frame;
-	SDL_assert(ctx->frames[parent_frame].taken);
-	if (ctx->frames[search_frame].buffer->text_size == 0) {
-		ctx->frames[search_frame].search_status = Search_Status_not_found;
-		ctx->should_render = true;
-		return;
+// Shifts in the last `n` bytes of previous chunk, like a byte alignr across both lanes
+#define text_prev_avx2(chunk, prev, n) \
+	_mm256_alignr_epi8((chunk), _mm256_permute2x128_si256((prev), (chunk), 0x21), 16 - (n))
+
+enum {
+	UTF8_TOO_SHORT = 1 << 0,
+	UTF8_TOO_LONG = 1 << 1,
+	UTF8_OVERLONG_3 = 1 << 2,
+	UTF8_TOO_LARGE = 1 << 3,
+	UTF8_SURROGATE = 1 << 4,
+	UTF8_OVERLONG_2 = 1 << 5,
+	UTF8_TOO_LARGE_1000 = 1 << 6,
+	UTF8_OVERLONG_4 = 1 << 6,
+	UTF8_TWO_CONTS = 1 << 7,
+	UTF8_CARRY = UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS,
+};
+
+// Error bits by high nibble of the previous byte
+static const Uint8 text_utf8_byte_1_high[16] = {
+	UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+	UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+	UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+	UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+	UTF8_TOO_SHORT,
+	UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+	UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+// Error bits by low nibble of the previous byte
+static const Uint8 text_utf8_byte_1_low[16] = {
+	UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+	UTF8_CARRY | UTF8_OVERLONG_2,
+	UTF8_CARRY,
+	UTF8_CARRY,
+	UTF8_CARRY | UTF8_TOO_LARGE,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+	UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+// Error bits by high nibble of the current byte
+static const Uint8 text_utf8_byte_2_high[16] = {
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+	UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+	UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+// Anything above these at the chunk end still waits for continuation bytes
+static const Uint8 text_utf8_incomplete_max[32] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1,
+};
+
+// Lookup table validation from Keiser and Lemire "Validating UTF-8 In Less Than One Instruction Per Byte"
+static bool SDL_TARGETING("avx2") text_utf8_validate_avx2(const char *text, size_t size) {
+	const __m256i byte_1_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)text_utf8_byte_1_high));
+	const __m256i byte_1_low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)text_utf8_byte_1_low));
+	const __m256i byte_2_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)text_utf8_byte_2_high));
+	const __m256i incomplete_max = _mm256_loadu_si256((const __m256i *)text_utf8_incomplete_max);
+	const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+	__m256i error = _mm256_setzero_si256();
+	__m256i prev_chunk = _mm256_setzero_si256();
+	__m256i prev_incomplete = _mm256_setzero_si256();
+	size_t i = 0;
+	bool last = false;
+	while (!last) {
+		__m256i chunk;
+		if (i + 32 <= size) {
+			chunk = _mm256_loadu_si256((const __m256i *)(text + i));
+		} else {
+			// Zero padding makes a sequence cut by the end fail as too short
+			char tail[32] = {0};
+			SDL_memcpy(tail, text + i, size - i);
+			chunk = _mm256_loadu_si256((const __m256i *)tail);
+			last = true;
+		}
+		i += 32;
+		if (_mm256_movemask_epi8(chunk) == 0) {
+			error = _mm256_or_si256(error, prev_incomplete);
+		} else {
+			__m256i prev1 = text_prev_avx2(chunk, prev_chunk, 1);
+			__m256i special = _mm256_and_si256(
+				_mm256_and_si256(
+					_mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble)),
+					_mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, low_nibble))),
+				_mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), low_nibble)));
+			__m256i prev2 = text_prev_avx2(chunk, prev_chunk, 2);
+			__m256i prev3 = text_prev_avx2(chunk, prev_chunk, 3);
+			__m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xe0 - 0x80));
+			__m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xf0 - 0x80));
+			__m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(-0x80));
+			error = _mm256_or_si256(error, _mm256_xor_si256(must_continue, special));
+			prev_incomplete = _mm256_subs_epu8(chunk, incomplete_max);
+		}
+		prev_chunk = chunk;
+		if (!_mm256_testz_si256(error, error)) return false;
 	}
-	char *found_ptr;
-	if (ctx->frames[search_frame].search_backwards) {
-		found_ptr = strnstr_r(ctx->frames[parent_frame].buffer->text, ctx->frames[parent_frame].cursor, ctx->frames[search_frame].buffer->text);
+	return true;
+}
+#undef text_prev_avx2
+
+static size_t SDL_TARGETING("avx2") text_utf8_length_avx2(const char *text, size_t size) {
+	const __m256i continuation = _mm256_set1_epi8(-65);
+	size_t count = 0, i = 0;
+	while (i + 32 <= size) {
+		__m256i counters = _mm256_setzero_si256();
+		size_t rounds_end = SDL_min(size, i + 255 * 32);
+		for (; i + 32 <= rounds_end; i += 32) {
+			__m256i chunk = _mm256_loadu_si256((const __m256i *)(text + i));
+			counters = _mm256_sub_epi8(counters, _mm256_cmpgt_epi8(chunk, continuation));
+		}
+		count += text_sum_bytes_avx2(counters);
+	}
+	return count + text_utf8_length_scalar(text + i, size - i);
+}
+#endif
+
+static const Text_Kernels text_kernels_scalar = {
+	.name = "scalar",
+	.count_newlines = text_count_newlines_scalar,
+	.find_newline = text_find_newline_scalar,
+	.find_newline_back = text_find_newline_back_scalar,
+	.is_blank = text_is_blank_scalar,
+	.columns_prefix = text_columns_prefix_scalar,
+	.utf8_validate = text_utf8_validate_scalar,
+	.utf8_length = text_utf8_length_scalar,
+};
+
+#ifdef SDL_SSE2_INTRINSICS
+static const Text_Kernels text_kernels_sse2 = {
+	.name = "sse2",
+	.count_newlines = text_count_newlines_sse2,
+	.find_newline = text_find_newline_sse2,
+	.find_newline_back = text_find_newline_back_sse2,
+	.is_blank = text_is_blank_sse2,
+	.columns_prefix = text_columns_prefix_sse2,
+	.utf8_validate = text_utf8_validate_sse2,
+	.utf8_length = text_utf8_length_sse2,
+};
+#endif
+
+#ifdef SDL_AVX2_INTRINSICS
+static const Text_Kernels text_kernels_avx2 = {
+	.name = "avx2",
+	.count_newlines = text_count_newlines_avx2,
+	.find_newline = text_find_newline_avx2,
+	.find_newline_back = text_find_newline_back_avx2,
+	.is_blank = text_is_blank_avx2,
+	.columns_prefix = text_columns_prefix_avx2,
+	.utf8_validate = text_utf8_validate_avx2,
+	.utf8_length = text_utf8_length_avx2,
+};
+#endif
+
+// Scalar until text_kernels_init, so NO_MAIN builds work without it
+static const Text_Kernels *text_kernels = &text_kernels_scalar;
+
+#ifdef DEBUG_KERNELS
+// Random mixes of ascii, tabs, newlines, multibyte, broken utf8 and zeros at every offset
+static void text_kernels_check(const Text_Kernels *kernels) {
+	static const char *pieces[] = {
+		"a", "word ", "\t", "\n", " ", "\xd0\xb6", "\xe2\x82\xac", "\xf0\x9f\x98\x80",
+		"\xc0\xaf", "\xed\xa0\x80", "\xe2\x82", "\x80", "\xf4\x90\x80\x80", "\0",
+	};
+	char text[600];
+	Uint32 failures = 0;
+	for (Uint32 round = 0; round < 2000; ++round) {
+		size_t size = 0;
+		Uint32 rare = round % 4 == 0 ? SDL_arraysize(pieces) : 8; // Mostly valid text
+		while (size < sizeof(text) - 4 && SDL_rand(64) != 0) {
+			const char *piece = pieces[SDL_rand(rare)];
+			size_t length = piece[0] == '\0' ? 1 : SDL_strlen(piece);
+			SDL_memcpy(text + size, piece, length);
+			size += length;
+		}
+		for (size_t start = 0; start < SDL_min(size, 40); start += 7) {
+			const char *sub = text + start;
+			size_t sub_size = size - start;
+			Uint32 limit = SDL_rand(200), ref_columns, columns;
+			size_t ref_prefix = text_kernels_scalar.columns_prefix(sub, sub_size, limit, &ref_columns);
+			size_t prefix = kernels->columns_prefix(sub, sub_size, limit, &columns);
+			if (kernels->count_newlines(sub, sub_size) != text_kernels_scalar.count_newlines(sub, sub_size)
+				|| kernels->find_newline(sub, sub_size) != text_kernels_scalar.find_newline(sub, sub_size)
+				|| kernels->find_newline_back(sub, sub_size) != text_kernels_scalar.find_newline_back(sub, sub_size)
+				|| kernels->is_blank(sub, sub_size) != text_kernels_scalar.is_blank(sub, sub_size)
+				|| prefix != ref_prefix || columns != ref_columns
+				|| kernels->utf8_validate(sub, sub_size) != text_kernels_scalar.utf8_validate(sub, sub_size)
+				|| kernels->utf8_length(sub, sub_size) != text_kernels_scalar.utf8_length(sub, sub_size)) {
+				failures += 1;
+			}
+		}
+	}
+	if (failures != 0) {
+		SDL_LogError(0, "Text kernels %s differ from scalar in %" SDL_PRIu32 " cases", kernels->name, failures);
 	} else {
-		found_ptr = SDL_strnstr(ctx->frames[parent_frame].buffer->text + ctx->frames[parent_frame].cursor,
-			ctx->frames[search_frame].buffer->text,
-			ctx->frames[parent_frame].buffer->text_size - ctx->frames[parent_frame].cursor);
+		SDL_LogInfo(0, "Text kernels %s match scalar", kernels->name);
 	}
-	if (found_ptr == NULL) {
-		ctx->frames[search_frame].search_status = Search_Status_not_found;
-		ctx->should_render = true;
+}
+#endif
+
+static void text_kernels_init(void) {
+#ifdef DEBUG_KERNELS
+#ifdef SDL_SSE2_INTRINSICS
+	if (SDL_HasSSE2()) text_kernels_check(&text_kernels_sse2);
+#endif
+#ifdef SDL_AVX2_INTRINSICS
+	if (SDL_HasAVX2()) text_kernels_check(&text_kernels_avx2);
+#endif
+#endif
+#if defined(SDL_AVX2_INTRINSICS)
+	if (SDL_HasAVX2()) {
+		text_kernels = &text_kernels_avx2;
 		return;
 	}
-	ctx->frames[search_frame].search_status = Search_Status_found;
-	ctx->frames[parent_frame].search_cursor = found_ptr - ctx->frames[parent_frame].buffer->text;
-	Uint32 line = count_lines(ctx, ctx->frames[parent_frame].search_cursor, ctx->frames[parent_frame].buffer->text);
-	frame_scroll_to_line_centered(ctx, parent_frame, line);
-	ctx->should_render = true;
+#endif
+#if defined(SDL_SSE2_INTRINSICS)
+	if (SDL_HasSSE2()) {
+		text_kernels = &text_kernels_sse2;
+		return;
+	}
+#endif
+	text_kernels = &text_kernels_scalar;
 }
 
-static bool get_frame_render_rect(Ctx *ctx, Uint32 frame, SDL_FRect *bounds) {
-	SDL_assert(bounds != NULL);
-	SDL_assert(ctx->frames_count >= frame);
-	SDL_FRect frame_bounds = ctx->frames[frame].bounds_interp;
-	if (!ctx->frames[frame].is_global) {
-		frame_bounds.x += ctx->transform.x;
-		frame_bounds.y += ctx->transform.y;
+static void worker_pool_drain(Worker_Pool *pool, Parallel_Job job, void *userdata, Uint32 count) {
+	while (true) {
+		Uint32 index = (Uint32)SDL_AddAtomicInt(&pool->next_job, 1);
+		if (index >= count) break;
+		Uint64 start = trace_begin();
+		job(userdata, index);
+		trace_end_arg("job", start, "index", index);
 	}
-	*bounds = (SDL_FRect) {
-		.x = frame_bounds.x,
-		.y = frame_bounds.y,
-		.w = frame_bounds.w,
-		.h = frame_bounds.h,
-	};
-	return true;
 }
 
-static inline bool get_frame_line_prefix_rect(Ctx *ctx, Uint32 frame, SDL_FRect *bounds) {
-	get_frame_render_rect(ctx, frame, bounds);
-	bounds->w = 0;
-	if (ctx->frames[frame].line_prefix != NULL) {
-		float prefix_length = (SDL_utf8strlen(ctx->frames[frame].line_prefix)) * ctx->font_width;
-		bounds->w = prefix_length;
+static int worker_pool_thread(void *data) {
+	Worker_Pool *pool = data;
+	Uint32 seen = 0;
+	trace_thread_name = "worker";
+	SDL_LockMutex(pool->lock);
+	while (true) {
+		while (!pool->quit && pool->generation == seen) {
+			SDL_WaitCondition(pool->wake, pool->lock);
+		}
+		if (pool->quit) break;
+		seen = pool->generation;
+		// Woke too late, the next batch can't be published until busy drops, so joining a closed one would race with it
+		if (!pool->open) continue;
+		pool->busy += 1;
+		Parallel_Job job = pool->job;
+		void *userdata = pool->userdata;
+		Uint32 count = pool->jobs_count;
+		SDL_UnlockMutex(pool->lock);
+		worker_pool_drain(pool, job, userdata, count);
+		SDL_LockMutex(pool->lock);
+		pool->busy -= 1;
+		if (pool->busy == 0) SDL_SignalCondition(pool->done);
 	}
-	return true;
+	SDL_UnlockMutex(pool->lock);
+	return 0;
 }
 
-static inline bool get_frame_render_text_rect(Ctx *ctx, Uint32 frame, SDL_FRect *bounds) {
-	get_frame_render_rect(ctx, frame, bounds);
-	if (frame_has_line_numbers(ctx, frame)) {
-		bounds->x += ctx->font_width * 4;
-		bounds->w -= ctx->font_width * 4;
-		bounds->y += SDL_max(0, ctx->frames[frame].scroll_interp.y);
-		bounds->h -= SDL_max(0, ctx->frames[frame].scroll_interp.y);
-		bounds->h = SDL_max(bounds->h, 0);
+// Started on first use, with no threads everything just runs on the caller
+static void worker_pool_start(Worker_Pool *pool) {
+	if (pool->started) return;
+	pool->started = true;
+	int cores = SDL_GetNumLogicalCPUCores();
+	if (cores <= 1) return;
+	pool->lock = SDL_CreateMutex();
+	pool->wake = SDL_CreateCondition();
+	pool->done = SDL_CreateCondition();
+	pool->threads = SDL_calloc(SDL_min(cores - 1, WORKERS_MAX), sizeof *pool->threads);
+	if (pool->lock == NULL || pool->wake == NULL || pool->done == NULL || pool->threads == NULL) {
+		SDL_LogWarn(0, "Can't create worker pool: %s", SDL_GetError());
+		return;
 	}
-	if (ctx->frames[frame].line_prefix != NULL) {
-		float prefix_length = (SDL_utf8strlen(ctx->frames[frame].line_prefix)) * ctx->font_width;
-		bounds->x += prefix_length;
-		bounds->w -= prefix_length;
+	for (int i = 0; i < SDL_min(cores - 1, WORKERS_MAX); ++i) {
+		SDL_Thread *thread = SDL_CreateThread(worker_pool_thread, "worker", pool);
+		if (thread == NULL) {
+			SDL_LogWarn(0, "Can't create worker thread: %s", SDL_GetError());
+			break;
+		}
+		pool->threads[pool->threads_count++] = thread;
 	}
-	return true;
 }
 
-static inline bool get_frame_render_lines_numbers_rect(Ctx *ctx, Uint32 frame, SDL_FRect *bounds) {
-	get_frame_render_rect(ctx, frame, bounds);
-	bounds->w = ctx->font_width * 4;
-	bounds->y += SDL_max(0, ctx->frames[frame].scroll_interp.y);
-	bounds->h -= SDL_max(0, ctx->frames[frame].scroll_interp.y);
-	bounds->h = SDL_max(bounds->h, 0);
-	return true;
+#ifdef DEBUG_QUIT
+static void worker_pool_stop(Worker_Pool *pool) {
+	if (pool->lock != NULL) {
+		SDL_LockMutex(pool->lock);
+		pool->quit = true;
+		SDL_BroadcastCondition(pool->wake);
+		SDL_UnlockMutex(pool->lock);
+	}
+	for (Uint32 i = 0; i < pool->threads_count; ++i) {
+		SDL_WaitThread(pool->threads[i], NULL);
+	}
+	SDL_free(pool->threads);
+	SDL_DestroyCondition(pool->wake);
+	SDL_DestroyCondition(pool->done);
+	SDL_DestroyMutex(pool->lock);
+	*pool = (Worker_Pool){0};
 }
+#endif
 
-static inline int draw_text(Ctx *ctx, float x, float y, SDL_Color color, size_t text_length, const char text[text_length]) {
-	if (text == NULL) return 0;
-	SDL_Surface *surface = TTF_RenderText_Blended(ctx->font, text, text_length, color);
-	if (surface == NULL) {
-		SDL_LogWarn(0, "Can't render text |%.*s|: %s", (int)text_length, text, SDL_GetError());
-		return 0;
+// Runs job for every index in [0, count) on the pool and the calling thread, returns when all are done
+static void parallel_for(Ctx *ctx, Uint32 count, Parallel_Job job, void *userdata) {
+	Worker_Pool *pool = &ctx->pool;
+	worker_pool_start(pool);
+	Uint64 start = trace_begin();
+	if (pool->threads_count == 0 || count <= 1) {
+		for (Uint32 i = 0; i < count; ++i) {
+			Uint64 job_start = trace_begin();
+			job(userdata, i);
+			trace_end_arg("job", job_start, "index", i);
+		}
+		trace_end_arg("parallel_for", start, "jobs", count);
+		return;
 	}
-	SDL_assert(surface != NULL);
-	SDL_Texture *texture = SDL_CreateTextureFromSurface(ctx->renderer, surface);
-	SDL_assert(texture != NULL);
-	SDL_DestroySurface(surface);
-	SDL_FRect draw_pos = {
-		.x = SDL_floor(x),
-		.y = SDL_floor(y),
-		.w = texture->w,
-		.h = texture->h,
-	};
-#if 0
-#ifdef DEBUG
-	set_color_tinted(ctx, (SDL_Color[]){debug_red, debug_green, debug_blue}[ctx->draw_text_back_color], 0.4);
-	SDL_RenderFillRect(ctx->renderer, &draw_pos);
-	ctx->draw_text_back_color = (ctx->draw_text_back_color + 1) % 3;
-#endif
-#endif
-	SDL_RenderTexture(ctx->renderer, texture, NULL, &draw_pos);
-	int res = texture->w;
-	SDL_DestroyTexture(texture);
-#ifdef DEBUG
-	// Invalidate color
-	set_color(ctx, debug_purple);
-#endif
-	return res;
+	SDL_LockMutex(pool->lock);
+	pool->job = job;
+	pool->userdata = userdata;
+	pool->jobs_count = count;
+	SDL_SetAtomicInt(&pool->next_job, 0);
+	pool->generation += 1;
+	pool->open = true;
+	SDL_BroadcastCondition(pool->wake);
+	SDL_UnlockMutex(pool->lock);
+	worker_pool_drain(pool, job, userdata, count);
+	SDL_LockMutex(pool->lock);
+	pool->open = false;
+	while (pool->busy > 0) SDL_WaitCondition(pool->done, pool->lock);
+	SDL_UnlockMutex(pool->lock);
+	trace_end_arg("parallel_for", start, "jobs", count);
 }
 
-static inline int draw_text_fmt(Ctx *ctx, float x, float y, SDL_Color color, SDL_PRINTF_FORMAT_STRING const char *fmt, ...) SDL_PRINTF_VARARG_FUNC(5);
-static inline int draw_text_fmt(Ctx *ctx, float x, float y, SDL_Color color, SDL_PRINTF_FORMAT_STRING const char *fmt, ...) {
-	va_list ap;
-	va_start(ap, fmt);
-	if (SDL_strcmp(fmt, "%s") == 0) {
-		const char *str = va_arg(ap, const char *);
-		va_end(ap);
-		return draw_text(ctx, x, y, color, 0, str);
-	}
-	char *str = NULL;
-	const int rc = SDL_vasprintf(&str, fmt, ap);
-	va_end(ap);
-	if (rc == -1) {
-		SDL_LogWarn(0, "Can't allocate with vasprintf format |%s|", fmt);
-		return false;
-	}
-	int ret = draw_text(ctx, x, y, color, rc, str);
-	SDL_free(str);
-	return ret;
-}
+typedef struct Load_Chunk {
+	size_t begin;
+	size_t end;
+	size_t *starts; // Lines starting inside the chunk
+	size_t starts_count;
+	size_t starts_capacity;
+	size_t starts_offset; // Where starts go in the merged table
+	size_t utf8_begin; // Validated here, bytes around chunk borders are checked at merge
+	size_t utf8_end;
+	Uint32 head_columns; // Before the first '\n'
+	Uint32 tail_columns; // After the last '\n'
+	Uint32 longest_line; // Of lines fully inside the chunk
+	bool utf8_valid;
+	bool has_tabs;
+	bool has_zero;
+	bool failed;
+} Load_Chunk;
 
-static String get_vis_line(Ctx *ctx, SDL_FRect bounds, size_t text_size, char text[text_size], Uint32 linenum) {
-	if (text_size == 0) return (String){0};
-	size_t size = text_size;
-	char *begin = text;
-	float cur_line_width = 0;
-	while (linenum != 0) {
-		Uint32 cp = SDL_StepUTF8((const char **)&begin, &size);
-		if (cp == 0) return (String){0};
-		else if (cp == '\n') {
-			linenum -= 1;
-			cur_line_width = 0;
-			continue;
-		} else if (cp == '\t') cur_line_width += TAB_WIDTH * ctx->font_width;
-		else cur_line_width += ctx->font_width;
-		if (cur_line_width >= bounds.w) {
-			const char *next_char = begin;
-			size_t next_size = size;
-			Uint32 cp = SDL_StepUTF8((const char **)&next_char, &next_size);
-			if (cp != '\n') {
-				linenum -= 1;
-				cur_line_width = 0;
-			}
+typedef struct Load_Job {
+	const char *path; // NULL if text is already read
+	char *text;
+	size_t text_size;
+	Uint32 chunks_count;
+	Load_Chunk *chunks;
+	size_t *starts;
+} Load_Job;
+
+static void load_chunk_job(void *userdata, Uint32 index) {
+	Load_Job *load = userdata;
+	Load_Chunk *chunk = &load->chunks[index];
+	const char *text = load->text;
+	if (load->path != NULL) {
+		SDL_IOStream *io = SDL_IOFromFile(load->path, "rb");
+		size_t size = chunk->end - chunk->begin;
+		if (io == NULL || SDL_SeekIO(io, chunk->begin, SDL_IO_SEEK_SET) < 0
+			|| SDL_ReadIO(io, load->text + chunk->begin, size) != size) {
+			chunk->failed = true;
 		}
+		if (io != NULL) SDL_CloseIO(io);
+		if (chunk->failed) return;
 	}
-	text = begin;
-	cur_line_width = 0;
+	size_t pos = chunk->begin;
+	Uint32 columns = 0;
+	size_t chunk_columns = 0;
 	while (true) {
-		Uint32 cp = SDL_StepUTF8((const char **)&text, &size);
-		if (cp == 0) {
-			break;
-		}
-		else if (cp == '\n') {
-			text -= 1;
-			break;
+		size_t length = text_kernels->find_newline(text + pos, chunk->end - pos);
+		text_kernels->columns_prefix(text + pos, length, (Uint32)-1, &columns);
+		chunk_columns += columns;
+		pos += length;
+		if (pos >= chunk->end) break;
+		if (text[pos] == '\0') {
+			// Rest of the editor treats it as the end of text, so the index would lie
+			chunk->has_zero = true;
+			return;
 		}
-		else if (cp == '\t') cur_line_width += TAB_WIDTH * ctx->font_width;
-		else cur_line_width += ctx->font_width;
-		if (cur_line_width >= bounds.w) break;
-	}
-	return (String){.text = begin, .size = text - begin};
-}
-
-static Uint32 split_into_lines(Ctx *ctx, Uint32 strings_length, String strings[strings_length], char *text, Uint32 line_offset) {
-	(void)ctx;
-	Sint32 line = -line_offset;
-	if (text == NULL) {
-		if (line >= 0) {
-			strings[line] = (String) {
-				.size = 0,
-				.text = text,
-			};
-			return 1;
+		if (chunk->starts_count == 0) chunk->head_columns = columns;
+		else chunk->longest_line = SDL_max(chunk->longest_line, columns);
+		pos += 1;
+		if (chunk->starts_count >= chunk->starts_capacity) {
+			size_t new_cap = chunk->starts_capacity == 0 ? 1024 : chunk->starts_capacity * 2;
+			size_t *new_starts = SDL_realloc(chunk->starts, new_cap * sizeof *new_starts);
+			if (new_starts == NULL) {
+				chunk->failed = true;
+				return;
+			}
+			chunk->starts = new_starts;
+			chunk->starts_capacity = new_cap;
 		}
-		return 0;
+		chunk->starts[chunk->starts_count++] = pos;
 	}
-	char *end = text;
-	char *last = text - 1;
-	while (*end != '\0') {
-		if ((Sint32)strings_length <= line) break;
-		while (*end != '\0' && *end != '\n') end++;
-		if (line >= 0) {
-			strings[line] = (String) {
-				.size = end - text,
-				.text = text,
-			};
+	if (chunk->starts_count == 0) chunk->head_columns = columns;
+	chunk->tail_columns = columns;
+	// Sequences cut by chunk borders are left for the merge
+	chunk->utf8_begin = chunk->begin;
+	if (chunk->begin != 0) {
+		while (chunk->utf8_begin < SDL_min(chunk->end, chunk->begin + 3)
+			&& ((Uint8)text[chunk->utf8_begin] & 0xc0) == 0x80) {
+			chunk->utf8_begin += 1;
 		}
-		last = end;
-		line += 1;
-		if (*end == '\0') break;
-		end += 1;
-		text = end;
 	}
-	if ((Sint32)strings_length > line && last != end && line >= 0) {
-		strings[line] = (String) {
-			.size = end - text,
-			.text = text,
-		};
-		line += 1;
+	chunk->utf8_end = chunk->end;
+	for (size_t back = 1; back <= 3 && chunk->end - back >= chunk->utf8_begin && chunk->end - back > chunk->begin; ++back) {
+		Uint8 byte = text[chunk->end - back];
+		if (byte < 0x80) break;
+		if (byte < 0xc0) continue;
+		size_t length = byte >= 0xf0 ? 4 : byte >= 0xe0 ? 3 : 2;
+		if (length > back) chunk->utf8_end = chunk->end - back;
+		break;
 	}
-	return SDL_max(0, line);
-}
-
-static void frame_cursor_moved(Ctx *ctx, Uint32 framei) {
-	Frame *frame = &ctx->frames[framei];
-	SDL_assert(frame->taken);
-	Uint32 line = count_lines(ctx, frame->cursor, frame->buffer->text);
-	frame_scroll_to_line_centered(ctx, framei, line);
+	chunk->utf8_valid = text_kernels->utf8_validate(text + chunk->utf8_begin, chunk->utf8_end - chunk->utf8_begin);
+	// Without tabs every codepoint but the newlines is one column
+	chunk->has_tabs = chunk_columns + chunk->starts_count != text_kernels->utf8_length(text + chunk->begin, chunk->end - chunk->begin);
 }
 
-static void frame_beggining_line(Ctx *ctx, Uint32 frame) {
-	Uint32 cp;
-	Frame *current_frame = &ctx->frames[frame];
-	ctx->moving_col = false;
-	current_frame->scroll_lock = true;
-	const char *cur = current_frame->buffer->text + current_frame->cursor;
-	if (current_frame->buffer->text_size == 0) return;
-	do {
-		cp = SDL_StepBackUTF8(current_frame->buffer->text, &cur);
-	} while (cp != 0 && cp != '\n');
-	if (cp == '\n') SDL_StepUTF8(&cur, 0);
-	current_frame->cursor = cur - current_frame->buffer->text;
-	ctx->should_render = true;
+static void load_merge_job(void *userdata, Uint32 index) {
+	Load_Job *load = userdata;
+	Load_Chunk *chunk = &load->chunks[index];
+	if (chunk->starts_count > 0) {
+		SDL_memcpy(load->starts + chunk->starts_offset, chunk->starts, chunk->starts_count * sizeof *chunk->starts);
+	}
 }
 
-static void frame_beggining_spaced_line(Ctx *ctx, Uint32 frame) {
-	Uint32 cp;
-	Frame *current_frame = &ctx->frames[frame];
-	ctx->moving_col = false;
-	current_frame->scroll_lock = true;
-	const char *cur = current_frame->buffer->text + current_frame->cursor;
-	if (current_frame->buffer->text_size == 0) return;
-	do {
-		cp = SDL_StepBackUTF8(current_frame->buffer->text, &cur);
-	} while (cp != 0 && cp != '\n');
-	if (cp == '\n') {
-		cp = SDL_StepUTF8(&cur, 0);
+// Start of the codepoint cut by end, end if the last one is whole, looks at most 3 bytes back but not before begin
+static size_t utf8_cut(const char *text, size_t begin, size_t end) {
+	for (size_t back = 1; back <= 3 && back <= end - begin; ++back) {
+		Uint8 byte = text[end - back];
+		if (byte < 0x80) break;
+		if (byte < 0xc0) continue;
+		size_t length = byte >= 0xf0 ? 4 : byte >= 0xe0 ? 3 : 2;
+		if (length > back) return end - back;
+		break;
 	}
-	do {
-		cp = SDL_StepUTF8(&cur, 0);
-	} while (cp == ' ' || cp == '\t');
-	if (cp != 0) SDL_StepBackUTF8(current_frame->buffer->text, &cur);
-	current_frame->cursor = cur - current_frame->buffer->text;
-	ctx->should_render = true;
+	return end;
 }
 
-static void frame_end_line(Ctx *ctx, Uint32 frame) {
-	Uint32 cp;
-	Frame *current_frame = &ctx->frames[frame];
-	ctx->moving_col = false;
-	current_frame->scroll_lock = true;
-	const char *cur = current_frame->buffer->text + current_frame->cursor;
-	if (current_frame->buffer->text_size == 0) return;
-	do {
-		cp = SDL_StepUTF8(&cur, 0);
-	} while (cp != 0 && cp != '\n');
-	if (cp == '\n') cp = SDL_StepBackUTF8(current_frame->buffer->text, &cur);
-	current_frame->cursor = cur - current_frame->buffer->text;
-	ctx->should_render = true;
+// Splits text into chunks indexed on the worker pool, then glues their line tables with prefix sums
+static bool load_index_text(Ctx *ctx, Load_Job *load, Line_Index *index) {
+	load->chunks_count = (load->text_size + LOAD_CHUNK_SIZE - 1) / LOAD_CHUNK_SIZE;
+	load->chunks = SDL_calloc(SDL_max(load->chunks_count, 1), sizeof *load->chunks);
+	if (load->chunks == NULL) {
+		SDL_Log("Error, can't allocate load chunks");
+		return false;
+	}
+	for (Uint32 i = 0; i < load->chunks_count; ++i) {
+		load->chunks[i].begin = (size_t)i * LOAD_CHUNK_SIZE;
+		load->chunks[i].end = SDL_min(load->text_size, (size_t)(i + 1) * LOAD_CHUNK_SIZE);
+	}
+	parallel_for(ctx, load->chunks_count, load_chunk_job, load);
+	bool ok = true, has_zero = false;
+	size_t lines_count = 1;
+	*index = (Line_Index){.utf8_valid = true};
+	Uint32 carry = 0; // Columns of the line crossing into the next chunk
+	size_t utf8_checked = 0;
+	for (Uint32 i = 0; i < load->chunks_count; ++i) {
+		Load_Chunk *chunk = &load->chunks[i];
+		if (chunk->failed) ok = false;
+		if (chunk->has_zero) has_zero = true;
+		if (!ok || has_zero) continue;
+		chunk->starts_offset = lines_count;
+		lines_count += chunk->starts_count;
+		if (chunk->starts_count == 0) {
+			carry += chunk->head_columns;
+		} else {
+			index->longest_line = SDL_max(index->longest_line, SDL_max(carry + chunk->head_columns, chunk->longest_line));
+			carry = chunk->tail_columns;
+		}
+		index->has_tabs = index->has_tabs || chunk->has_tabs;
+		if (!chunk->utf8_valid
+			|| !text_kernels->utf8_validate(load->text + utf8_checked, chunk->utf8_begin - utf8_checked)) {
+			index->utf8_valid = false;
+		}
+		utf8_checked = chunk->utf8_end;
+	}
+	if (ok && !has_zero) {
+		// Appends measure a cut codepoint once it's whole
+		size_t cut = utf8_cut(load->text, 0, load->text_size);
+		if (cut < load->text_size) {
+			Uint32 cut_columns;
+			text_kernels->columns_prefix(load->text + cut, load->text_size - cut, (Uint32)-1, &cut_columns);
+			carry -= SDL_min(carry, cut_columns);
+		}
+		index->longest_line = SDL_max(index->longest_line, carry);
+		index->tail_columns = carry;
+		if (!text_kernels->utf8_validate(load->text + utf8_checked, load->text_size - utf8_checked)) {
+			index->utf8_valid = false;
+		}
+		index->utf8_checked = load->text_size;
+		load->starts = SDL_malloc(lines_count * sizeof *load->starts);
+		if (load->starts != NULL) {
+			load->starts[0] = 0;
+			parallel_for(ctx, load->chunks_count, load_merge_job, load);
+			index->starts = load->starts;
+			memory_retag(index->starts, Memory_Tag_layout);
+			index->lines_count = lines_count;
+			index->starts_capacity = lines_count;
+			index->valid = true;
+		}
+	}
+	if (has_zero) {
+		index->utf8_valid = text_kernels->utf8_validate(load->text, load->text_size);
+	}
+	for (Uint32 i = 0; i < load->chunks_count; ++i) {
+		SDL_free(load->chunks[i].starts);
+	}
+	SDL_free(load->chunks);
+	return ok;
 }
 
-static void frame_previous_char(Ctx *ctx, Uint32 frame) {
-	Frame *current_frame = &ctx->frames[frame];
-	ctx->moving_col = false;
-	current_frame->scroll_lock = true;
-	if (current_frame->buffer->text_size == 0) return;
-	const char *text = &current_frame->buffer->text[current_frame->cursor];
-	SDL_StepBackUTF8(current_frame->buffer->text, &text);
-	current_frame->cursor = text - current_frame->buffer->text;
-	ctx->should_render = true;
+static void buffer_drop_line_index(TextBuffer *buffer) {
+	if (!buffer->line_index.valid) return;
+	SDL_free(buffer->line_index.starts);
+	buffer->line_index = (Line_Index){0};
 }
 
-static void frame_next_char(Ctx *ctx, Uint32 frame) {
-	Frame *current_frame = &ctx->frames[frame];
-	ctx->moving_col = false;
-	current_frame->scroll_lock = true;
-	if (current_frame->buffer->text_size == 0) return;
-	const char *text = &current_frame->buffer->text[current_frame->cursor];
-	size_t len = current_frame->buffer->text_size - current_frame->cursor;
-	SDL_StepUTF8(&text, &len);
-	current_frame->cursor = text - current_frame->buffer->text;
-	ctx->should_render = true;
+static void syntax_cache_free(TextBuffer *buffer) {
+	SDL_free(buffer->syntax.states);
+	buffer->syntax = (Syntax_Cache){0};
 }
 
 static inline bool is_word_char(Uint32 ch) {
 	return SDL_isalnum(ch);
 }
 
-static void frame_delete_previous_char(Ctx *ctx, Uint32 framei, Undo_Group undo_group) {
-	Frame *frame = &ctx->frames[framei];
-	SDL_assert(frame->taken);
-	ctx->moving_col = false;
-	if (frame->cursor <= 0 || frame->buffer->text_size <= 0) return;
-	const char *current = frame->buffer->text + frame->cursor;
-	const char *previous = current;
-	SDL_StepBackUTF8(frame->buffer->text, &previous);
-	size_t diff = current - previous;
-	buffer_delete_text(ctx, (frame->buffer - ctx->buffers), frame->cursor - diff, frame->cursor, undo_group);
+// Identifiers, unlike is_word_char it takes '_' and UTF-8 bytes in, so completion and highlighting see the same words
+static inline bool syntax_word_char(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || (Uint8)c >= 0x80;
 }
 
-static void frame_delete_previous_word(Ctx *ctx, Uint32 framei, Undo_Group undo_group) {
-	Frame *frame = &ctx->frames[framei];
-	SDL_assert(frame->taken);
-	ctx->moving_col = false;
-	if (frame->cursor <= 0 || frame->buffer->text_size <= 0) return;
-	const char *current = frame->buffer->text + frame->cursor;
-	const char *previous = current;
-	Uint32 cp;
-	do {
-		cp = SDL_StepBackUTF8(frame->buffer->text, &previous);
-	} while (cp != 0 && !is_word_char(cp));
-	do {
-		cp = SDL_StepBackUTF8(frame->buffer->text, &previous);
-	} while (cp != 0 && is_word_char(cp));
-	if (cp != 0)
-		SDL_StepUTF8(&previous, 0);
-	size_t diff = current - previous;
-	buffer_delete_text(ctx, (frame->buffer - ctx->buffers), frame->cursor - diff, frame->cursor, undo_group);
+static inline size_t text_word_start(const char *text, size_t pos) {
+	while (pos > 0 && syntax_word_char(text[pos - 1])) pos -= 1;
+	return pos;
 }
 
-static void frame_forward_paragraph(Ctx *ctx, Uint32 frame) {
-	Frame *current_frame = &ctx->frames[frame];
-	SDL_assert(current_frame->taken);
-	ctx->moving_col = false;
-	current_frame->scroll_lock = true;
-	if (current_frame->buffer->text_size == 0) return;
-	const char *text = &current_frame->buffer->text[current_frame->cursor];
-	size_t len = current_frame->buffer->text_size - current_frame->cursor;
-	Uint32 prev_cp = 0;
-	Uint32 cp = 0;
-	while (true) {
-		cp = SDL_StepUTF8(&text, &len);
-		if (cp == 0 || (cp == '\n' && prev_cp == '\n')) break;
-		prev_cp = cp;
-	}
-	if (cp != 0)
-		SDL_StepBackUTF8(current_frame->buffer->text, &text);
-	current_frame->cursor = text - current_frame->buffer->text;
-	frame_cursor_moved(ctx, frame);
-	ctx->should_render = true;
+static inline size_t text_word_end(const char *text, size_t text_size, size_t pos) {
+	while (pos < text_size && syntax_word_char(text[pos])) pos += 1;
+	return pos;
 }
 
-static void frame_backward_paragraph(Ctx *ctx, Uint32 frame) {
-	Frame *current_frame = &ctx->frames[frame];
-	SDL_assert(current_frame->taken);
-	ctx->moving_col = false;
-	current_frame->scroll_lock = true;
-	if (current_frame->buffer->text_size == 0) return;
-	const char *text = &current_frame->buffer->text[current_frame->cursor];
-	Uint32 prev_cp = 0;
-	Uint32 cp = 0;
-	while (true) {
-		cp = SDL_StepBackUTF8(current_frame->buffer->text, &text);
-		if (cp == 0 || (cp == '\n' && prev_cp == '\n')) break;
-		prev_cp = cp;
+static Uint32 *words_slot(Word_Table *table, const char *text, Uint32 length, Uint32 hash) {
+	Uint32 mask = table->slots_capacity - 1;
+	for (Uint32 i = hash & mask;; i = (i + 1) & mask) {
+		Uint32 id = table->slots[i];
+		if (id == 0) return &table->slots[i];
+		const Word *word = &table->words[id];
+		if (word->hash == hash && word->length == length && SDL_memcmp(table->chars + word->offset, text, length) == 0) {
+			return &table->slots[i];
+		}
 	}
-	if (cp != 0)
-		SDL_StepUTF8(&text, 0);
-	current_frame->cursor = text - current_frame->buffer->text;
-	frame_cursor_moved(ctx, frame);
-	ctx->should_render = true;
-}
-
-static void frame_next_word(Ctx *ctx, Uint32 frame) {
-	Frame *current_frame = &ctx->frames[frame];
-	ctx->moving_col = false;
-	current_frame->scroll_lock = true;
-	if (current_frame->buffer->text_size == 0) return;
-	const char *text = &current_frame->buffer->text[current_frame->cursor];
-	size_t len = current_frame->buffer->text_size - current_frame->cursor;
-	Uint32 cp;
-	do {
-		cp = SDL_StepUTF8(&text, &len);
-	} while (cp != 0 && !is_word_char(cp));
-	do {
-		cp = SDL_StepUTF8(&text, &len);
-	} while (is_word_char(cp));
-	if (cp != 0)
-		SDL_StepBackUTF8(current_frame->buffer->text, &text);
-	current_frame->cursor = text - current_frame->buffer->text;
-	ctx->should_render = true;
-}
-
-static void frame_previous_word(Ctx *ctx, Uint32 frame) {
-	Frame *current_frame = &ctx->frames[frame];
-	ctx->moving_col = false;
-	current_frame->scroll_lock = true;
-	if (current_frame->buffer->text_size == 0) return;
-	const char *text = &current_frame->buffer->text[current_frame->cursor];
-	Uint32 cp;
-	do {
-		cp = SDL_StepBackUTF8(current_frame->buffer->text, &text);
-	} while (cp != 0 && !is_word_char(cp));
-	do {
-		cp = SDL_StepBackUTF8(current_frame->buffer->text, &text);
-	} while (is_word_char(cp));
-	if (cp != 0)
-		SDL_StepUTF8(&text, 0);
-	current_frame->cursor = text - current_frame->buffer->text;
-	ctx->should_render = true;
 }
 
-static void frame_previous_line(Ctx *ctx, Uint32 frame) {
-	Frame *current_frame = &ctx->frames[frame];
-	int row = 0;
-	current_frame->scroll_lock = true;
-	if (current_frame->buffer->text_size == 0) return;
-	const char *cur = current_frame->buffer->text + current_frame->cursor;
-	Uint32 cp = -1;
-	while (true) {
-		cp = SDL_StepBackUTF8(current_frame->buffer->text, &cur);
-		if (cp == '\n' || cp == 0) break;
-		if (cp == '\t') row += TAB_WIDTH;
-		else row += 1;
+static bool words_reserve(Word_Table *table, Uint32 length) {
+	if (table->words_count + 1 > table->words_capacity) {
+		Uint32 new_cap = table->words_capacity == 0 ? 1024 : table->words_capacity * 2;
+		Word *new_words = SDL_realloc(table->words, new_cap * sizeof *new_words);
+		if (new_words == NULL) return false;
+		memory_retag(new_words, Memory_Tag_layout);
+		table->words = new_words;
+		table->words_capacity = new_cap;
+		if (table->words_count == 0) table->words_count = 1;
 	}
-	if (cp == '\0') goto update_cursor;
-	do {
-		cp = SDL_StepBackUTF8(current_frame->buffer->text, &cur);
-	} while (cp != '\n' && cp != '\0');
-	if (cp == '\n') cp = SDL_StepUTF8(&cur, 0);
-	if (ctx->moving_col) row = ctx->last_row;
-	else ctx->last_row = row;
-	ctx->moving_col = true;
-	ctx->should_render = true;
-	while (row > 0) {
-		cp = SDL_StepUTF8(&cur, 0);
-		if (cp == '\n') {
-			cp = SDL_StepBackUTF8(current_frame->buffer->text, &cur);
-			break;
+	if (table->chars_size + length > table->chars_capacity) {
+		size_t new_cap = SDL_max(table->chars_capacity * 2, 0x4000);
+		char *new_chars = SDL_realloc(table->chars, new_cap);
+		if (new_chars == NULL) return false;
+		memory_retag(new_chars, Memory_Tag_layout);
+		table->chars = new_chars;
+		table->chars_capacity = new_cap;
+	}
+	if ((table->words_count + 1) * 4 > table->slots_capacity * 3) {
+		Uint32 new_cap = table->slots_capacity == 0 ? 2048 : table->slots_capacity * 2;
+		Uint32 *new_slots = SDL_calloc(new_cap, sizeof *new_slots);
+		if (new_slots == NULL) return false;
+		memory_retag(new_slots, Memory_Tag_layout);
+		Uint32 mask = new_cap - 1;
+		for (Uint32 id = 1; id < table->words_count; ++id) {
+			Uint32 i = table->words[id].hash & mask;
+			while (new_slots[i] != 0) i = (i + 1) & mask;
+			new_slots[i] = id;
 		}
-		if (cp == '\t') row -= TAB_WIDTH;
-		else row -= 1;
-	};
-update_cursor:
-	current_frame->cursor = cur - current_frame->buffer->text;
-	frame_cursor_moved(ctx, frame);
+		SDL_free(table->slots);
+		table->slots = new_slots;
+		table->slots_capacity = new_cap;
+	}
+	return true;
 }
 
-static void frame_next_line(Ctx *ctx, Uint32 frame) {
-	Frame *current_frame = &ctx->frames[frame];
-	int row = 0;
-	current_frame->scroll_lock = true;
-	if (current_frame->buffer->text_size == 0) return;
-	const char *cur = current_frame->buffer->text + current_frame->cursor;
-	Uint32 cp = -1;
-	while (true) {
-		cp = SDL_StepBackUTF8(current_frame->buffer->text, &cur);
-		if (cp == '\n' || cp == 0) break;
-		if (cp == '\t') row += TAB_WIDTH;
-		else row += 1;
+// Id of the word, 0 if it isn't there and add is false or the table can't take it
+static Uint32 words_intern(Word_Table *table, const char *text, Uint32 length, bool add) {
+	Uint32 hash = SDL_murmur3_32(text, length, 0);
+	if (table->slots_capacity > 0) {
+		Uint32 id = *words_slot(table, text, length, hash);
+		if (id != 0 || !add) return id;
+	} else if (!add) {
+		return 0;
 	}
-	if (cp == '\n') cp = SDL_StepUTF8(&cur, 0);
-	while (true) {
-		cp = SDL_StepUTF8(&cur, 0);
-		if (cp == '\n' || cp == 0) break;
+	if (table->words_count >= WORDS_MAX) return 0;
+	if (!words_reserve(table, length)) {
+		SDL_Log("Error, can't grow word table past %" SDL_PRIu32 " words", table->words_count);
+		return 0;
 	}
-	if (ctx->moving_col) row = ctx->last_row;
-	else ctx->last_row = row;
-	ctx->moving_col = true;
-	ctx->should_render = true;
-	while (row > 0) {
-		cp = SDL_StepUTF8(&cur, 0);
-		if (cp == '\n') {
-			cp = SDL_StepBackUTF8(current_frame->buffer->text, &cur);
-			break;
-		}
-		if (cp == '\t') row -= TAB_WIDTH;
-		else row -= 1;
+	Uint32 id = table->words_count++;
+	table->words[id] = (Word){
+		.offset = (Uint32)table->chars_size,
+		.length = length,
+		.hash = hash,
 	};
-	current_frame->cursor = cur - current_frame->buffer->text;
-	frame_cursor_moved(ctx, frame);
+	table->dead += 1;
+	SDL_memcpy(table->chars + table->chars_size, text, length);
+	table->chars_size += length;
+	*words_slot(table, text, length, hash) = id;
+	return id;
 }
 
-static Uint32 split_into_vis_lines(Ctx *ctx, SDL_FRect bounds, String line, Uint32 vislines_count, String vislines[vislines_count]) {
-	// TODO(c4llv07e): Make it use TTF_MeasureString
-	if (line.text == NULL || line.size <= 0) {
-		if (vislines_count > 0) {
-			vislines[0] = (String){0};
-			return 1;
-		}
-		return 0;
+static inline void words_count_add(Word_Table *table, Uint32 id, Sint32 delta) {
+	Word *word = &table->words[id];
+	if (word->count == 0 && delta > 0) table->dead -= 1;
+	word->count += delta;
+	if (word->count == 0 && delta < 0) table->dead += 1;
+}
+
+static Word_Count *buffer_words_slot(Word_Count *slots, Uint32 capacity, Uint32 word) {
+	Uint32 mask = capacity - 1;
+	for (Uint32 i = (word * 2654435761u) & mask;; i = (i + 1) & mask) {
+		if (slots[i].word == 0 || slots[i].word == word) return &slots[i];
 	}
-	if (vislines_count <= 0) return 0;
-	char *text = line.text;
-	size_t size = line.size;
-	float cur_line_width = 0;
-	Uint32 linenum = 1;
-	vislines[0].text = line.text;
-	vislines[0].size = line.size;
-	while (true) {
-		Uint32 cp = SDL_StepUTF8((const char **)&text, &size);
-		if (cp == 0) break;
-		if (cp == '\t') {
-			cur_line_width += TAB_WIDTH * ctx->font_width;
-		} else {
-			cur_line_width += ctx->font_width;
+}
+
+// Adds delta occurrences of the word to the buffer and to the merged table
+static void words_add(Ctx *ctx, TextBuffer *buffer, const char *text, Uint32 length, Sint32 delta) {
+	Buffer_Words *words = &buffer->words;
+	Uint32 id = words_intern(&ctx->words, text, length, delta > 0);
+	if (id == 0) return;
+	if (delta > 0 && (words->used + 1) * 4 > words->capacity * 3) {
+		Uint32 new_cap = words->capacity == 0 ? 256 : words->capacity * 2;
+		Word_Count *new_slots = SDL_calloc(new_cap, sizeof *new_slots);
+		if (new_slots == NULL) {
+			SDL_Log("Error, can't grow words of %s to %" SDL_PRIu32, buffer->name, new_cap);
+			return;
 		}
-		if (cur_line_width >= bounds.w) {
-			vislines[linenum - 1].size -= size;
-			if (linenum >= vislines_count) break;
-			if (size <= 0) break;
-			vislines[linenum].text = text;
-			vislines[linenum].size = size;
-			linenum += 1;
-			cur_line_width = 0;
+		memory_retag(new_slots, Memory_Tag_layout);
+		for (Uint32 i = 0; i < words->capacity; ++i) {
+			if (words->slots[i].word == 0) continue;
+			*buffer_words_slot(new_slots, new_cap, words->slots[i].word) = words->slots[i];
 		}
+		SDL_free(words->slots);
+		words->slots = new_slots;
+		words->capacity = new_cap;
+	}
+	if (words->capacity == 0) return;
+	Word_Count *slot = buffer_words_slot(words->slots, words->capacity, id);
+	if (slot->word == 0) {
+		// Never counted, the table was full when it was added
+		if (delta < 0) return;
+		slot->word = id;
+		words->used += 1;
+	}
+	if (delta < 0 && slot->count < (Uint32)-delta) delta = -(Sint32)slot->count;
+	slot->count += delta;
+	Word_Table *table = &ctx->words;
+	words_count_add(table, id, delta);
+	if (id <= table->sorted_count) {
+		Uint32 *block_max = &table->blocks_max[table->sorted_positions[id] / WORDS_BLOCK];
+		*block_max = SDL_max(*block_max, table->words[id].count);
 	}
-	return linenum;
 }
 
-static void render_line(Ctx *ctx, SDL_FRect bounds, SDL_FPoint *start, size_t text_size, const char text[text_size]) {
-	size_t accum = 0;
-	if (text_size == 0) {
-		start->x = bounds.x;
-		start->y += ctx->line_height;
+// Counts words in [begin, end) of the text, neither end is inside of a word
+static void words_scan(Ctx *ctx, TextBuffer *buffer, size_t begin, size_t end, Sint32 delta) {
+	const char *text = buffer->text;
+	size_t pos = begin;
+	while (pos < end) {
+		if (!syntax_word_char(text[pos])) {
+			pos += 1;
+			continue;
+		}
+		size_t start = pos;
+		pos = text_word_end(text, end, pos);
+		size_t length = pos - start;
+		// Numbers aren't worth completing
+		if (length >= WORDS_LENGTH_MIN && length <= WORDS_LENGTH_MAX && !SDL_isdigit((Uint8)text[start])) {
+			words_add(ctx, buffer, text + start, length, delta);
+		}
+	}
+}
+
+// Takes all words of the buffer out of the merged table, so it doesn't need the text
+static void buffer_words_free(Ctx *ctx, TextBuffer *buffer) {
+	Buffer_Words *words = &buffer->words;
+	for (Uint32 i = 0; i < words->capacity; ++i) {
+		if (words->slots[i].word != 0) words_count_add(&ctx->words, words->slots[i].word, -(Sint32)words->slots[i].count);
+	}
+	SDL_free(words->slots);
+	*words = (Buffer_Words){0};
+}
+
+// Before [from, to) of the text is replaced, takes out words touching it.
+// words_edit_done puts them back from the new text
+static void words_edit(Ctx *ctx, TextBuffer *buffer, size_t from, size_t to) {
+	Buffer_Words *words = &buffer->words;
+	words->edit_start = text_word_start(buffer->text, from);
+	words->edit_end = text_word_end(buffer->text, buffer->text_size, to);
+	words->edit_size = buffer->text_size;
+	if (words->edit_start >= words->indexed) return;
+	words_scan(ctx, buffer, words->edit_start, SDL_min(words->edit_end, words->indexed), -1);
+}
+
+static void words_edit_done(Ctx *ctx, TextBuffer *buffer) {
+	Buffer_Words *words = &buffer->words;
+	if (words->edit_start >= words->indexed) return;
+	if (words->edit_end > words->indexed) {
+		// Rest is left for words_index
+		words->indexed = words->edit_start;
 		return;
 	}
-	while (text_size > 0 && accum < text_size) {
-		if (text[accum] == '\t') {
-			if (accum != 0) {
-				int offset = draw_text(ctx, start->x, start->y, text_color, accum, text);
-				start->x += offset;
-			}
-			SDL_RenderTexture(ctx->renderer, ctx->tab_texture, NULL, &(SDL_FRect) {
-				.x = SDL_floor(start->x),
-				.y = SDL_floor(start->y),
-				.w = ctx->font_width * TAB_WIDTH,
-				.h = ctx->font_size,
-			});
-			start->x += ctx->font_width * TAB_WIDTH;
-			text += accum + 1;
-			text_size -= accum + 1;
-			accum = 0;
-		} else if (text[accum] == ' ') {
-			if (accum != 0) {
-				int offset = draw_text(ctx, start->x, start->y, text_color, accum, text);
-				start->x += offset;
-			}
-			SDL_RenderTexture(ctx->renderer, ctx->space_texture, NULL, &(SDL_FRect) {
-				.x = start->x,
-				.y = start->y,
-				.w = ctx->font_width,
-				.h = ctx->font_size,
-			});
-			start->x += ctx->font_width;
-			text += accum + 1;
-			text_size -= accum + 1;
-			accum = 0;
+	size_t edit_end = words->edit_end + buffer->text_size - words->edit_size;
+	words->indexed += buffer->text_size - words->edit_size;
+	words_scan(ctx, buffer, words->edit_start, edit_end, 1);
+}
+
+static int words_compare(void *userdata, const void *a, const void *b) {
+	const Word_Table *table = userdata;
+	const Word *word_a = &table->words[*(const Uint32 *)a];
+	const Word *word_b = &table->words[*(const Uint32 *)b];
+	int result = SDL_memcmp(table->chars + word_a->offset, table->chars + word_b->offset, SDL_min(word_a->length, word_b->length));
+	if (result != 0) return result;
+	return (int)word_a->length - (int)word_b->length;
+}
+
+// Sorts words added since the last merge and merges them into the sorted list
+static bool words_sort(Word_Table *table) {
+	Uint32 total = table->words_count - 1;
+	Uint32 added = total - table->sorted_count;
+	if (total > table->sorted_capacity) {
+		Uint32 new_cap = SDL_max(table->sorted_capacity * 2, total);
+		Uint32 *new_sorted = SDL_realloc(table->sorted, new_cap * sizeof *new_sorted);
+		if (new_sorted == NULL) return false;
+		memory_retag(new_sorted, Memory_Tag_layout);
+		table->sorted = new_sorted;
+		Uint32 *new_positions = SDL_realloc(table->sorted_positions, (new_cap + 1) * sizeof *new_positions);
+		if (new_positions == NULL) return false;
+		memory_retag(new_positions, Memory_Tag_layout);
+		table->sorted_positions = new_positions;
+		Uint32 *new_blocks = SDL_realloc(table->blocks_max, (new_cap / WORDS_BLOCK + 1) * sizeof *new_blocks);
+		if (new_blocks == NULL) return false;
+		memory_retag(new_blocks, Memory_Tag_layout);
+		table->blocks_max = new_blocks;
+		table->sorted_capacity = new_cap;
+	}
+	Uint32 *tail = SDL_malloc(added * sizeof *tail);
+	if (tail == NULL) return false;
+	for (Uint32 i = 0; i < added; ++i) tail[i] = table->sorted_count + 1 + i;
+	SDL_qsort_r(tail, added, sizeof *tail, words_compare, table);
+	// From the back, so nothing is overwritten before it's moved
+	Uint32 old = table->sorted_count, out = total;
+	while (added > 0) {
+		if (old > 0 && words_compare(table, &table->sorted[old - 1], &tail[added - 1]) > 0) {
+			table->sorted[--out] = table->sorted[--old];
 		} else {
-			accum += 1;
+			table->sorted[--out] = tail[--added];
 		}
 	}
-	if (accum != 0) {
-		draw_text(ctx, start->x, start->y, text_color, accum, text);
+	SDL_free(tail);
+	table->sorted_count = total;
+	SDL_memset(table->blocks_max, 0, (total / WORDS_BLOCK + 1) * sizeof *table->blocks_max);
+	for (Uint32 i = 0; i < total; ++i) {
+		Uint32 id = table->sorted[i];
+		table->sorted_positions[id] = i;
+		table->blocks_max[i / WORDS_BLOCK] = SDL_max(table->blocks_max[i / WORDS_BLOCK], table->words[id].count);
 	}
-	start->x = bounds.x;
-	start->y += ctx->line_height;
+	return true;
 }
 
-static void render_frame(Ctx *ctx, Uint32 frame) {
-	String lines[0x100];
-	String vislines[0x10] = {0};
-	Frame *draw_frame = &ctx->frames[frame];
-#ifdef DEBUG
-	ctx->draw_text_back_color = 0;
-#endif
-	char *text = draw_frame->buffer->text;
-	SDL_FRect bounds, lines_bounds, lines_numbers_bounds;
-	get_frame_render_rect(ctx, frame, &bounds);
-	get_frame_render_text_rect(ctx, frame, &lines_bounds);
-	get_frame_render_lines_numbers_rect(ctx, frame, &lines_numbers_bounds);
-	SDL_assert(SDL_arraysize(lines) >= (lines_bounds.h / ctx->line_height));
-	if (draw_frame->frame_type == Frame_Type_search) {
-		if (draw_frame->search_status == Search_Status_not_found) {
-			set_color(ctx, background_color_error);
-		} else {
-			SDL_SetRenderDrawColor(ctx->renderer, 0x12, 0x12, 0x12, SDL_ALPHA_OPAQUE);
+static void words_table_free(Word_Table *table) {
+	SDL_free(table->words);
+	SDL_free(table->slots);
+	SDL_free(table->chars);
+	SDL_free(table->sorted);
+	SDL_free(table->sorted_positions);
+	SDL_free(table->blocks_max);
+	*table = (Word_Table){0};
+}
+
+// Table of the words some buffer still has, with new ids in every buffer. Nothing changes if it runs out of memory
+static bool words_rebuild(Ctx *ctx) {
+	Word_Table *old = &ctx->words;
+	Uint64 start = trace_begin();
+	Word_Table table = {0};
+	Uint32 *ids = SDL_calloc(old->words_count, sizeof *ids);
+	Word_Count **slots = SDL_calloc(SDL_max(ctx->buffers_count, 1), sizeof *slots);
+	bool result = false;
+	if (ids == NULL || slots == NULL) goto exit;
+	for (Uint32 id = 1; id < old->words_count; ++id) {
+		const Word *word = &old->words[id];
+		if (word->count == 0) continue;
+		ids[id] = words_intern(&table, old->chars + word->offset, word->length, true);
+		if (ids[id] == 0) goto exit;
+		words_count_add(&table, ids[id], word->count);
+	}
+	if (table.words_count > 0 && !words_sort(&table)) goto exit;
+	for (Uint32 i = 0; i < ctx->buffers_count; ++i) {
+		const Buffer_Words *words = &ctx->buffers[i].words;
+		if (words->capacity == 0) continue;
+		slots[i] = SDL_calloc(words->capacity, sizeof *slots[i]);
+		if (slots[i] == NULL) goto exit;
+		memory_retag(slots[i], Memory_Tag_layout);
+	}
+	for (Uint32 i = 0; i < ctx->buffers_count; ++i) {
+		Buffer_Words *words = &ctx->buffers[i].words;
+		if (words->capacity == 0) continue;
+		words->used = 0;
+		for (Uint32 j = 0; j < words->capacity; ++j) {
+			const Word_Count *slot = &words->slots[j];
+			if (slot->word == 0 || slot->count == 0) continue;
+			*buffer_words_slot(slots[i], words->capacity, ids[slot->word]) = (Word_Count){ids[slot->word], slot->count};
+			words->used += 1;
+		}
+		SDL_free(words->slots);
+		words->slots = slots[i];
+		slots[i] = NULL;
+	}
+	trace_end_arg("rebuild words", start, "dropped", old->words_count - table.words_count);
+	words_table_free(old);
+	*old = table;
+	table = (Word_Table){0};
+	result = true;
+exit:
+	words_table_free(&table);
+	for (Uint32 i = 0; slots != NULL && i < ctx->buffers_count; ++i) SDL_free(slots[i]);
+	SDL_free(slots);
+	SDL_free(ids);
+	return result;
+}
+
+// Counts words of buffers a budget at a time, edits keep counted parts up to date
+static void words_index(Ctx *ctx) {
+	Word_Table *table = &ctx->words;
+	// Candidates of a completion in progress are ids
+	if (table->dead >= WORDS_DEAD_MIN && table->dead >= table->words_count / 4 && !ctx->completion.active && !words_rebuild(ctx)) {
+		SDL_LogWarn(0, "Can't rebuild word table of %" SDL_PRIu32 " words", table->words_count - 1);
+	}
+	size_t budget = WORDS_BUDGET;
+	for (Uint32 i = 0; i < ctx->buffers_count && budget > 0; ++i) {
+		TextBuffer *buffer = &ctx->buffers[i];
+		if (buffer->refcount <= 0 || buffer->prompt || buffer->text == NULL) continue;
+		Buffer_Words *words = &buffer->words;
+		if (words->indexed >= buffer->text_size) continue;
+		Uint64 start = trace_begin();
+		size_t end = SDL_min(buffer->text_size, words->indexed + budget);
+		end = text_word_end(buffer->text, buffer->text_size, end);
+		words_scan(ctx, buffer, words->indexed, end, 1);
+		budget -= SDL_min(budget, end - words->indexed);
+		trace_end_arg("index words", start, "bytes", end - words->indexed);
+		words->indexed = end;
+	}
+}
+
+// Keeps out sorted by count, the word goes in if it's among the first max
+static void words_rank(const Word_Table *table, Uint32 id, Uint32 prefix_length, Uint32 max, Uint32 *out, Uint32 *found) {
+	const Word *word = &table->words[id];
+	if (word->count == 0 || word->length <= prefix_length) return;
+	Uint32 i = *found;
+	while (i > 0 && table->words[out[i - 1]].count < word->count) i -= 1;
+	if (i >= max) return;
+	Uint32 moved = SDL_min(*found, max - 1) - i;
+	SDL_memmove(out + i + 1, out + i, moved * sizeof *out);
+	out[i] = id;
+	*found = SDL_min(*found + 1, max);
+}
+
+static inline bool words_has_prefix(const Word_Table *table, Uint32 id, const char *prefix, Uint32 length) {
+	const Word *word = &table->words[id];
+	return word->length >= length && SDL_memcmp(table->chars + word->offset, prefix, length) == 0;
+}
+
+// Up to max most frequent words longer than prefix that start with it, returns how many
+static Uint32 words_complete(Word_Table *table, const char *prefix, Uint32 length, Uint32 max, Uint32 *out) {
+	if (table->words_count == 0) return 0;
+	if (table->words_count - 1 - table->sorted_count > WORDS_UNSORTED_MAX && !words_sort(table)) {
+		SDL_LogWarn(0, "Can't sort %" SDL_PRIu32 " words, completion gets slower", table->words_count - 1);
+	}
+	Uint32 found = 0;
+	Uint32 low = 0, high = table->sorted_count;
+	while (low < high) {
+		Uint32 mid = low + (high - low) / 2;
+		const Word *word = &table->words[table->sorted[mid]];
+		int result = SDL_memcmp(table->chars + word->offset, prefix, SDL_min(word->length, length));
+		if (result < 0 || (result == 0 && word->length < length)) low = mid + 1;
+		else high = mid;
+	}
+	Uint32 i = low;
+	while (i < table->sorted_count) {
+		// Whole blocks of matches that can't beat the last candidate are skipped
+		Uint32 block_end = SDL_min((i / WORDS_BLOCK + 1) * WORDS_BLOCK, table->sorted_count);
+		if (i % WORDS_BLOCK == 0 && found == max && table->blocks_max[i / WORDS_BLOCK] <= table->words[out[max - 1]].count
+			&& words_has_prefix(table, table->sorted[block_end - 1], prefix, length)) {
+			i = block_end;
+			continue;
+		}
+		if (!words_has_prefix(table, table->sorted[i], prefix, length)) break;
+		words_rank(table, table->sorted[i], length, max, out, &found);
+		i += 1;
+	}
+	for (Uint32 id = table->sorted_count + 1; id < table->words_count; ++id) {
+		if (words_has_prefix(table, id, prefix, length)) words_rank(table, id, length, max, out, &found);
+	}
+	return found;
+}
+
+// Bracket << 1 with the low bit set for closing ones, -1 for other bytes
+static inline int bracket_kind(char c) {
+	switch (c) {
+	case '(': return Bracket_round << 1;
+	case ')': return Bracket_round << 1 | 1;
+	case '[': return Bracket_square << 1;
+	case ']': return Bracket_square << 1 | 1;
+	case '{': return Bracket_curly << 1;
+	case '}': return Bracket_curly << 1 | 1;
+	default: return -1;
+	}
+}
+
+static inline Uint32 mark_block_last(const Mark_Block *block) {
+	return block->base + block->offsets[block->count - 1];
+}
+
+static void marks_free(Mark_Set *set) {
+	for (Uint32 i = 0; i < set->blocks_count; ++i) SDL_free(set->blocks[i]);
+	SDL_free(set->blocks);
+	SDL_free(set->tree);
+	*set = (Mark_Set){0};
+}
+
+static void structure_free(TextBuffer *buffer) {
+	marks_free(&buffer->structure.paragraphs);
+	marks_free(&buffer->structure.brackets);
+	marks_free(&buffer->structure.states);
+	buffer->structure = (Buffer_Structure){0};
+}
+
+static bool mark_list_push(Mark_List *list, Uint32 pos, Uint8 kind) {
+	if (list->count == list->capacity) {
+		Uint32 new_cap = list->capacity == 0 ? 256 : list->capacity * 2;
+		Uint32 *new_positions = SDL_realloc(list->positions, new_cap * sizeof *new_positions);
+		if (new_positions == NULL) return false;
+		list->positions = new_positions;
+		Uint8 *new_kinds = SDL_realloc(list->kinds, new_cap * sizeof *new_kinds);
+		if (new_kinds == NULL) return false;
+		list->kinds = new_kinds;
+		list->capacity = new_cap;
+	}
+	list->positions[list->count] = pos;
+	list->kinds[list->count] = kind;
+	list->count += 1;
+	return true;
+}
+
+static void mark_list_free(Mark_List *list) {
+	SDL_free(list->positions);
+	SDL_free(list->kinds);
+	*list = (Mark_List){0};
+}
+
+// Bytes structure_scan stops at, the rest are skipped without a branch miss
+static const bool structure_bytes[256] = {
+	['\n'] = true,
+	['('] = true, [')'] = true,
+	['['] = true, [']'] = true,
+	['{'] = true, ['}'] = true,
+};
+
+// Marks of text in [from, to), a blank line is marked when its newline is in the range
+static bool structure_scan(const char *text, size_t from, size_t to, Mark_List *paragraphs, Mark_List *brackets) {
+	for (size_t i = from; i < to; ++i) {
+		if (!structure_bytes[(Uint8)text[i]]) continue;
+		if (text[i] == '\n') {
+			if (i > 0 && text[i - 1] == '\n' && !mark_list_push(paragraphs, i, 0)) return false;
+			continue;
+		}
+		int kind = bracket_kind(text[i]);
+		if (kind >= 0 && !mark_list_push(brackets, i, kind)) return false;
+	}
+	return true;
+}
+
+// Marks of the line at pos lexed from state, pos and state move to the next line. Brackets the lexer colors as strings
+// or comments aren't marked, except past SYNTAX_SPANS_MAX spans, where the colors stop
+static bool structure_lex_line(const Syntax *syntax, const char *text, size_t size, size_t *pos, Uint32 *state, Mark_List *paragraphs, Mark_List *brackets) {
+	size_t start = *pos;
+	size_t end = start + text_kernels->find_newline(text + start, size - start);
+	while (end < size && text[end] != '\n') end += 1 + text_kernels->find_newline(text + end + 1, size - end - 1);
+	if (start > 0 && end == start && end < size && !mark_list_push(paragraphs, end, 0)) return false;
+	Uint32 first = brackets->count;
+	for (size_t i = start; i < end; ++i) {
+		if (!structure_bytes[(Uint8)text[i]]) continue;
+		if (!mark_list_push(brackets, i, bracket_kind(text[i]))) return false;
+	}
+	Syntax_Spans spans = {.line = text + start};
+	*state = syntax->lex_line(*state, text + start, end - start, brackets->count > first ? &spans : NULL);
+	*pos = end < size ? end + 1 : size;
+	Uint32 kept = first, span = 0;
+	for (Uint32 i = first; i < brackets->count; ++i) {
+		Uint32 offset = brackets->positions[i] - start;
+		while (span + 1 < spans.count && spans.spans[span + 1].start <= offset) span += 1;
+		Syntax_Color color = spans.count > 0 && spans.spans[0].start <= offset ? spans.spans[span].color : Syntax_Color_text;
+		bool overflowed = spans.count == SYNTAX_SPANS_MAX && span + 1 == spans.count;
+		if (!overflowed && (color == Syntax_Color_string || color == Syntax_Color_comment)) continue;
+		brackets->positions[kept] = brackets->positions[i];
+		brackets->kinds[kept++] = brackets->kinds[i];
+	}
+	brackets->count = kept;
+	return true;
+}
+
+static void mark_block_fill(Mark_Block *block, Uint32 count, const Uint32 *positions, const Uint8 *kinds) {
+	block->base = positions[0];
+	block->count = count;
+	for (Uint32 i = 0; i < Bracket_count; ++i) {
+		block->depth[i] = 0;
+		block->depth_min[i] = 0;
+	}
+	for (Uint32 i = 0; i < count; ++i) {
+		block->offsets[i] = positions[i] - block->base;
+		block->kinds[i] = kinds[i];
+		// Kinds of other sets aren't brackets
+		Uint32 bracket = kinds[i] >> 1;
+		if (bracket >= Bracket_count) continue;
+		block->depth[bracket] += kinds[i] & 1 ? -1 : 1;
+		block->depth_min[bracket] = SDL_min(block->depth_min[bracket], block->depth[bracket]);
+	}
+}
+
+// Base of block b with the shifts on its path
+static Uint32 marks_block_base(const Mark_Set *set, Uint32 b) {
+	Uint32 base = set->blocks[b]->base;
+	for (Uint32 node = set->leaves + b; node > 0; node /= 2) base += set->tree[node].shift;
+	return base;
+}
+
+// First block with a mark at or after pos, blocks_count if there is none, base gets its base
+static Uint32 marks_block_after(const Mark_Set *set, Uint32 pos, Uint32 *base) {
+	if (set->blocks_count == 0 || set->tree[1].last < pos) return set->blocks_count;
+	Uint32 node = 1, shift = 0;
+	// Left children are never empty, right ones are only taken when the left one ends before pos
+	while (node < set->leaves) {
+		shift += set->tree[node].shift;
+		node *= 2;
+		if (set->tree[node].last + shift < pos) node += 1;
+	}
+	*base = set->blocks[node - set->leaves]->base + shift + set->tree[node].shift;
+	return node - set->leaves;
+}
+
+static inline void mark_node_shift(Mark_Node *node, Uint32 delta) {
+	node->shift += delta;
+	node->last += delta;
+}
+
+static void mark_node_pull(Mark_Set *set, Uint32 node, Uint32 mid) {
+	Mark_Node *parent = &set->tree[node];
+	const Mark_Node *left = &set->tree[2 * node];
+	const Mark_Node *right = &set->tree[2 * node + 1];
+	parent->last = (mid < set->blocks_count ? right->last : left->last) + parent->shift;
+	for (Uint32 i = 0; i < Bracket_count; ++i) {
+		parent->depth[i] = left->depth[i] + right->depth[i];
+		parent->depth_min[i] = SDL_min(left->depth_min[i], left->depth[i] + right->depth_min[i]);
+	}
+}
+
+// Leaf of block b after it was filled
+static void mark_node_leaf(Mark_Set *set, Uint32 b) {
+	Mark_Node *leaf = &set->tree[set->leaves + b];
+	*leaf = (Mark_Node){0};
+	if (b >= set->blocks_count) return;
+	const Mark_Block *block = set->blocks[b];
+	leaf->last = mark_block_last(block);
+	for (Uint32 i = 0; i < Bracket_count; ++i) {
+		leaf->depth[i] = block->depth[i];
+		leaf->depth_min[i] = block->depth_min[i];
+	}
+}
+
+// Adds the shifts on the paths of blocks [from, to) of the node's [lo, hi) to their bases
+static void marks_tree_push(Mark_Set *set, Uint32 node, Uint32 lo, Uint32 hi, Uint32 from, Uint32 to) {
+	if (hi <= from || lo >= to) return;
+	if (node >= set->leaves) {
+		if (lo < set->blocks_count) set->blocks[lo]->base += set->tree[node].shift;
+		set->tree[node].shift = 0;
+		return;
+	}
+	Uint32 mid = lo + (hi - lo) / 2;
+	mark_node_shift(&set->tree[2 * node], set->tree[node].shift);
+	mark_node_shift(&set->tree[2 * node + 1], set->tree[node].shift);
+	set->tree[node].shift = 0;
+	marks_tree_push(set, 2 * node, lo, mid, from, to);
+	marks_tree_push(set, 2 * node + 1, mid, hi, from, to);
+}
+
+// Reads blocks [from, to) again, after their shifts were pushed, and moves the ones after them by delta
+static void marks_tree_update(Mark_Set *set, Uint32 node, Uint32 lo, Uint32 hi, Uint32 from, Uint32 to, Uint32 delta) {
+	if (hi <= from) return;
+	if (lo >= to) {
+		mark_node_shift(&set->tree[node], delta);
+		return;
+	}
+	if (node >= set->leaves) {
+		mark_node_leaf(set, lo);
+		return;
+	}
+	Uint32 mid = lo + (hi - lo) / 2;
+	marks_tree_update(set, 2 * node, lo, mid, from, to, delta);
+	marks_tree_update(set, 2 * node + 1, mid, hi, from, to, delta);
+	mark_node_pull(set, node, mid);
+}
+
+// Moves the shifts of the nodes above the leaves down to them, so leaves can move with their blocks
+static void marks_tree_flatten(Mark_Set *set) {
+	for (Uint32 node = 1; node < set->leaves; ++node) {
+		mark_node_shift(&set->tree[2 * node], set->tree[node].shift);
+		mark_node_shift(&set->tree[2 * node + 1], set->tree[node].shift);
+		set->tree[node].shift = 0;
+	}
+}
+
+// Room for count leaves, the tree has to be flat
+static bool marks_tree_reserve(Mark_Set *set, Uint32 count) {
+	if (count <= set->leaves) return true;
+	Uint32 leaves = SDL_max(set->leaves, 1);
+	while (leaves < count) leaves *= 2;
+	Mark_Node *new_tree = SDL_malloc(2 * leaves * sizeof *new_tree);
+	if (new_tree == NULL) return false;
+	memory_retag(new_tree, Memory_Tag_layout);
+	SDL_memset(new_tree, 0, 2 * leaves * sizeof *new_tree);
+	if (set->tree != NULL) SDL_memcpy(&new_tree[leaves], &set->tree[set->leaves], set->leaves * sizeof *new_tree);
+	SDL_free(set->tree);
+	set->tree = new_tree;
+	set->leaves = leaves;
+	return true;
+}
+
+// Nodes above the leaves of a flat tree, a level at a time from the bottom
+static void marks_tree_fill(Mark_Set *set) {
+	for (Uint32 size = 2, first = set->leaves / 2; first > 0; size *= 2, first /= 2) {
+		for (Uint32 node = first; node < 2 * first; ++node) mark_node_pull(set, node, (node - first) * size + size / 2);
+	}
+}
+
+// Drops marks in [from, to], moves the ones after it by delta and puts the new ones, all inside of the edit, in between.
+// Only the blocks the edit touches are rewritten and the rest are shifted in O(log blocks). A block that overflows
+// splits into ones 3/4 full and blocks a quarter full merge, then the leaves move and the nodes above them are filled
+// again in O(blocks), so that's once every STRUCTURE_BLOCK / 4 marks put or dropped in them
+static bool marks_replace(Mark_Set *set, Uint32 from, Uint32 to, Sint64 delta, const Mark_List *added) {
+	Uint32 base = 0;
+	Uint32 first = marks_block_after(set, from, &base);
+	if (first == set->blocks_count && first > 0) first -= 1;
+	Uint32 last = first;
+	while (last < set->blocks_count && marks_block_base(set, last) <= to) last += 1;
+	// New marks between two blocks go to the front of the next one
+	if (last == first && first < set->blocks_count) last = first + 1;
+	Uint32 total = added->count;
+	for (Uint32 i = first; i < last; ++i) total += set->blocks[i]->count;
+	if (total == 0 && first == last) return true;
+	Uint32 *positions = SDL_malloc((total + 1) * sizeof *positions);
+	Uint8 *kinds = SDL_malloc(total + 1);
+	bool result = false;
+	if (positions == NULL || kinds == NULL) goto exit;
+	marks_tree_push(set, 1, 0, set->leaves, first, last);
+	Uint32 merged = 0;
+	for (Uint32 i = first; i < last; ++i) {
+		const Mark_Block *block = set->blocks[i];
+		for (Uint32 j = 0; j < block->count && block->base + block->offsets[j] < from; ++j) {
+			positions[merged] = block->base + block->offsets[j];
+			kinds[merged++] = block->kinds[j];
+		}
+	}
+	SDL_memcpy(positions + merged, added->positions, added->count * sizeof *positions);
+	SDL_memcpy(kinds + merged, added->kinds, added->count);
+	merged += added->count;
+	for (Uint32 i = first; i < last; ++i) {
+		const Mark_Block *block = set->blocks[i];
+		for (Uint32 j = 0; j < block->count; ++j) {
+			if (block->base + block->offsets[j] <= to) continue;
+			positions[merged] = block->base + block->offsets[j] + delta;
+			kinds[merged++] = block->kinds[j];
+		}
+	}
+	Uint32 old_pieces = last - first;
+	Uint32 pieces = old_pieces;
+	if (merged > pieces * STRUCTURE_BLOCK) {
+		pieces = (merged + STRUCTURE_BLOCK * 3 / 4 - 1) / (STRUCTURE_BLOCK * 3 / 4);
+	} else if (merged < pieces * (STRUCTURE_BLOCK / 4)) {
+		pieces = (merged + STRUCTURE_BLOCK / 2 - 1) / (STRUCTURE_BLOCK / 2);
+	}
+	if (pieces > old_pieces) {
+		Uint32 extra = pieces - old_pieces;
+		if (set->blocks_count + extra > set->blocks_capacity) {
+			Uint32 new_cap = SDL_max(set->blocks_capacity * 2, set->blocks_count + extra);
+			Mark_Block **new_blocks = SDL_realloc(set->blocks, new_cap * sizeof *new_blocks);
+			if (new_blocks == NULL) goto exit;
+			memory_retag(new_blocks, Memory_Tag_layout);
+			set->blocks = new_blocks;
+			set->blocks_capacity = new_cap;
 		}
+		marks_tree_flatten(set);
+		if (!marks_tree_reserve(set, set->blocks_count + extra)) goto exit;
+		Mark_Node *leaves = &set->tree[set->leaves];
+		SDL_memmove(&set->blocks[last + extra], &set->blocks[last], (set->blocks_count - last) * sizeof *set->blocks);
+		SDL_memmove(&leaves[last + extra], &leaves[last], (set->blocks_count - last) * sizeof *leaves);
+		set->blocks_count += extra;
+		for (Uint32 i = last; i < last + extra; ++i) {
+			set->blocks[i] = SDL_malloc(sizeof (Mark_Block));
+			if (set->blocks[i] == NULL) {
+				// Holes are fine for marks_free, the caller drops everything
+				SDL_memset(&set->blocks[i], 0, (last + extra - i) * sizeof *set->blocks);
+				goto exit;
+			}
+			memory_retag(set->blocks[i], Memory_Tag_layout);
+		}
+	} else if (pieces < old_pieces) {
+		marks_tree_flatten(set);
+		Mark_Node *leaves = &set->tree[set->leaves];
+		for (Uint32 i = first + pieces; i < last; ++i) SDL_free(set->blocks[i]);
+		SDL_memmove(&set->blocks[first + pieces], &set->blocks[last], (set->blocks_count - last) * sizeof *set->blocks);
+		SDL_memmove(&leaves[first + pieces], &leaves[last], (set->blocks_count - last) * sizeof *leaves);
+		set->blocks_count -= old_pieces - pieces;
+		SDL_memset(&leaves[set->blocks_count], 0, (old_pieces - pieces) * sizeof *leaves);
+	}
+	// Split evenly, so the next few edits fit without splitting again
+	for (Uint32 i = 0; i < pieces; ++i) {
+		Uint32 begin = (Uint64)merged * i / pieces;
+		Uint32 end = (Uint64)merged * (i + 1) / pieces;
+		mark_block_fill(set->blocks[first + i], end - begin, positions + begin, kinds + begin);
+	}
+	if (pieces == old_pieces) {
+		marks_tree_update(set, 1, 0, set->leaves, first, first + pieces, (Uint32)delta);
 	} else {
-		SDL_SetRenderDrawColor(ctx->renderer, 0x12, 0x12, 0x12, SDL_ALPHA_OPAQUE);
+		for (Uint32 i = first; i < first + pieces; ++i) mark_node_leaf(set, i);
+		for (Uint32 i = first + pieces; i < set->blocks_count; ++i) mark_node_shift(&set->tree[set->leaves + i], (Uint32)delta);
+		marks_tree_fill(set);
 	}
-	SDL_RenderFillRect(ctx->renderer, &(SDL_FRect) {
-		bounds.x,
-		bounds.y,
-		bounds.w,
-		bounds.h,
-	});
-	if (SDL_fabs(ctx->frames[frame].scroll_interp.y - ctx->frames[frame].scroll.y) >= 0.01) {
-		float speed = 10;
-		ctx->frames[frame].scroll_interp.y = lerp(ctx->frames[frame].scroll_interp.y, ctx->frames[frame].scroll.y, speed * ctx->deltatime);
-		ctx->should_render = true;
+	result = true;
+exit:
+	SDL_free(positions);
+	SDL_free(kinds);
+	return result;
+}
+
+// First mark at or after pos, (Uint32)-1 if there is none
+static Uint32 marks_next(const Mark_Set *set, Uint32 pos) {
+	Uint32 base = 0;
+	Uint32 b = marks_block_after(set, pos, &base);
+	if (b == set->blocks_count) return (Uint32)-1;
+	const Mark_Block *block = set->blocks[b];
+	Uint32 low = 0, high = block->count;
+	while (low < high) {
+		Uint32 mid = low + (high - low) / 2;
+		if (base + block->offsets[mid] < pos) low = mid + 1;
+		else high = mid;
 	}
-	Uint32 lines_count;
-	String offset_line = get_vis_line(ctx, bounds, draw_frame->buffer->text_size, draw_frame->buffer->text, SDL_max(0, -draw_frame->scroll_interp.y / ctx->line_height));
-	Uint32 linenum_offset = 0;
-	if (offset_line.text > text)
-		linenum_offset = count_lines(ctx, offset_line.text - text, text);
-	else if (offset_line.text == 0)
-		linenum_offset = count_lines(ctx, draw_frame->buffer->text_size, text);
-	lines_count = split_into_lines(ctx, SDL_arraysize(lines), lines, text, linenum_offset);
-	Uint32 selection_min = SDL_min(draw_frame->cursor, draw_frame->selection);
-	Uint32 selection_max = SDL_max(draw_frame->cursor, draw_frame->selection);
-	SDL_FPoint start = {lines_bounds.x, lines_bounds.y + SDL_fmod(SDL_min(0, draw_frame->scroll_interp.y), ctx->line_height)};
-	Uint32 linenum;
-	for (linenum = linenum_offset; linenum < lines_count + linenum_offset; ++linenum) {
-		String line = lines[linenum - linenum_offset];
-		Uint32 vislines_count = split_into_vis_lines(ctx, lines_bounds, line, SDL_arraysize(vislines), vislines);
-		if (draw_frame->line_prefix != NULL) {
-			Uint32 prefix_size = SDL_utf8strlen(draw_frame->line_prefix);
-			float prefix_width = prefix_size * ctx->font_width;
-			draw_text(ctx, start.x - prefix_width, start.y, prefix_color, prefix_size, draw_frame->line_prefix);
+	return base + block->offsets[low];
+}
+
+// Last mark before pos, (Uint32)-1 if there is none
+static Uint32 marks_previous(const Mark_Set *set, Uint32 pos) {
+	Uint32 base = 0;
+	Uint32 b = marks_block_after(set, pos, &base);
+	if (b == set->blocks_count || base >= pos) {
+		if (b == 0) return (Uint32)-1;
+		const Mark_Block *previous = set->blocks[b - 1];
+		return marks_block_base(set, b - 1) + previous->offsets[previous->count - 1];
+	}
+	const Mark_Block *block = set->blocks[b];
+	Uint32 low = 0, high = block->count;
+	while (low < high) {
+		Uint32 mid = low + (high - low) / 2;
+		if (base + block->offsets[mid] < pos) low = mid + 1;
+		else high = mid;
+	}
+	return base + block->offsets[low - 1];
+}
+
+// Whether there is a mark at pos, kind gets its kind
+static bool marks_at(const Mark_Set *set, Uint32 pos, Uint8 *kind) {
+	Uint32 base = 0;
+	Uint32 b = marks_block_after(set, pos, &base);
+	if (b == set->blocks_count) return false;
+	const Mark_Block *block = set->blocks[b];
+	Uint32 low = 0, high = block->count;
+	while (low < high) {
+		Uint32 mid = low + (high - low) / 2;
+		if (base + block->offsets[mid] < pos) low = mid + 1;
+		else high = mid;
+	}
+	if (base + block->offsets[low] != pos) return false;
+	*kind = block->kinds[low];
+	return true;
+}
+
+// Closing bracket at or after pos that no bracket opened after pos pairs with, (Uint32)-1 if it's unbalanced.
+// After the first block it goes up the tree to the first node that gets below the starting depth and down to its
+// block, so it scans at most two blocks that don't have it
+static Uint32 marks_close(const Mark_Set *set, Bracket bracket, Uint32 pos) {
+	Sint32 depth = 0;
+	Uint32 base = 0;
+	Uint32 b = marks_block_after(set, pos, &base);
+	while (b < set->blocks_count) {
+		const Mark_Block *block = set->blocks[b];
+		for (Uint32 i = 0; i < block->count; ++i) {
+			Uint32 mark = base + block->offsets[i];
+			if (mark < pos || block->kinds[i] >> 1 != bracket) continue;
+			if (!(block->kinds[i] & 1)) {
+				depth += 1;
+			} else if (depth == 0) {
+				return mark;
+			} else {
+				depth -= 1;
+			}
 		}
-		if (frame_has_line_numbers(ctx, frame)) {
-			if (start.y >= lines_bounds.y && (start.y + ctx->line_height) < lines_bounds.y + lines_bounds.h) {
-				draw_text_fmt(ctx, start.x - (lines_bounds.x - lines_numbers_bounds.x), start.y, line_number_color, "%u", linenum);
+		Uint32 node = set->leaves + b;
+		while (node > 1) {
+			if (node % 2 == 0) {
+				const Mark_Node *right = &set->tree[node + 1];
+				if (depth + right->depth_min[bracket] < 0) break;
+				depth += right->depth[bracket];
 			}
+			node /= 2;
 		}
-		for (Uint32 vislinenum = 0; vislinenum < vislines_count; ++vislinenum) {
-			String visline = vislines[vislinenum];
-#ifdef DEBUG_VISLINES
-			if (frame_has_line_numbers(ctx, frame)) {
-				if (start.y >= lines_bounds.y && (start.y + ctx->line_height) < lines_bounds.y + lines_bounds.h) {
-					draw_text_fmt(ctx, ctx->font_width * 2 + start.x - (lines_bounds.x - lines_numbers_bounds.x), start.y, debug_red, "%u", vislinenum);
-				}
+		if (node == 1) return (Uint32)-1;
+		node += 1;
+		while (node < set->leaves) {
+			node *= 2;
+			if (depth + set->tree[node].depth_min[bracket] >= 0) {
+				depth += set->tree[node].depth[bracket];
+				node += 1;
 			}
-#endif
-			if (start.y < lines_bounds.y) {
-				start.y += ctx->line_height;
-				continue;
+		}
+		b = node - set->leaves;
+		base = marks_block_base(set, b);
+	}
+	return (Uint32)-1;
+}
+
+// Opening bracket before pos that no bracket closed before pos pairs with, (Uint32)-1 if it's unbalanced
+static Uint32 marks_open(const Mark_Set *set, Bracket bracket, Uint32 pos) {
+	if (set->blocks_count == 0) return (Uint32)-1;
+	Sint32 depth = 0;
+	Uint32 base = 0;
+	Uint32 b = marks_block_after(set, pos, &base);
+	if (b == set->blocks_count) {
+		b -= 1;
+		base = marks_block_base(set, b);
+	}
+	while (true) {
+		const Mark_Block *block = set->blocks[b];
+		for (Uint32 i = block->count; i-- > 0;) {
+			Uint32 mark = base + block->offsets[i];
+			if (mark >= pos || block->kinds[i] >> 1 != bracket) continue;
+			if (block->kinds[i] & 1) {
+				depth += 1;
+			} else if (depth == 0) {
+				return mark;
+			} else {
+				depth -= 1;
 			}
-			if (start.y + ctx->line_height > lines_bounds.y + lines_bounds.h + 4) break;
-			if (visline.size == 0) {
-				visline.text = line.text; // duct tape to make pointer math work
+		}
+		// Highest depth of a node's suffixes is its depth minus the lowest of its prefixes
+		Uint32 node = set->leaves + b;
+		while (node > 1) {
+			if (node % 2 == 1) {
+				const Mark_Node *left = &set->tree[node - 1];
+				if (depth - (left->depth[bracket] - left->depth_min[bracket]) < 0) break;
+				depth -= left->depth[bracket];
 			}
-			if (((visline.text - text <= draw_frame->cursor) && (visline.text - text + visline.size >= draw_frame->cursor))) {
-				set_color(ctx, current_line_background_color);
-				SDL_FRect current_line_bounds = {
-					.x = start.x,
-					.y = start.y,
-					.w = lines_bounds.w,
-					.h = ctx->line_height,
-				};
-				SDL_RenderFillRect(ctx->renderer, &current_line_bounds);
-			} // end of current line highlight
-			if (draw_frame->active_selection) {
-				set_color(ctx, selection_color);
-				if ((visline.text + visline.size >= draw_frame->buffer->text + selection_min && visline.text <= draw_frame->buffer->text + selection_min) &&
-					(visline.text + visline.size >= draw_frame->buffer->text + selection_max && visline.text <= draw_frame->buffer->text + selection_max)) {
-					SDL_FRect selection_oneline_rect = {
-						.x = start.x + string_to_visual(ctx, SDL_min(visline.size, selection_min - (visline.text - text)), visline.text) * ctx->font_width,
-						.y = start.y,
-						.h = ctx->line_height,
-					};
-					selection_oneline_rect.w =
-						SDL_min((string_to_visual(ctx, SDL_min(visline.size, selection_max - (visline.text - text)), visline.text) * ctx->font_width)
-							- selection_oneline_rect.x + start.x,
-							lines_bounds.w - selection_oneline_rect.x + start.x);
-					if (selection_oneline_rect.x < start.x + lines_bounds.w) {
-						SDL_RenderFillRect(ctx->renderer, &selection_oneline_rect);
-					}
-				} else if (visline.text + visline.size >= draw_frame->buffer->text + selection_min && visline.text <= draw_frame->buffer->text + selection_min) {
-					SDL_FRect selection_min_rect = {
-						.x = start.x + string_to_visual(ctx, SDL_min(visline.size, selection_min - (visline.text - text)), visline.text) * ctx->font_width,
-						.y = start.y,
-						.h = ctx->line_height,
-					};
-					selection_min_rect.w = lines_bounds.w - selection_min_rect.x + start.x;
-					SDL_RenderFillRect(ctx->renderer, &selection_min_rect);
-				} else if (visline.text >= draw_frame->buffer->text + selection_min && visline.text + visline.size <= draw_frame->buffer->text + selection_max) {
-					SDL_FRect selection_intermediate_rect = {
-						.x = start.x,
-						.y = start.y,
-						.w = lines_bounds.w,
-						.h = ctx->line_height,
-					};
-					SDL_RenderFillRect(ctx->renderer, &selection_intermediate_rect);
-				} else if (visline.text + visline.size >= draw_frame->buffer->text + selection_max && visline.text <= draw_frame->buffer->text + selection_max) {
-					SDL_FRect selection_max_rect = {
-						.x = start.x,
-						.y = start.y,
-						.w = SDL_min(string_to_visual(ctx, SDL_min(visline.size, selection_max - (visline.text - text)), visline.text) * ctx->font_width, lines_bounds.w),
-						.h = ctx->line_height,
-					};
-					SDL_RenderFillRect(ctx->renderer, &selection_max_rect);
-				}
-			} // end of active selection
-			if (draw_frame->searching_mode && ctx->frames[draw_frame->search_frame].buffer->text_size > 0) {
-				const char *search_cursor = visline.text;
-				set_color(ctx, search_background_color);
-				while (true) {
-					search_cursor = SDL_strnstr(search_cursor, ctx->frames[draw_frame->search_frame].buffer->text, visline.text + visline.size - search_cursor);
-					if (search_cursor == NULL) break;
-					SDL_FRect search_hi_rect = {
-						.x = start.x + string_to_visual(ctx, search_cursor - visline.text, visline.text) * ctx->font_width,
-						.y = start.y,
-						.w = ctx->frames[draw_frame->search_frame].buffer->text_size * ctx->font_width,
-						.h = ctx->line_height,
-					};
-					search_hi_rect.w = SDL_min(search_hi_rect.w, lines_bounds.w - search_hi_rect.x + start.x);
-					if (search_hi_rect.x < start.x + lines_bounds.w) {
-						SDL_RenderFillRect(ctx->renderer, &search_hi_rect);
-					}
-					search_cursor += ctx->frames[draw_frame->search_frame].buffer->text_size;
-				}
-			} // end of searching mode
-			Sint32 hscroll = SDL_floor(draw_frame->scroll_interp.x / ctx->font_width);
-			SDL_FPoint line_start = start;
-			render_line(ctx, lines_bounds, &start, SDL_max(0, (Sint32)visline.size - hscroll), visline.text);
-			if (((visline.text - text <= draw_frame->selection) && (visline.text - text + visline.size >= draw_frame->selection))) {
-				SDL_FRect selection_rect = {
-					.x = line_start.x + string_to_visual(ctx, SDL_min(visline.size, draw_frame->selection - (visline.text - text)), visline.text) * ctx->font_width - draw_frame->scroll_interp.x,
-					.y = line_start.y,
-					.w = ctx->font_width,
-					.h = ctx->line_height,
-				};
-				if (selection_rect.x < start.x + lines_bounds.w) {
-					set_color(ctx, selection_rect_color);
-					SDL_RenderRect(ctx->renderer, &selection_rect);
+			node /= 2;
+		}
+		if (node == 1) return (Uint32)-1;
+		node -= 1;
+		while (node < set->leaves) {
+			node = 2 * node + 1;
+			const Mark_Node *right = &set->tree[node];
+			if (depth - (right->depth[bracket] - right->depth_min[bracket]) >= 0) {
+				depth -= right->depth[bracket];
+				node -= 1;
+			}
+		}
+		b = node - set->leaves;
+		base = marks_block_base(set, b);
+	}
+}
+
+static const Syntax *syntax_prepare(TextBuffer *buffer);
+
+// Lexes whole lines from the line start at pos until one at or after to, false if it ran out of memory. After an edit
+// that put text up to edit_end, it stops at the first line past it that starts with the state it had, or past the
+// indexed part
+static bool structure_lex_lines(TextBuffer *buffer, size_t *pos, size_t to, size_t edit_end, Mark_List *paragraphs, Mark_List *brackets, Mark_List *states) {
+	Buffer_Structure *structure = &buffer->structure;
+	Uint8 kind = 0;
+	marks_at(&structure->states, *pos, &kind);
+	Uint32 state = kind;
+	while (true) {
+		if (state != 0 && !mark_list_push(states, *pos, state)) return false;
+		if (*pos >= to || *pos == buffer->text_size) return true;
+		// Text after the line wasn't edited, so the state it had there means the marks it had
+		if (*pos > edit_end) {
+			if (*pos >= structure->built) return true;
+			kind = 0;
+			marks_at(&structure->states, *pos, &kind);
+			if (kind == state) return true;
+		}
+		if (!structure_lex_line(structure->syntax, buffer->text, buffer->text_size, pos, &state, paragraphs, brackets)) return false;
+	}
+}
+
+// After del_len bytes at from were replaced with in_len new ones, before structure_relex. Edits past the indexed part
+// change nothing
+static void structure_move(TextBuffer *buffer, size_t from, size_t del_len, size_t in_len) {
+	Buffer_Structure *structure = &buffer->structure;
+	if (buffer->prompt || from > structure->built) return;
+	if (syntax_prepare(buffer) != structure->syntax) {
+		structure_free(buffer);
+		return;
+	}
+	size_t to = from + del_len;
+	Sint64 delta = (Sint64)in_len - (Sint64)del_len;
+	// Rest of the indexed part moves, unless the edit went past it
+	size_t built = to < structure->built ? structure->built + delta : from + in_len;
+	Mark_List paragraphs = {0}, brackets = {0};
+	bool result;
+	if (structure->syntax == NULL) {
+		result = structure_scan(buffer->text, from, SDL_min(from + in_len + 1, built), &paragraphs, &brackets)
+			&& marks_replace(&structure->paragraphs, from, to, delta, &paragraphs)
+			&& marks_replace(&structure->brackets, from, to, delta, &brackets);
+	} else {
+		// Lines are marked again once all edits of a batch moved the marks, since they read the text of later ones.
+		// A line starting at from still starts with the same state
+		Mark_List states = {0};
+		Uint8 kind = 0;
+		result = (!marks_at(&structure->states, from, &kind) || mark_list_push(&states, from, kind))
+			&& marks_replace(&structure->paragraphs, from, to, delta, &paragraphs)
+			&& marks_replace(&structure->brackets, from, to, delta, &brackets)
+			&& marks_replace(&structure->states, from, to, delta, &states);
+		mark_list_free(&states);
+	}
+	mark_list_free(&paragraphs);
+	mark_list_free(&brackets);
+	if (!result) {
+		SDL_LogWarn(0, "Can't update structure of %s, indexing it again", buffer->name);
+		structure_free(buffer);
+		return;
+	}
+	structure->built = built;
+}
+
+// Marks lines of a buffer with a syntax again after structure_move of the edit that put [from, to)
+static void structure_relex(TextBuffer *buffer, size_t from, size_t to) {
+	Buffer_Structure *structure = &buffer->structure;
+	if (buffer->prompt || structure->syntax == NULL || from > structure->built) return;
+	size_t start = text_kernels->find_newline_back(buffer->text, from) + 1;
+	size_t pos = start;
+	Mark_List paragraphs = {0}, brackets = {0}, states = {0};
+	bool result = structure_lex_lines(buffer, &pos, SDL_SIZE_MAX, to, &paragraphs, &brackets, &states)
+		&& marks_replace(&structure->paragraphs, start, SDL_max(pos, start + 1) - 1, 0, &paragraphs)
+		&& marks_replace(&structure->brackets, start, SDL_max(pos, start + 1) - 1, 0, &brackets)
+		&& marks_replace(&structure->states, start, pos, 0, &states);
+	mark_list_free(&paragraphs);
+	mark_list_free(&brackets);
+	mark_list_free(&states);
+	if (!result) {
+		SDL_LogWarn(0, "Can't update structure of %s, indexing it again", buffer->name);
+		structure_free(buffer);
+		return;
+	}
+	structure->built = SDL_max(structure->built, pos);
+}
+
+static void structure_edit(TextBuffer *buffer, size_t from, size_t del_len, size_t in_len) {
+	structure_move(buffer, from, del_len, in_len);
+	structure_relex(buffer, from, from + in_len);
+}
+
+// Indexes up to budget more bytes, whole lines for buffers with a syntax. False if it ran out of memory
+static bool structure_build(TextBuffer *buffer, size_t budget) {
+	Buffer_Structure *structure = &buffer->structure;
+	const Syntax *syntax = syntax_prepare(buffer);
+	if (syntax != structure->syntax) {
+		structure_free(buffer);
+		structure->syntax = syntax;
+	}
+	size_t from = structure->built;
+	size_t to = from + SDL_min(budget, buffer->text_size - from);
+	if (from >= to) return true;
+	Uint64 start = trace_begin();
+	Mark_List paragraphs = {0}, brackets = {0}, states = {0};
+	bool result;
+	if (syntax == NULL) {
+		result = structure_scan(buffer->text, from, to, &paragraphs, &brackets);
+	} else {
+		size_t pos = from;
+		result = structure_lex_lines(buffer, &pos, to, SDL_SIZE_MAX, &paragraphs, &brackets, &states);
+		to = pos;
+	}
+	result = result
+		&& marks_replace(&structure->paragraphs, from, from, 0, &paragraphs)
+		&& marks_replace(&structure->brackets, from, from, 0, &brackets)
+		&& marks_replace(&structure->states, from, from, 0, &states);
+	mark_list_free(&paragraphs);
+	mark_list_free(&brackets);
+	mark_list_free(&states);
+	trace_end_arg("index structure", start, "bytes", to - from);
+	if (!result) {
+		structure_free(buffer);
+		return false;
+	}
+	structure->built = to;
+	return true;
+}
+
+// Indexes the rest of the text right away, for commands that need all of it
+static bool structure_ensure(TextBuffer *buffer) {
+	if (buffer->text == NULL || buffer->structure.built >= buffer->text_size) return true;
+	if (structure_build(buffer, buffer->text_size)) return true;
+	SDL_LogWarn(0, "Can't index structure of %s, not enough memory", buffer->name);
+	return false;
+}
+
+// Bracket at pos, or a closing one right before it, and its pair
+static bool structure_match(TextBuffer *buffer, Uint32 pos, Uint32 *open, Uint32 *close) {
+	Uint8 kind;
+	if (!marks_at(&buffer->structure.brackets, pos, &kind)) {
+		if (pos == 0 || !marks_at(&buffer->structure.brackets, pos - 1, &kind) || !(kind & 1)) return false;
+		pos -= 1;
+	}
+	if (kind & 1) {
+		*close = pos;
+		*open = marks_open(&buffer->structure.brackets, kind >> 1, pos);
+		return *open != (Uint32)-1;
+	}
+	*open = pos;
+	*close = marks_close(&buffer->structure.brackets, kind >> 1, pos + 1);
+	return *close != (Uint32)-1;
+}
+
+// Innermost bracket pair around pos
+static bool structure_enclosing(TextBuffer *buffer, Uint32 pos, Uint32 *open, Uint32 *close) {
+	Uint32 innermost = (Uint32)-1;
+	Bracket bracket = Bracket_round;
+	for (Bracket i = 0; i < Bracket_count; ++i) {
+		Uint32 found = marks_open(&buffer->structure.brackets, i, pos);
+		if (found != (Uint32)-1 && (innermost == (Uint32)-1 || found > innermost)) {
+			innermost = found;
+			bracket = i;
+		}
+	}
+	if (innermost == (Uint32)-1) return false;
+	*open = innermost;
+	*close = marks_close(&buffer->structure.brackets, bracket, innermost + 1);
+	return *close != (Uint32)-1;
+}
+
+// Indexes text appended after old_size, false if index has to be dropped
+static bool line_index_extend(Line_Index *index, const char *text, size_t old_size, size_t text_size) {
+	// Last line goes on from tail_columns. A codepoint cut by the end isn't measured until the append that finishes it
+	size_t pos = utf8_cut(text, 0, old_size);
+	size_t first = pos, first_line = index->lines_count;
+	size_t end = utf8_cut(text, first, text_size);
+	Uint32 columns = 0;
+	size_t appended_columns = 0;
+	while (true) {
+		size_t length = text_kernels->find_newline(text + pos, end - pos);
+		text_kernels->columns_prefix(text + pos, length, (Uint32)-1, &columns);
+		appended_columns += columns;
+		index->tail_columns += columns;
+		index->longest_line = SDL_max(index->longest_line, index->tail_columns);
+		pos += length;
+		if (pos >= end) break;
+		if (text[pos] == '\0') return false;
+		pos += 1;
+		if (index->lines_count >= index->starts_capacity) {
+			size_t new_cap = SDL_max(index->starts_capacity * 2, 1024);
+			size_t *new_starts = SDL_realloc(index->starts, new_cap * sizeof *new_starts);
+			if (new_starts == NULL) return false;
+			index->starts = new_starts;
+			index->starts_capacity = new_cap;
+		}
+		index->starts[index->lines_count++] = pos;
+		index->tail_columns = 0;
+	}
+	index->has_tabs = index->has_tabs
+		|| appended_columns + (index->lines_count - first_line) != text_kernels->utf8_length(text + first, end - first);
+	if (!index->utf8_valid) return true;
+	size_t utf8_end = utf8_cut(text, index->utf8_checked, text_size);
+	index->utf8_valid = text_kernels->utf8_validate(text + index->utf8_checked, utf8_end - index->utf8_checked);
+	index->utf8_checked = utf8_end;
+	return true;
+}
+
+// Replaces buffer text with the file, false if it can't be read
+static bool buffer_load_file(Ctx *ctx, TextBuffer *buffer, const char *path) {
+	Uint64 start = trace_begin();
+	SDL_IOStream *io = SDL_IOFromFile(path, "rb");
+	if (io == NULL) return false;
+	Sint64 size = SDL_GetIOSize(io);
+	SDL_CloseIO(io);
+	Load_Job load = {.path = path};
+	Line_Index index;
+	if (size >= 0) {
+		load.text_size = (size_t)size;
+		load.text = SDL_malloc(load.text_size + 1);
+		if (load.text == NULL) {
+			SDL_Log("Error, can't allocate %zu bytes for %s", load.text_size + 1, path);
+			return false;
+		}
+		load.text[load.text_size] = '\0';
+		if (!load_index_text(ctx, &load, &index)) {
+			// Changed under us or not seekable, read it in one go
+			SDL_free(load.text);
+			load.text = NULL;
+		}
+	}
+	if (load.text == NULL) {
+		load.path = NULL;
+		load.text = SDL_LoadFile(path, &load.text_size);
+		if (load.text == NULL) return false;
+		if (!load_index_text(ctx, &load, &index)) index = (Line_Index){0};
+	}
+	buffer_drop_line_index(buffer);
+	syntax_cache_free(buffer);
+	buffer_words_free(ctx, buffer);
+	structure_free(buffer);
+	SDL_free(buffer->text);
+	SDL_free(buffer->packed);
+	buffer->packed = NULL;
+	buffer->packed_size = 0;
+	buffer->text = load.text;
+	buffer->lost = false;
+	buffer->saved = true;
+	memory_retag(buffer->text, buffer_memory_tag(ctx, buffer));
+	buffer->text_size = load.text_size;
+	buffer->text_capacity = load.text_size;
+	buffer->line_index = index;
+	trace_end_arg("load file", start, "bytes", load.text_size);
+	return true;
+}
+
+static bool buffer_save_file(TextBuffer *buffer, const char *path) {
+	if (buffer->lost) return SDL_SetError("text of %s was lost, open the file again", buffer->name);
+	Uint64 start = trace_begin();
+	bool saved = SDL_SaveFile(path, buffer->text, buffer->text_size);
+	trace_end_arg("save file", start, "bytes", buffer->text_size);
+	if (saved) buffer->saved = true;
+	return saved;
+}
+
+static inline bool frame_has_line_numbers(Ctx *ctx, Uint32 frame) {
+	return (ctx->frames[frame].frame_type == Frame_Type_memory
+		|| ctx->frames[frame].frame_type == Frame_Type_file);
+}
+
+static inline bool frame_is_multiline(Ctx *ctx, Uint32 frame) {
+	return (ctx->frames[frame].frame_type == Frame_Type_memory
+		|| ctx->frames[frame].frame_type == Frame_Type_file);
+}
+
+static inline Uint32 reverse_sorted_index(Ctx *ctx, Uint32 sorted_ind) {
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		if (ctx->sorted_frames[i] == sorted_ind) return i;
+	}
+	SDL_assert(!"Sorted index out of bounds");
+	return -1;
+}
+
+static inline void undo_op_free(Undo_Operation *op) {
+	SDL_free(op->data);
+	SDL_free(op->edits);
+	SDL_free(op->ins_data);
+	*op = (Undo_Operation){0};
+}
+
+static void undo_clear_after_cursor(Ctx *ctx, Uint32 buffer) {
+	SDL_assert(ctx->buffers[buffer].refcount > 0);
+	TextBuffer *buf = &ctx->buffers[buffer];
+	for (Uint32 i = buf->undos_cursor; i < buf->undos_size; ++i) {
+		undo_op_free(&buf->undos[i]);
+	}
+	buf->undos_size = buf->undos_cursor;
+}
+
+// Unlike undo_clear_after_cursor, works on released buffers too
+static void buffer_free_undos(TextBuffer *buffer) {
+	for (size_t i = 0; i < buffer->undos_size; ++i) {
+		undo_op_free(&buffer->undos[i]);
+	}
+	buffer->undos_size = 0;
+	buffer->undos_cursor = 0;
+}
+
+typedef struct Buffer_Memory {
+	size_t text; // Packed size for packed buffers
+	size_t undo;
+	size_t index;
+} Buffer_Memory;
+
+// Counted from the buffer itself, so it works without DEBUG_MEMORY
+static Buffer_Memory buffer_memory(const TextBuffer *buffer) {
+	Buffer_Memory memory = {
+		.text = buffer->text_capacity + buffer->packed_size,
+		.index = buffer->line_index.starts_capacity * sizeof *buffer->line_index.starts,
+	};
+	for (size_t i = 0; i < buffer->undos_size; ++i) {
+		const Undo_Operation *op = &buffer->undos[i];
+		if (op->type != Undo_Type_batch) {
+			memory.undo += op->len;
+			continue;
+		}
+		// Edits share bytes, so it's where the data ends, not the sum of lengths
+		size_t del_end = 0, ins_end = 0;
+		for (Uint32 e = 0; e < op->edits_count; ++e) {
+			del_end = SDL_max(del_end, (size_t)op->edits[e].del_off + op->edits[e].del_len);
+			ins_end = SDL_max(ins_end, (size_t)op->edits[e].ins_off + op->edits[e].ins_len);
+		}
+		memory.undo += op->edits_count * sizeof *op->edits + del_end + ins_end;
+	}
+	return memory;
+}
+
+// Merges multi-cursor typing (or deleting) into the previous batch, the same way
+// push_undo_op glues single cursor inserts. Only batches touching the same cursors do.
+static bool undo_batch_coalesce(Undo_Operation *prev_op, const Undo_Operation *op) {
+	if (prev_op->edits_count != op->edits_count) return false;
+	Uint32 count = op->edits_count;
+	bool inserts = true, deletes = true;
+	for (Uint32 i = 0; i < count; ++i) {
+		if (op->edits[i].del_len != 0 || prev_op->edits[i].del_len != 0) inserts = false;
+		if (op->edits[i].ins_len != 0 || prev_op->edits[i].ins_len != 0) deletes = false;
+	}
+	if (inserts == deletes) return false;
+	// Position of the previous edit after the previous batch was applied
+	Sint64 shift = 0;
+	size_t data_size = 0;
+	for (Uint32 i = 0; i < count; ++i) {
+		const Buffer_Edit *pe = &prev_op->edits[i], *e = &op->edits[i];
+		if (inserts) {
+			if (e->pos != pe->pos + shift + pe->ins_len) return false;
+			char last = prev_op->ins_data[pe->ins_off + pe->ins_len - 1];
+			if ((op->ins_data[e->ins_off] == '\n') != (last == '\n')) return false;
+			shift += pe->ins_len;
+			data_size += pe->ins_len + e->ins_len;
+		} else {
+			if (e->pos + e->del_len != pe->pos + shift) return false;
+			shift -= pe->del_len;
+			data_size += pe->del_len + e->del_len;
+		}
+	}
+	char *data = SDL_malloc(SDL_max(data_size, 1));
+	if (data == NULL) return false;
+	memory_retag(data, Memory_Tag_undo);
+	size_t off = 0;
+	shift = 0;
+	for (Uint32 i = 0; i < count; ++i) {
+		Buffer_Edit *pe = &prev_op->edits[i];
+		const Buffer_Edit *e = &op->edits[i];
+		if (inserts) {
+			SDL_memcpy(data + off, prev_op->ins_data + pe->ins_off, pe->ins_len);
+			SDL_memcpy(data + off + pe->ins_len, op->ins_data + e->ins_off, e->ins_len);
+			pe->ins_off = off;
+			pe->ins_len += e->ins_len;
+			off += pe->ins_len;
+		} else {
+			SDL_memcpy(data + off, op->data + e->del_off, e->del_len);
+			SDL_memcpy(data + off + e->del_len, prev_op->data + pe->del_off, pe->del_len);
+			pe->pos -= e->del_len;
+			pe->del_off = off;
+			pe->del_len += e->del_len;
+			off += pe->del_len;
+		}
+	}
+	if (inserts) {
+		SDL_free(prev_op->ins_data);
+		prev_op->ins_data = data;
+	} else {
+		SDL_free(prev_op->data);
+		prev_op->data = data;
+	}
+	return true;
+}
+
+// I will kill myself if one of the ops data won't be allocated with SDL_malloc
+static void push_undo_op(Ctx *ctx, Uint32 buffer, Undo_Operation op) {
+	SDL_assert(ctx->buffers[buffer].refcount > 0);
+	TextBuffer *buf = &ctx->buffers[buffer];
+	memory_retag(op.data, Memory_Tag_undo);
+	memory_retag(op.edits, Memory_Tag_undo);
+	memory_retag(op.ins_data, Memory_Tag_undo);
+	if (ctx->macro_replaying && ctx->macro_buffer == buffer) {
+		// The whole replay is pushed as one op when it ends
+		undo_op_free(&op);
+		return;
+	}
+	if (buf->undos_cursor > 0) {
+		Undo_Operation *prev_op = &buf->undos[buf->undos_cursor - 1];
+		if (op.type == Undo_Type_insert) {
+			if (op.type == prev_op->type && op.pos == (prev_op->pos + prev_op->len)) {
+				if ((op.data[0] == '\n') == (prev_op->data[prev_op->len - 1] == '\n')) {
+					undo_clear_after_cursor(ctx, buffer);
+					prev_op->data = SDL_realloc(prev_op->data, prev_op->len + op.len);
+					SDL_assert(prev_op->data != NULL);
+					SDL_memcpy(prev_op->data + prev_op->len, op.data, op.len);
+					SDL_free(op.data);
+					prev_op->len += op.len;
+					return;
 				}
-			} // end of selection cursor
-			if (((visline.text - text <= draw_frame->cursor) && (visline.text - text + visline.size >= draw_frame->cursor))) {
-				Uint32 visual_x = string_to_visual(ctx, SDL_min(visline.size, draw_frame->cursor - (visline.text - text)), visline.text) * ctx->font_width - draw_frame->scroll_interp.x;
-				SDL_FPoint actual_cursor_pos = {
-					.x = line_start.x + SDL_fmod(visual_x, lines_bounds.w),
-					.y = line_start.y + SDL_floor(visual_x / lines_bounds.w) * ctx->line_height,
-				};
-				float speed = 30;
-				Uint32 width = 2;
-				if (ctx->focused_frame == frame &&
-					(((SDL_fabs(actual_cursor_pos.x - ctx->active_cursor_pos.x) >= 0.01) ||
-					(SDL_fabs(actual_cursor_pos.y - ctx->active_cursor_pos.y) >= 0.01)))) {
-					width = SDL_max(width, SDL_log(SDL_abs(ctx->active_cursor_pos.x - lerp(ctx->active_cursor_pos.x, actual_cursor_pos.x, speed * ctx->deltatime))) * 2);
-					ctx->active_cursor_pos.x = lerp(ctx->active_cursor_pos.x, actual_cursor_pos.x, SDL_min(1, speed * ctx->deltatime));
-					ctx->active_cursor_pos.y = lerp(ctx->active_cursor_pos.y, actual_cursor_pos.y, SDL_min(1, speed * ctx->deltatime));
-					ctx->should_render = true;
+			}
+		} else if (op.type == Undo_Type_delete) {
+			if (op.type == prev_op->type && (op.pos + op.len) == prev_op->pos) {
+				undo_clear_after_cursor(ctx, buffer);
+				op.data = SDL_realloc(op.data, op.len + prev_op->len);
+				SDL_assert(op.data != NULL);
+				SDL_memcpy(op.data + op.len, prev_op->data, prev_op->len);
+				SDL_free(prev_op->data);
+				prev_op->data = op.data;
+				prev_op->pos = op.pos;
+				prev_op->len += op.len;
+				return;
+			}
+		} else if (op.type == Undo_Type_batch) {
+			if (op.type == prev_op->type && op.group == prev_op->group && undo_batch_coalesce(prev_op, &op)) {
+				undo_clear_after_cursor(ctx, buffer);
+				undo_op_free(&op);
+				return;
+			}
+		}
+	}
+	if (buf->undos_cursor >= UNDO_RING_SIZE) {
+		undo_op_free(&buf->undos[0]);
+		SDL_memmove(buf->undos, buf->undos + 1, (UNDO_RING_SIZE - 1) * sizeof *buf->undos);
+		buf->undos_cursor -= 1;
+	}
+	// [][]
+	// SIZE = 2
+	// | 0
+	//   | 1
+	//     | 2
+	buf->undos[buf->undos_cursor] = op;
+	buf->undos_cursor += 1;
+	undo_clear_after_cursor(ctx, buffer);
+}
+
+static inline bool is_space_only(Ctx *ctx, size_t text_length, const char text[text_length]) {
+	(void) ctx;
+	return text_kernels->is_blank(text, text_length);
+}
+
+static inline void set_color(Ctx *ctx, SDL_Color color) {
+	SDL_SetRenderDrawColor(ctx->renderer, color.r, color.g, color.b, color.a);
+}
+
+static inline void set_color_tinted(Ctx *ctx, SDL_Color color, float tint) {
+	SDL_SetRenderDrawColor(ctx->renderer, color.r * tint, color.g * tint, color.b * tint, color.a * tint);
+}
+
+static Uint32 buffer_count_lines(Ctx *ctx, TextBuffer *buffer, size_t pos);
+static inline size_t text_line_start(const char *text, size_t pos);
+
+static inline void syntax_span(Syntax_Spans *spans, size_t offset, Syntax_Color color) {
+	if (spans == NULL) return;
+	if (spans->count > 0) {
+		Syntax_Span *last = &spans->spans[spans->count - 1];
+		if (last->color == color) return;
+		if (last->start == offset) {
+			last->color = color;
+			if (spans->count > 1 && spans->spans[spans->count - 2].color == color) spans->count -= 1;
+			return;
+		}
+	}
+	if (spans->count >= SYNTAX_SPANS_MAX) return;
+	spans->spans[spans->count++] = (Syntax_Span){.start = offset, .color = color};
+}
+
+static inline bool syntax_word_in(const char *word, size_t length, Uint32 words_count, const char *const words[words_count]) {
+	for (Uint32 i = 0; i < words_count; ++i) {
+		if (words[i][0] == word[0] && SDL_strncmp(words[i], word, length) == 0 && words[i][length] == '\0') return true;
+	}
+	return false;
+}
+
+typedef enum {
+	Syntax_C_code,
+	Syntax_C_comment, // Inside of /* */
+	Syntax_C_directive, // Continued with a backslash
+	Syntax_C_string, // Continued with a backslash
+} Syntax_C_State;
+
+static const char *const syntax_c_keywords[] = {
+	"break", "case", "const", "continue", "default", "do", "else", "enum", "extern", "for", "goto", "if",
+	"inline", "register", "restrict", "return", "sizeof", "static", "struct", "switch", "typedef", "union",
+	"volatile", "while", "_Alignas", "_Alignof", "_Static_assert", "_Thread_local", "true", "false", "NULL",
+};
+
+static const char *const syntax_c_types[] = {
+	"bool", "char", "double", "float", "int", "long", "short", "signed", "unsigned", "void", "_Bool", "auto",
+	"Uint8", "Uint16", "Uint32", "Uint64", "Sint8", "Sint16", "Sint32", "Sint64",
+};
+
+// Just after */, SDL_SIZE_MAX if the comment isn't closed on this line
+static inline size_t syntax_c_comment_end(const char *text, size_t size, size_t from) {
+	for (size_t i = from; i + 1 < size; ++i) {
+		if (text[i] == '*' && text[i + 1] == '/') return i + 2;
+	}
+	return SDL_SIZE_MAX;
+}
+
+// End of a string or character literal that starts at quote, size if it isn't closed on this line
+static inline size_t syntax_c_literal_end(const char *text, size_t size, size_t quote) {
+	for (size_t i = quote + 1; i < size; ++i) {
+		if (text[i] == '\\') i += 1;
+		else if (text[i] == text[quote]) return i + 1;
+	}
+	return size;
+}
+
+static Uint32 syntax_c_line(Uint32 state, const char *text, size_t size, Syntax_Spans *spans) {
+	bool directive = state == Syntax_C_directive;
+	Syntax_Color base = directive ? Syntax_Color_preprocessor : Syntax_Color_text;
+	bool continued = size > 0 && text[size - 1] == '\\';
+	size_t i = 0;
+	if (state == Syntax_C_comment) {
+		syntax_span(spans, 0, Syntax_Color_comment);
+		i = syntax_c_comment_end(text, size, 0);
+		if (i == SDL_SIZE_MAX) return Syntax_C_comment;
+	} else if (state == Syntax_C_string) {
+		syntax_span(spans, 0, Syntax_Color_string);
+		for (; i < size && text[i] != '"'; ++i) {
+			if (text[i] == '\\') i += 1;
+		}
+		if (i >= size) return continued ? Syntax_C_string : Syntax_C_code;
+		i += 1;
+	}
+	syntax_span(spans, i, base);
+	while (i < size) {
+		char c = text[i];
+		if (c == '/' && i + 1 < size && text[i + 1] == '/') {
+			syntax_span(spans, i, Syntax_Color_comment);
+			return Syntax_C_code;
+		} else if (c == '/' && i + 1 < size && text[i + 1] == '*') {
+			syntax_span(spans, i, Syntax_Color_comment);
+			size_t end = syntax_c_comment_end(text, size, i + 2);
+			if (end == SDL_SIZE_MAX) return Syntax_C_comment;
+			i = end;
+			syntax_span(spans, i, base);
+		} else if (c == '"' || c == '\'') {
+			syntax_span(spans, i, Syntax_Color_string);
+			size_t end = syntax_c_literal_end(text, size, i);
+			if (end >= size && c == '"' && continued) return Syntax_C_string;
+			i = end;
+			syntax_span(spans, i, base);
+		} else if (c == '#' && !directive) {
+			size_t indent = 0;
+			while (indent < i && (text[indent] == ' ' || text[indent] == '\t')) indent += 1;
+			directive = indent == i;
+			if (directive) base = Syntax_Color_preprocessor;
+			syntax_span(spans, i, base);
+			i += 1;
+		} else if ((c >= '0' && c <= '9') || (c == '.' && i + 1 < size && text[i + 1] >= '0' && text[i + 1] <= '9')) {
+			size_t end = i + 1;
+			while (end < size && (syntax_word_char(text[end]) || text[end] == '.'
+				|| ((text[end] == '+' || text[end] == '-') && (text[end - 1] == 'e' || text[end - 1] == 'E' || text[end - 1] == 'p' || text[end - 1] == 'P')))) {
+				end += 1;
+			}
+			if (!directive) syntax_span(spans, i, Syntax_Color_number);
+			i = end;
+			syntax_span(spans, i, base);
+		} else if (syntax_word_char(c)) {
+			size_t end = i + 1;
+			while (end < size && syntax_word_char(text[end])) end += 1;
+			size_t length = end - i;
+			if (!directive && spans != NULL) {
+				if (syntax_word_in(text + i, length, SDL_arraysize(syntax_c_keywords), syntax_c_keywords)) {
+					syntax_span(spans, i, Syntax_Color_keyword);
+				} else if (syntax_word_in(text + i, length, SDL_arraysize(syntax_c_types), syntax_c_types)
+					|| (length > 2 && text[end - 2] == '_' && text[end - 1] == 't')) {
+					syntax_span(spans, i, Syntax_Color_type);
 				}
-				SDL_FRect cursor_rect = {
-					.x = actual_cursor_pos.x,
-					.y = actual_cursor_pos.y,
+				syntax_span(spans, end, base);
+			}
+			i = end;
+		} else {
+			i += 1;
+		}
+	}
+	return directive && continued ? Syntax_C_directive : Syntax_C_code;
+}
+
+static const char *const syntax_log_levels[] = {"TRACE", "DEBUG", "INFO", "WARN", "WARNING", "ERROR", "FATAL", "CRITICAL"};
+static const Syntax_Color syntax_log_level_colors[SDL_arraysize(syntax_log_levels)] = {
+	Syntax_Color_debug, Syntax_Color_debug, Syntax_Color_info, Syntax_Color_warning, Syntax_Color_warning,
+	Syntax_Color_error, Syntax_Color_error, Syntax_Color_error,
+};
+
+// Dims the leading timestamp and colors the first level word, lines are independent
+static Uint32 syntax_log_line(Uint32 state, const char *text, size_t size, Syntax_Spans *spans) {
+	(void) state;
+	if (spans == NULL) return 0;
+	size_t i = 0;
+	while (i < size && ((text[i] >= '0' && text[i] <= '9') || SDL_strchr("-:.,/+T", text[i]) != NULL
+		|| (text[i] == ' ' && i + 1 < size && text[i + 1] >= '0' && text[i + 1] <= '9'))) {
+		i += 1;
+	}
+	if (i > 0 && (i == size || !syntax_word_char(text[i]))) {
+		syntax_span(spans, 0, Syntax_Color_comment);
+		syntax_span(spans, i, Syntax_Color_text);
+	} else {
+		i = 0;
+	}
+	while (i < size) {
+		if (!(text[i] >= 'A' && text[i] <= 'Z') || (i > 0 && syntax_word_char(text[i - 1]))) {
+			i += 1;
+			continue;
+		}
+		size_t end = i + 1;
+		while (end < size && syntax_word_char(text[end])) end += 1;
+		for (Uint32 level = 0; level < SDL_arraysize(syntax_log_levels); ++level) {
+			if (SDL_strncmp(syntax_log_levels[level], text + i, end - i) == 0 && syntax_log_levels[level][end - i] == '\0') {
+				syntax_span(spans, i, syntax_log_level_colors[level]);
+				syntax_span(spans, end, Syntax_Color_text);
+				return 0;
+			}
+		}
+		i = end;
+	}
+	return 0;
+}
+
+// New languages only need a lexer and an entry here
+static const Syntax syntaxes[] = {
+	{"c", ".c .h", syntax_c_line},
+	{"log", ".log", syntax_log_line},
+};
+
+static const Syntax *syntax_detect(const char *name) {
+	if (name == NULL) return NULL;
+	// The log buffer
+	if (SDL_strcmp(name, "logs") == 0) return &syntaxes[1];
+	const char *extension = SDL_strrchr(name, '.');
+	if (extension == NULL || SDL_strchr(extension, '/') != NULL) return NULL;
+	size_t length = SDL_strlen(extension);
+	for (Uint32 i = 0; i < SDL_arraysize(syntaxes); ++i) {
+		const char *found = syntaxes[i].extensions;
+		while ((found = SDL_strstr(found, extension)) != NULL) {
+			if (found[length] == ' ' || found[length] == '\0') return &syntaxes[i];
+			found += length;
+		}
+	}
+	return NULL;
+}
+
+static bool syntax_reserve(Syntax_Cache *cache, size_t lines) {
+	if (lines <= cache->states_capacity) return true;
+	size_t new_cap = SDL_max(cache->states_capacity * 2, SDL_max(lines, 1024));
+	Uint32 *new_states = SDL_realloc(cache->states, new_cap * sizeof *new_states);
+	if (new_states == NULL) {
+		SDL_Log("Error, can't grow syntax states to %zu lines", new_cap);
+		return false;
+	}
+	memory_retag(new_states, Memory_Tag_layout);
+	cache->states = new_states;
+	cache->states_capacity = new_cap;
+	return true;
+}
+
+// Syntax of the buffer, NULL for plain text
+static const Syntax *syntax_prepare(TextBuffer *buffer) {
+	Syntax_Cache *cache = &buffer->syntax;
+	if (cache->detected_name != buffer->name) {
+		syntax_cache_free(buffer);
+		cache->detected_name = buffer->name;
+		cache->syntax = syntax_detect(buffer->name);
+	}
+	if (cache->syntax == NULL) return NULL;
+	if (cache->lines == 0) {
+		if (!syntax_reserve(cache, 1)) return NULL;
+		cache->states[0] = 0;
+		cache->lines = 1;
+		cache->clean_lines = 1;
+	}
+	return cache->syntax;
+}
+
+// Forgets states after the line with pos, for edits that can't be tracked line by line
+static void syntax_truncate(Ctx *ctx, TextBuffer *buffer, size_t pos) {
+	Syntax_Cache *cache = &buffer->syntax;
+	if (cache->lines == 0) return;
+	size_t line = pos == 0 ? 0 : buffer_count_lines(ctx, buffer, pos) - 1;
+	if (line + 1 >= cache->lines) return;
+	if (line + 1 <= cache->clean_lines) {
+		cache->clean_lines = line + 1;
+		cache->anchor_line = line;
+		cache->anchor_offset = text_line_start(buffer->text, pos);
+	}
+	cache->lines = cache->clean_lines;
+}
+
+// Before del_len bytes at pos are replaced with in. States of the following lines are kept
+// for the convergence check
+static void syntax_edit(Ctx *ctx, TextBuffer *buffer, size_t pos, size_t del_len, const char *in, size_t in_len) {
+	Syntax_Cache *cache = &buffer->syntax;
+	if (cache->lines == 0) return;
+	size_t removed = del_len == 0 ? 0 : text_kernels->count_newlines(buffer->text + pos, del_len);
+	size_t added = in_len == 0 ? 0 : text_kernels->count_newlines(in, in_len);
+	size_t line = pos == 0 ? 0 : buffer_count_lines(ctx, buffer, pos) - 1;
+	if (line >= cache->lines) return;
+	bool was_clean = cache->clean_lines == cache->lines;
+	// Anchor before the edit stays valid
+	if (line + 1 <= cache->clean_lines) {
+		cache->clean_lines = line + 1;
+		cache->anchor_line = line;
+		cache->anchor_offset = text_line_start(buffer->text, pos);
+	}
+	if (line + removed + 1 >= cache->lines || !syntax_reserve(cache, cache->lines + added)) {
+		cache->lines = cache->clean_lines;
+		return;
+	}
+	SDL_memmove(cache->states + line + 1 + added, cache->states + line + 1 + removed, (cache->lines - line - 1 - removed) * sizeof *cache->states);
+	cache->lines = cache->lines + added - removed;
+	size_t dirty_until = line + added;
+	if (!was_clean && cache->dirty_until > line + removed) dirty_until = cache->dirty_until + added - removed;
+	cache->dirty_until = dirty_until;
+}
+
+// Lexes until the state at the start of line is known, false if it ran out of budget or text
+static bool syntax_lex_to(Ctx *ctx, TextBuffer *buffer, size_t line) {
+	Syntax_Cache *cache = &buffer->syntax;
+	if (line < cache->clean_lines) return true;
+	if (buffer->text == NULL || cache->syntax == NULL) return false;
+	const char *text = buffer->text;
+	size_t text_size = buffer->text_size;
+	while (cache->clean_lines <= line) {
+		if (ctx->syntax_budget == 0) return false;
+		// Behind only after convergence, catching up is spread over ticks too
+		while (cache->anchor_line + 1 < cache->clean_lines) {
+			if (ctx->syntax_budget == 0) return false;
+			size_t length = text_kernels->find_newline(text + cache->anchor_offset, text_size - cache->anchor_offset);
+			ctx->syntax_budget -= SDL_min(ctx->syntax_budget, length / 16);
+			cache->anchor_offset += length + 1;
+			cache->anchor_line += 1;
+		}
+		size_t offset = cache->anchor_offset;
+		size_t length = text_kernels->find_newline(text + offset, text_size - offset);
+		// Last line has no next one
+		if (offset + length >= text_size) return false;
+		Uint32 state = cache->syntax->lex_line(cache->states[cache->clean_lines - 1], text + offset, length, NULL);
+		ctx->syntax_budget -= SDL_min(ctx->syntax_budget, length + 1);
+		size_t next = cache->clean_lines;
+		cache->anchor_line = next;
+		cache->anchor_offset = offset + length + 1;
+		if (next < cache->lines && next > cache->dirty_until && cache->states[next] == state) {
+			// Converged, the rest is the same as before the edit
+			cache->clean_lines = cache->lines;
+			continue;
+		}
+		if (!syntax_reserve(cache, next + 1)) return false;
+		cache->states[next] = state;
+		cache->clean_lines = next + 1;
+		cache->lines = SDL_max(cache->lines, cache->clean_lines);
+	}
+	return true;
+}
+
+static void frame_normalize_cursors(Frame *frame);
+
+static void buffer_delete_text_no_undo(Ctx *ctx, Uint32 bufid, Uint32 from, Uint32 to) {
+	TextBuffer *buffer = &ctx->buffers[bufid];
+	SDL_assert(buffer->refcount > 0);
+	SDL_assert(to >= from);
+	if (!buffer_touch(ctx, buffer)) return;
+	buffer->saved = false;
+	syntax_edit(ctx, buffer, from, to - from, NULL, 0);
+	buffer_drop_line_index(buffer);
+	words_edit(ctx, buffer, from, to);
+	SDL_memmove(buffer->text + from, buffer->text + to,
+		buffer->text_size - to + 1);
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		if (!ctx->frames[i].taken) continue;
+		if (ctx->frames[i].buffer.index != bufid) continue;
+		if (ctx->frames[i].cursor >= to) ctx->frames[i].cursor -= to - from;
+		else if (ctx->frames[i].cursor > from) ctx->frames[i].cursor = from;
+		if (ctx->frames[i].selection >= to) ctx->frames[i].selection -= to - from;
+		else if (ctx->frames[i].selection > from) ctx->frames[i].selection = from;
+		for (Uint32 c = 0; c < ctx->frames[i].cursors_count; ++c) {
+			if (ctx->frames[i].cursors[c] >= to) ctx->frames[i].cursors[c] -= to - from;
+			else if (ctx->frames[i].cursors[c] > from) ctx->frames[i].cursors[c] = from;
+		}
+		// Cursors in the deleted range all land on from
+		frame_normalize_cursors(&ctx->frames[i]);
+	}
+	buffer->text_size -= to - from;
+	words_edit_done(ctx, buffer);
+	structure_edit(buffer, from, to - from, 0);
+	ctx->should_render = true;
+}
+
+static void buffer_delete_text(Ctx *ctx, Uint32 bufid, Uint32 from, Uint32 to, Undo_Group undo_group) {
+	TextBuffer *buffer = &ctx->buffers[bufid];
+	SDL_assert(buffer->refcount > 0);
+	SDL_assert(to >= from);
+	char *data = SDL_strndup(buffer->text + from, to - from);
+	buffer_delete_text_no_undo(ctx, bufid, from, to);
+	push_undo_op(ctx, bufid, (Undo_Operation) {
+		.type = Undo_Type_delete,
+		.group = undo_group,
+		.pos = from,
+		.len = to - from,
+		.data = data,
+	});
+}
+
+static inline Uint32 count_lines(Ctx *ctx, size_t text_size, char text[text_size]) {
+	profile_count(ctx, Profile_Counter_bytes_scanned, text_size);
+	if (text_size == 0) return 0;
+	return 1 + text_kernels->count_newlines(text, text_size);
+}
+
+// Same as count_lines over the buffer text, but in O(log n) while the line index is there
+static Uint32 buffer_count_lines(Ctx *ctx, TextBuffer *buffer, size_t pos) {
+	const Line_Index *index = &buffer->line_index;
+	if (!index->valid) return count_lines(ctx, pos, buffer->text);
+	if (pos == 0) return 0;
+	size_t low = 0, high = index->lines_count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (index->starts[mid] <= pos) low = mid + 1;
+		else high = mid;
+	}
+	return low;
+}
+
+// Start of the line containing pos
+static inline size_t text_line_start(const char *text, size_t pos) {
+	size_t newline = text_kernels->find_newline_back(text, pos);
+	return newline == SDL_SIZE_MAX ? 0 : newline + 1;
+}
+
+// Keeps the end of the text visible in frames without scroll lock (logs)
+static void frame_follow_tail(Ctx *ctx, Uint32 frame) {
+	Frame *current_frame = &ctx->frames[frame];
+	if (ctx->macro_replaying) return;
+	if (!frame_is_multiline(ctx, frame)) return;
+	if (current_frame->scroll_lock) return;
+	Sint32 text_lines = (Sint32)buffer_count_lines(ctx, frame_buffer(ctx, current_frame), frame_buffer(ctx, current_frame)->text_size);
+	Sint32 buffer_last_line = (Sint32)SDL_ceil((current_frame->bounds.h - current_frame->scroll.y) / ctx->line_height);
+	if (text_lines >= buffer_last_line) {
+		current_frame->scroll.y = current_frame->bounds.h - (text_lines + 5.0) * ctx->line_height;
+	}
+}
+
+static void buffer_insert_text_no_undo(Ctx *ctx, TextBuffer *buffer, const char *in, size_t in_len, Uint32 pos) {
+	if (in_len == 0) return;
+	if (!buffer_touch(ctx, buffer)) return;
+	buffer->saved = false;
+	if (pos > buffer->text_size) pos = buffer->text_size;
+	syntax_edit(ctx, buffer, pos, 0, in, in_len);
+	// Appends (followed files) keep the index
+	if (pos != buffer->text_size) buffer_drop_line_index(buffer);
+	size_t new_size = (size_t)buffer->text_size + in_len;
+	if (new_size + 1 > buffer->text_capacity) {
+		size_t new_capacity = ((new_size + 1 + TEXT_CHUNK_SIZE - 1) / TEXT_CHUNK_SIZE) * TEXT_CHUNK_SIZE;
+		char *new_buf = SDL_realloc(buffer->text, new_capacity);
+		if (!new_buf) {
+			SDL_Log("Error, failed to reallocate new buffer");
+			return;
+		}
+		buffer->text = new_buf;
+		buffer->text_capacity = (Uint32)new_capacity;
+		memory_retag(buffer->text, buffer_memory_tag(ctx, buffer));
+	}
+	words_edit(ctx, buffer, pos, pos);
+	SDL_memmove(buffer->text + pos + in_len,
+		buffer->text + pos,
+		(size_t)buffer->text_size - (size_t)pos);
+	SDL_memcpy(buffer->text + pos, in, in_len);
+	buffer->text_size = (Uint32)new_size;
+	buffer->text[buffer->text_size] = '\0';
+	words_edit_done(ctx, buffer);
+	structure_edit(buffer, pos, 0, in_len);
+	if (buffer->line_index.valid
+		&& !line_index_extend(&buffer->line_index, buffer->text, buffer->text_size - in_len, buffer->text_size)) {
+		buffer_drop_line_index(buffer);
+	}
+	Uint32 bufid = buffer - ctx->buffers;
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		if (!ctx->frames[i].taken) continue;
+		if (ctx->frames[i].buffer.index == bufid) {
+			if (ctx->frames[i].cursor == buffer->text_size - 1) ctx->frames[i].scroll_lock = false;
+			if (ctx->frames[i].cursor >= pos) ctx->frames[i].cursor += in_len;
+			if (ctx->frames[i].selection >= pos) ctx->frames[i].selection += in_len;
+			for (Uint32 c = 0; c < ctx->frames[i].cursors_count; ++c) {
+				if (ctx->frames[i].cursors[c] >= pos) ctx->frames[i].cursors[c] += in_len;
+			}
+			frame_follow_tail(ctx, i);
+		}
+	}
+	ctx->should_render = true;
+}
+
+static void buffer_insert_text(Ctx *ctx, TextBuffer *buffer, const char *in, size_t in_len, Uint32 pos, Undo_Group undo_group) {
+	buffer_insert_text_no_undo(ctx, buffer, in, in_len, pos);
+	push_undo_op(ctx, (buffer - &ctx->buffers[0]), (Undo_Operation) {
+		.type = Undo_Type_insert,
+		.group = undo_group,
+		.pos = pos,
+		.len = in_len,
+		.data = SDL_strndup(in, in_len),
+	});
+}
+
+// Returns position of the same anchor after the batch, shifts[i] is a size change made by edits up to i.
+// Anchors inside of a deleted range are moved to the start of its replacement.
+static inline Uint32 batch_map_position(Uint32 edits_count, const Buffer_Edit edits[edits_count], const Sint64 shifts[edits_count], Uint32 pos) {
+	Uint32 lo = 0, hi = edits_count;
+	while (lo < hi) {
+		Uint32 mid = lo + (hi - lo) / 2;
+		if (edits[mid].pos <= pos) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return pos;
+	const Buffer_Edit *edit = &edits[lo - 1];
+	if (pos >= edit->pos + edit->del_len) return pos + shifts[lo - 1];
+	return edit->pos + (lo >= 2 ? shifts[lo - 2] : 0);
+}
+
+static int compare_cursors(const void *a, const void *b) {
+	Uint32 lhs = *(const Uint32 *)a;
+	Uint32 rhs = *(const Uint32 *)b;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+static int compare_times(const void *a, const void *b) {
+	Uint64 lhs = *(const Uint64 *)a;
+	Uint64 rhs = *(const Uint64 *)b;
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+static void frame_normalize_cursors(Frame *frame) {
+	if (frame->cursors_count == 0) return;
+	SDL_qsort(frame->cursors, frame->cursors_count, sizeof *frame->cursors, compare_cursors);
+	Uint32 unique = 0;
+	for (Uint32 i = 0; i < frame->cursors_count; ++i) {
+		if (frame->cursors[i] == frame->cursor) continue;
+		if (unique > 0 && frame->cursors[unique - 1] == frame->cursors[i]) continue;
+		frame->cursors[unique++] = frame->cursors[i];
+	}
+	frame->cursors_count = unique;
+}
+
+// Applies all edits in one sweep over the text, then moves anchors of every frame once.
+// Growing and shrinking batches are done in place, mixed ones are copied into a new block.
+static bool buffer_apply_batch_no_undo(Ctx *ctx, Uint32 bufid, Uint32 edits_count, const Buffer_Edit edits[edits_count], const char *ins_data) {
+	TextBuffer *buffer = &ctx->buffers[bufid];
+	SDL_assert(buffer->refcount > 0);
+	if (edits_count == 0) return true;
+	if (!buffer_touch(ctx, buffer)) return false;
+	buffer->saved = false;
+	Uint32 first = edits[0].pos;
+	for (Uint32 i = 1; i < edits_count; ++i) first = SDL_min(first, edits[i].pos);
+	syntax_truncate(ctx, buffer, first);
+	buffer_drop_line_index(buffer);
+	Sint64 *shifts = SDL_malloc(edits_count * sizeof *shifts);
+	if (shifts == NULL) {
+		SDL_Log("Error, can't allocate shifts for batch of %" SDL_PRIu32 " edits", edits_count);
+		return false;
+	}
+	bool grows = true, shrinks = true;
+	Sint64 shift = 0;
+	for (Uint32 i = 0; i < edits_count; ++i) {
+		SDL_assert(edits[i].pos + edits[i].del_len <= buffer->text_size);
+		SDL_assert(i == 0 || edits[i - 1].pos + edits[i - 1].del_len <= edits[i].pos);
+		if (edits[i].ins_len < edits[i].del_len) grows = false;
+		if (edits[i].ins_len > edits[i].del_len) shrinks = false;
+		shift += (Sint64)edits[i].ins_len - (Sint64)edits[i].del_len;
+		shifts[i] = shift;
+	}
+	words_edit(ctx, buffer, edits[0].pos, edits[edits_count - 1].pos + edits[edits_count - 1].del_len);
+	size_t old_size = buffer->text_size;
+	size_t new_size = old_size + shift;
+	size_t new_capacity = ((new_size + 1 + TEXT_CHUNK_SIZE - 1) / TEXT_CHUNK_SIZE) * TEXT_CHUNK_SIZE;
+	if (grows && shrinks) {
+		// Every edit replaces text of the same size, nothing moves
+		for (Uint32 i = 0; i < edits_count; ++i) {
+			SDL_memcpy(buffer->text + edits[i].pos, ins_data + edits[i].ins_off, edits[i].ins_len);
+		}
+	} else if (grows) {
+		if (new_size + 1 > buffer->text_capacity) {
+			char *new_text = SDL_realloc(buffer->text, new_capacity);
+			if (new_text == NULL) {
+				SDL_Log("Error, failed to reallocate buffer for batch");
+				words_edit_done(ctx, buffer);
+				SDL_free(shifts);
+				return false;
+			}
+			buffer->text = new_text;
+			buffer->text_capacity = new_capacity;
+			memory_retag(buffer->text, buffer_memory_tag(ctx, buffer));
+		}
+		// From the end, so every tail is moved exactly once
+		size_t src_end = old_size, dst_end = new_size;
+		for (Uint32 i = edits_count; i-- > 0;) {
+			size_t tail_start = edits[i].pos + edits[i].del_len;
+			dst_end -= src_end - tail_start;
+			SDL_memmove(buffer->text + dst_end, buffer->text + tail_start, src_end - tail_start);
+			dst_end -= edits[i].ins_len;
+			SDL_memcpy(buffer->text + dst_end, ins_data + edits[i].ins_off, edits[i].ins_len);
+			src_end = edits[i].pos;
+		}
+	} else if (shrinks) {
+		size_t dst = edits[0].pos;
+		for (Uint32 i = 0; i < edits_count; ++i) {
+			SDL_memcpy(buffer->text + dst, ins_data + edits[i].ins_off, edits[i].ins_len);
+			dst += edits[i].ins_len;
+			size_t src = edits[i].pos + edits[i].del_len;
+			size_t next = (i + 1 < edits_count) ? edits[i + 1].pos : old_size;
+			SDL_memmove(buffer->text + dst, buffer->text + src, next - src);
+			dst += next - src;
+		}
+	} else {
+		char *new_text = SDL_malloc(new_capacity);
+		if (new_text == NULL) {
+			SDL_Log("Error, failed to allocate buffer for batch");
+			words_edit_done(ctx, buffer);
+			SDL_free(shifts);
+			return false;
+		}
+		size_t src = 0, dst = 0;
+		for (Uint32 i = 0; i < edits_count; ++i) {
+			SDL_memcpy(new_text + dst, buffer->text + src, edits[i].pos - src);
+			dst += edits[i].pos - src;
+			SDL_memcpy(new_text + dst, ins_data + edits[i].ins_off, edits[i].ins_len);
+			dst += edits[i].ins_len;
+			src = edits[i].pos + edits[i].del_len;
+		}
+		SDL_memcpy(new_text + dst, buffer->text + src, old_size - src);
+		SDL_free(buffer->text);
+		buffer->text = new_text;
+		buffer->text_capacity = new_capacity;
+		memory_retag(buffer->text, buffer_memory_tag(ctx, buffer));
+	}
+	buffer->text_size = new_size;
+	if (buffer->text != NULL) buffer->text[new_size] = '\0';
+	words_edit_done(ctx, buffer);
+	for (Uint32 i = 0; i < edits_count; ++i) {
+		structure_move(buffer, edits[i].pos + (i > 0 ? shifts[i - 1] : 0), edits[i].del_len, edits[i].ins_len);
+	}
+	for (Uint32 i = 0; i < edits_count; ++i) {
+		size_t pos = edits[i].pos + (i > 0 ? shifts[i - 1] : 0);
+		structure_relex(buffer, pos, pos + edits[i].ins_len);
+	}
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		Frame *frame = &ctx->frames[i];
+		if (!frame->taken) continue;
+		if (frame->buffer.index != bufid) continue;
+		frame->cursor = batch_map_position(edits_count, edits, shifts, frame->cursor);
+		frame->selection = batch_map_position(edits_count, edits, shifts, frame->selection);
+		frame_cold(ctx, frame)->search_cursor = batch_map_position(edits_count, edits, shifts, frame_cold(ctx, frame)->search_cursor);
+		for (Uint32 c = 0; c < frame->cursors_count; ++c) {
+			frame->cursors[c] = batch_map_position(edits_count, edits, shifts, frame->cursors[c]);
+		}
+		frame_normalize_cursors(frame);
+		frame_follow_tail(ctx, i);
+	}
+	SDL_free(shifts);
+	ctx->should_render = true;
+	return true;
+}
+
+// Edits reverting the batch, in coordinates of the text after it. Deleted and inserted data swap places.
+static Buffer_Edit *batch_invert(Uint32 edits_count, const Buffer_Edit edits[edits_count]) {
+	Buffer_Edit *inverse = SDL_malloc(SDL_max(edits_count, 1) * sizeof *inverse);
+	if (inverse == NULL) return NULL;
+	Sint64 shift = 0;
+	for (Uint32 i = 0; i < edits_count; ++i) {
+		inverse[i] = (Buffer_Edit) {
+			.pos = edits[i].pos + shift,
+			.del_len = edits[i].ins_len,
+			.ins_len = edits[i].del_len,
+			.del_off = edits[i].ins_off,
+			.ins_off = edits[i].del_off,
+		};
+		shift += (Sint64)edits[i].ins_len - (Sint64)edits[i].del_len;
+	}
+	return inverse;
+}
+
+// Same as buffer_apply_batch_no_undo, but whole batch is recorded as a single undo operation
+static bool buffer_apply_batch(Ctx *ctx, Uint32 bufid, Uint32 edits_count, const Buffer_Edit edits[edits_count], size_t ins_data_size, const char *ins_data, Undo_Group undo_group) {
+	TextBuffer *buffer = &ctx->buffers[bufid];
+	SDL_assert(buffer->refcount > 0);
+	if (edits_count == 0) return true;
+	if (!buffer_touch(ctx, buffer)) return false;
+	size_t del_data_size = 0;
+	for (Uint32 i = 0; i < edits_count; ++i) del_data_size += edits[i].del_len;
+	Undo_Operation op = {
+		.type = Undo_Type_batch,
+		.group = undo_group,
+		.pos = edits[0].pos,
+		.edits_count = edits_count,
+		.edits = SDL_malloc(edits_count * sizeof *op.edits),
+		.data = SDL_malloc(SDL_max(del_data_size, 1)),
+		.ins_data = SDL_malloc(SDL_max(ins_data_size, 1)),
+	};
+	if (op.edits == NULL || op.data == NULL || op.ins_data == NULL) {
+		SDL_Log("Error, can't allocate undo for batch of %" SDL_PRIu32 " edits", edits_count);
+		undo_op_free(&op);
+		return false;
+	}
+	size_t del_off = 0;
+	for (Uint32 i = 0; i < edits_count; ++i) {
+		op.edits[i] = edits[i];
+		// Replace all deletes the same bytes every time, keep only one copy of them
+		if (i > 0 && edits[i].del_len == edits[0].del_len
+			&& SDL_memcmp(op.data, buffer->text + edits[i].pos, edits[i].del_len) == 0) {
+			op.edits[i].del_off = 0;
+			continue;
+		}
+		op.edits[i].del_off = del_off;
+		SDL_memcpy(op.data + del_off, buffer->text + edits[i].pos, edits[i].del_len);
+		del_off += edits[i].del_len;
+	}
+	if (del_off < del_data_size) {
+		char *shrinked = SDL_realloc(op.data, SDL_max(del_off, 1));
+		if (shrinked != NULL) op.data = shrinked;
+	}
+	op.len = del_off;
+	if (ins_data_size > 0) SDL_memcpy(op.ins_data, ins_data, ins_data_size);
+	if (!buffer_apply_batch_no_undo(ctx, bufid, edits_count, edits, ins_data)) {
+		undo_op_free(&op);
+		return false;
+	}
+	push_undo_op(ctx, bufid, op);
+	return true;
+}
+
+static bool buffer_undo_batch(Ctx *ctx, Uint32 bufid, const Undo_Operation *op) {
+	SDL_assert(op->type == Undo_Type_batch);
+	Buffer_Edit *inverse = batch_invert(op->edits_count, op->edits);
+	if (inverse == NULL) {
+		SDL_Log("Error, can't allocate inverse batch");
+		return false;
+	}
+	bool res = buffer_apply_batch_no_undo(ctx, bufid, op->edits_count, inverse, op->data);
+	SDL_free(inverse);
+	return res;
+}
+
+// False if there is nothing to undo
+static bool buffer_undo(Ctx *ctx, Uint32 bufid) {
+	TextBuffer *buffer = &ctx->buffers[bufid];
+	if (buffer->undos_cursor <= 0) return false;
+	Undo_Operation op = buffer->undos[buffer->undos_cursor - 1];
+	if (op.type == Undo_Type_insert) {
+		buffer_delete_text_no_undo(ctx, bufid, op.pos, op.pos + op.len);
+	} else if (op.type == Undo_Type_delete) {
+		buffer_insert_text_no_undo(ctx, buffer, op.data, op.len, op.pos);
+	} else if (op.type == Undo_Type_batch) {
+		buffer_undo_batch(ctx, bufid, &op);
+	} else {
+		SDL_assert(!"Unknown Undo type operation");
+		return false;
+	}
+	buffer->undos_cursor -= 1;
+	return true;
+}
+
+// False if there is nothing to redo
+static bool buffer_redo(Ctx *ctx, Uint32 bufid) {
+	TextBuffer *buffer = &ctx->buffers[bufid];
+	if (buffer->undos_cursor >= buffer->undos_size) return false;
+	Undo_Operation op = buffer->undos[buffer->undos_cursor];
+	if (op.type == Undo_Type_insert) {
+		buffer_insert_text_no_undo(ctx, buffer, op.data, op.len, op.pos);
+	} else if (op.type == Undo_Type_delete) {
+		buffer_delete_text_no_undo(ctx, bufid, op.pos, op.pos + op.len);
+	} else if (op.type == Undo_Type_batch) {
+		buffer_apply_batch_no_undo(ctx, bufid, op.edits_count, op.edits, op.ins_data);
+	} else {
+		SDL_assert(!"Unknown Undo type operation");
+		return false;
+	}
+	buffer->undos_cursor += 1;
+	return true;
+}
+
+// Appends without keeping the order, call frame_normalize_cursors after
+static bool frame_push_cursor(Frame *frame, Uint32 pos) {
+	if (frame->cursors_count >= frame->cursors_capacity) {
+		Uint32 new_cap = frame->cursors_capacity * 2;
+		if (new_cap == 0) new_cap = 8;
+		Uint32 *new_cursors = SDL_realloc(frame->cursors, new_cap * sizeof *frame->cursors);
+		if (new_cursors == NULL) {
+			SDL_Log("Can't reallocate cursors array");
+			return false;
+		}
+		frame->cursors = new_cursors;
+		frame->cursors_capacity = new_cap;
+		memory_retag(frame->cursors, Memory_Tag_layout);
+	}
+	frame->cursors[frame->cursors_count++] = pos;
+	return true;
+}
+
+// Records the difference between old_text and the current text as one undo operation
+static void buffer_push_snapshot_undo(Ctx *ctx, Uint32 bufid, const char *old_text, size_t old_size, Undo_Group undo_group) {
+	TextBuffer *buffer = &ctx->buffers[bufid];
+	if (!buffer_touch(ctx, buffer)) return;
+	size_t new_size = buffer->text_size;
+	size_t prefix = 0;
+	size_t common = SDL_min(old_size, new_size);
+	while (prefix < common && old_text[prefix] == buffer->text[prefix]) prefix += 1;
+	size_t suffix = 0;
+	while (suffix < common - prefix && old_text[old_size - suffix - 1] == buffer->text[new_size - suffix - 1]) suffix += 1;
+	if (prefix == old_size && prefix == new_size) return;
+	Buffer_Edit *edit = SDL_malloc(sizeof *edit);
+	if (edit == NULL) {
+		SDL_Log("Error, can't allocate snapshot undo");
+		return;
+	}
+	*edit = (Buffer_Edit) {
+		.pos = prefix,
+		.del_len = old_size - prefix - suffix,
+		.ins_len = new_size - prefix - suffix,
+	};
+	Undo_Operation op = {
+		.type = Undo_Type_batch,
+		.group = undo_group,
+		.pos = prefix,
+		.len = edit->del_len,
+		.edits_count = 1,
+		.edits = edit,
+		.data = SDL_malloc(SDL_max(edit->del_len, 1)),
+		.ins_data = SDL_malloc(SDL_max(edit->ins_len, 1)),
+	};
+	if (op.data == NULL || op.ins_data == NULL) {
+		SDL_Log("Error, can't allocate snapshot undo");
+		undo_op_free(&op);
+		return;
+	}
+	SDL_memcpy(op.data, old_text + prefix, edit->del_len);
+	SDL_memcpy(op.ins_data, buffer->text + prefix, edit->ins_len);
+	push_undo_op(ctx, bufid, op);
+}
+
+static bool frame_add_cursor(Ctx *ctx, Uint32 framei, Uint32 pos) {
+	Frame *frame = &ctx->frames[framei];
+	if (pos == frame->cursor) return true;
+	if (!frame_push_cursor(frame, pos)) return false;
+	frame_normalize_cursors(frame);
+	ctx->should_render = true;
+	return true;
+}
+
+static void frame_clear_cursors(Ctx *ctx, Uint32 framei) {
+	ctx->frames[framei].cursors_count = 0;
+	ctx->should_render = true;
+}
+
+// Sorted positions of all cursors of the frame including the main one
+static Uint32 *frame_collect_cursors(Ctx *ctx, Uint32 framei, Uint32 *count) {
+	Frame *frame = &ctx->frames[framei];
+	Uint32 *positions = SDL_malloc((frame->cursors_count + 1) * sizeof *positions);
+	if (positions == NULL) return NULL;
+	Uint32 n = 0;
+	bool main_added = false;
+	for (Uint32 i = 0; i < frame->cursors_count; ++i) {
+		if (!main_added && frame->cursor < frame->cursors[i]) {
+			positions[n++] = frame->cursor;
+			main_added = true;
+		}
+		positions[n++] = frame->cursors[i];
+	}
+	if (!main_added) positions[n++] = frame->cursor;
+	*count = n;
+	return positions;
+}
+
+static inline void debug_rect(Ctx *ctx, SDL_FRect *rect, SDL_Color color) {
+	set_color(ctx, color);
+	SDL_RenderRect(ctx->renderer, rect);
+}
+
+// Byte offset in the line of the character under pos, columns count codepoints and tabs
+static inline Uint32 coords_to_text_index(Ctx *ctx, size_t text_length, char text[text_length], float pos) {
+	Uint32 visual_char = 0;
+	size_t ind = 0;
+	// [ ][ ][ ][ ][ ][ ][ ][ ][a][b][c]
+	//       | 2 before
+	// | 0 vis_char
+	//                      | 7 nvis_char
+	//                            | 9 after
+	float column = pos / ctx->font_width;
+	if (column <= -0.4) return 0;
+	// Nothing can match more than half a tab before the point, skip that part at once
+	if (column - TAB_WIDTH / 2 >= 1) {
+		ind = text_kernels->columns_prefix(text, text_length, (Uint32)(column - TAB_WIDTH / 2), &visual_char);
+	}
+	while (ind < text_length) {
+		const char *cur = text + ind;
+		size_t left = text_length - ind;
+		Uint32 cp = SDL_StepUTF8(&cur, &left);
+		if (cp == 0) break;
+		float diff = (pos - (float)visual_char * ctx->font_width) / ctx->font_width;
+		if (cp == '\t') {
+			visual_char += TAB_WIDTH;
+			if (diff <= TAB_WIDTH / 2) return ind;
+		} else {
+			visual_char += 1;
+			if (diff <= 0.6) return ind;
+		}
+		ind = cur - text;
+	}
+	return ind;
+}
+
+static inline Uint32 string_to_visual(Ctx *ctx, size_t text_length, const char text[text_length]) {
+	(void) ctx;
+	Uint32 visual_char;
+	text_kernels->columns_prefix(text, text_length, (Uint32)-1, &visual_char);
+	return visual_char;
+}
+
+static inline void frame_scroll_to_line(Ctx *ctx, Uint32 frame, Sint32 line) {
+	ctx->frames[frame].scroll.y = -line * ctx->line_height;
+}
+
+static inline void frame_scroll_to_line_centered(Ctx *ctx, Uint32 frame, Sint32 line) {
+	line -= ctx->frames[frame].bounds.h / ctx->line_height / 2;
+	ctx->frames[frame].scroll.y = -line * ctx->line_height;
+}
+
+static inline char *strnstr_r(char *start, size_t len, const char *needle) {
+	size_t needle_len = SDL_strlen(needle);
+	char *end = start + len - needle_len;
+	while (start < end) {
+		if (SDL_strncmp(end, needle, needle_len) == 0) return end;
+		end--;
+	}
+	return NULL;
+}
+
+static inline const char *text_search_forward(const char *text, size_t text_size, const char *needle, size_t needle_len) {
+	if (needle_len == 0 || needle_len > text_size) return NULL;
+	const char *end = text + text_size - needle_len;
+	for (const char *cur = text; cur <= end; ++cur) {
+		if (*cur != needle[0]) continue;
+		if (SDL_memcmp(cur, needle, needle_len) == 0) return cur;
+	}
+	return NULL;
+}
+
+// All non-overlapping matches, in order. Returns NULL on zero matches or when out of memory.
+static Uint32 *text_search_all(const char *text, size_t text_size, const char *needle, size_t needle_len, Uint32 *count) {
+	Uint32 *matches = NULL;
+	Uint32 matches_count = 0, matches_capacity = 0;
+	const char *cur = text;
+	const char *end = text + text_size;
+	while (true) {
+		const char *found = text_search_forward(cur, end - cur, needle, needle_len);
+		if (found == NULL) break;
+		if (matches_count >= matches_capacity) {
+			Uint32 new_cap = matches_capacity * 2;
+			if (new_cap == 0) new_cap = 64;
+			Uint32 *new_matches = SDL_realloc(matches, new_cap * sizeof *matches);
+			if (new_matches == NULL) {
+				SDL_Log("Can't reallocate matches array");
+				SDL_free(matches);
+				*count = 0;
+				return NULL;
+			}
+			matches = new_matches;
+			matches_capacity = new_cap;
+		}
+		matches[matches_count++] = found - text;
+		cur = found + needle_len;
+	}
+	*count = matches_count;
+	return matches;
+}
+
+static void update_search(Ctx *ctx, Uint32 search_frame) {
+	SDL_assert(ctx->frames[search_frame].taken);
+	Uint32 parent_frame = frame_parent(ctx, &ctx->frames[search_frame]);
+	SDL_assert(ctx->frames[parent_frame].taken);
+	TextBuffer *needle = frame_buffer(ctx, &ctx->frames[search_frame]);
+	TextBuffer *haystack = frame_buffer(ctx, &ctx->frames[parent_frame]);
+	if (needle->text_size == 0) {
+		ctx->frames_cold[search_frame].search_status = Search_Status_not_found;
+		ctx->should_render = true;
+		return;
+	}
+	char *found_ptr;
+	Uint64 start = trace_begin();
+	if (ctx->frames_cold[search_frame].search_backwards) {
+		found_ptr = strnstr_r(haystack->text, ctx->frames[parent_frame].cursor, needle->text);
+	} else {
+		found_ptr = (char *)text_search_forward(haystack->text + ctx->frames[parent_frame].cursor,
+			haystack->text_size - ctx->frames[parent_frame].cursor,
+			needle->text,
+			needle->text_size);
+	}
+	trace_end_arg("search", start, "found", found_ptr != NULL);
+	if (found_ptr == NULL) {
+		ctx->frames_cold[search_frame].search_status = Search_Status_not_found;
+		ctx->macro_search_failed = true;
+		ctx->should_render = true;
+		return;
+	}
+	ctx->frames_cold[search_frame].search_status = Search_Status_found;
+	ctx->frames_cold[parent_frame].search_cursor = found_ptr - haystack->text;
+	if (ctx->macro_replaying) return;
+	Uint32 line = buffer_count_lines(ctx, haystack, ctx->frames_cold[parent_frame].search_cursor);
+	frame_scroll_to_line_centered(ctx, parent_frame, line);
+	ctx->should_render = true;
+}
+
+// Replaces every match in the whole buffer as one batch, so it's a single linear pass and a single undo
+static Uint32 frame_replace_all(Ctx *ctx, Uint32 framei, const char *needle, size_t needle_len, const char *replacement, size_t replacement_len) {
+	Frame *frame = &ctx->frames[framei];
+	SDL_assert(frame->taken);
+	if (needle_len == 0 || frame_buffer(ctx, frame)->text_size == 0) return 0;
+	Uint32 count;
+	Uint64 start = trace_begin();
+	Uint32 *matches = text_search_all(frame_buffer(ctx, frame)->text, frame_buffer(ctx, frame)->text_size, needle, needle_len, &count);
+	trace_end_arg("search all", start, "matches", matches != NULL ? count : 0);
+	if (matches == NULL) return 0;
+	Buffer_Edit *edits = SDL_malloc(count * sizeof *edits);
+	if (edits == NULL) {
+		SDL_Log("Error, can't allocate edits for %" SDL_PRIu32 " matches", count);
+		SDL_free(matches);
+		return 0;
+	}
+	for (Uint32 i = 0; i < count; ++i) {
+		edits[i] = (Buffer_Edit) {
+			.pos = matches[i],
+			.del_len = needle_len,
+			.ins_len = replacement_len,
+		};
+	}
+	SDL_free(matches);
+	if (!buffer_apply_batch(ctx, (frame_buffer(ctx, frame) - ctx->buffers), count, edits, replacement_len, replacement, Undo_Group_none)) {
+		count = 0;
+	}
+	SDL_free(edits);
+	return count;
+}
+
+static bool get_frame_render_rect(Ctx *ctx, Uint32 frame, SDL_FRect *bounds) {
+	SDL_assert(bounds != NULL);
+	SDL_assert(ctx->frames_count >= frame);
+	SDL_FRect frame_bounds = ctx->frames[frame].bounds_interp;
+	if (!ctx->frames[frame].is_global) {
+		frame_bounds.x += ctx->transform.x;
+		frame_bounds.y += ctx->transform.y;
+	}
+	*bounds = (SDL_FRect) {
+		.x = frame_bounds.x,
+		.y = frame_bounds.y,
+		.w = frame_bounds.w,
+		.h = frame_bounds.h,
+	};
+	return true;
+}
+
+static inline bool get_frame_line_prefix_rect(Ctx *ctx, Uint32 frame, SDL_FRect *bounds) {
+	get_frame_render_rect(ctx, frame, bounds);
+	bounds->w = 0;
+	if (ctx->frames_cold[frame].line_prefix != NULL) {
+		float prefix_length = (SDL_utf8strlen(ctx->frames_cold[frame].line_prefix)) * ctx->font_width;
+		bounds->w = prefix_length;
+	}
+	return true;
+}
+
+static inline bool get_frame_render_text_rect(Ctx *ctx, Uint32 frame, SDL_FRect *bounds) {
+	get_frame_render_rect(ctx, frame, bounds);
+	if (frame_has_line_numbers(ctx, frame)) {
+		bounds->x += ctx->font_width * 4;
+		bounds->w -= ctx->font_width * 4;
+		bounds->y += SDL_max(0, ctx->frames[frame].scroll_interp.y);
+		bounds->h -= SDL_max(0, ctx->frames[frame].scroll_interp.y);
+		bounds->h = SDL_max(bounds->h, 0);
+	}
+	if (ctx->frames_cold[frame].line_prefix != NULL) {
+		float prefix_length = (SDL_utf8strlen(ctx->frames_cold[frame].line_prefix)) * ctx->font_width;
+		bounds->x += prefix_length;
+		bounds->w -= prefix_length;
+	}
+	return true;
+}
+
+static inline bool get_frame_render_lines_numbers_rect(Ctx *ctx, Uint32 frame, SDL_FRect *bounds) {
+	get_frame_render_rect(ctx, frame, bounds);
+	bounds->w = ctx->font_width * 4;
+	bounds->y += SDL_max(0, ctx->frames[frame].scroll_interp.y);
+	bounds->h -= SDL_max(0, ctx->frames[frame].scroll_interp.y);
+	bounds->h = SDL_max(bounds->h, 0);
+	return true;
+}
+
+static void *arena_alloc(Arena *arena, size_t size) {
+	Arena_Block *block = arena->head;
+	if (block != NULL) {
+		size_t pad = -(uintptr_t)(block->data + block->used) & (ARENA_ALIGN - 1);
+		if (block->used + pad + size <= block->capacity) {
+			void *result = block->data + block->used + pad;
+			block->used += pad + size;
+			arena->used += pad + size;
+			return result;
+		}
+	}
+	// Tick doesn't fit, chain a block now and merge them on reset
+	size_t capacity = block == NULL ? FRAME_ARENA_SIZE : block->capacity * 2;
+	capacity = SDL_max(capacity, size + ARENA_ALIGN);
+	Arena_Block *new_block = SDL_malloc(sizeof *new_block + capacity);
+	if (new_block == NULL) {
+		SDL_Log("Error, can't grow arena to %zu bytes", capacity);
+		return NULL;
+	}
+	memory_retag(new_block, Memory_Tag_layout);
+	*new_block = (Arena_Block){
+		.next = block,
+		.capacity = capacity,
+	};
+	arena->head = new_block;
+	return arena_alloc(arena, size);
+}
+
+static void arena_free(Arena *arena) {
+	while (arena->head != NULL) {
+		Arena_Block *next = arena->head->next;
+		SDL_free(arena->head);
+		arena->head = next;
+	}
+	arena->used = 0;
+}
+
+// Invalidates everything allocated since the last reset
+static void arena_reset(Arena *arena) {
+	arena->high_water = SDL_max(arena->high_water, arena->used);
+	arena->used = 0;
+	if (arena->head == NULL) return;
+	if (arena->head->next != NULL) {
+		// One block big enough for the whole tick, so the next one doesn't allocate
+		size_t capacity = 0;
+		for (Arena_Block *block = arena->head; block != NULL; block = block->next) {
+			capacity += block->capacity;
+		}
+		arena_free(arena);
+		arena->head = SDL_malloc(sizeof *arena->head + capacity);
+		if (arena->head == NULL) return;
+		memory_retag(arena->head, Memory_Tag_layout);
+		*arena->head = (Arena_Block){
+			.capacity = capacity,
+		};
+	}
+	arena->head->used = 0;
+}
+
+static char *arena_vsprintf(Arena *arena, int *length, SDL_PRINTF_FORMAT_STRING const char *fmt, va_list ap) {
+	va_list size_ap;
+	va_copy(size_ap, ap);
+	int len = SDL_vsnprintf(NULL, 0, fmt, size_ap);
+	va_end(size_ap);
+	if (len < 0) return NULL;
+	char *str = arena_alloc(arena, len + 1);
+	if (str == NULL) return NULL;
+	SDL_vsnprintf(str, len + 1, fmt, ap);
+	if (length != NULL) *length = len;
+	return str;
+}
+
+static inline Uint32 glyph_hash(Uint32 codepoint) {
+	return codepoint * 2654435761u;
+}
+
+static Glyph *glyph_slot(Glyph *glyphs, Uint32 capacity, Uint32 codepoint) {
+	Uint32 mask = capacity - 1;
+	for (Uint32 i = glyph_hash(codepoint) & mask;; i = (i + 1) & mask) {
+		if (!glyphs[i].taken || glyphs[i].codepoint == codepoint) return &glyphs[i];
+	}
+}
+
+// Copies surface into the atlas, starting a new page when the last one is full
+static bool glyph_atlas_put(Ctx *ctx, Glyph *glyph, SDL_Surface *surface) {
+	// Gap keeps filtering from bleeding neighbours in
+	int w = surface->w + 1, h = surface->h + 1;
+	if (w > GLYPH_ATLAS_SIZE || h > GLYPH_ATLAS_SIZE) {
+		SDL_SetError("glyph is %dx%d, bigger than atlas", surface->w, surface->h);
+		return false;
+	}
+	if (ctx->atlas_x + w > GLYPH_ATLAS_SIZE) {
+		ctx->atlas_x = 0;
+		ctx->atlas_y += ctx->atlas_row_h;
+		ctx->atlas_row_h = 0;
+	}
+	if (ctx->atlas_pages == 0 || ctx->atlas_y + h > GLYPH_ATLAS_SIZE) {
+		if (ctx->atlas_pages == GLYPH_ATLAS_PAGES) {
+			SDL_SetError("all %d atlas pages are full", GLYPH_ATLAS_PAGES);
+			return false;
+		}
+		SDL_Texture *page = SDL_CreateTexture(ctx->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE);
+		if (page == NULL) return false;
+		profile_count(ctx, Profile_Counter_textures, 1);
+		// Starts out undefined, gaps have to be clear
+		void *clear = SDL_calloc(GLYPH_ATLAS_SIZE * GLYPH_ATLAS_SIZE, 4);
+		if (clear == NULL || !SDL_UpdateTexture(page, NULL, clear, GLYPH_ATLAS_SIZE * 4)) {
+			SDL_free(clear);
+			SDL_DestroyTexture(page);
+			return false;
+		}
+		SDL_free(clear);
+		SDL_SetTextureBlendMode(page, SDL_BLENDMODE_BLEND);
+		SDL_SetTextureScaleMode(page, SDL_SCALEMODE_NEAREST);
+		ctx->atlas[ctx->atlas_pages++] = page;
+		ctx->atlas_x = ctx->atlas_y = ctx->atlas_row_h = 0;
+	}
+	SDL_Surface *converted = surface;
+	if (surface->format != SDL_PIXELFORMAT_ARGB8888) {
+		converted = SDL_ConvertSurface(surface, SDL_PIXELFORMAT_ARGB8888);
+		if (converted == NULL) return false;
+	}
+	SDL_Rect rect = {ctx->atlas_x, ctx->atlas_y, surface->w, surface->h};
+	bool result = SDL_UpdateTexture(ctx->atlas[ctx->atlas_pages - 1], &rect, converted->pixels, converted->pitch);
+	if (result) {
+		glyph->page = ctx->atlas_pages - 1;
+		glyph->rect = rect;
+		ctx->atlas_x += w;
+		ctx->atlas_row_h = SDL_max(ctx->atlas_row_h, h);
+	}
+	if (converted != surface) SDL_DestroySurface(converted);
+	return result;
+}
+
+// NULL only if the cache can't grow
+static Glyph *glyph_get(Ctx *ctx, Uint32 codepoint) {
+	if (ctx->glyphs_capacity > 0) {
+		Glyph *glyph = glyph_slot(ctx->glyphs, ctx->glyphs_capacity, codepoint);
+		if (glyph->taken) return glyph;
+	}
+	if ((ctx->glyphs_used + 1) * 4 > ctx->glyphs_capacity * 3) {
+		Uint32 new_capacity = ctx->glyphs_capacity == 0 ? GLYPH_CACHE_MIN : ctx->glyphs_capacity * 2;
+		Glyph *new_glyphs = SDL_calloc(new_capacity, sizeof *new_glyphs);
+		if (new_glyphs == NULL) {
+			SDL_Log("Error, can't grow glyph cache");
+			return NULL;
+		}
+		for (Uint32 i = 0; i < ctx->glyphs_capacity; ++i) {
+			if (!ctx->glyphs[i].taken) continue;
+			*glyph_slot(new_glyphs, new_capacity, ctx->glyphs[i].codepoint) = ctx->glyphs[i];
+		}
+		SDL_free(ctx->glyphs);
+		ctx->glyphs = new_glyphs;
+		ctx->glyphs_capacity = new_capacity;
+		memory_retag(ctx->glyphs, Memory_Tag_glyphs);
+	}
+	Glyph *glyph = glyph_slot(ctx->glyphs, ctx->glyphs_capacity, codepoint);
+	*glyph = (Glyph){
+		.taken = true,
+		.codepoint = codepoint,
+		.advance = ctx->font_width,
+	};
+	ctx->glyphs_used += 1;
+	// Font and renderer allocate inside, so they're tagged by thread
+	Memory_Tag tag = memory_tag_set(Memory_Tag_glyphs);
+	Uint64 start = profile_begin();
+	TTF_GetGlyphMetrics(ctx->font, codepoint, NULL, NULL, NULL, NULL, &glyph->advance);
+	SDL_Surface *surface = TTF_RenderGlyph_Blended(ctx->font, codepoint, (SDL_Color){0xff, 0xff, 0xff, SDL_ALPHA_OPAQUE});
+	if (surface == NULL) {
+		SDL_LogWarn(0, "Can't render glyph U+%04" SDL_PRIX32 ": %s", codepoint, SDL_GetError());
+	} else {
+		if (!glyph_atlas_put(ctx, glyph, surface)) SDL_LogWarn(0, "Can't put glyph U+%04" SDL_PRIX32 " into atlas: %s", codepoint, SDL_GetError());
+		SDL_DestroySurface(surface);
+	}
+	profile_end(ctx, Profile_Phase_glyphs, start);
+	memory_tag_set(tag);
+	return glyph;
+}
+
+#if defined(DEBUG_QUIT) || defined(NO_MAIN)
+static void glyphs_free(Ctx *ctx) {
+	for (Uint32 i = 0; i < ctx->atlas_pages; ++i) SDL_DestroyTexture(ctx->atlas[i]);
+	ctx->atlas_pages = 0;
+	SDL_free(ctx->glyphs);
+	ctx->glyphs = NULL;
+	ctx->glyphs_used = 0;
+	ctx->glyphs_capacity = 0;
+}
+#endif
+
+// Sends the quads collected by draw_text, all from one atlas page
+static void glyph_batch_flush(Ctx *ctx, Uint32 page, SDL_Vertex *vertices, Uint32 *count) {
+	if (*count == 0) return;
+	SDL_RenderGeometry(ctx->renderer, ctx->atlas[page], vertices, *count * 6, NULL, 0);
+	profile_count(ctx, Profile_Counter_draw_calls, 1);
+	*count = 0;
+}
+
+// Zero text_length means text is null terminated
+static inline int draw_text(Ctx *ctx, float x, float y, SDL_Color color, size_t text_length, const char text[text_length]) {
+	if (text == NULL) return 0;
+	if (text_length == 0) text_length = SDL_strlen(text);
+	float pen = SDL_floor(x);
+	y = SDL_floor(y);
+	SDL_FColor tint = {color.r / 255.0f, color.g / 255.0f, color.b / 255.0f, color.a / 255.0f};
+	// Run goes out in as few draws as pages it touches
+	SDL_Vertex vertices[GLYPH_BATCH * 6];
+	Uint32 quads = 0, page = 0;
+	const char *cur = text;
+	size_t left = text_length;
+	while (left > 0) {
+		if (*cur == '\0') {
+			// SDL_StepUTF8 stops on it
+			cur += 1;
+			left -= 1;
+			pen += ctx->font_width;
+			continue;
+		}
+		Uint32 codepoint = SDL_StepUTF8(&cur, &left);
+		Glyph *glyph = glyph_get(ctx, codepoint);
+		if (glyph == NULL) {
+			pen += ctx->font_width;
+			continue;
+		}
+		if (glyph->rect.w > 0 && glyph->rect.h > 0) {
+			if (quads == GLYPH_BATCH || (quads > 0 && glyph->page != page)) glyph_batch_flush(ctx, page, vertices, &quads);
+			page = glyph->page;
+			float x0 = pen, y0 = y, x1 = pen + glyph->rect.w, y1 = y + glyph->rect.h;
+			float u0 = (float)glyph->rect.x / GLYPH_ATLAS_SIZE, v0 = (float)glyph->rect.y / GLYPH_ATLAS_SIZE;
+			float u1 = (float)(glyph->rect.x + glyph->rect.w) / GLYPH_ATLAS_SIZE, v1 = (float)(glyph->rect.y + glyph->rect.h) / GLYPH_ATLAS_SIZE;
+			SDL_Vertex *quad = &vertices[quads * 6];
+			quad[0] = (SDL_Vertex){{x0, y0}, tint, {u0, v0}};
+			quad[1] = (SDL_Vertex){{x1, y0}, tint, {u1, v0}};
+			quad[2] = (SDL_Vertex){{x1, y1}, tint, {u1, v1}};
+			quad[3] = quad[0];
+			quad[4] = quad[2];
+			quad[5] = (SDL_Vertex){{x0, y1}, tint, {u0, v1}};
+			quads += 1;
+		}
+		pen += glyph->advance;
+	}
+	glyph_batch_flush(ctx, page, vertices, &quads);
+#ifdef DEBUG
+	// Invalidate color
+	set_color(ctx, debug_purple);
+#endif
+	return pen - SDL_floor(x);
+}
+
+static inline int draw_text_fmt(Ctx *ctx, float x, float y, SDL_Color color, SDL_PRINTF_FORMAT_STRING const char *fmt, ...) SDL_PRINTF_VARARG_FUNC(5);
+static inline int draw_text_fmt(Ctx *ctx, float x, float y, SDL_Color color, SDL_PRINTF_FORMAT_STRING const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	if (SDL_strcmp(fmt, "%s") == 0) {
+		const char *str = va_arg(ap, const char *);
+		va_end(ap);
+		return draw_text(ctx, x, y, color, 0, str);
+	}
+	int len = 0;
+	char *str = arena_vsprintf(&ctx->frame_arena, &len, fmt, ap);
+	va_end(ap);
+	if (str == NULL) {
+		SDL_LogWarn(0, "Can't format |%s|", fmt);
+		return false;
+	}
+	return draw_text(ctx, x, y, color, len, str);
+}
+
+// How many columns fit into width, a glyph crossing the edge still goes on the line
+static inline Uint32 width_to_columns(Ctx *ctx, float width) {
+	float columns = SDL_ceil(width / ctx->font_width);
+	if (columns < 1) return 1;
+	return (Uint32)columns;
+}
+
+static String get_vis_line(Ctx *ctx, SDL_FRect bounds, size_t text_size, char text[text_size], Uint32 linenum) {
+	if (text_size == 0) return (String){0};
+	size_t size = text_size;
+	char *begin = text;
+	Uint32 limit = width_to_columns(ctx, bounds.w);
+	Uint32 columns;
+	while (linenum != 0) {
+		size_t line_size = text_kernels->find_newline(begin, size);
+		profile_count(ctx, Profile_Counter_bytes_scanned, line_size);
+		size_t consumed = text_kernels->columns_prefix(begin, line_size, limit, &columns);
+		if (columns >= limit && consumed < line_size) {
+			// Wrapped in the middle of the line
+			begin += consumed;
+			size -= consumed;
+			linenum -= 1;
+			continue;
+		}
+		begin += line_size;
+		size -= line_size;
+		if (size == 0 || *begin == '\0') {
+			// Line wrapped right at the end of text still makes an empty visual line
+			if (columns >= limit && linenum == 1) return (String){.text = begin, .size = 0};
+			return (String){0};
+		}
+		begin += 1;
+		size -= 1;
+		linenum -= 1;
+	}
+	size_t line_size = text_kernels->find_newline(begin, size);
+	return (String){.text = begin, .size = text_kernels->columns_prefix(begin, line_size, limit, &columns)};
+}
+
+static Uint32 split_into_lines(Ctx *ctx, Uint32 strings_length, String strings[strings_length], size_t text_size, char *text, Uint32 line_offset) {
+	Sint32 line = -line_offset;
+	if (text == NULL) {
+		if (line >= 0) {
+			strings[line] = (String) {
+				.size = 0,
+				.text = text,
+			};
+			return 1;
+		}
+		return 0;
+	}
+	char *end = text;
+	char *text_end = text + text_size;
+	char *last = text - 1;
+	while (end < text_end && *end != '\0') {
+		if ((Sint32)strings_length <= line) break;
+		size_t line_size = text_kernels->find_newline(end, text_end - end);
+		profile_count(ctx, Profile_Counter_bytes_scanned, line_size);
+		end += line_size;
+		if (line >= 0) {
+			strings[line] = (String) {
+				.size = end - text,
+				.text = text,
+			};
+		}
+		last = end;
+		line += 1;
+		if (end >= text_end || *end == '\0') break;
+		end += 1;
+		text = end;
+	}
+	if ((Sint32)strings_length > line && last != end && line >= 0) {
+		strings[line] = (String) {
+			.size = end - text,
+			.text = text,
+		};
+		line += 1;
+	}
+	return SDL_max(0, line);
+}
+
+// While no line is wider than the frame, visual lines are logical ones and come from the index
+static String buffer_get_vis_line(Ctx *ctx, TextBuffer *buffer, SDL_FRect bounds, Uint32 linenum) {
+	const Line_Index *index = &buffer->line_index;
+	if (!index->valid || index->longest_line >= width_to_columns(ctx, bounds.w)) {
+		return get_vis_line(ctx, bounds, buffer->text_size, buffer->text, linenum);
+	}
+	if (buffer->text_size == 0 || linenum >= index->lines_count) return (String){0};
+	size_t start = index->starts[linenum];
+	size_t end = linenum + 1 < index->lines_count ? index->starts[linenum + 1] - 1 : buffer->text_size;
+	return (String){.text = buffer->text + start, .size = end - start};
+}
+
+static Uint32 buffer_split_into_lines(Ctx *ctx, TextBuffer *buffer, Uint32 strings_length, String strings[strings_length], Uint32 line_offset) {
+	const Line_Index *index = &buffer->line_index;
+	if (!index->valid || line_offset >= index->lines_count || buffer->text == NULL) {
+		return split_into_lines(ctx, strings_length, strings, buffer->text_size, buffer->text, line_offset);
+	}
+	size_t start = index->starts[line_offset];
+	return split_into_lines(ctx, strings_length, strings, buffer->text_size - start, buffer->text + start, 0);
+}
+
+static void frame_cursor_moved(Ctx *ctx, Uint32 framei) {
+	Frame *frame = &ctx->frames[framei];
+	SDL_assert(frame->taken);
+	if (ctx->moving_extra_cursors || ctx->macro_replaying || ctx->batching_moves) return;
+	Uint32 line = buffer_count_lines(ctx, frame_buffer(ctx, frame), frame->cursor);
+	frame_scroll_to_line_centered(ctx, framei, line);
+}
+
+static void frame_beggining_line(Ctx *ctx, Uint32 frame) {
+	Uint32 cp;
+	Frame *current_frame = &ctx->frames[frame];
+	ctx->moving_col = false;
+	current_frame->scroll_lock = true;
+	const char *cur = frame_buffer(ctx, current_frame)->text + current_frame->cursor;
+	if (frame_buffer(ctx, current_frame)->text_size == 0) return;
+	do {
+		cp = SDL_StepBackUTF8(frame_buffer(ctx, current_frame)->text, &cur);
+	} while (cp != 0 && cp != '\n');
+	if (cp == '\n') SDL_StepUTF8(&cur, 0);
+	current_frame->cursor = cur - frame_buffer(ctx, current_frame)->text;
+	ctx->should_render = true;
+}
+
+static void frame_beggining_spaced_line(Ctx *ctx, Uint32 frame) {
+	Uint32 cp;
+	Frame *current_frame = &ctx->frames[frame];
+	ctx->moving_col = false;
+	current_frame->scroll_lock = true;
+	const char *cur = frame_buffer(ctx, current_frame)->text + current_frame->cursor;
+	if (frame_buffer(ctx, current_frame)->text_size == 0) return;
+	do {
+		cp = SDL_StepBackUTF8(frame_buffer(ctx, current_frame)->text, &cur);
+	} while (cp != 0 && cp != '\n');
+	if (cp == '\n') {
+		cp = SDL_StepUTF8(&cur, 0);
+	}
+	do {
+		cp = SDL_StepUTF8(&cur, 0);
+	} while (cp == ' ' || cp == '\t');
+	if (cp != 0) SDL_StepBackUTF8(frame_buffer(ctx, current_frame)->text, &cur);
+	current_frame->cursor = cur - frame_buffer(ctx, current_frame)->text;
+	ctx->should_render = true;
+}
+
+static void frame_end_line(Ctx *ctx, Uint32 frame) {
+	Uint32 cp;
+	Frame *current_frame = &ctx->frames[frame];
+	ctx->moving_col = false;
+	current_frame->scroll_lock = true;
+	const char *cur = frame_buffer(ctx, current_frame)->text + current_frame->cursor;
+	if (frame_buffer(ctx, current_frame)->text_size == 0) return;
+	do {
+		cp = SDL_StepUTF8(&cur, 0);
+	} while (cp != 0 && cp != '\n');
+	if (cp == '\n') cp = SDL_StepBackUTF8(frame_buffer(ctx, current_frame)->text, &cur);
+	current_frame->cursor = cur - frame_buffer(ctx, current_frame)->text;
+	ctx->should_render = true;
+}
+
+static void frame_previous_char(Ctx *ctx, Uint32 frame) {
+	Frame *current_frame = &ctx->frames[frame];
+	ctx->moving_col = false;
+	current_frame->scroll_lock = true;
+	if (frame_buffer(ctx, current_frame)->text_size == 0) return;
+	const char *text = &frame_buffer(ctx, current_frame)->text[current_frame->cursor];
+	SDL_StepBackUTF8(frame_buffer(ctx, current_frame)->text, &text);
+	current_frame->cursor = text - frame_buffer(ctx, current_frame)->text;
+	ctx->should_render = true;
+}
+
+static void frame_next_char(Ctx *ctx, Uint32 frame) {
+	Frame *current_frame = &ctx->frames[frame];
+	ctx->moving_col = false;
+	current_frame->scroll_lock = true;
+	if (frame_buffer(ctx, current_frame)->text_size == 0) return;
+	const char *text = &frame_buffer(ctx, current_frame)->text[current_frame->cursor];
+	size_t len = frame_buffer(ctx, current_frame)->text_size - current_frame->cursor;
+	SDL_StepUTF8(&text, &len);
+	current_frame->cursor = text - frame_buffer(ctx, current_frame)->text;
+	ctx->should_render = true;
+}
+
+static Uint32 text_previous_char(const char *text, Uint32 pos) {
+	const char *previous = text + pos;
+	SDL_StepBackUTF8(text, &previous);
+	return previous - text;
+}
+
+static Uint32 text_previous_word(const char *text, Uint32 pos) {
+	const char *previous = text + pos;
+	Uint32 cp;
+	do {
+		cp = SDL_StepBackUTF8(text, &previous);
+	} while (cp != 0 && !is_word_char(cp));
+	do {
+		cp = SDL_StepBackUTF8(text, &previous);
+	} while (cp != 0 && is_word_char(cp));
+	if (cp != 0)
+		SDL_StepUTF8(&previous, 0);
+	return previous - text;
+}
+
+static void frame_delete_previous_char(Ctx *ctx, Uint32 framei, Undo_Group undo_group) {
+	Frame *frame = &ctx->frames[framei];
+	SDL_assert(frame->taken);
+	ctx->moving_col = false;
+	if (frame->cursor <= 0 || frame_buffer(ctx, frame)->text_size <= 0) return;
+	Uint32 previous = text_previous_char(frame_buffer(ctx, frame)->text, frame->cursor);
+	buffer_delete_text(ctx, (frame_buffer(ctx, frame) - ctx->buffers), previous, frame->cursor, undo_group);
+}
+
+static void frame_delete_previous_word(Ctx *ctx, Uint32 framei, Undo_Group undo_group) {
+	Frame *frame = &ctx->frames[framei];
+	SDL_assert(frame->taken);
+	ctx->moving_col = false;
+	if (frame->cursor <= 0 || frame_buffer(ctx, frame)->text_size <= 0) return;
+	Uint32 previous = text_previous_word(frame_buffer(ctx, frame)->text, frame->cursor);
+	buffer_delete_text(ctx, (frame_buffer(ctx, frame) - ctx->buffers), previous, frame->cursor, undo_group);
+}
+
+// Typing with multiple cursors, whole keystroke is one batch
+static void frame_insert_text(Ctx *ctx, Uint32 framei, const char *in, size_t in_len, Undo_Group undo_group) {
+	Frame *frame = &ctx->frames[framei];
+	SDL_assert(frame->taken);
+	if (in_len == 0) return;
+	if (frame->cursors_count == 0) {
+		buffer_insert_text(ctx, frame_buffer(ctx, frame), in, in_len, frame->cursor, undo_group);
+		return;
+	}
+	Uint32 count;
+	Uint32 *positions = frame_collect_cursors(ctx, framei, &count);
+	Buffer_Edit *edits = SDL_malloc(count * sizeof *edits);
+	if (positions == NULL || edits == NULL) {
+		SDL_Log("Error, can't allocate edits for %" SDL_PRIu32 " cursors", frame->cursors_count + 1);
+		SDL_free(positions);
+		SDL_free(edits);
+		return;
+	}
+	for (Uint32 i = 0; i < count; ++i) {
+		edits[i] = (Buffer_Edit) {
+			.pos = SDL_min(positions[i], frame_buffer(ctx, frame)->text_size),
+			.ins_len = in_len,
+		};
+	}
+	buffer_apply_batch(ctx, (frame_buffer(ctx, frame) - ctx->buffers), count, edits, in_len, in, undo_group);
+	SDL_free(edits);
+	SDL_free(positions);
+}
+
+static void frame_delete_before_cursors(Ctx *ctx, Uint32 framei, bool word, Undo_Group undo_group) {
+	Frame *frame = &ctx->frames[framei];
+	SDL_assert(frame->taken);
+	if (frame->cursors_count == 0) {
+		if (word) frame_delete_previous_word(ctx, framei, undo_group);
+		else frame_delete_previous_char(ctx, framei, undo_group);
+		return;
+	}
+	ctx->moving_col = false;
+	if (frame_buffer(ctx, frame)->text_size <= 0) return;
+	Uint32 count;
+	Uint32 *positions = frame_collect_cursors(ctx, framei, &count);
+	Buffer_Edit *edits = SDL_malloc(count * sizeof *edits);
+	if (positions == NULL || edits == NULL) {
+		SDL_Log("Error, can't allocate edits for %" SDL_PRIu32 " cursors", frame->cursors_count + 1);
+		SDL_free(positions);
+		SDL_free(edits);
+		return;
+	}
+	Uint32 edits_count = 0;
+	Uint32 prev_end = 0;
+	for (Uint32 i = 0; i < count; ++i) {
+		Uint32 pos = SDL_min(positions[i], frame_buffer(ctx, frame)->text_size);
+		Uint32 from = word ? text_previous_word(frame_buffer(ctx, frame)->text, pos) : text_previous_char(frame_buffer(ctx, frame)->text, pos);
+		from = SDL_max(from, prev_end);
+		if (from >= pos) continue;
+		edits[edits_count++] = (Buffer_Edit) {
+			.pos = from,
+			.del_len = pos - from,
+		};
+		prev_end = pos;
+	}
+	buffer_apply_batch(ctx, (frame_buffer(ctx, frame) - ctx->buffers), edits_count, edits, 0, NULL, undo_group);
+	SDL_free(edits);
+	SDL_free(positions);
+}
+
+static void frame_forward_paragraph(Ctx *ctx, Uint32 frame) {
+	Frame *current_frame = &ctx->frames[frame];
+	SDL_assert(current_frame->taken);
+	ctx->moving_col = false;
+	current_frame->scroll_lock = true;
+	TextBuffer *buffer = frame_buffer(ctx, current_frame);
+	if (buffer->text_size == 0 || !structure_ensure(buffer)) return;
+	Uint32 next = marks_next(&buffer->structure.paragraphs, current_frame->cursor + 1);
+	current_frame->cursor = next != (Uint32)-1 ? next : buffer->text_size;
+	frame_cursor_moved(ctx, frame);
+	ctx->should_render = true;
+}
+
+static void frame_backward_paragraph(Ctx *ctx, Uint32 frame) {
+	Frame *current_frame = &ctx->frames[frame];
+	SDL_assert(current_frame->taken);
+	ctx->moving_col = false;
+	current_frame->scroll_lock = true;
+	TextBuffer *buffer = frame_buffer(ctx, current_frame);
+	if (buffer->text_size == 0 || !structure_ensure(buffer)) return;
+	Uint32 previous = marks_previous(&buffer->structure.paragraphs, current_frame->cursor);
+	current_frame->cursor = previous != (Uint32)-1 ? previous : 0;
+	frame_cursor_moved(ctx, frame);
+	ctx->should_render = true;
+}
+
+// To the pair of the bracket under or right before the cursor
+static void frame_match_bracket(Ctx *ctx, Uint32 frame) {
+	Frame *current_frame = &ctx->frames[frame];
+	SDL_assert(current_frame->taken);
+	ctx->moving_col = false;
+	TextBuffer *buffer = frame_buffer(ctx, current_frame);
+	if (buffer->text_size == 0 || !structure_ensure(buffer)) return;
+	Uint32 open, close;
+	if (!structure_match(buffer, current_frame->cursor, &open, &close)) return;
+	current_frame->scroll_lock = true;
+	current_frame->cursor = current_frame->cursor == open ? close : open;
+	frame_cursor_moved(ctx, frame);
+	ctx->should_render = true;
+}
+
+static void frame_next_word(Ctx *ctx, Uint32 frame) {
+	Frame *current_frame = &ctx->frames[frame];
+	ctx->moving_col = false;
+	current_frame->scroll_lock = true;
+	if (frame_buffer(ctx, current_frame)->text_size == 0) return;
+	const char *text = &frame_buffer(ctx, current_frame)->text[current_frame->cursor];
+	size_t len = frame_buffer(ctx, current_frame)->text_size - current_frame->cursor;
+	Uint32 cp;
+	do {
+		cp = SDL_StepUTF8(&text, &len);
+	} while (cp != 0 && !is_word_char(cp));
+	do {
+		cp = SDL_StepUTF8(&text, &len);
+	} while (is_word_char(cp));
+	if (cp != 0)
+		SDL_StepBackUTF8(frame_buffer(ctx, current_frame)->text, &text);
+	current_frame->cursor = text - frame_buffer(ctx, current_frame)->text;
+	ctx->should_render = true;
+}
+
+static void frame_previous_word(Ctx *ctx, Uint32 frame) {
+	Frame *current_frame = &ctx->frames[frame];
+	ctx->moving_col = false;
+	current_frame->scroll_lock = true;
+	if (frame_buffer(ctx, current_frame)->text_size == 0) return;
+	const char *text = &frame_buffer(ctx, current_frame)->text[current_frame->cursor];
+	Uint32 cp;
+	do {
+		cp = SDL_StepBackUTF8(frame_buffer(ctx, current_frame)->text, &text);
+	} while (cp != 0 && !is_word_char(cp));
+	do {
+		cp = SDL_StepBackUTF8(frame_buffer(ctx, current_frame)->text, &text);
+	} while (is_word_char(cp));
+	if (cp != 0)
+		SDL_StepUTF8(&text, 0);
+	current_frame->cursor = text - frame_buffer(ctx, current_frame)->text;
+	ctx->should_render = true;
+}
+
+static void frame_previous_line(Ctx *ctx, Uint32 frame) {
+	Frame *current_frame = &ctx->frames[frame];
+	Uint32 row = 0;
+	current_frame->scroll_lock = true;
+	if (frame_buffer(ctx, current_frame)->text_size == 0) return;
+	const char *text = frame_buffer(ctx, current_frame)->text;
+	size_t line_start = text_line_start(text, current_frame->cursor);
+	if (line_start == 0) {
+		current_frame->cursor = 0;
+		frame_cursor_moved(ctx, frame);
+		return;
+	}
+	text_kernels->columns_prefix(text + line_start, current_frame->cursor - line_start, (Uint32)-1, &row);
+	size_t previous_start = text_line_start(text, line_start - 1);
+	if (ctx->moving_col) row = ctx->last_row;
+	else ctx->last_row = row;
+	ctx->moving_col = true;
+	ctx->should_render = true;
+	Uint32 columns;
+	current_frame->cursor = previous_start
+		+ text_kernels->columns_prefix(text + previous_start, line_start - 1 - previous_start, row, &columns);
+	frame_cursor_moved(ctx, frame);
+}
+
+static void frame_next_line(Ctx *ctx, Uint32 frame) {
+	Frame *current_frame = &ctx->frames[frame];
+	Uint32 row = 0;
+	current_frame->scroll_lock = true;
+	size_t text_size = frame_buffer(ctx, current_frame)->text_size;
+	if (text_size == 0) return;
+	const char *text = frame_buffer(ctx, current_frame)->text;
+	size_t cursor = current_frame->cursor;
+	size_t line_start = text_line_start(text, cursor);
+	text_kernels->columns_prefix(text + line_start, cursor - line_start, (Uint32)-1, &row);
+	size_t next_start = cursor + text_kernels->find_newline(text + cursor, text_size - cursor);
+	if (next_start < text_size && text[next_start] == '\n') next_start += 1;
+	if (ctx->moving_col) row = ctx->last_row;
+	else ctx->last_row = row;
+	ctx->moving_col = true;
+	ctx->should_render = true;
+	size_t next_length = text_kernels->find_newline(text + next_start, text_size - next_start);
+	Uint32 columns;
+	current_frame->cursor = next_start
+		+ text_kernels->columns_prefix(text + next_start, next_length, row, &columns);
+	frame_cursor_moved(ctx, frame);
+}
+
+// Moves every cursor of the frame with the same motion, only the main one scrolls
+static void frame_move_cursors(Ctx *ctx, Uint32 framei, void (*move)(Ctx *ctx, Uint32 frame)) {
+	Frame *frame = &ctx->frames[framei];
+	if (frame->cursors_count > 0) {
+		Uint32 main_cursor = frame->cursor;
+		Uint32 last_row = ctx->last_row;
+		bool moving_col = ctx->moving_col;
+		ctx->moving_extra_cursors = true;
+		for (Uint32 i = 0; i < frame->cursors_count; ++i) {
+			frame->cursor = frame->cursors[i];
+			ctx->moving_col = false;
+			move(ctx, framei);
+			frame->cursors[i] = frame->cursor;
+		}
+		ctx->moving_extra_cursors = false;
+		frame->cursor = main_cursor;
+		ctx->last_row = last_row;
+		ctx->moving_col = moving_col;
+	}
+	move(ctx, framei);
+	frame_normalize_cursors(frame);
+}
+
+// Leaves a cursor on the current line and moves the main one to the next or previous line
+static void frame_add_cursor_line(Ctx *ctx, Uint32 framei, bool down) {
+	Frame *frame = &ctx->frames[framei];
+	SDL_assert(frame->taken);
+	Uint32 pos = frame->cursor;
+	if (down) frame_next_line(ctx, framei);
+	else frame_previous_line(ctx, framei);
+	if (frame->cursor == pos) return;
+	frame_add_cursor(ctx, framei, pos);
+}
+
+// Places a cursor on every line of the selection, in the column of the main cursor
+static void frame_cursors_from_selection(Ctx *ctx, Uint32 framei) {
+	Frame *frame = &ctx->frames[framei];
+	SDL_assert(frame->taken);
+	if (!frame->active_selection || frame_buffer(ctx, frame)->text_size == 0) return;
+	const char *text = frame_buffer(ctx, frame)->text;
+	Uint32 selection_min = SDL_min(frame->cursor, frame->selection);
+	Uint32 selection_max = SDL_max(frame->cursor, frame->selection);
+	Uint32 line_start = frame->cursor;
+	while (line_start > 0 && text[line_start - 1] != '\n') line_start -= 1;
+	Uint32 column = string_to_visual(ctx, frame->cursor - line_start, text + line_start);
+	Uint32 pos = selection_min;
+	while (pos > 0 && text[pos - 1] != '\n') pos -= 1;
+	while (pos <= selection_max) {
+		Uint32 row = 0;
+		const char *cur = text + pos;
+		size_t len = frame_buffer(ctx, frame)->text_size - pos;
+		while (row < column && len > 0 && *cur != '\n') {
+			Uint32 cp = SDL_StepUTF8(&cur, &len);
+			if (cp == '\t') row += TAB_WIDTH;
+			else row += 1;
+		}
+		if (!frame_push_cursor(frame, cur - text)) break;
+		while (len > 0 && *cur != '\n') {
+			cur += 1;
+			len -= 1;
+		}
+		if (len == 0) break;
+		pos = cur + 1 - text;
+	}
+	frame_normalize_cursors(frame);
+	frame->active_selection = false;
+	ctx->should_render = true;
+}
+
+static Uint32 split_into_vis_lines(Ctx *ctx, SDL_FRect bounds, String line, Uint32 vislines_count, String vislines[vislines_count]) {
+	// TODO(c4llv07e): Make it use TTF_MeasureString
+	if (line.text == NULL || line.size <= 0) {
+		if (vislines_count > 0) {
+			vislines[0] = (String){0};
+			return 1;
+		}
+		return 0;
+	}
+	if (vislines_count <= 0) return 0;
+	char *text = line.text;
+	size_t size = line.size;
+	Uint32 limit = width_to_columns(ctx, bounds.w);
+	Uint32 linenum = 1;
+	vislines[0].text = line.text;
+	vislines[0].size = line.size;
+	while (true) {
+		Uint32 columns;
+		size_t consumed = text_kernels->columns_prefix(text, size, limit, &columns);
+		profile_count(ctx, Profile_Counter_bytes_scanned, consumed);
+		if (columns < limit) break;
+		text += consumed;
+		size -= consumed;
+		vislines[linenum - 1].size -= size;
+		if (linenum >= vislines_count) break;
+		if (size <= 0) break;
+		vislines[linenum].text = text;
+		vislines[linenum].size = size;
+		linenum += 1;
+	}
+	return linenum;
+}
+
+// Color at position of the line, span is the current one and next is where the following one starts
+static inline SDL_Color syntax_color_at(const Syntax_Spans *spans, size_t position, Uint32 *span, size_t *next) {
+	while (*span + 1 < spans->count && spans->spans[*span + 1].start <= position) *span += 1;
+	*next = *span + 1 < spans->count ? spans->spans[*span + 1].start : SDL_SIZE_MAX;
+	if (spans->count == 0 || spans->spans[*span].start > position) {
+		*next = spans->count > 0 ? spans->spans[0].start : SDL_SIZE_MAX;
+		return text_color;
+	}
+	return syntax_colors[spans->spans[*span].color];
+}
+
+// Without spans all text is in text_color
+static void render_line(Ctx *ctx, SDL_FRect bounds, SDL_FPoint *start, size_t text_size, const char text[text_size], const Syntax_Spans *spans) {
+	size_t accum = 0;
+	if (text_size == 0) {
+		start->x = bounds.x;
+		start->y += ctx->line_height;
+		return;
+	}
+	SDL_Color color = text_color;
+	Uint32 span = 0;
+	size_t position = 0; // Of text in the line of spans
+	size_t next_span = SDL_SIZE_MAX;
+	if (spans != NULL) {
+		position = text - spans->line;
+		color = syntax_color_at(spans, position, &span, &next_span);
+	}
+	while (text_size > 0 && accum < text_size) {
+		if (position + accum >= next_span) {
+			if (accum != 0) {
+				start->x += draw_text(ctx, start->x, start->y, color, accum, text);
+				text += accum;
+				text_size -= accum;
+				position += accum;
+				accum = 0;
+			}
+			color = syntax_color_at(spans, position, &span, &next_span);
+		} else if (text[accum] == '\t') {
+			if (accum != 0) {
+				int offset = draw_text(ctx, start->x, start->y, color, accum, text);
+				start->x += offset;
+			}
+			SDL_RenderTexture(ctx->renderer, ctx->tab_texture, NULL, &(SDL_FRect) {
+				.x = SDL_floor(start->x),
+				.y = SDL_floor(start->y),
+				.w = ctx->font_width * TAB_WIDTH,
+				.h = ctx->font_size,
+			});
+			profile_count(ctx, Profile_Counter_draw_calls, 1);
+			start->x += ctx->font_width * TAB_WIDTH;
+			text += accum + 1;
+			text_size -= accum + 1;
+			position += accum + 1;
+			accum = 0;
+		} else if (text[accum] == ' ') {
+			if (accum != 0) {
+				int offset = draw_text(ctx, start->x, start->y, color, accum, text);
+				start->x += offset;
+			}
+			SDL_RenderTexture(ctx->renderer, ctx->space_texture, NULL, &(SDL_FRect) {
+				.x = start->x,
+				.y = start->y,
+				.w = ctx->font_width,
+				.h = ctx->font_size,
+			});
+			profile_count(ctx, Profile_Counter_draw_calls, 1);
+			start->x += ctx->font_width;
+			text += accum + 1;
+			text_size -= accum + 1;
+			position += accum + 1;
+			accum = 0;
+		} else {
+			accum += 1;
+		}
+	}
+	if (accum != 0) {
+		draw_text(ctx, start->x, start->y, color, accum, text);
+	}
+	start->x = bounds.x;
+	start->y += ctx->line_height;
+}
+
+static void render_frame(Ctx *ctx, Uint32 frame) {
+	String vislines[0x10] = {0};
+	Frame *draw_frame = &ctx->frames[frame];
+	Frame_Cold *cold = frame_cold(ctx, draw_frame);
+	TextBuffer *buffer = frame_buffer(ctx, draw_frame);
+	TextBuffer *search_buffer = NULL;
+	if (cold->searching_mode) {
+		Uint32 search_frame = frame_resolve(ctx, cold->search_frame);
+		if (search_frame != (Uint32)-1) search_buffer = frame_buffer(ctx, &ctx->frames[search_frame]);
+	}
+#ifdef DEBUG
+	ctx->draw_text_back_color = 0;
+#endif
+	char *text = buffer->text;
+	SDL_FRect bounds, lines_bounds, lines_numbers_bounds;
+	get_frame_render_rect(ctx, frame, &bounds);
+	get_frame_render_text_rect(ctx, frame, &lines_bounds);
+	get_frame_render_lines_numbers_rect(ctx, frame, &lines_numbers_bounds);
+	Uint32 lines_capacity = SDL_max(0, lines_bounds.h / ctx->line_height) + 2; // Partly visible first and last
+	String *lines = arena_alloc(&ctx->frame_arena, lines_capacity * sizeof *lines);
+	if (lines == NULL) return;
+	if (draw_frame->frame_type == Frame_Type_search) {
+		if (cold->search_status == Search_Status_not_found) {
+			set_color(ctx, background_color_error);
+		} else {
+			SDL_SetRenderDrawColor(ctx->renderer, 0x12, 0x12, 0x12, SDL_ALPHA_OPAQUE);
+		}
+	} else {
+		SDL_SetRenderDrawColor(ctx->renderer, 0x12, 0x12, 0x12, SDL_ALPHA_OPAQUE);
+	}
+	SDL_RenderFillRect(ctx->renderer, &(SDL_FRect) {
+		bounds.x,
+		bounds.y,
+		bounds.w,
+		bounds.h,
+	});
+	if (SDL_fabs(ctx->frames[frame].scroll_interp.y - ctx->frames[frame].scroll.y) >= 0.01) {
+		float speed = 10;
+		ctx->frames[frame].scroll_interp.y = lerp(ctx->frames[frame].scroll_interp.y, ctx->frames[frame].scroll.y, speed * ctx->deltatime);
+		ctx->should_render = true;
+	}
+	Uint32 lines_count;
+	Uint64 layout_start = profile_begin();
+	String offset_line = buffer_get_vis_line(ctx, buffer, bounds, SDL_max(0, -draw_frame->scroll_interp.y / ctx->line_height));
+	Uint32 linenum_offset = 0;
+	if (offset_line.text > text)
+		linenum_offset = buffer_count_lines(ctx, buffer, offset_line.text - text);
+	else if (offset_line.text == 0)
+		linenum_offset = buffer_count_lines(ctx, buffer, buffer->text_size);
+	lines_count = buffer_split_into_lines(ctx, buffer, lines_capacity, lines, linenum_offset);
+	profile_end(ctx, Profile_Phase_layout, layout_start);
+	Uint32 selection_min = SDL_min(draw_frame->cursor, draw_frame->selection);
+	Uint32 selection_max = SDL_max(draw_frame->cursor, draw_frame->selection);
+	// Bracket pair at the cursor or around it, once the whole buffer is indexed
+	Uint32 block_open = 0, block_close = 0;
+	bool block = frame_is_multiline(ctx, frame) && text != NULL && buffer->structure.built >= buffer->text_size
+		&& (structure_match(buffer, draw_frame->cursor, &block_open, &block_close)
+			|| structure_enclosing(buffer, draw_frame->cursor, &block_open, &block_close));
+	SDL_FPoint start = {lines_bounds.x, lines_bounds.y + SDL_fmod(SDL_min(0, draw_frame->scroll_interp.y), ctx->line_height)};
+	const Syntax *syntax = syntax_prepare(buffer);
+	Syntax_Spans spans;
+	Uint32 linenum;
+	for (linenum = linenum_offset; linenum < lines_count + linenum_offset; ++linenum) {
+		String line = lines[linenum - linenum_offset];
+		layout_start = profile_begin();
+		Uint32 vislines_count = split_into_vis_lines(ctx, lines_bounds, line, SDL_arraysize(vislines), vislines);
+		const Syntax_Spans *line_spans = NULL;
+		if (syntax != NULL) {
+			if (syntax_lex_to(ctx, buffer, linenum)) {
+				spans.line = line.text;
+				spans.count = 0;
+				syntax->lex_line(buffer->syntax.states[linenum], line.text, line.size, &spans);
+				line_spans = &spans;
+			} else {
+				// Plain until the lexer catches up on the next frames
+				ctx->should_render = true;
+			}
+		}
+		profile_end(ctx, Profile_Phase_layout, layout_start);
+		if (cold->line_prefix != NULL) {
+			Uint32 prefix_size = SDL_utf8strlen(cold->line_prefix);
+			float prefix_width = prefix_size * ctx->font_width;
+			draw_text(ctx, start.x - prefix_width, start.y, prefix_color, prefix_size, cold->line_prefix);
+		}
+		if (frame_has_line_numbers(ctx, frame)) {
+			if (start.y >= lines_bounds.y && (start.y + ctx->line_height) < lines_bounds.y + lines_bounds.h) {
+				draw_text_fmt(ctx, start.x - (lines_bounds.x - lines_numbers_bounds.x), start.y, line_number_color, "%u", linenum);
+			}
+		}
+		for (Uint32 vislinenum = 0; vislinenum < vislines_count; ++vislinenum) {
+			String visline = vislines[vislinenum];
+#ifdef DEBUG_VISLINES
+			if (frame_has_line_numbers(ctx, frame)) {
+				if (start.y >= lines_bounds.y && (start.y + ctx->line_height) < lines_bounds.y + lines_bounds.h) {
+					draw_text_fmt(ctx, ctx->font_width * 2 + start.x - (lines_bounds.x - lines_numbers_bounds.x), start.y, debug_red, "%u", vislinenum);
+				}
+			}
+#endif
+			if (start.y < lines_bounds.y) {
+				start.y += ctx->line_height;
+				continue;
+			}
+			if (start.y + ctx->line_height > lines_bounds.y + lines_bounds.h + 4) break;
+			if (visline.size == 0) {
+				visline.text = line.text; // duct tape to make pointer math work
+			}
+			if (((visline.text - text <= draw_frame->cursor) && (visline.text - text + visline.size >= draw_frame->cursor))) {
+				set_color(ctx, current_line_background_color);
+				SDL_FRect current_line_bounds = {
+					.x = start.x,
+					.y = start.y,
+					.w = lines_bounds.w,
+					.h = ctx->line_height,
+				};
+				SDL_RenderFillRect(ctx->renderer, &current_line_bounds);
+				profile_count(ctx, Profile_Counter_draw_calls, 1);
+			} // end of current line highlight
+			if (draw_frame->active_selection) {
+				set_color(ctx, selection_color);
+				if ((visline.text + visline.size >= buffer->text + selection_min && visline.text <= buffer->text + selection_min) &&
+					(visline.text + visline.size >= buffer->text + selection_max && visline.text <= buffer->text + selection_max)) {
+					SDL_FRect selection_oneline_rect = {
+						.x = start.x + string_to_visual(ctx, SDL_min(visline.size, selection_min - (visline.text - text)), visline.text) * ctx->font_width,
+						.y = start.y,
+						.h = ctx->line_height,
+					};
+					selection_oneline_rect.w =
+						SDL_min((string_to_visual(ctx, SDL_min(visline.size, selection_max - (visline.text - text)), visline.text) * ctx->font_width)
+							- selection_oneline_rect.x + start.x,
+							lines_bounds.w - selection_oneline_rect.x + start.x);
+					if (selection_oneline_rect.x < start.x + lines_bounds.w) {
+						SDL_RenderFillRect(ctx->renderer, &selection_oneline_rect);
+						profile_count(ctx, Profile_Counter_draw_calls, 1);
+					}
+				} else if (visline.text + visline.size >= buffer->text + selection_min && visline.text <= buffer->text + selection_min) {
+					SDL_FRect selection_min_rect = {
+						.x = start.x + string_to_visual(ctx, SDL_min(visline.size, selection_min - (visline.text - text)), visline.text) * ctx->font_width,
+						.y = start.y,
+						.h = ctx->line_height,
+					};
+					selection_min_rect.w = lines_bounds.w - selection_min_rect.x + start.x;
+					SDL_RenderFillRect(ctx->renderer, &selection_min_rect);
+					profile_count(ctx, Profile_Counter_draw_calls, 1);
+				} else if (visline.text >= buffer->text + selection_min && visline.text + visline.size <= buffer->text + selection_max) {
+					SDL_FRect selection_intermediate_rect = {
+						.x = start.x,
+						.y = start.y,
+						.w = lines_bounds.w,
+						.h = ctx->line_height,
+					};
+					SDL_RenderFillRect(ctx->renderer, &selection_intermediate_rect);
+					profile_count(ctx, Profile_Counter_draw_calls, 1);
+				} else if (visline.text + visline.size >= buffer->text + selection_max && visline.text <= buffer->text + selection_max) {
+					SDL_FRect selection_max_rect = {
+						.x = start.x,
+						.y = start.y,
+						.w = SDL_min(string_to_visual(ctx, SDL_min(visline.size, selection_max - (visline.text - text)), visline.text) * ctx->font_width, lines_bounds.w),
+						.h = ctx->line_height,
+					};
+					SDL_RenderFillRect(ctx->renderer, &selection_max_rect);
+					profile_count(ctx, Profile_Counter_draw_calls, 1);
+				}
+			} // end of active selection
+			if (search_buffer != NULL && search_buffer->text_size > 0) {
+				const char *search_cursor = visline.text;
+				set_color(ctx, search_background_color);
+				while (true) {
+					search_cursor = SDL_strnstr(search_cursor, search_buffer->text, visline.text + visline.size - search_cursor);
+					if (search_cursor == NULL) break;
+					SDL_FRect search_hi_rect = {
+						.x = start.x + string_to_visual(ctx, search_cursor - visline.text, visline.text) * ctx->font_width,
+						.y = start.y,
+						.w = search_buffer->text_size * ctx->font_width,
+						.h = ctx->line_height,
+					};
+					search_hi_rect.w = SDL_min(search_hi_rect.w, lines_bounds.w - search_hi_rect.x + start.x);
+					if (search_hi_rect.x < start.x + lines_bounds.w) {
+						SDL_RenderFillRect(ctx->renderer, &search_hi_rect);
+						profile_count(ctx, Profile_Counter_draw_calls, 1);
+					}
+					search_cursor += search_buffer->text_size;
+				}
+			} // end of searching mode
+			Uint32 visline_pos = visline.text - text;
+			if (block && visline_pos <= block_close && visline_pos + visline.size >= block_open) {
+				set_color(ctx, block_color);
+				SDL_RenderFillRect(ctx->renderer, &(SDL_FRect) {
+					.x = start.x - 3,
+					.y = start.y,
+					.w = 2,
+					.h = ctx->line_height,
+				});
+				profile_count(ctx, Profile_Counter_draw_calls, 1);
+			} // end of block bar
+			Sint32 hscroll = SDL_floor(draw_frame->scroll_interp.x / ctx->font_width);
+			SDL_FPoint line_start = start;
+			render_line(ctx, lines_bounds, &start, SDL_max(0, (Sint32)visline.size - hscroll), visline.text, line_spans);
+			for (Uint32 side = 0; block && side < 2; ++side) {
+				Uint32 bracket = side == 0 ? block_open : block_close;
+				if (bracket < visline_pos || bracket >= visline_pos + visline.size) continue;
+				SDL_FRect bracket_rect = {
+					.x = line_start.x + string_to_visual(ctx, bracket - visline_pos, visline.text) * ctx->font_width - draw_frame->scroll_interp.x,
+					.y = line_start.y,
+					.w = ctx->font_width,
+					.h = ctx->line_height,
+				};
+				if (bracket_rect.x >= line_start.x && bracket_rect.x < line_start.x + lines_bounds.w) {
+					set_color(ctx, block_color);
+					SDL_RenderRect(ctx->renderer, &bracket_rect);
+					profile_count(ctx, Profile_Counter_draw_calls, 1);
+				}
+			} // end of block brackets
+			if (((visline.text - text <= draw_frame->selection) && (visline.text - text + visline.size >= draw_frame->selection))) {
+				SDL_FRect selection_rect = {
+					.x = line_start.x + string_to_visual(ctx, SDL_min(visline.size, draw_frame->selection - (visline.text - text)), visline.text) * ctx->font_width - draw_frame->scroll_interp.x,
+					.y = line_start.y,
+					.w = ctx->font_width,
+					.h = ctx->line_height,
+				};
+				if (selection_rect.x < start.x + lines_bounds.w) {
+					set_color(ctx, selection_rect_color);
+					SDL_RenderRect(ctx->renderer, &selection_rect);
+				}
+			} // end of selection cursor
+			if (((visline.text - text <= draw_frame->cursor) && (visline.text - text + visline.size >= draw_frame->cursor))) {
+				Uint32 visual_x = string_to_visual(ctx, SDL_min(visline.size, draw_frame->cursor - (visline.text - text)), visline.text) * ctx->font_width - draw_frame->scroll_interp.x;
+				SDL_FPoint actual_cursor_pos = {
+					.x = line_start.x + SDL_fmod(visual_x, lines_bounds.w),
+					.y = line_start.y + SDL_floor(visual_x / lines_bounds.w) * ctx->line_height,
+				};
+				float speed = 30;
+				Uint32 width = 2;
+				if (ctx->focused_frame == frame &&
+					(((SDL_fabs(actual_cursor_pos.x - ctx->active_cursor_pos.x) >= 0.01) ||
+					(SDL_fabs(actual_cursor_pos.y - ctx->active_cursor_pos.y) >= 0.01)))) {
+					width = SDL_max(width, SDL_log(SDL_abs(ctx->active_cursor_pos.x - lerp(ctx->active_cursor_pos.x, actual_cursor_pos.x, speed * ctx->deltatime))) * 2);
+					ctx->active_cursor_pos.x = lerp(ctx->active_cursor_pos.x, actual_cursor_pos.x, SDL_min(1, speed * ctx->deltatime));
+					ctx->active_cursor_pos.y = lerp(ctx->active_cursor_pos.y, actual_cursor_pos.y, SDL_min(1, speed * ctx->deltatime));
+					ctx->should_render = true;
+				}
+				SDL_FRect cursor_rect = {
+					.x = actual_cursor_pos.x,
+					.y = actual_cursor_pos.y,
 					.w = ctx->font_width,
 					.h = ctx->line_height,
 				};
@@ -1225,368 +5735,2451 @@ static void render_frame(Ctx *ctx, Uint32 frame) {
 					cursor_rect.y = ctx->active_cursor_pos.y;
 					cursor_rect.w = width;
 				}
-				if (ctx->frames[frame].frame_type != Frame_Type_ask) {
-					SDL_GetRectIntersectionFloat(&bounds, &cursor_rect, &cursor_rect);
+				if (ctx->frames[frame].frame_type != Frame_Type_ask) {
+					SDL_GetRectIntersectionFloat(&bounds, &cursor_rect, &cursor_rect);
+				}
+				cursor_rect.w = SDL_max(0, cursor_rect.w);
+				cursor_rect.h = SDL_max(0, cursor_rect.h);
+				set_color(ctx, text_color);
+				if (cursor_rect.x >= bounds.x + bounds.w) {
+					if (ctx->overflow_cursor_texture) {
+						cursor_rect.x = bounds.x + bounds.w - ctx->font_width * 1.5;
+						cursor_rect.w = ctx->font_width;
+						SDL_RenderTexture(ctx->renderer, ctx->overflow_cursor_texture, NULL, &cursor_rect);
+					} else {
+						cursor_rect.x = bounds.x + bounds.w - 12;
+						cursor_rect.w = 12;
+						set_color(ctx, debug_red);
+						SDL_RenderFillRect(ctx->renderer, &cursor_rect);
+					}
+				} else if (ctx->focused_frame == frame) {
+					SDL_RenderFillRect(ctx->renderer, &cursor_rect);
+				} else {
+					SDL_RenderRect(ctx->renderer, &cursor_rect);
+				}
+			} // end of cursor
+			if (draw_frame->cursors_count > 0) {
+				Uint32 visline_start = visline.text - text;
+				Uint32 lo = 0, hi = draw_frame->cursors_count;
+				while (lo < hi) {
+					Uint32 mid = lo + (hi - lo) / 2;
+					if (draw_frame->cursors[mid] < visline_start) lo = mid + 1;
+					else hi = mid;
+				}
+				set_color(ctx, text_color);
+				for (Uint32 c = lo; c < draw_frame->cursors_count && draw_frame->cursors[c] <= visline_start + visline.size; ++c) {
+					SDL_FRect extra_cursor_rect = {
+						.x = line_start.x + string_to_visual(ctx, draw_frame->cursors[c] - visline_start, visline.text) * ctx->font_width - draw_frame->scroll_interp.x,
+						.y = line_start.y,
+						.w = 2,
+						.h = ctx->line_height,
+					};
+					if (extra_cursor_rect.x < line_start.x + lines_bounds.w) {
+						SDL_RenderFillRect(ctx->renderer, &extra_cursor_rect);
+						profile_count(ctx, Profile_Counter_draw_calls, 1);
+					}
+				}
+			} // end of extra cursors
+		}
+	}
+	if (frame_has_line_numbers(ctx, frame)) {
+		for (; (start.y + ctx->line_height) < lines_numbers_bounds.y + lines_numbers_bounds.h; ++linenum) {
+			draw_text_fmt(ctx, start.x - (lines_bounds.x - lines_numbers_bounds.x), start.y, line_number_dimmed_color, "%u", linenum);
+			start.y += ctx->line_height;
+		}
+	} // end of line numbers
+#ifdef DEBUG_UNDO
+	for (Uint32 i = 0; i < buffer->undos_size; ++i) {
+		Undo_Operation op = buffer->undos[i];
+		SDL_FPoint start = {50, 200};
+		draw_text_fmt(ctx, start.x, start.y + i * ctx->line_height, debug_green, "%u (%d %u - %u) %.*s", i, (int)op.type, op.pos, op.len, (int)op.len, op.data);
+	}
+#endif
+#ifdef DEBUG_SCROLL
+	if (draw_frame->scroll_lock)
+		SDL_SetRenderDrawColor(ctx->renderer, 0xcc, 0x20, 0x20, SDL_ALPHA_OPAQUE);
+	else
+		SDL_SetRenderDrawColor(ctx->renderer, 0x20, 0xcc, 0x20, SDL_ALPHA_OPAQUE);
+	SDL_RenderFillRect(ctx->renderer, &(SDL_FRect) {
+		bounds.x + bounds.w - 0x10,
+		bounds.y,
+		0x10, 0x10,
+	});
+#endif
+#ifdef DEBUG_CURSOR
+	draw_text_fmt(ctx, bounds.x + bounds.w - 0x10 * ctx->font_width, bounds.y + bounds.h - ctx->line_height * 2, text_color, "%u", draw_frame->cursor);
+#endif
+#ifdef DEBUG_FILES
+	if (cold->filename) {
+		SDL_SetRenderDrawColor(ctx->renderer, 0x20, 0x20, 0x20, SDL_ALPHA_OPAQUE);
+		SDL_RenderFillRect(ctx->renderer, &(SDL_FRect) {
+			bounds.x + bounds.w - SDL_strlen(cold->filename) * ctx->font_width,
+			bounds.y + bounds.h - ctx->line_height,
+			SDL_strlen(cold->filename) * ctx->font_width,
+			ctx->line_height,
+		});
+		draw_text(ctx, bounds.x + bounds.w - SDL_strlen(cold->filename) * ctx->font_width,
+			bounds.y + bounds.h - ctx->line_height, text_color, 0, cold->filename);
+	}
+#endif
+	if (ctx->focused_frame == frame) {
+		SDL_SetRenderDrawColor(ctx->renderer, 0x08, 0x38, 0x08, SDL_ALPHA_OPAQUE);
+	} else {
+		SDL_SetRenderDrawColor(ctx->renderer, 0x08, 0x08, 0x08, SDL_ALPHA_OPAQUE);
+	}
+	SDL_RenderRect(ctx->renderer, &(SDL_FRect) {
+		bounds.x,
+		bounds.y,
+		bounds.w,
+		bounds.h,
+	});
+#ifdef DEBUG_LAYOUT
+	set_color(ctx, debug_red);
+	SDL_RenderRect(ctx->renderer, &lines_bounds);
+	set_color(ctx, debug_blue);
+	SDL_RenderLine(ctx->renderer, lines_bounds.x, bounds.y + draw_frame->scroll_interp.y, lines_bounds.x + lines_bounds.w, bounds.y + draw_frame->scroll_interp.y);
+#endif
+}
+
+static File_Id file_id(const char *path) {
+#ifdef SDL_PLATFORM_LINUX
+	struct stat st;
+	if (stat(path, &st) == 0) return (File_Id){true, st.st_dev, st.st_ino};
+#else
+	(void) path;
+#endif
+	return (File_Id){0};
+}
+
+static Uint32 file_id_hash(File_Id id, const char *path) {
+	if (id.valid) {
+		Uint64 key[2] = {id.device, id.inode};
+		return SDL_murmur3_32(key, sizeof key, 0);
+	}
+	return SDL_murmur3_32(path, SDL_strlen(path), 1);
+}
+
+static inline bool buffer_file_matches(const Buffer_File *file, File_Id id, const char *path) {
+	if (file->id.valid || id.valid) {
+		return file->id.valid && id.valid && file->id.device == id.device && file->id.inode == id.inode;
+	}
+	return SDL_strcmp(file->path, path) == 0;
+}
+
+// Slot of the file or of the first free place in its probe sequence
+static Buffer_File *buffer_files_probe(Ctx *ctx, File_Id id, const char *path, bool *found) {
+	*found = false;
+	if (ctx->files_capacity == 0) return NULL;
+	Uint32 mask = ctx->files_capacity - 1;
+	Buffer_File *free_slot = NULL;
+	for (Uint32 i = file_id_hash(id, path) & mask;; i = (i + 1) & mask) {
+		Buffer_File *file = &ctx->files[i];
+		if (!file->taken) {
+			if (!file->removed) return free_slot != NULL ? free_slot : file;
+			if (free_slot == NULL) free_slot = file;
+			continue;
+		}
+		if (buffer_file_matches(file, id, path)) {
+			*found = true;
+			return file;
+		}
+	}
+}
+
+// Buffer that already has the file, (Uint32)-1 if it's not opened
+static Uint32 buffer_find_file(Ctx *ctx, const char *path) {
+	bool found;
+	Buffer_File *file = buffer_files_probe(ctx, file_id(path), path, &found);
+	if (!found || ctx->buffers[file->buffer].refcount <= 0) return (Uint32)-1;
+	return file->buffer;
+}
+
+// Its entry is on the probe sequence of its hash, before the first never used slot
+static void buffer_unregister_file(Ctx *ctx, Uint32 bufid) {
+	TextBuffer *buffer = &ctx->buffers[bufid];
+	if (!buffer->registered || ctx->files_capacity == 0) return;
+	buffer->registered = false;
+	Uint32 mask = ctx->files_capacity - 1;
+	for (Uint32 i = buffer->file_hash & mask;; i = (i + 1) & mask) {
+		Buffer_File *file = &ctx->files[i];
+		if (!file->taken) {
+			if (!file->removed) return;
+			continue;
+		}
+		if (file->buffer != bufid) continue;
+		SDL_free(file->path);
+		file->taken = false;
+		file->removed = true;
+		return;
+	}
+}
+
+static bool buffer_files_rehash(Ctx *ctx) {
+	Uint32 old_capacity = ctx->files_capacity;
+	Buffer_File *old_files = ctx->files;
+	Uint32 live = 0;
+	for (Uint32 i = 0; i < old_capacity; ++i) live += old_files[i].taken;
+	// Mostly tombstones, rehash in place
+	Uint32 new_capacity = old_capacity == 0 ? 16 : live * 2 < old_capacity ? old_capacity : old_capacity * 2;
+	Buffer_File *new_files = SDL_calloc(new_capacity, sizeof *new_files);
+	if (new_files == NULL) return false;
+	ctx->files = new_files;
+	ctx->files_capacity = new_capacity;
+	ctx->files_used = 0;
+	for (Uint32 i = 0; i < old_capacity; ++i) {
+		if (!old_files[i].taken) continue;
+		bool found;
+		*buffer_files_probe(ctx, old_files[i].id, old_files[i].path, &found) = old_files[i];
+		ctx->files_used += 1;
+	}
+	SDL_free(old_files);
+	return true;
+}
+
+// Makes the buffer the one for the file at path, id is taken again as saves can replace the file
+static void buffer_register_file(Ctx *ctx, Uint32 bufid, const char *path) {
+	buffer_unregister_file(ctx, bufid);
+	if ((ctx->files_used + 1) * 4 > ctx->files_capacity * 3 && !buffer_files_rehash(ctx)) {
+		SDL_Log("Error, can't rehash buffer files table");
+		return;
+	}
+	File_Id id = file_id(path);
+	bool found;
+	Buffer_File *file = buffer_files_probe(ctx, id, path, &found);
+	if (found) {
+		// Other buffer had it, the last registered wins
+		SDL_free(file->path);
+	} else if (!file->removed) {
+		ctx->files_used += 1;
+	}
+	*file = (Buffer_File){
+		.taken = true,
+		.buffer = bufid,
+		.id = id,
+		.path = SDL_strdup(path),
+	};
+	ctx->buffers[bufid].registered = true;
+	ctx->buffers[bufid].file_hash = file_id_hash(id, path);
+}
+
+static void buffer_unwatch_file(Ctx *ctx, Uint32 bufid);
+
+static TextBuffer *allocate_buffer(Ctx *ctx, char *name) {
+	while (ctx->free_buffers_count > 0) {
+		Uint32 i = ctx->free_buffers[--ctx->free_buffers_count];
+		// Taken again before allocation, e.g. by a frame still showing it
+		if (ctx->buffers[i].refcount > 0) continue;
+		TextBuffer *buffer = &ctx->buffers[i];
+		buffer_free_undos(buffer);
+		SDL_free(buffer->text);
+		SDL_free(buffer->packed);
+		buffer_drop_line_index(buffer);
+		syntax_cache_free(buffer);
+		buffer_words_free(ctx, buffer);
+		structure_free(buffer);
+		Uint32 generation = buffer->generation + 1;
+		*buffer = (TextBuffer){
+			.name = name,
+			.generation = generation,
+			.last_access = ctx->ticks,
+		};
+		return buffer;
+	}
+	if (ctx->buffers_capacity <= ctx->buffers_count) {
+		size_t new_cap = ctx->buffers_capacity * 2;
+		if (new_cap == 0) {
+			new_cap = 8;
+		}
+		TextBuffer *new_buffers = SDL_realloc(ctx->buffers, new_cap * (sizeof *ctx->buffers));
+		if (new_buffers == NULL) {
+			SDL_Log("Can't reallocate buffers array");
+			return NULL;
+		}
+		ctx->buffers = new_buffers;
+		ctx->buffers_capacity = new_cap;
+	}
+	TextBuffer *buffer = &ctx->buffers[ctx->buffers_count++];
+	*buffer = (TextBuffer){
+		.name = name,
+		.generation = 1, // Zeroed handles never resolve
+		.last_access = ctx->ticks,
+	};
+	return buffer;
+}
+
+static bool index_list_push(Uint32 **items, Uint32 *count, Uint32 *capacity, Uint32 index) {
+	if (*count >= *capacity) {
+		Uint32 new_cap = *capacity == 0 ? 8 : *capacity * 2;
+		Uint32 *new_items = SDL_realloc(*items, new_cap * sizeof *new_items);
+		if (new_items == NULL) return false;
+		*items = new_items;
+		*capacity = new_cap;
+	}
+	(*items)[(*count)++] = index;
+	return true;
+}
+
+// Ask and search inputs keep their text block between prompts, so opening one doesn't allocate
+static TextBuffer *allocate_prompt_buffer(Ctx *ctx, char *name) {
+	while (ctx->prompt_buffers_count > 0) {
+		TextBuffer *buffer = &ctx->buffers[ctx->prompt_buffers[--ctx->prompt_buffers_count]];
+		if (buffer->refcount > 0) continue;
+		buffer_free_undos(buffer);
+		buffer_drop_line_index(buffer);
+		syntax_cache_free(buffer);
+		buffer_words_free(ctx, buffer);
+		structure_free(buffer);
+		buffer->name = name;
+		buffer->generation += 1;
+		buffer->text_size = 0;
+		if (buffer->text != NULL) buffer->text[0] = '\0';
+		return buffer;
+	}
+	TextBuffer *buffer = allocate_buffer(ctx, name);
+	if (buffer != NULL) buffer->prompt = true;
+	return buffer;
+}
+
+// Drops one reference, a buffer without them goes to the free list and forgets its file
+static void buffer_release(Ctx *ctx, TextBuffer *buffer) {
+	buffer->refcount -= 1;
+	if (buffer->refcount != 0) return;
+	Uint32 bufid = buffer - ctx->buffers;
+	// Prompts never have a file
+	if (buffer->prompt && index_list_push(&ctx->prompt_buffers, &ctx->prompt_buffers_count, &ctx->prompt_buffers_capacity, bufid)) return;
+	buffer_unwatch_file(ctx, bufid);
+	buffer_unregister_file(ctx, bufid);
+	// Closed files don't complete, taken again it's indexed anew
+	buffer_words_free(ctx, buffer);
+	structure_free(buffer);
+	if (!index_list_push(&ctx->free_buffers, &ctx->free_buffers_count, &ctx->free_buffers_capacity, bufid)) {
+		SDL_Log("Error, can't grow free buffers list");
+	}
+}
+
+static inline float vec_len(const SDL_FPoint vec) {
+	return SDL_sqrt(vec.x * vec.x + vec.y * vec.y);
+}
+
+static inline float point_to_line_dist(SDL_FPoint point, SDL_FPoint start, SDL_FPoint end) {
+	SDL_FPoint rel_point = {point.x - start.x, point.y - start.y};
+	SDL_FPoint vec = {end.x - start.x, end.y - start.y};
+	SDL_FPoint norm_vec = {vec.x / vec_len(vec), vec.y / vec_len(vec)};
+	float dot_prod = SDL_min(SDL_fabs(norm_vec.x * rel_point.x + norm_vec.y * rel_point.y), vec_len(vec));
+	SDL_FPoint inter = {start.x + norm_vec.x * dot_prod, start.y + norm_vec.y * dot_prod};
+	SDL_FPoint dist_vec = {inter.x - point.x, inter.y - point.y};
+	return SDL_sqrt(dist_vec.x * dist_vec.x + dist_vec.y * dist_vec.y);
+}
+
+static void set_focused_frame(Ctx *ctx, Uint32 frame) {
+	ctx->focused_frame = frame;
+	Uint32 first = frame;
+	Uint32 sorted_ind = reverse_sorted_index(ctx, frame);
+	if (sorted_ind != 0)
+		SDL_memmove(&ctx->sorted_frames[1], &ctx->sorted_frames[0], sorted_ind * sizeof (*ctx->sorted_frames));
+	ctx->sorted_frames[0] = first;
+}
+
+static bool generate_overflow_cursor(Ctx *ctx) {
+	SDL_Surface *cursor_overflow_surface = SDL_CreateSurface(ctx->font_width * 2, ctx->font_size * 2, SDL_PIXELFORMAT_RGBA8888);
+	if (!cursor_overflow_surface) {
+		SDL_LogWarn(0, "Error, can't create surface for cursor overflow texture: %s", SDL_GetError());
+		return false;
+	}
+	if (!SDL_LockSurface(cursor_overflow_surface)) {
+		SDL_LogWarn(0, "Can't lock cursor overflow cursor surface: %s", SDL_GetError());
+		SDL_DestroySurface(cursor_overflow_surface);
+		return false;
+	}
+	float width = 2.5;
+	float min_rot = SDL_min(cursor_overflow_surface->h / 2, cursor_overflow_surface->w) - width;
+	for (int y = 0; y < cursor_overflow_surface->h; ++y) {
+		for (int x = 0; x < cursor_overflow_surface->w; ++x) {
+			float dist1 = width - point_to_line_dist((SDL_FPoint){x, y+0.5}, (SDL_FPoint){2, 2}, (SDL_FPoint){min_rot, min_rot});
+			float dist2 = width - point_to_line_dist((SDL_FPoint){x, y+0.5}, (SDL_FPoint){2, min_rot * 2 - 2}, (SDL_FPoint){min_rot, min_rot});
+			float value = SDL_clamp(SDL_max(dist1, dist2) * 0xcc, 0x00, 0xff);
+			SDL_Color color = {value, value, value, value};
+			((Uint32 *)((Uint8 *)cursor_overflow_surface->pixels + y * cursor_overflow_surface->pitch))[x]
+				= SDL_MapSurfaceRGBA(cursor_overflow_surface, color.r, color.g, color.b, color.a);
+		}
+	}
+	SDL_UnlockSurface(cursor_overflow_surface);
+	ctx->overflow_cursor_texture = SDL_CreateTextureFromSurface(ctx->renderer, cursor_overflow_surface);
+	SDL_DestroySurface(cursor_overflow_surface);
+	profile_count(ctx, Profile_Counter_textures, 1);
+	if (ctx->overflow_cursor_texture == NULL) {
+		SDL_LogWarn(0, "Can't convert cursor overflow surface into texture: %s", SDL_GetError());
+		return false;
+	}
+	return true;
+}
+
+static bool generate_space_texture(Ctx *ctx) {
+	SDL_Surface *space_surface = SDL_CreateSurface(ctx->font_width, ctx->font_size, SDL_PIXELFORMAT_RGBA8888);
+	if (!space_surface) {
+		SDL_LogWarn(0, "Can't create surface for space texture: %s", SDL_GetError());
+		return false;
+	}
+	if (!SDL_LockSurface(space_surface)) {
+		SDL_LogWarn(0, "Can't lock space surface: %s", SDL_GetError());
+		SDL_DestroySurface(space_surface);
+		return false;
+	}
+	float width = 1.8;
+	SDL_FPoint center = {space_surface->w / 2, space_surface->h / 2.1};
+	for (int y = 0; y < space_surface->h; ++y) {
+		for (int x = 0; x < space_surface->w; ++x) {
+			float dist = width - SDL_sqrt((center.y - y) * (center.y - y) + (center.x - x) * (center.x - x));
+			float value = SDL_clamp(dist * 0xee, 0x00, 0xff);
+			SDL_Color color = {value, value, value, value / 2.2};
+			((Uint32 *)((Uint8 *)space_surface->pixels + y * space_surface->pitch))[x]
+				= SDL_MapSurfaceRGBA(space_surface, color.r, color.g, color.b, color.a);
+		}
+	}
+	SDL_UnlockSurface(space_surface);
+	ctx->space_texture = SDL_CreateTextureFromSurface(ctx->renderer, space_surface);
+	SDL_DestroySurface(space_surface);
+	profile_count(ctx, Profile_Counter_textures, 1);
+	if (ctx->space_texture == NULL) {
+		SDL_LogWarn(0, "Can't convert space surface into texture: %s", SDL_GetError());
+		return false;
+	}
+	return true;
+}
+
+static bool generate_tab_texture(Ctx *ctx) {
+	SDL_Surface *tab_surface = SDL_CreateSurface(ctx->font_width * TAB_WIDTH, ctx->font_size, SDL_PIXELFORMAT_RGBA8888);
+	if (!tab_surface) {
+		SDL_LogWarn(0, "Can't create surface for tab texture: %s", SDL_GetError());
+		return false;
+	}
+	if (!SDL_LockSurface(tab_surface)) {
+		SDL_LogWarn(0, "Can't lock tab surface: %s", SDL_GetError());
+		SDL_DestroySurface(tab_surface);
+		return false;
+	}
+	for (int y = 0; y < tab_surface->h; ++y) {
+		for (int x = 0; x < tab_surface->w; ++x) {
+			float x0 = (x == 0) * 0xff;
+			float value = SDL_clamp(x0, 0x00, 0xff);
+			SDL_Color color = {value, value, value, value};
+			((Uint32 *)((Uint8 *)tab_surface->pixels + y * tab_surface->pitch))[x]
+				= SDL_MapSurfaceRGBA(tab_surface, color.r, color.g, color.b, color.a);
+		}
+	}
+	SDL_UnlockSurface(tab_surface);
+	ctx->tab_texture = SDL_CreateTextureFromSurface(ctx->renderer, tab_surface);
+	SDL_DestroySurface(tab_surface);
+	profile_count(ctx, Profile_Counter_textures, 1);
+	if (ctx->tab_texture == NULL) {
+		SDL_LogWarn(0, "Can't convert tab surface into texture: %s", SDL_GetError());
+		return false;
+	}
+	return true;
+}
+
+// Embedded font and the textures sized by it, needs ctx->renderer
+static bool font_open(Ctx *ctx, float size) {
+	ctx->font_size = size;
+	ctx->line_height = ctx->font_size * 1.2;
+	SDL_IOStream *font_stream = SDL_IOFromConstMem(_binary_LiberationMono_Regular_ttf_start, (size_t)&_binary_LiberationMono_Regular_ttf_size);
+	if (font_stream == NULL) {
+		SDL_LogCritical(0, "Can't create iostream for font: %s", SDL_GetError());
+		return false;
+	}
+	ctx->font = TTF_OpenFontIO(font_stream, true, ctx->font_size);
+	if (ctx->font == NULL) {
+		SDL_LogCritical(0, "Can't open font: %s", SDL_GetError());
+		return false;
+	}
+	int font_width_int;
+	TTF_GetGlyphMetrics(ctx->font, 'w', NULL, NULL, NULL, NULL, &font_width_int);
+	ctx->font_width = (float)font_width_int;
+	generate_overflow_cursor(ctx);
+	generate_tab_texture(ctx);
+	generate_space_texture(ctx);
+	return true;
+}
+
+static bool handle_frame_mouse_click(Ctx *ctx, Uint32 frame, SDL_FPoint point) {
+	SDL_FRect bounds;
+	Frame *draw_frame = &ctx->frames[frame];
+	get_frame_render_text_rect(ctx, frame, &bounds);
+	draw_frame->scroll_lock = true;
+	if (point.y < bounds.y) {
+		draw_frame->cursor = 0;
+		return true;
+	}
+	Uint32 linenum = (point.y - bounds.y - SDL_min(0, draw_frame->scroll_interp.y)) / ctx->line_height;
+	String line = buffer_get_vis_line(ctx, frame_buffer(ctx, draw_frame), bounds, (Uint32)linenum);
+	if (line.text == NULL) {
+		draw_frame->cursor = frame_buffer(ctx, draw_frame)->text_size;
+		return true;
+	}
+	// Don't fucking reallocate sized strings which only point is zero copy.
+	SDL_assert(line.text >= frame_buffer(ctx, draw_frame)->text && line.text <= frame_buffer(ctx, draw_frame)->text + frame_buffer(ctx, draw_frame)->text_size);
+	Uint32 offset = coords_to_text_index(ctx, line.size, line.text, point.x - bounds.x);
+	draw_frame->cursor = line.text - frame_buffer(ctx, draw_frame)->text + offset;
+	return true;
+}
+
+static Uint32 append_frame(Ctx *ctx, TextBuffer *buffer, SDL_FRect bounds) {
+	Uint32 frame_ind;
+	Uint32 generation = 1; // Zeroed handles never resolve
+	if (ctx->free_frames_count > 0) {
+		frame_ind = ctx->free_frames[--ctx->free_frames_count];
+		SDL_assert(!ctx->frames[frame_ind].taken);
+		SDL_free(ctx->frames[frame_ind].cursors);
+		generation = ctx->frames[frame_ind].generation + 1;
+	} else {
+		if (ctx->frames_capacity <= ctx->frames_count) {
+			size_t new_cap = ctx->frames_capacity * 2;
+			if (new_cap == 0) {
+				new_cap = 8;
+			}
+			// Stored one by one, a bigger array than frames_capacity says is fine
+			Frame *new_frames = SDL_realloc(ctx->frames, new_cap * (sizeof *ctx->frames));
+			if (new_frames == NULL) {
+				SDL_Log("Can't reallocate frames array");
+				return -1;
+			}
+			ctx->frames = new_frames;
+			Frame_Cold *new_frames_cold = SDL_realloc(ctx->frames_cold, new_cap * (sizeof *ctx->frames_cold));
+			if (new_frames_cold == NULL) {
+				SDL_Log("Can't reallocate cold frames array");
+				return -1;
+			}
+			ctx->frames_cold = new_frames_cold;
+			Uint32 *new_sorted_frames = SDL_realloc(ctx->sorted_frames, new_cap * (sizeof *ctx->sorted_frames));
+			if (new_sorted_frames == NULL) {
+				SDL_LogWarn(0, "Can't reallocate sorted frames index");
+				return -1;
+			}
+			ctx->sorted_frames = new_sorted_frames;
+			ctx->frames_capacity = new_cap;
+		}
+		frame_ind = ctx->frames_count++;
+		ctx->sorted_frames[frame_ind] = frame_ind;
+	}
+	ctx->frames[frame_ind] = (Frame){
+		.taken = true,
+		.generation = generation,
+		.cursor = 0,
+		.selection = 0,
+		.active_selection = false,
+		.scroll = 0,
+		.bounds = bounds,
+		.buffer = buffer_handle(ctx, buffer),
+	};
+	ctx->frames_cold[frame_ind] = (Frame_Cold){0};
+	buffer->refcount += 1;
+	return frame_ind;
+}
+
+// Slot goes to the free list, frames asking or searching for this one close too
+static void frame_close(Ctx *ctx, Uint32 framei) {
+	Frame *frame = &ctx->frames[framei];
+	if (!frame->taken) return;
+	Frame_Handle handle = frame_handle(ctx, framei);
+	buffer_release(ctx, frame_buffer(ctx, frame));
+	frame->taken = false;
+	frame->generation += 1;
+	SDL_free(ctx->frames_cold[framei].filename);
+	ctx->frames_cold[framei].filename = NULL;
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		Frame_Handle parent = ctx->frames_cold[i].parent_frame;
+		if (!ctx->frames[i].taken || parent.index != handle.index || parent.generation != handle.generation) continue;
+		frame_close(ctx, i);
+	}
+	if (!index_list_push(&ctx->free_frames, &ctx->free_frames_count, &ctx->free_frames_capacity, framei)) {
+		SDL_Log("Error, can't grow free frames list");
+	}
+}
+
+static Uint32 find_any_frame(Ctx *ctx) {
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		if (ctx->frames[ctx->sorted_frames[i]].taken) return ctx->sorted_frames[i];
+	}
+	SDL_LogError(0, "No more frames, creating one");
+	TextBuffer *buffer = allocate_buffer(ctx, "scratch");
+	if (buffer == NULL) {
+		SDL_LogError(0, "Can't allocate buffer");
+		return -1;
+	}
+	return append_frame(ctx, buffer, (SDL_FRect){0, 0, ctx->win_w, ctx->win_h});
+}
+
+static Uint32 create_ask_frame(Ctx *ctx, Ask_Option option, Uint32 parent, char *prefix) {
+	TextBuffer *buffer = allocate_prompt_buffer(ctx, "ask buffer");
+	if (buffer == NULL) {
+		SDL_Log("Error, can't allocate ask buffer");
+		return -1;
+	}
+	Uint32 frame = append_frame(ctx, buffer, (SDL_FRect){0, ctx->win_h - ctx->line_height, ctx->win_w, ctx->line_height});
+	if (frame == (Uint32)-1) {
+		SDL_Log("Error, can't append ask buffer");
+		return -1;
+	}
+	ctx->frames[frame].frame_type = Frame_Type_ask;
+	ctx->frames[frame].is_global = true;
+	ctx->frames_cold[frame].parent_frame = frame_handle(ctx, parent);
+	ctx->frames_cold[frame].ask_option = option;
+	ctx->frames_cold[frame].line_prefix = prefix;
+	return frame;
+}
+
+// Appends to the end, cutting whole lines from the start to keep buffer about budget bytes
+static void buffer_append_bounded(Ctx *ctx, Uint32 bufid, const char *in, size_t in_len, size_t budget) {
+	TextBuffer *buffer = &ctx->buffers[bufid];
+	if (!buffer_touch(ctx, buffer)) return;
+	size_t new_size = buffer->text_size + in_len;
+	if (new_size > budget + budget / 2) {
+		// Trim back to the budget only after it's overshot by half, so each byte is moved O(1) times
+		size_t cut = SDL_min(new_size - budget, buffer->text_size);
+		if (cut < buffer->text_size) {
+			cut += text_kernels->find_newline(buffer->text + cut, buffer->text_size - cut);
+			if (cut < buffer->text_size) cut += 1;
+		}
+		// Empty buffer may have no text at all
+		if (cut > 0) buffer_delete_text_no_undo(ctx, bufid, 0, cut);
+	}
+	buffer_insert_text_no_undo(ctx, buffer, in, in_len, buffer->text_size);
+}
+
+#ifndef DISABLE_LOG_BUFFER
+// Can be called from any thread, messages are dropped while the ring is full
+static void log_handler(void *userdata, int category, SDL_LogPriority priority, const char *message) {
+	(void) category;
+	(void) priority;
+	Log_Ring *ring = (Log_Ring *)userdata;
+	Uint32 position = (Uint32)SDL_GetAtomicInt(&ring->push_position);
+	Log_Slot *slot;
+	while (true) {
+		slot = &ring->slots[position % LOG_RING_SIZE];
+		Sint32 diff = (Sint32)((Uint32)SDL_GetAtomicInt(&slot->sequence) - position);
+		if (diff == 0) {
+			if (SDL_CompareAndSwapAtomicInt(&ring->push_position, (int)position, (int)(position + 1))) break;
+			position = (Uint32)SDL_GetAtomicInt(&ring->push_position);
+		} else if (diff < 0) {
+			SDL_AddAtomicInt(&ring->dropped, 1);
+			return;
+		} else {
+			position = (Uint32)SDL_GetAtomicInt(&ring->push_position);
+		}
+	}
+	size_t length = SDL_strlen(message);
+	if (length > LOG_MESSAGE_SIZE) {
+		length = LOG_MESSAGE_SIZE;
+		// Don't leave half of a codepoint
+		while (length > 0 && ((Uint8)message[length] & 0xc0) == 0x80) length -= 1;
+	}
+	SDL_memcpy(slot->text, message, length);
+	slot->length = length;
+	SDL_SetAtomicInt(&slot->sequence, (int)(position + 1));
+}
+
+static bool log_ring_create(Ctx *ctx) {
+	ctx->log_ring = SDL_malloc(sizeof *ctx->log_ring);
+	ctx->log_batch = SDL_malloc(LOG_RING_SIZE * (LOG_MESSAGE_SIZE + 1) + 64);
+	if (ctx->log_ring == NULL || ctx->log_batch == NULL) {
+		SDL_free(ctx->log_ring);
+		SDL_free(ctx->log_batch);
+		ctx->log_ring = NULL;
+		ctx->log_batch = NULL;
+		return false;
+	}
+	memory_retag(ctx->log_ring, Memory_Tag_log);
+	memory_retag(ctx->log_batch, Memory_Tag_log);
+	SDL_SetAtomicInt(&ctx->log_ring->push_position, 0);
+	SDL_SetAtomicInt(&ctx->log_ring->dropped, 0);
+	ctx->log_ring->pop_position = 0;
+	for (Uint32 i = 0; i < LOG_RING_SIZE; ++i) {
+		SDL_SetAtomicInt(&ctx->log_ring->slots[i].sequence, (int)i);
+	}
+	ctx->log_budget = LOG_BUDGET;
+	const char *budget = SDL_getenv("EDITOR_LOG_BUDGET");
+	if (budget != NULL && SDL_strtoul(budget, NULL, 10) > 0) {
+		ctx->log_budget = SDL_strtoul(budget, NULL, 10);
+	}
+	return true;
+}
+
+// Moves everything logged since last frame into the log buffer with one append
+static void log_drain(Ctx *ctx) {
+	Log_Ring *ring = ctx->log_ring;
+	if (ring == NULL) return;
+	size_t batch_size = 0;
+	while (true) {
+		Log_Slot *slot = &ring->slots[ring->pop_position % LOG_RING_SIZE];
+		if ((Sint32)((Uint32)SDL_GetAtomicInt(&slot->sequence) - (ring->pop_position + 1)) < 0) break;
+		SDL_memcpy(ctx->log_batch + batch_size, slot->text, slot->length);
+		batch_size += slot->length;
+		ctx->log_batch[batch_size++] = '\n';
+		SDL_SetAtomicInt(&slot->sequence, (int)(ring->pop_position + LOG_RING_SIZE));
+		ring->pop_position += 1;
+	}
+	int dropped = SDL_SetAtomicInt(&ring->dropped, 0);
+	if (dropped > 0) {
+		batch_size += SDL_snprintf(ctx->log_batch + batch_size, 64, "%d log messages dropped\n", dropped);
+	}
+	if (batch_size == 0) return;
+	if (buffer_resolve(ctx, ctx->log_buffer) == NULL) return;
+	buffer_append_bounded(ctx, ctx->log_buffer.index, ctx->log_batch, batch_size, ctx->log_budget);
+}
+#endif
+
+static int command_reader_thread(void *data) {
+	Command_Runner *runner = (Command_Runner *)data;
+	trace_thread_name = "command reader";
+	SDL_IOStream *output = SDL_GetProcessOutput(runner->process);
+	bool ended = output == NULL;
+	while (!ended) {
+		SDL_WaitSemaphore(runner->free_chunks);
+		if (SDL_GetAtomicInt(&runner->cancel)) break;
+		Uint32 position = (Uint32)SDL_GetAtomicInt(&runner->push_position);
+		Command_Chunk *chunk = &runner->chunks[position % COMMAND_CHUNKS];
+		chunk->size = 0;
+		Uint64 start = trace_begin();
+		// Fill the chunk while output is fast, hand out what's there once it stalls
+		while (chunk->size < COMMAND_CHUNK_SIZE) {
+			size_t read = SDL_ReadIO(output, chunk->data + chunk->size, COMMAND_CHUNK_SIZE - chunk->size);
+			chunk->size += read;
+			if (read > 0) continue;
+			if (SDL_GetIOStatus(output) != SDL_IO_STATUS_NOT_READY) {
+				ended = true;
+				break;
+			}
+			if (chunk->size > 0) break;
+			if (SDL_GetAtomicInt(&runner->cancel)) {
+				ended = true;
+				break;
+			}
+			SDL_Delay(1);
+		}
+		trace_end_arg("command read", start, "bytes", chunk->size);
+		if (chunk->size == 0) {
+			SDL_SignalSemaphore(runner->free_chunks);
+			continue;
+		}
+		SDL_SetAtomicInt(&runner->push_position, (int)(position + 1));
+	}
+	trace_thread_exit();
+	SDL_SetAtomicInt(&runner->done, 1);
+	return 0;
+}
+
+static void command_free(Command_Runner *runner) {
+	SDL_DestroyProcess(runner->process);
+	SDL_DestroySemaphore(runner->free_chunks);
+	SDL_free(runner->chunks);
+	SDL_free(runner->batch);
+	SDL_free(runner);
+}
+
+static Uint32 frame_find_buffer(Ctx *ctx, Uint32 bufid);
+
+// Runs command through the shell, its output goes to a frame split off the one it was run from.
+// That frame keeps its buffer, a command never takes the last reference of unsaved edits
+static bool command_start(Ctx *ctx, Uint32 framei, const char *command) {
+	if (ctx->command != NULL) {
+		SDL_LogWarn(0, "Command is already running, cancel it first");
+		return false;
+	}
+	if (ctx->command_buffer == (Uint32)-1) {
+		TextBuffer *buffer = allocate_buffer(ctx, "command");
+		if (buffer == NULL) {
+			SDL_Log("Error, can't allocate command buffer");
+			return false;
+		}
+		buffer->refcount += 1;
+		ctx->command_buffer = buffer - ctx->buffers;
+	}
+	Command_Runner *runner = SDL_malloc(sizeof *runner);
+	if (runner == NULL) {
+		SDL_Log("Error, can't allocate command runner");
+		return false;
+	}
+	*runner = (Command_Runner){0};
+	runner->chunks = SDL_malloc(COMMAND_CHUNKS * sizeof *runner->chunks);
+	runner->batch = SDL_malloc(COMMAND_CHUNKS * COMMAND_CHUNK_SIZE);
+	runner->free_chunks = SDL_CreateSemaphore(COMMAND_CHUNKS);
+	if (runner->chunks == NULL || runner->batch == NULL || runner->free_chunks == NULL) {
+		SDL_Log("Error, can't allocate command output ring");
+		command_free(runner);
+		return false;
+	}
+#ifdef SDL_PLATFORM_WINDOWS
+	const char *args[] = {"cmd.exe", "/c", command, NULL};
+#else
+	const char *args[] = {"/bin/sh", "-c", command, NULL};
+#endif
+	SDL_PropertiesID props = SDL_CreateProperties();
+	SDL_SetPointerProperty(props, SDL_PROP_PROCESS_CREATE_ARGS_POINTER, (void *)args);
+	SDL_SetNumberProperty(props, SDL_PROP_PROCESS_CREATE_STDIN_NUMBER, SDL_PROCESS_STDIO_NULL);
+	SDL_SetNumberProperty(props, SDL_PROP_PROCESS_CREATE_STDOUT_NUMBER, SDL_PROCESS_STDIO_APP);
+	SDL_SetBooleanProperty(props, SDL_PROP_PROCESS_CREATE_STDERR_TO_STDOUT_BOOLEAN, true);
+	runner->process = SDL_CreateProcessWithProperties(props);
+	SDL_DestroyProperties(props);
+	if (runner->process == NULL) {
+		SDL_LogWarn(0, "Can't run command: %s", SDL_GetError());
+		command_free(runner);
+		return false;
+	}
+	runner->reader = SDL_CreateThread(command_reader_thread, "command reader", runner);
+	if (runner->reader == NULL) {
+		SDL_LogWarn(0, "Can't create command reader thread: %s", SDL_GetError());
+		SDL_KillProcess(runner->process, true);
+		SDL_WaitProcess(runner->process, true, NULL);
+		command_free(runner);
+		return false;
+	}
+	ctx->command = runner;
+	TextBuffer *buffer = &ctx->buffers[ctx->command_buffer];
+	if (buffer->text_size > 0) buffer_delete_text_no_undo(ctx, ctx->command_buffer, 0, buffer->text_size);
+	char header[256];
+	int header_size = SDL_snprintf(header, sizeof header, "$ %s\n", command);
+	buffer_insert_text_no_undo(ctx, buffer, header, SDL_min((size_t)header_size, sizeof header - 1), 0);
+	Uint32 output = frame_find_buffer(ctx, ctx->command_buffer);
+	if (output == (Uint32)-1) {
+		ctx->frames[framei].bounds.h /= 2;
+		SDL_FRect bounds = ctx->frames[framei].bounds;
+		bounds.y += bounds.h;
+		output = append_frame(ctx, buffer, bounds);
+		if (output == (Uint32)-1) {
+			ctx->frames[framei].bounds.h *= 2;
+			SDL_LogWarn(0, "Can't open frame for command output, it still goes to the command buffer");
+			return true;
+		}
+	}
+	set_focused_frame(ctx, output);
+	Frame *frame = &ctx->frames[output];
+	frame->cursor = 0;
+	frame->selection = 0;
+	frame->active_selection = false;
+	frame->scroll_lock = false;
+	frame->scroll = (SDL_FPoint){0};
+	frame_clear_cursors(ctx, output);
+	return true;
+}
+
+// Kills the shell with everything it started. Children of a killed shell keep the output pipe open,
+// so the reader would never see its end
+static void command_kill(Command_Runner *runner, bool force) {
+#ifdef SDL_PLATFORM_LINUX
+	pid_t tree[COMMAND_TREE_MAX];
+	Uint32 tree_count = 0;
+	Sint64 pid = SDL_GetNumberProperty(SDL_GetProcessProperties(runner->process), SDL_PROP_PROCESS_PID_NUMBER, 0);
+	if (pid > 0) tree[tree_count++] = (pid_t)pid;
+	// Listed before anything is killed, orphans are moved to init and can't be found anymore
+	for (Uint32 i = 0; i < tree_count; ++i) {
+		char path[64];
+		SDL_snprintf(path, sizeof path, "/proc/%d/task/%d/children", (int)tree[i], (int)tree[i]);
+		// Size of proc files is unknown, so it's read until the end
+		SDL_IOStream *file = SDL_IOFromFile(path, "r");
+		if (file == NULL) continue;
+		char children[1024];
+		size_t size = 0, read;
+		while (size < sizeof children - 1 && (read = SDL_ReadIO(file, children + size, sizeof children - 1 - size)) > 0) size += read;
+		SDL_CloseIO(file);
+		children[size] = '\0';
+		char *cursor = children;
+		while (tree_count < COMMAND_TREE_MAX) {
+			char *end;
+			long child = SDL_strtol(cursor, &end, 10);
+			if (end == cursor) break;
+			tree[tree_count++] = (pid_t)child;
+			cursor = end;
+		}
+	}
+	// Shell goes first, so it doesn't run the next command once its child is gone
+	SDL_KillProcess(runner->process, force);
+	for (Uint32 i = 1; i < tree_count; ++i) kill(tree[i], force ? SIGKILL : SIGTERM);
+#else
+	SDL_KillProcess(runner->process, force);
+#endif
+}
+
+// Kills process, output that's left is still shown
+static void command_cancel(Ctx *ctx) {
+	if (ctx->command == NULL) return;
+	SDL_SetAtomicInt(&ctx->command->cancel, 1);
+	command_kill(ctx->command, false);
+	SDL_LogInfo(0, "Command cancelled");
+}
+
+// Moves output read since last frame into the command buffer with one append
+static void command_drain(Ctx *ctx) {
+	Command_Runner *runner = ctx->command;
+	if (runner == NULL) return;
+	bool done = SDL_GetAtomicInt(&runner->done);
+	Uint32 pushed = (Uint32)SDL_GetAtomicInt(&runner->push_position);
+	size_t batch_size = 0;
+	for (; runner->pop_position != pushed; ++runner->pop_position) {
+		Command_Chunk *chunk = &runner->chunks[runner->pop_position % COMMAND_CHUNKS];
+		SDL_memcpy(runner->batch + batch_size, chunk->data, chunk->size);
+		batch_size += chunk->size;
+		SDL_SignalSemaphore(runner->free_chunks);
+	}
+	if (batch_size > 0) {
+		buffer_append_bounded(ctx, ctx->command_buffer, runner->batch, batch_size, COMMAND_BUDGET);
+	}
+	if (!done) return;
+	if (runner->reader != NULL) {
+		SDL_WaitThread(runner->reader, NULL);
+		runner->reader = NULL;
+	}
+	int exit_code = 0;
+	// Output can be closed before process is finished, check again next frame
+	if (!SDL_WaitProcess(runner->process, false, &exit_code)) return;
+	char footer[64];
+	int footer_size = SDL_snprintf(footer, sizeof footer, "\nExited with code %d\n", exit_code);
+	buffer_append_bounded(ctx, ctx->command_buffer, footer, footer_size, COMMAND_BUDGET);
+	SDL_LogInfo(0, "Command exited with code %d", exit_code);
+	command_free(runner);
+	ctx->command = NULL;
+}
+
+static File_Watch *buffer_file_watch(Ctx *ctx, Uint32 bufid) {
+	for (Uint32 i = 0; i < ctx->watches_count; ++i) {
+		if (ctx->watches[i].taken && ctx->watches[i].buffer == bufid) return &ctx->watches[i];
+	}
+	return NULL;
+}
+
+static void watch_add_inotify(Ctx *ctx, File_Watch *watch) {
+	watch->watch = -1;
+#ifdef SDL_PLATFORM_LINUX
+	if (ctx->inotify < 0) {
+		ctx->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (ctx->inotify < 0) SDL_LogWarn(0, "Can't init inotify, polling watched files");
+	}
+	if (ctx->inotify >= 0) {
+		watch->watch = inotify_add_watch(ctx->inotify, watch->path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+	}
+#else
+	(void) ctx;
+#endif
+}
+
+static void watch_remove_inotify(Ctx *ctx, File_Watch *watch) {
+#ifdef SDL_PLATFORM_LINUX
+	if (watch->watch >= 0) {
+		// Same file in two buffers gets the same descriptor
+		bool shared = false;
+		for (Uint32 i = 0; i < ctx->watches_count; ++i) {
+			if (&ctx->watches[i] != watch && ctx->watches[i].taken && ctx->watches[i].watch == watch->watch) shared = true;
+		}
+		if (!shared) inotify_rm_watch(ctx->inotify, watch->watch);
+	}
+#else
+	(void) ctx;
+#endif
+	watch->watch = -1;
+}
+
+static void watch_release(Ctx *ctx, File_Watch *watch) {
+	watch_remove_inotify(ctx, watch);
+	SDL_free(watch->path);
+	watch->taken = false;
+}
+
+static void buffer_unwatch_file(Ctx *ctx, Uint32 bufid) {
+	File_Watch *watch = buffer_file_watch(ctx, bufid);
+	if (watch != NULL) watch_release(ctx, watch);
+}
+
+// Remembers that the buffer now has the same text as the file at path, after open or save
+static File_Watch *buffer_watch_file(Ctx *ctx, Uint32 bufid, const char *path) {
+	buffer_register_file(ctx, bufid, path);
+	File_Watch *watch = buffer_file_watch(ctx, bufid);
+	if (watch != NULL && SDL_strcmp(watch->path, path) != 0) {
+		watch_release(ctx, watch);
+		watch = NULL;
+	}
+	if (watch == NULL) {
+		for (Uint32 i = 0; i < ctx->watches_count; ++i) {
+			if (!ctx->watches[i].taken) {
+				watch = &ctx->watches[i];
+				break;
+			}
+		}
+		if (watch == NULL) {
+			if (ctx->watches_count >= ctx->watches_capacity) {
+				Uint32 new_cap = ctx->watches_capacity == 0 ? 4 : ctx->watches_capacity * 2;
+				File_Watch *new_watches = SDL_realloc(ctx->watches, new_cap * sizeof *new_watches);
+				if (new_watches == NULL) {
+					SDL_Log("Error, can't allocate file watches");
+					return NULL;
+				}
+				ctx->watches = new_watches;
+				ctx->watches_capacity = new_cap;
+			}
+			watch = &ctx->watches[ctx->watches_count++];
+		}
+		*watch = (File_Watch){
+			.taken = true,
+			.buffer = bufid,
+			.path = SDL_strdup(path),
+		};
+		if (watch->path == NULL) {
+			watch->taken = false;
+			return NULL;
+		}
+		watch_add_inotify(ctx, watch);
+	}
+	SDL_PathInfo info;
+	if (SDL_GetPathInfo(path, &info)) {
+		watch->size = info.size;
+		watch->modify_time = info.modify_time;
+		watch->offset = SDL_min(info.size, (Sint64)ctx->buffers[bufid].text_size);
+		watch->reopen = false;
+		if (watch->watch < 0) watch_add_inotify(ctx, watch);
+	} else {
+		// Not created yet
+		watch->size = 0;
+		watch->modify_time = 0;
+		watch->offset = 0;
+		watch->reopen = true;
+	}
+	watch->changed = false;
+	return watch;
+}
+
+static void buffer_reindex(Ctx *ctx, TextBuffer *buffer) {
+	buffer_drop_line_index(buffer);
+	if (buffer->text == NULL) return;
+	Load_Job load = {.text = buffer->text, .text_size = buffer->text_size};
+	Line_Index index;
+	if (load_index_text(ctx, &load, &index)) buffer->line_index = index;
+}
+
+// LZ77 in LZ4 block layout: token (literals << 4 | match - LZ_MIN_MATCH), literals, 16 bit offset.
+// Nibble of 15 continues in the next bytes, each 255 adds and reads one more.
+// The last sequence has only literals
+static inline size_t lz_bound(size_t size) {
+	return size + size / 255 + 16;
+}
+
+static inline Uint32 lz_read32(const Uint8 *at) {
+	Uint32 value;
+	SDL_memcpy(&value, at, sizeof value);
+	return value;
+}
+
+static inline Uint8 *lz_put_length(Uint8 *out, size_t length) {
+	for (; length >= 255; length -= 255) *out++ = 255;
+	*out++ = (Uint8)length;
+	return out;
+}
+
+static Uint8 *lz_put_sequence(Uint8 *out, const Uint8 *literals, size_t literals_len, Uint32 offset, size_t match_len) {
+	Uint8 *token = out++;
+	*token = (Uint8)(SDL_min(literals_len, 15) << 4);
+	if (literals_len >= 15) out = lz_put_length(out, literals_len - 15);
+	SDL_memcpy(out, literals, literals_len);
+	out += literals_len;
+	if (match_len == 0) return out;
+	*out++ = (Uint8)offset;
+	*out++ = (Uint8)(offset >> 8);
+	match_len -= LZ_MIN_MATCH;
+	*token |= (Uint8)SDL_min(match_len, 15);
+	if (match_len >= 15) out = lz_put_length(out, match_len - 15);
+	return out;
+}
+
+// Out must have lz_bound(size) bytes, returns the compressed size
+static size_t lz_compress(const char *text, size_t size, char *out) {
+	const Uint8 *in = (const Uint8 *)text;
+	Uint8 *op = (Uint8 *)out;
+	Uint32 table[1 << LZ_HASH_BITS] = {0};
+	size_t anchor = 0, pos = 1, misses = 0;
+	while (pos + LZ_MIN_MATCH <= size) {
+		Uint32 seq = lz_read32(in + pos);
+		Uint32 hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		size_t candidate = table[hash];
+		table[hash] = (Uint32)pos;
+		if (pos - candidate > 0xffff || lz_read32(in + candidate) != seq) {
+			// Skip faster through text that doesn't compress
+			pos += 1 + (misses++ >> 6);
+			continue;
+		}
+		misses = 0;
+		size_t match = LZ_MIN_MATCH;
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+		while (pos + match + sizeof(Uint64) <= size) {
+			Uint64 a, b;
+			SDL_memcpy(&a, in + candidate + match, sizeof a);
+			SDL_memcpy(&b, in + pos + match, sizeof b);
+			if (a != b) {
+				match += __builtin_ctzll(a ^ b) / 8;
+				break;
+			}
+			match += sizeof(Uint64);
+		}
+		if (pos + match + sizeof(Uint64) > size)
+#endif
+		while (pos + match < size && in[candidate + match] == in[pos + match]) match += 1;
+		while (pos > anchor && candidate > 0 && in[pos - 1] == in[candidate - 1]) {
+			pos -= 1;
+			candidate -= 1;
+			match += 1;
+		}
+		op = lz_put_sequence(op, in + anchor, pos - anchor, (Uint32)(pos - candidate), match);
+		pos += match;
+		anchor = pos;
+	}
+	op = lz_put_sequence(op, in + anchor, size - anchor, 0, 0);
+	return op - (Uint8 *)out;
+}
+
+static inline bool lz_get_length(const Uint8 **ip, const Uint8 *end, size_t *length) {
+	Uint8 byte;
+	do {
+		if (*ip >= end) return false;
+		byte = *(*ip)++;
+		*length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+// False on corrupted input or if it doesn't decompress to exactly size bytes
+static bool lz_decompress(const char *packed, size_t packed_size, char *text, size_t size) {
+	const Uint8 *ip = (const Uint8 *)packed, *end = ip + packed_size;
+	Uint8 *op = (Uint8 *)text, *out_end = op + size;
+	while (ip < end) {
+		Uint8 token = *ip++;
+		size_t literals_len = token >> 4;
+		if (literals_len == 15 && !lz_get_length(&ip, end, &literals_len)) return false;
+		if (literals_len > (size_t)(end - ip) || literals_len > (size_t)(out_end - op)) return false;
+		SDL_memcpy(op, ip, literals_len);
+		ip += literals_len;
+		op += literals_len;
+		if (ip == end) break;
+		if (end - ip < 2) return false;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - (Uint8 *)text)) return false;
+		size_t match_len = token & 15;
+		if (match_len == 15 && !lz_get_length(&ip, end, &match_len)) return false;
+		match_len += LZ_MIN_MATCH;
+		if (match_len > (size_t)(out_end - op)) return false;
+		const Uint8 *match = op - offset;
+		if (offset >= match_len) {
+			SDL_memcpy(op, match, match_len);
+			op += match_len;
+		} else {
+			// Overlapping, repeats the last offset bytes
+			for (size_t i = 0; i < match_len; ++i) *op++ = match[i];
+		}
+	}
+	return op == out_end;
+}
+
+// Line index is dropped too, it's rebuilt on unpack
+static bool buffer_pack(Ctx *ctx, TextBuffer *buffer) {
+	char *packed = SDL_malloc(lz_bound(buffer->text_size));
+	if (packed == NULL) return false;
+	Uint64 start = trace_begin();
+	size_t packed_size = lz_compress(buffer->text, buffer->text_size, packed);
+	trace_end_arg("pack", start, "bytes", buffer->text_size);
+	// Not worth the unpacking
+	if (packed_size > buffer->text_size - buffer->text_size / 8) {
+		SDL_free(packed);
+		return false;
+	}
+	char *shrunk = SDL_realloc(packed, packed_size);
+	if (shrunk != NULL) packed = shrunk;
+	buffer_drop_line_index(buffer);
+	SDL_free(buffer->text);
+	buffer->text = NULL;
+	buffer->text_capacity = 0;
+	buffer->packed = packed;
+	buffer->packed_size = packed_size;
+	memory_retag(buffer->packed, buffer_memory_tag(ctx, buffer));
+	return true;
+}
+
+// Empties the buffer whose packed text is corrupted, so nothing reads text that isn't there.
+// It stays unsaved and can't be saved, the file keeps what it had
+static void buffer_lose_text(Ctx *ctx, TextBuffer *buffer) {
+	SDL_free(buffer->packed);
+	buffer->packed = NULL;
+	buffer->packed_size = 0;
+	buffer->text_size = 0;
+	buffer->lost = true;
+	buffer->saved = false;
+	buffer_free_undos(buffer);
+	syntax_cache_free(buffer);
+	buffer_words_free(ctx, buffer);
+	structure_free(buffer);
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		Frame *frame = &ctx->frames[i];
+		if (!frame->taken || frame->buffer.index != buffer - ctx->buffers) continue;
+		frame->cursor = 0;
+		frame->selection = 0;
+		frame->active_selection = false;
+		frame->scroll = (SDL_FPoint){0};
+		frame_cold(ctx, frame)->search_cursor = 0;
+		frame_clear_cursors(ctx, i);
+	}
+	ctx->should_render = true;
+}
+
+static bool buffer_unpack(Ctx *ctx, TextBuffer *buffer) {
+	char *text = SDL_malloc(buffer->text_size + 1);
+	if (text == NULL) {
+		// Stays packed for the next try
+		SDL_Log("Error, can't allocate text to unpack %s", buffer->name);
+		return false;
+	}
+	Uint64 start = trace_begin();
+	bool unpacked = lz_decompress(buffer->packed, buffer->packed_size, text, buffer->text_size);
+	trace_end_arg("unpack", start, "bytes", buffer->text_size);
+	if (!unpacked) {
+		SDL_Log("Error, packed text of %s is corrupted, it's lost", buffer->name);
+		SDL_free(text);
+		buffer_lose_text(ctx, buffer);
+		return false;
+	}
+	text[buffer->text_size] = '\0';
+	SDL_free(buffer->packed);
+	buffer->packed = NULL;
+	buffer->packed_size = 0;
+	buffer->text = text;
+	buffer->text_capacity = buffer->text_size;
+	memory_retag(buffer->text, buffer_memory_tag(ctx, buffer));
+	buffer_reindex(ctx, buffer);
+	return true;
+}
+
+static bool frame_on_screen(Ctx *ctx, Uint32 frame) {
+	SDL_FRect bounds;
+	get_frame_render_rect(ctx, frame, &bounds);
+	SDL_FRect screen = {0, 0, ctx->win_w, ctx->win_h};
+	return SDL_HasRectIntersectionFloat(&bounds, &screen);
+}
+
+// Compresses the least recently used saved buffer that no frame holds, e.g. one only a jump keeps,
+// when it's idle for PACK_IDLE_MS or resident text is over the budget. Edits are never packed, a corrupted
+// stream can only lose what the file still has
+static void buffers_pack_idle(Ctx *ctx) {
+	if (ctx->ticks < ctx->next_pack_sweep) return;
+	ctx->next_pack_sweep = ctx->ticks + PACK_SWEEP_MS;
+	bool *shown = arena_alloc(&ctx->frame_arena, ctx->buffers_count * sizeof *shown);
+	if (shown == NULL) return;
+	SDL_memset(shown, 0, ctx->buffers_count * sizeof *shown);
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		if (ctx->frames[i].taken) shown[ctx->frames[i].buffer.index] = true;
+	}
+	size_t resident = 0;
+	TextBuffer *oldest = NULL;
+	for (Uint32 i = 0; i < ctx->buffers_count; ++i) {
+		TextBuffer *buffer = &ctx->buffers[i];
+		if (buffer->refcount <= 0 || buffer->packed != NULL) continue;
+		resident += buffer->text_capacity;
+		if (shown[i] || !buffer->saved || buffer->prompt || buffer->text_size < PACK_MIN_SIZE) continue;
+		if (oldest == NULL || buffer->last_access < oldest->last_access) oldest = buffer;
+	}
+	if (oldest == NULL) return;
+	if (ctx->ticks - oldest->last_access < PACK_IDLE_MS && resident <= ctx->pack_budget) return;
+	// Text that doesn't compress waits for the next idle period
+	if (!buffer_pack(ctx, oldest)) oldest->last_access = ctx->ticks;
+}
+
+// Writes where the memory goes into the log, totals by subsystem need DEBUG_MEMORY
+static void memory_dump(Ctx *ctx) {
+#ifdef DEBUG_MEMORY
+	Memory_Stats stats = memory_stats_get();
+	for (Uint32 tag = 0; tag < Memory_Tag_count; ++tag) {
+		SDL_LogInfo(0, "Memory %s: %zu bytes in %zu blocks, peak %zu", memory_tag_names[tag], stats.bytes[tag], stats.count[tag], stats.peak[tag]);
+	}
+	SDL_LogInfo(0, "Memory accounting: %zu bytes", stats.blocks_capacity * sizeof *stats.blocks);
+#endif
+	for (Uint32 i = 0; i < ctx->buffers_count; ++i) {
+		const TextBuffer *buffer = &ctx->buffers[i];
+		if (buffer->refcount <= 0) continue;
+		Buffer_Memory memory = buffer_memory(buffer);
+		SDL_LogInfo(0, "Buffer %" SDL_PRIu32 " %s: text %zu%s, undo %zu, index %zu", i, buffer->name,
+			memory.text, buffer->packed != NULL ? " packed" : "", memory.undo, memory.index);
+	}
+}
+
+typedef struct Diff_Line {
+	size_t start;
+	size_t size; // With '\n'
+	Uint32 hash;
+} Diff_Line;
+
+static Diff_Line *diff_split_lines(const char *text, size_t begin, size_t end, Sint32 *count) {
+	size_t lines = text_kernels->count_newlines(text + begin, end - begin) + 1;
+	Diff_Line *result = SDL_malloc(lines * sizeof *result);
+	if (result == NULL) return NULL;
+	*count = 0;
+	size_t pos = begin;
+	while (pos < end) {
+		size_t length = text_kernels->find_newline(text + pos, end - pos);
+		length = SDL_min(length + 1, end - pos);
+		result[*count] = (Diff_Line){pos, length, SDL_murmur3_32(text + pos, length, 0)};
+		*count += 1;
+		pos += length;
+	}
+	return result;
+}
+
+static inline bool diff_lines_equal(const char *a_text, const Diff_Line *a, const char *b_text, const Diff_Line *b) {
+	return a->hash == b->hash && a->size == b->size && SDL_memcmp(a_text + a->start, b_text + b->start, a->size) == 0;
+}
+
+// Edits turning old text into the new one, sorted and in coordinates of the old text.
+// Lines between the common prefix and suffix are matched with Myers' algorithm, if more
+// than DIFF_MAX_COST of them differ the whole range is replaced. Returns (Uint32)-1 on fail.
+static Uint32 text_diff(const char *old_text, size_t old_size, const char *new_text, size_t new_size,
+	Buffer_Edit **edits_out, char **ins_out, size_t *ins_size_out) {
+	*edits_out = NULL;
+	*ins_out = NULL;
+	*ins_size_out = 0;
+	size_t common = SDL_min(old_size, new_size);
+	size_t prefix = 0;
+	while (prefix < common && old_text[prefix] == new_text[prefix]) prefix += 1;
+	if (prefix == old_size && prefix == new_size) return 0;
+	prefix = text_line_start(old_text, prefix);
+	size_t suffix = 0;
+	while (suffix < common - prefix && old_text[old_size - suffix - 1] == new_text[new_size - suffix - 1]) suffix += 1;
+	size_t old_end = old_size - suffix, new_end = new_size - suffix;
+	Sint32 n = 0, m = 0;
+	Diff_Line *old_lines = diff_split_lines(old_text, prefix, old_end, &n);
+	Diff_Line *new_lines = diff_split_lines(new_text, prefix, new_end, &m);
+	Sint32 max = SDL_min(n + m, DIFF_MAX_COST);
+	// v[k] is the furthest old line on diagonal k, trace keeps v of every cost for the way back
+	Sint32 *v = SDL_malloc((2 * max + 3) * sizeof *v);
+	Sint32 *trace = SDL_malloc((size_t)(max + 1) * (max + 1) * sizeof *trace);
+	Sint32 cost = -1;
+	if (old_lines != NULL && new_lines != NULL && v != NULL && trace != NULL) {
+		Sint32 *vk = v + max + 1;
+		vk[1] = 0;
+		for (Sint32 d = 0; d <= max && cost < 0; ++d) {
+			for (Sint32 k = -d; k <= d; k += 2) {
+				Sint32 x = (k == -d || (k != d && vk[k - 1] < vk[k + 1])) ? vk[k + 1] : vk[k - 1] + 1;
+				Sint32 y = x - k;
+				while (x < n && y < m && diff_lines_equal(old_text, &old_lines[x], new_text, &new_lines[y])) {
+					x += 1;
+					y += 1;
 				}
-				cursor_rect.w = SDL_max(0, cursor_rect.w);
-				cursor_rect.h = SDL_max(0, cursor_rect.h);
-				set_color(ctx, text_color);
-				if (cursor_rect.x >= bounds.x + bounds.w) {
-					if (ctx->overflow_cursor_texture) {
-						cursor_rect.x = bounds.x + bounds.w - ctx->font_width * 1.5;
-						cursor_rect.w = ctx->font_width;
-						SDL_RenderTexture(ctx->renderer, ctx->overflow_cursor_texture, NULL, &cursor_rect);
-					} else {
-						cursor_rect.x = bounds.x + bounds.w - 12;
-						cursor_rect.w = 12;
-						set_color(ctx, debug_red);
-						SDL_RenderFillRect(ctx->renderer, &cursor_rect);
+				vk[k] = x;
+				if (x >= n && y >= m) cost = d;
+			}
+			SDL_memcpy(trace + (size_t)d * d, vk - d, (2 * d + 1) * sizeof *trace);
+		}
+	}
+	// Every step is one line, they are glued into edits on the way
+	Uint32 steps_count = cost < 0 ? 1 : (Uint32)cost;
+	Buffer_Edit *edits = SDL_malloc(SDL_max(steps_count, 1) * sizeof *edits);
+	char *ins = SDL_malloc(SDL_max(new_end - prefix, 1));
+	Uint32 edits_count = 0;
+	size_t ins_size = 0;
+	if (edits == NULL || ins == NULL) {
+		edits_count = (Uint32)-1;
+	} else if (cost < 0) {
+		edits[0] = (Buffer_Edit){
+			.pos = prefix,
+			.del_len = old_end - prefix,
+			.ins_len = new_end - prefix,
+		};
+		SDL_memcpy(ins, new_text + prefix, new_end - prefix);
+		ins_size = new_end - prefix;
+		edits_count = 1;
+	} else {
+		// Walked backwards, so steps are put from the end
+		Buffer_Edit *steps = edits + steps_count;
+		Sint32 x = n, y = m;
+		for (Sint32 d = cost; d > 0; --d) {
+			const Sint32 *prev = trace + (size_t)(d - 1) * (d - 1) + (d - 1);
+			Sint32 k = x - y;
+			bool insert = k == -d || (k != d && prev[k - 1] < prev[k + 1]);
+			Sint32 prev_k = insert ? k + 1 : k - 1;
+			Sint32 prev_x = prev[prev_k];
+			Sint32 prev_y = prev_x - prev_k;
+			steps -= 1;
+			if (insert) {
+				size_t pos = prev_x < n ? old_lines[prev_x].start : old_end;
+				*steps = (Buffer_Edit){.pos = pos, .ins_off = new_lines[prev_y].start, .ins_len = new_lines[prev_y].size};
+			} else {
+				*steps = (Buffer_Edit){.pos = old_lines[prev_x].start, .del_len = old_lines[prev_x].size};
+			}
+			x = prev_x;
+			y = prev_y;
+		}
+		for (Uint32 i = 0; i < steps_count; ++i) {
+			Buffer_Edit step = steps[i];
+			if (step.ins_len > 0) SDL_memcpy(ins + ins_size, new_text + step.ins_off, step.ins_len);
+			step.ins_off = ins_size;
+			ins_size += step.ins_len;
+			Buffer_Edit *last = edits_count > 0 ? &edits[edits_count - 1] : NULL;
+			if (last != NULL && last->pos + last->del_len == step.pos && last->ins_off + last->ins_len == step.ins_off) {
+				last->del_len += step.del_len;
+				last->ins_len += step.ins_len;
+			} else {
+				edits[edits_count++] = step;
+			}
+		}
+	}
+	SDL_free(old_lines);
+	SDL_free(new_lines);
+	SDL_free(v);
+	SDL_free(trace);
+	if (edits_count == (Uint32)-1) {
+		SDL_free(edits);
+		SDL_free(ins);
+		return edits_count;
+	}
+	*edits_out = edits;
+	*ins_out = ins;
+	*ins_size_out = ins_size;
+	return edits_count;
+}
+
+// Patches the buffer to the file on disk, cursors and undo history stay valid and the reload can be undone
+static void watch_reload_diff(Ctx *ctx, File_Watch *watch) {
+	size_t new_size;
+	Uint64 start = trace_begin();
+	char *new_text = SDL_LoadFile(watch->path, &new_size);
+	trace_end_arg("reload file", start, "bytes", new_text != NULL ? (Sint64)new_size : -1);
+	if (new_text == NULL) {
+		SDL_LogWarn(0, "Can't read changed file %s: %s", watch->path, SDL_GetError());
+		return;
+	}
+	TextBuffer *buffer = &ctx->buffers[watch->buffer];
+	if (!buffer_touch(ctx, buffer)) {
+		SDL_Log("Error, can't unpack %s to apply its changes on disk", watch->path);
+		SDL_free(new_text);
+		return;
+	}
+	Buffer_Edit *edits;
+	char *ins;
+	size_t ins_size;
+	Uint32 edits_count = text_diff(buffer->text, buffer->text_size, new_text, new_size, &edits, &ins, &ins_size);
+	if (edits_count == (Uint32)-1) {
+		SDL_Log("Error, can't allocate diff for %s", watch->path);
+	} else if (edits_count > 0) {
+		if (buffer_apply_batch(ctx, watch->buffer, edits_count, edits, ins_size, ins, Undo_Group_none)) {
+			// It's the file now
+			buffer->saved = true;
+			buffer_reindex(ctx, buffer);
+			SDL_LogInfo(0, "File %s changed on disk, applied %" SDL_PRIu32 " edits", watch->path, edits_count);
+		}
+	}
+	SDL_free(edits);
+	SDL_free(ins);
+	SDL_free(new_text);
+}
+
+// Reads the whole followed file again after truncation or rotation
+static void follow_reload(Ctx *ctx, File_Watch *watch, Sint64 size) {
+	TextBuffer *buffer = &ctx->buffers[watch->buffer];
+	if (!buffer_load_file(ctx, buffer, watch->path)) return;
+	buffer->undos_cursor = 0;
+	undo_clear_after_cursor(ctx, watch->buffer);
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		Frame *frame = &ctx->frames[i];
+		if (!frame->taken || frame->buffer.index != watch->buffer) continue;
+		frame->cursor = SDL_min(frame->cursor, buffer->text_size);
+		frame->selection = SDL_min(frame->selection, buffer->text_size);
+		frame_clear_cursors(ctx, i);
+		if (!frame->scroll_lock) frame->cursor = buffer->text_size;
+		frame_follow_tail(ctx, i);
+	}
+	watch->offset = SDL_min(size, (Sint64)buffer->text_size);
+	ctx->should_render = true;
+	SDL_LogInfo(0, "Reloaded followed file %s", watch->path);
+}
+
+static void follow_read(Ctx *ctx, File_Watch *watch, Sint64 file_size) {
+	if (file_size < watch->offset) {
+		follow_reload(ctx, watch, file_size);
+		return;
+	}
+	if (file_size == watch->offset) return;
+	size_t size = (size_t)SDL_min(file_size - watch->offset, FOLLOW_READ_SIZE);
+	Uint64 start = trace_begin();
+	SDL_IOStream *io = SDL_IOFromFile(watch->path, "rb");
+	if (io == NULL) return;
+	char *appended = SDL_malloc(size);
+	size_t read = 0;
+	if (appended != NULL && SDL_SeekIO(io, watch->offset, SDL_IO_SEEK_SET) >= 0) {
+		read = SDL_ReadIO(io, appended, size);
+	}
+	SDL_CloseIO(io);
+	trace_end_arg("follow file", start, "bytes", read);
+	if (read > 0) {
+		TextBuffer *buffer = &ctx->buffers[watch->buffer];
+		buffer_insert_text_no_undo(ctx, buffer, appended, read, buffer->text_size);
+		watch->offset += read;
+	}
+	SDL_free(appended);
+	// Big appends are spread over frames
+	if (watch->offset < file_size) watch->changed = true;
+}
+
+static void watch_check(Ctx *ctx, File_Watch *watch) {
+	watch->changed = false;
+	SDL_PathInfo info;
+	if (!SDL_GetPathInfo(watch->path, &info)) {
+		watch->reopen = true;
+		return;
+	}
+	bool reopened = watch->reopen;
+	if (reopened) {
+		watch->reopen = false;
+		watch_remove_inotify(ctx, watch);
+		watch_add_inotify(ctx, watch);
+		// New file has a new inode
+		buffer_register_file(ctx, watch->buffer, watch->path);
+	}
+	if (watch->follow) {
+		if (reopened) follow_reload(ctx, watch, info.size);
+		else follow_read(ctx, watch, info.size);
+	} else if (reopened || (Sint64)info.size != watch->size || info.modify_time != watch->modify_time) {
+		watch_reload_diff(ctx, watch);
+	}
+	watch->size = info.size;
+	watch->modify_time = info.modify_time;
+}
+
+// Starts or stops following the file of the frame
+static void frame_toggle_follow(Ctx *ctx, Uint32 framei) {
+	Frame *frame = &ctx->frames[framei];
+	Uint32 bufid = frame_buffer(ctx, frame) - ctx->buffers;
+	File_Watch *watch = buffer_file_watch(ctx, bufid);
+	if (watch != NULL && watch->follow) {
+		// Still watched, the rest of the file comes as a diff
+		watch->follow = false;
+		watch->changed = true;
+		watch->size = watch->offset;
+		SDL_LogInfo(0, "Stopped following %s", watch->path);
+		return;
+	}
+	if (frame_cold(ctx, frame)->filename == NULL) {
+		SDL_LogWarn(0, "Frame has no file to follow");
+		return;
+	}
+	SDL_PathInfo info;
+	if (!SDL_GetPathInfo(frame_cold(ctx, frame)->filename, &info) || info.type != SDL_PATHTYPE_FILE) {
+		SDL_LogWarn(0, "Can't follow %s: %s", frame_cold(ctx, frame)->filename, SDL_GetError());
+		return;
+	}
+	watch = buffer_watch_file(ctx, bufid, frame_cold(ctx, frame)->filename);
+	if (watch == NULL) return;
+	watch->follow = true;
+	// Edits of the buffer don't matter, it continues from what the file had
+	watch->changed = true;
+	frame->cursor = frame_buffer(ctx, frame)->text_size;
+	frame->active_selection = false;
+	frame_clear_cursors(ctx, framei);
+	frame->scroll_lock = false;
+	frame_follow_tail(ctx, framei);
+	ctx->should_render = true;
+	SDL_LogInfo(0, "Following %s%s", frame_cold(ctx, frame)->filename, watch->watch < 0 ? " by polling" : "");
+}
+
+// Shows the file in the frame from the start. The frame keeps its buffer until the new one is ready,
+// false if there is no memory for it, the file can't be read or the opened one can't be unpacked
+static bool frame_open_file(Ctx *ctx, Uint32 framei, const char *path) {
+	Uint32 opened = buffer_find_file(ctx, path);
+	TextBuffer *buffer = NULL;
+	if (opened != (Uint32)-1) {
+		// Only a jump may hold it, unpacked before the frame takes it
+		if (!buffer_touch(ctx, &ctx->buffers[opened])) return false;
+		// One buffer per file, frames share it
+		buffer = &ctx->buffers[opened];
+		SDL_LogInfo(0, "File %s is already opened", path);
+	} else {
+		char *name = SDL_strdup(path);
+		buffer = name != NULL ? allocate_buffer(ctx, name) : NULL;
+		if (buffer == NULL) {
+			SDL_free(name);
+			SDL_LogError(0, "Can't allocate buffer for this file");
+			return false;
+		}
+		if (!buffer_load_file(ctx, buffer, path)) {
+			// Empty buffer would overwrite the file on save
+			if (SDL_GetPathInfo(path, NULL)) {
+				SDL_LogError(0, "Can't load file %s", path);
+				buffer->refcount = 1;
+				buffer_release(ctx, buffer);
+				return false;
+			}
+			SDL_LogInfo(0, "File %s doesn't exists, creating", path);
+		} else {
+			SDL_LogInfo(0, "Opened file %s", path);
+			if (!buffer->line_index.utf8_valid) {
+				SDL_LogWarn(0, "File %s isn't valid utf8", path);
+			}
+		}
+		buffer_watch_file(ctx, buffer - ctx->buffers, path);
+	}
+	buffer->refcount += 1;
+	// Taken after allocation, the buffers array may have moved
+	Frame *frame = &ctx->frames[framei];
+	buffer_release(ctx, frame_buffer(ctx, frame));
+	frame->buffer = buffer_handle(ctx, buffer);
+	SDL_free(frame_cold(ctx, frame)->filename);
+	frame_cold(ctx, frame)->filename = SDL_strdup(path);
+	frame->scroll_lock = true;
+	frame->cursor = 0;
+	frame->active_selection = false;
+	frame_clear_cursors(ctx, framei);
+	frame->scroll.x = 0;
+	return true;
+}
+
+// Once per frame, applies changes of watched files
+static void watch_update(Ctx *ctx) {
+	if (ctx->watches_count == 0) return;
+#ifdef SDL_PLATFORM_LINUX
+	if (ctx->inotify >= 0) {
+		char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		ssize_t length;
+		while ((length = read(ctx->inotify, events, sizeof events)) > 0) {
+			for (char *ptr = events; ptr < events + length; ptr += sizeof (struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+				const struct inotify_event *event = (const struct inotify_event *)ptr;
+				for (Uint32 i = 0; i < ctx->watches_count; ++i) {
+					File_Watch *watch = &ctx->watches[i];
+					if (!watch->taken || watch->watch != event->wd) continue;
+					watch->changed = true;
+					if (event->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) {
+						watch->reopen = true;
+						if (event->mask & IN_IGNORED) watch->watch = -1;
 					}
-				} else if (ctx->focused_frame == frame) {
-					SDL_RenderFillRect(ctx->renderer, &cursor_rect);
-				} else {
-					SDL_RenderRect(ctx->renderer, &cursor_rect);
 				}
-			} // end of cursor
+			}
 		}
 	}
-	if (frame_has_line_numbers(ctx, frame)) {
-		for (; (start.y + ctx->line_height) < lines_numbers_bounds.y + lines_numbers_bounds.h; ++linenum) {
-			draw_text_fmt(ctx, start.x - (lines_bounds.x - lines_numbers_bounds.x), start.y, line_number_dimmed_color, "%u", linenum);
-			start.y += ctx->line_height;
+#endif
+	Uint64 now = SDL_GetTicks();
+	for (Uint32 i = 0; i < ctx->watches_count; ++i) {
+		File_Watch *watch = &ctx->watches[i];
+		if (!watch->taken) continue;
+		bool polled = watch->watch < 0 || watch->reopen;
+		if (polled && now >= watch->next_poll) {
+			watch->next_poll = now + WATCH_POLL_MS;
+			watch->changed = true;
 		}
-	} // end of line numbers
-#ifdef DEBUG_UNDO
-	for (Uint32 i = 0; i < draw_frame->buffer->undos_size; ++i) {
-		Undo_Operation op = draw_frame->buffer->undos[i];
-		SDL_FPoint start = {50, 200};
-		draw_text_fmt(ctx, start.x, start.y + i * ctx->line_height, debug_green, "%u (%d %u - %u) %.*s", i, (int)op.type, op.pos, op.len, (int)op.len, op.data);
+		if (watch->changed) watch_check(ctx, watch);
 	}
-#endif
-#ifdef DEBUG_SCROLL
-	if (draw_frame->scroll_lock)
-		SDL_SetRenderDrawColor(ctx->renderer, 0xcc, 0x20, 0x20, SDL_ALPHA_OPAQUE);
-	else
-		SDL_SetRenderDrawColor(ctx->renderer, 0x20, 0xcc, 0x20, SDL_ALPHA_OPAQUE);
-	SDL_RenderFillRect(ctx->renderer, &(SDL_FRect) {
-		bounds.x + bounds.w - 0x10,
-		bounds.y,
-		0x10, 0x10,
-	});
-#endif
-#ifdef DEBUG_CURSOR
-	draw_text_fmt(ctx, bounds.x + bounds.w - 0x10 * ctx->font_width, bounds.y + bounds.h - ctx->line_height * 2, text_color, "%u", draw_frame->cursor);
-#endif
-#ifdef DEBUG_FILES
-	if (draw_frame->filename) {
-		SDL_SetRenderDrawColor(ctx->renderer, 0x20, 0x20, 0x20, SDL_ALPHA_OPAQUE);
-		SDL_RenderFillRect(ctx->renderer, &(SDL_FRect) {
-			bounds.x + bounds.w - SDL_strlen(draw_frame->filename) * ctx->font_width,
-			bounds.y + bounds.h - ctx->line_height,
-			SDL_strlen(draw_frame->filename) * ctx->font_width,
-			ctx->line_height,
-		});
-		draw_text(ctx, bounds.x + bounds.w - SDL_strlen(draw_frame->filename) * ctx->font_width,
-			bounds.y + bounds.h - ctx->line_height, text_color, 0, draw_frame->filename);
+}
+
+static bool tags_lex_add(Tags_Lex_Job *job, const char *name, size_t length, Uint32 line) {
+	if (length == 0 || length >= TAGS_NAME_MAX) return true;
+	// typedef struct Name {...} Name; is one place to jump to
+	for (Uint32 i = job->tags_count; i > 0 && job->tags[i - 1].line == line; --i) {
+		const char *other = job->chars + job->tags[i - 1].name;
+		if (SDL_strncmp(other, name, length) == 0 && other[length] == '\0') return true;
 	}
-#endif
-	if (ctx->focused_frame == frame) {
-		SDL_SetRenderDrawColor(ctx->renderer, 0x08, 0x38, 0x08, SDL_ALPHA_OPAQUE);
-	} else {
-		SDL_SetRenderDrawColor(ctx->renderer, 0x08, 0x08, 0x08, SDL_ALPHA_OPAQUE);
+	if (job->tags_count == job->tags_capacity) {
+		Uint32 new_cap = job->tags_capacity == 0 ? 64 : job->tags_capacity * 2;
+		Tag *new_tags = SDL_realloc(job->tags, new_cap * sizeof *new_tags);
+		if (new_tags == NULL) return false;
+		job->tags = new_tags;
+		job->tags_capacity = new_cap;
 	}
-	SDL_RenderRect(ctx->renderer, &(SDL_FRect) {
-		bounds.x,
-		bounds.y,
-		bounds.w,
-		bounds.h,
-	});
-#ifdef DEBUG_LAYOUT
-	set_color(ctx, debug_red);
-	SDL_RenderRect(ctx->renderer, &lines_bounds);
-	set_color(ctx, debug_blue);
-	SDL_RenderLine(ctx->renderer, lines_bounds.x, bounds.y + draw_frame->scroll_interp.y, lines_bounds.x + lines_bounds.w, bounds.y + draw_frame->scroll_interp.y);
-#endif
+	if (job->chars_size + length + 1 > job->chars_capacity) {
+		Uint32 new_cap = SDL_max(job->chars_capacity * 2, 1024);
+		char *new_chars = SDL_realloc(job->chars, new_cap);
+		if (new_chars == NULL) return false;
+		job->chars = new_chars;
+		job->chars_capacity = new_cap;
+	}
+	job->tags[job->tags_count++] = (Tag){.name = job->chars_size, .file = job->file, .line = line};
+	SDL_memcpy(job->chars + job->chars_size, name, length);
+	job->chars[job->chars_size + length] = '\0';
+	job->chars_size += length + 1;
+	return true;
 }
 
-static TextBuffer *allocate_buffer(Ctx *ctx, char *name) {
-	for (Uint32 i = 0; i < ctx->buffers_count; ++i) {
-		if (ctx->buffers[i].refcount > 0) continue;
-		ctx->buffers[i] = (TextBuffer){
-			.name = name,
-		};
-		return &ctx->buffers[i];
-	}
-	if (ctx->buffers_capacity <= ctx->buffers_count) {
-		size_t new_cap = ctx->buffers_capacity * 2;
-		if (new_cap == 0) {
-			new_cap = 8;
+static inline bool tags_word_is(const char *text, size_t length, const char *word) {
+	return SDL_strlen(word) == length && SDL_memcmp(text, word, length) == 0;
+}
+
+// Finds file scope definitions without preprocessing: functions with a body, macros,
+// struct, union and enum tags, enum constants and typedef names
+static void tags_lex(Tags_Lex_Job *job, const char *text, size_t size) {
+	Uint32 line = 0;
+	Uint32 depth = 0; // Braces
+	Uint32 parens = 0;
+	bool line_start = true;
+	char last = '\0'; // Last punctuation, 'a' for identifiers, numbers and literals
+	char before_last = '\0';
+	char third_last = '\0';
+	size_t ident = 0, ident_length = 0; // Last identifier
+	size_t function = 0, function_length = 0; // Named before '(' at file scope, defined if a body follows
+	Uint32 function_line = 0;
+	bool aggregate = false; // After struct, union or enum
+	bool enumeration = false;
+	Uint32 enum_depth = 0; // Depth inside an enum body, 0 outside
+	size_t aggregate_name = 0, aggregate_length = 0;
+	Uint32 aggregate_line = 0;
+	bool typedef_active = false;
+	size_t typedef_name = 0, typedef_length = 0;
+	Uint32 typedef_line = 0;
+	size_t i = 0;
+	while (i < size) {
+		char c = text[i];
+		if (c == '\n') {
+			line += 1;
+			line_start = true;
+			i += 1;
+			continue;
 		}
-		TextBuffer *new_buffers = SDL_realloc(ctx->buffers, new_cap * (sizeof *ctx->buffers));
-		if (new_buffers == NULL) {
-			SDL_Log("Can't reallocate buffers array");
-			return NULL;
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+			i += 1;
+			continue;
+		}
+		if (c == '/' && i + 1 < size && text[i + 1] == '/') {
+			while (i < size && text[i] != '\n') i += 1;
+			continue;
+		}
+		if (c == '/' && i + 1 < size && text[i + 1] == '*') {
+			i += 2;
+			while (i < size && !(text[i] == '*' && i + 1 < size && text[i + 1] == '/')) {
+				if (text[i] == '\n') line += 1;
+				i += 1;
+			}
+			i += 2;
+			continue;
+		}
+		if (c == '#' && line_start) {
+			i += 1;
+			while (i < size && (text[i] == ' ' || text[i] == '\t')) i += 1;
+			size_t word = i;
+			while (i < size && syntax_word_char(text[i])) i += 1;
+			if (tags_word_is(text + word, i - word, "define")) {
+				while (i < size && (text[i] == ' ' || text[i] == '\t')) i += 1;
+				size_t name = i;
+				while (i < size && syntax_word_char(text[i])) i += 1;
+				if (!tags_lex_add(job, text + name, i - name, line)) return;
+			}
+			// Rest of the directive, with continued lines
+			while (i < size && text[i] != '\n') {
+				if (text[i] == '\\' && i + 1 < size && text[i + 1] == '\n') {
+					line += 1;
+					i += 1;
+				}
+				i += 1;
+			}
+			continue;
+		}
+		line_start = false;
+		if (c == '"' || c == '\'') {
+			i += 1;
+			while (i < size && text[i] != c && text[i] != '\n') {
+				if (text[i] == '\\' && i + 1 < size && text[i + 1] == '\n') line += 1;
+				i += text[i] == '\\' ? 2 : 1;
+			}
+			i += 1;
+			last = 'a';
+			continue;
+		}
+		if (syntax_word_char(c)) {
+			size_t start = i;
+			while (i < size && syntax_word_char(text[i])) i += 1;
+			size_t length = i - start;
+			third_last = before_last;
+			before_last = last;
+			last = 'a';
+			if (SDL_isdigit((Uint8)c)) continue;
+			bool reserved = length >= 2 && text[start] == '_' && text[start + 1] == '_';
+			if (depth == 0 && parens == 0) {
+				if (tags_word_is(text + start, length, "typedef")) {
+					typedef_active = true;
+					typedef_length = 0;
+					continue;
+				}
+				if (tags_word_is(text + start, length, "struct") || tags_word_is(text + start, length, "union")
+					|| tags_word_is(text + start, length, "enum")) {
+					aggregate = true;
+					enumeration = text[start] == 'e';
+					aggregate_length = 0;
+					continue;
+				}
+				if (aggregate && aggregate_length == 0) {
+					aggregate_name = start;
+					aggregate_length = length;
+					aggregate_line = line;
+				} else {
+					aggregate = false;
+				}
+			}
+			// Function pointer types are named by (*Name)
+			if (typedef_active && !reserved && depth == 0 && (parens == 0 || (parens == 1 && before_last == '*' && third_last == '('))) {
+				typedef_name = start;
+				typedef_length = length;
+				typedef_line = line;
+			}
+			if (enum_depth > 0 && depth == enum_depth && parens == 0 && (before_last == '{' || before_last == ',')) {
+				if (!tags_lex_add(job, text + start, length, line)) return;
+			}
+			if (!reserved) {
+				ident = start;
+				ident_length = length;
+			} else {
+				ident_length = 0;
+			}
+			continue;
+		}
+		i += 1;
+		third_last = before_last;
+		before_last = last;
+		last = c;
+		switch (c) {
+		case '(': {
+			if (depth == 0 && parens == 0 && before_last == 'a' && ident_length > 0) {
+				function = ident;
+				function_length = ident_length;
+				function_line = line;
+			}
+			parens += 1;
+		} break;
+		case ')': {
+			if (parens > 0) parens -= 1;
+		} break;
+		case '{': {
+			if (depth == 0) {
+				if (aggregate && aggregate_length > 0) {
+					if (!tags_lex_add(job, text + aggregate_name, aggregate_length, aggregate_line)) return;
+				} else if (!aggregate && function_length > 0 && parens == 0) {
+					if (!tags_lex_add(job, text + function, function_length, function_line)) return;
+				}
+				if (aggregate && enumeration) enum_depth = 1;
+				function_length = 0;
+			}
+			aggregate = false;
+			depth += 1;
+		} break;
+		case '}': {
+			if (depth > 0) depth -= 1;
+			if (depth < enum_depth) enum_depth = 0;
+		} break;
+		case ';': {
+			if (depth == 0) {
+				if (typedef_active && typedef_length > 0) {
+					if (!tags_lex_add(job, text + typedef_name, typedef_length, typedef_line)) return;
+				}
+				typedef_active = false;
+				function_length = 0;
+				aggregate = false;
+				parens = 0;
+			}
+		} break;
+		case '=': {
+			if (depth == 0 && parens == 0) function_length = 0;
+		} break;
+		case ',': {
+			if (depth == 0 && parens == 0) function_length = 0;
+		} break;
+		default: break;
 		}
-		ctx->buffers = new_buffers;
-		ctx->buffers_capacity = new_cap;
 	}
-	TextBuffer *buffer = &ctx->buffers[ctx->buffers_count++];
-	*buffer = (TextBuffer){
-		.name = name,
-	};
-	return buffer;
 }
 
-static inline float vec_len(const SDL_FPoint vec) {
-	return SDL_sqrt(vec.x * vec.x + vec.y * vec.y);
+static void tags_lex_job(void *userdata, Uint32 index) {
+	Tags_Lex_Job *job = &((Tags_Lex_Job *)userdata)[index];
+	size_t size;
+	char *text = SDL_LoadFile(job->path, &size);
+	if (text == NULL) return;
+	tags_lex(job, text, size);
+	SDL_free(text);
 }
 
-static inline float point_to_line_dist(SDL_FPoint point, SDL_FPoint start, SDL_FPoint end) {
-	SDL_FPoint rel_point = {point.x - start.x, point.y - start.y};
-	SDL_FPoint vec = {end.x - start.x, end.y - start.y};
-	SDL_FPoint norm_vec = {vec.x / vec_len(vec), vec.y / vec_len(vec)};
-	float dot_prod = SDL_min(SDL_fabs(norm_vec.x * rel_point.x + norm_vec.y * rel_point.y), vec_len(vec));
-	SDL_FPoint inter = {start.x + norm_vec.x * dot_prod, start.y + norm_vec.y * dot_prod};
-	SDL_FPoint dist_vec = {inter.x - point.x, inter.y - point.y};
-	return SDL_sqrt(dist_vec.x * dist_vec.x + dist_vec.y * dist_vec.y);
+static inline const char *tags_file_path(const Tag_Index *tags, Uint32 file) {
+	return tags->strings + tags->files[file].path;
 }
 
-static void set_focused_frame(Ctx *ctx, Uint32 frame) {
-	ctx->focused_frame = frame;
-	Uint32 first = frame;
-	Uint32 sorted_ind = reverse_sorted_index(ctx, frame);
-	if (sorted_ind != 0)
-		SDL_memmove(&ctx->sorted_frames[1], &ctx->sorted_frames[0], sorted_ind * sizeof (*ctx->sorted_frames));
-	ctx->sorted_frames[0] = first;
+// Image file with the path, (Uint32)-1 if it has none
+static Uint32 tags_find_file(const Tag_Index *tags, const char *path) {
+	if (tags->image == NULL) return (Uint32)-1;
+	Uint32 low = 0, high = tags->header->files_count;
+	while (low < high) {
+		Uint32 mid = low + (high - low) / 2;
+		int result = SDL_strcmp(tags_file_path(tags, mid), path);
+		if (result == 0) return mid;
+		if (result < 0) low = mid + 1;
+		else high = mid;
+	}
+	return (Uint32)-1;
 }
 
-static char *utf8_go_forward(size_t text_size, char text[text_size], Uint32 count) {
-	for (; count != 0; --count) {
-		if (text_size <= 0) return text;
-		SDL_StepUTF8((const char **)&text, &text_size);
+static inline bool tags_file_is_saved(const Tag_Index *tags, Uint32 file) {
+	for (Uint32 i = 0; i < tags->saved_files_count; ++i) {
+		if (tags->saved_files[i] == file) return true;
 	}
-	return text;
+	return false;
 }
 
-static bool generate_overflow_cursor(Ctx *ctx) {
-	SDL_Surface *cursor_overflow_surface = SDL_CreateSurface(ctx->font_width * 2, ctx->font_size * 2, SDL_PIXELFORMAT_RGBA8888);
-	if (!cursor_overflow_surface) {
-		SDL_LogWarn(0, "Error, can't create surface for cursor overflow texture: %s", SDL_GetError());
-		return false;
+// First of the sorted tags with the name or past them
+static Uint32 tags_lower_bound(const Tag *all_tags, Uint32 count, const char *strings, const char *name) {
+	Uint32 low = 0, high = count;
+	while (low < high) {
+		Uint32 mid = low + (high - low) / 2;
+		if (SDL_strcmp(strings + all_tags[mid].name, name) < 0) low = mid + 1;
+		else high = mid;
 	}
-	if (!SDL_LockSurface(cursor_overflow_surface)) {
-		SDL_LogWarn(0, "Can't lock cursor overflow cursor surface: %s", SDL_GetError());
-		SDL_DestroySurface(cursor_overflow_surface);
-		return false;
+	return low;
+}
+
+// How many definitions the name has, the image's ones first and then of saved files. found gets the match-th
+static Uint32 tags_find(const Tag_Index *tags, const char *name, Uint32 match, Tag *found) {
+	if (tags->image == NULL) return 0;
+	Uint32 count = 0;
+	Uint32 tags_count = tags->header->tags_count;
+	for (Uint32 i = tags_lower_bound(tags->tags, tags_count, tags->strings, name);
+		i < tags_count && SDL_strcmp(tags->strings + tags->tags[i].name, name) == 0; ++i) {
+		if (tags_file_is_saved(tags, tags->tags[i].file)) continue;
+		if (count++ == match) *found = tags->tags[i];
 	}
-	float width = 2.5;
-	float min_rot = SDL_min(cursor_overflow_surface->h / 2, cursor_overflow_surface->w) - width;
-	for (int y = 0; y < cursor_overflow_surface->h; ++y) {
-		for (int x = 0; x < cursor_overflow_surface->w; ++x) {
-			float dist1 = width - point_to_line_dist((SDL_FPoint){x, y+0.5}, (SDL_FPoint){2, 2}, (SDL_FPoint){min_rot, min_rot});
-			float dist2 = width - point_to_line_dist((SDL_FPoint){x, y+0.5}, (SDL_FPoint){2, min_rot * 2 - 2}, (SDL_FPoint){min_rot, min_rot});
-			float value = SDL_clamp(SDL_max(dist1, dist2) * 0xcc, 0x00, 0xff);
-			SDL_Color color = {value, value, value, value};
-			((Uint32 *)((Uint8 *)cursor_overflow_surface->pixels + y * cursor_overflow_surface->pitch))[x]
-				= SDL_MapSurfaceRGBA(cursor_overflow_surface, color.r, color.g, color.b, color.a);
-		}
+	for (Uint32 i = tags_lower_bound(tags->saved, tags->saved_count, tags->saved_chars, name);
+		i < tags->saved_count && SDL_strcmp(tags->saved_chars + tags->saved[i].name, name) == 0; ++i) {
+		if (count++ == match) *found = tags->saved[i];
 	}
-	SDL_UnlockSurface(cursor_overflow_surface);
-	ctx->overflow_cursor_texture = SDL_CreateTextureFromSurface(ctx->renderer, cursor_overflow_surface);
-	SDL_DestroySurface(cursor_overflow_surface);
-	if (ctx->overflow_cursor_texture == NULL) {
-		SDL_LogWarn(0, "Can't convert cursor overflow surface into texture: %s", SDL_GetError());
-		return false;
+	return count;
+}
+
+// Takes the image if it's well formed, everything in it is checked so broken files can't be read past
+static bool tags_set_image(Tag_Index *tags, void *image, size_t size) {
+	const Tags_Header *header = image;
+	if (size < sizeof *header || header->magic != TAGS_MAGIC) return false;
+	size_t files_size = (size_t)header->files_count * sizeof (Tags_File);
+	size_t tags_size = (size_t)header->tags_count * sizeof (Tag);
+	if (size != sizeof *header + files_size + tags_size + header->strings_size) return false;
+	const Tags_File *files = (const Tags_File *)(header + 1);
+	const Tag *all_tags = (const Tag *)((const char *)files + files_size);
+	const char *strings = (const char *)all_tags + tags_size;
+	if (header->strings_size == 0 || strings[header->strings_size - 1] != '\0') return false;
+	for (Uint32 i = 0; i < header->files_count; ++i) {
+		if (files[i].path >= header->strings_size) return false;
+	}
+	for (Uint32 i = 0; i < header->tags_count; ++i) {
+		if (all_tags[i].name >= header->strings_size || all_tags[i].file >= header->files_count) return false;
 	}
+	SDL_free(tags->image);
+	tags->image = image;
+	tags->image_size = size;
+	tags->header = header;
+	tags->files = files;
+	tags->tags = all_tags;
+	tags->strings = strings;
+	// File ids changed and the image has what was saved
+	tags->saved_files_count = 0;
+	tags->saved_count = 0;
+	tags->saved_chars_size = 0;
 	return true;
 }
 
-static bool generate_space_texture(Ctx *ctx) {
-	SDL_Surface *space_surface = SDL_CreateSurface(ctx->font_width, ctx->font_size, SDL_PIXELFORMAT_RGBA8888);
-	if (!space_surface) {
-		SDL_LogWarn(0, "Can't create surface for space texture: %s", SDL_GetError());
-		return false;
+static bool tags_add_scanned(Tag_Index *tags, char *path, Sint64 modify_time, Uint64 size, Uint32 old) {
+	if (tags->scanned_count == tags->scanned_capacity) {
+		Uint32 new_cap = tags->scanned_capacity == 0 ? 256 : tags->scanned_capacity * 2;
+		Tags_Scanned *new_scanned = SDL_realloc(tags->scanned, new_cap * sizeof *new_scanned);
+		if (new_scanned == NULL) return false;
+		tags->scanned = new_scanned;
+		tags->scanned_capacity = new_cap;
 	}
-	if (!SDL_LockSurface(space_surface)) {
-		SDL_LogWarn(0, "Can't lock space surface: %s", SDL_GetError());
-		SDL_DestroySurface(space_surface);
-		return false;
+	tags->scanned[tags->scanned_count++] = (Tags_Scanned){.path = path, .modify_time = modify_time, .size = size, .old = old};
+	if (old != (Uint32)-1) tags->kept += 1;
+	return true;
+}
+
+static bool tags_push_dir(Tag_Index *tags, char *path) {
+	if (tags->dirs_count == tags->dirs_capacity) {
+		Uint32 new_cap = tags->dirs_capacity == 0 ? 64 : tags->dirs_capacity * 2;
+		char **new_dirs = SDL_realloc(tags->dirs, new_cap * sizeof *new_dirs);
+		if (new_dirs == NULL) return false;
+		tags->dirs = new_dirs;
+		tags->dirs_capacity = new_cap;
 	}
-	float width = 1.8;
-	SDL_FPoint center = {space_surface->w / 2, space_surface->h / 2.1};
-	for (int y = 0; y < space_surface->h; ++y) {
-		for (int x = 0; x < space_surface->w; ++x) {
-			float dist = width - SDL_sqrt((center.y - y) * (center.y - y) + (center.x - x) * (center.x - x));
-			float value = SDL_clamp(dist * 0xee, 0x00, 0xff);
-			SDL_Color color = {value, value, value, value / 2.2};
-			((Uint32 *)((Uint8 *)space_surface->pixels + y * space_surface->pitch))[x]
-				= SDL_MapSurfaceRGBA(space_surface, color.r, color.g, color.b, color.a);
+	tags->dirs[tags->dirs_count++] = path;
+	return true;
+}
+
+static void tags_scan_free(Tag_Index *tags) {
+	for (Uint32 i = 0; i < tags->dirs_count; ++i) SDL_free(tags->dirs[i]);
+	for (Uint32 i = 0; i < tags->scanned_count; ++i) SDL_free(tags->scanned[i].path);
+	tags->dirs_count = 0;
+	tags->scanned_count = 0;
+	tags->lexed = 0;
+	tags->kept = 0;
+	tags->added_count = 0;
+	tags->chars_size = 0;
+}
+
+typedef struct Tags_Listing {
+	Tag_Index *tags;
+	const char *dir;
+	Uint32 entries;
+} Tags_Listing;
+
+static SDL_EnumerationResult tags_list_entry(void *userdata, const char *dirname, const char *fname) {
+	(void) dirname;
+	Tags_Listing *listing = userdata;
+	Tag_Index *tags = listing->tags;
+	listing->entries += 1;
+	if (fname[0] == '.') return SDL_ENUM_CONTINUE;
+	size_t length = SDL_strlen(fname);
+	char *path;
+	if (listing->dir[0] == '\0') path = SDL_strdup(fname);
+	else if (SDL_asprintf(&path, "%s/%s", listing->dir, fname) < 0) path = NULL;
+	if (path == NULL) return SDL_ENUM_FAILURE;
+	SDL_PathInfo info;
+	if (SDL_GetPathInfo(path, &info)) {
+		if (info.type == SDL_PATHTYPE_DIRECTORY) {
+			Uint32 depth = 0;
+			for (const char *c = path; *c != '\0'; ++c) depth += *c == '/';
+			if (depth < TAGS_DEPTH_MAX && tags_push_dir(tags, path)) return SDL_ENUM_CONTINUE;
+		} else if (info.type == SDL_PATHTYPE_FILE && length > 2 && fname[length - 2] == '.'
+			&& (fname[length - 1] == 'c' || fname[length - 1] == 'h') && tags->scanned_count < TAGS_FILES_MAX) {
+			Uint32 old = tags_find_file(tags, path);
+			if (old != (Uint32)-1 && (tags->files[old].modify_time != info.modify_time || tags->files[old].size != info.size)) {
+				old = (Uint32)-1;
+			}
+			if (tags_add_scanned(tags, path, info.modify_time, info.size, old)) return SDL_ENUM_CONTINUE;
 		}
 	}
-	SDL_UnlockSurface(space_surface);
-	ctx->space_texture = SDL_CreateTextureFromSurface(ctx->renderer, space_surface);
-	SDL_DestroySurface(space_surface);
-	if (ctx->space_texture == NULL) {
-		SDL_LogWarn(0, "Can't convert space surface into texture: %s", SDL_GetError());
-		return false;
+	SDL_free(path);
+	return SDL_ENUM_CONTINUE;
+}
+
+// Lexes the next scanned files that aren't in the image yet on the pool
+static bool tags_lex_step(Ctx *ctx) {
+	Tag_Index *tags = &ctx->tags;
+	Tags_Lex_Job jobs[TAGS_LEX_STEP];
+	Uint32 count = 0;
+	while (tags->lexed < tags->scanned_count && count < TAGS_LEX_STEP) {
+		Uint32 file = tags->lexed++;
+		if (tags->scanned[file].old != (Uint32)-1) continue;
+		jobs[count++] = (Tags_Lex_Job){.path = tags->scanned[file].path, .file = file};
 	}
-	return true;
+	Uint64 start = trace_begin();
+	parallel_for(ctx, count, tags_lex_job, jobs);
+	trace_end_arg("lex definitions", start, "files", count);
+	bool result = true;
+	for (Uint32 i = 0; i < count; ++i) {
+		Tags_Lex_Job *job = &jobs[i];
+		if (result && (tags->added_count + job->tags_count > tags->added_capacity
+			|| tags->chars_size + job->chars_size > tags->chars_capacity)) {
+			Uint32 new_cap = SDL_max(tags->added_capacity * 2, tags->added_count + job->tags_count);
+			Tag *new_added = SDL_realloc(tags->added, new_cap * sizeof *new_added);
+			if (new_added != NULL) {
+				memory_retag(new_added, Memory_Tag_layout);
+				tags->added = new_added;
+				tags->added_capacity = new_cap;
+			}
+			Uint32 new_chars_cap = SDL_max(tags->chars_capacity * 2, tags->chars_size + job->chars_size);
+			char *new_chars = SDL_realloc(tags->chars, new_chars_cap);
+			if (new_chars != NULL) {
+				memory_retag(new_chars, Memory_Tag_layout);
+				tags->chars = new_chars;
+				tags->chars_capacity = new_chars_cap;
+			}
+			result = new_added != NULL && new_chars != NULL;
+		}
+		if (result) {
+			for (Uint32 j = 0; j < job->tags_count; ++j) {
+				Tag tag = job->tags[j];
+				tag.name += tags->chars_size;
+				tags->added[tags->added_count++] = tag;
+			}
+			SDL_memcpy(tags->chars + tags->chars_size, job->chars, job->chars_size);
+			tags->chars_size += job->chars_size;
+		}
+		SDL_free(job->tags);
+		SDL_free(job->chars);
+	}
+	return result;
 }
 
-static bool generate_tab_texture(Ctx *ctx) {
-	SDL_Surface *tab_surface = SDL_CreateSurface(ctx->font_width * TAB_WIDTH, ctx->font_size, SDL_PIXELFORMAT_RGBA8888);
-	if (!tab_surface) {
-		SDL_LogWarn(0, "Can't create surface for tab texture: %s", SDL_GetError());
-		return false;
+static int tags_path_compare(void *userdata, const void *a, const void *b) {
+	const Tags_Scanned *scanned = userdata;
+	return SDL_strcmp(scanned[*(const Uint32 *)a].path, scanned[*(const Uint32 *)b].path);
+}
+
+static int tags_name_compare(void *userdata, const void *a, const void *b) {
+	const char *chars = userdata;
+	int result = SDL_strcmp(chars + ((const Tag *)a)->name, chars + ((const Tag *)b)->name);
+	if (result != 0) return result;
+	return (int)((const Tag *)a)->file - (int)((const Tag *)b)->file;
+}
+
+// New image out of the scanned files: tags of kept files come from the old image, the rest from lexing
+static bool tags_merge(Tag_Index *tags) {
+	Uint32 files_count = tags->scanned_count;
+	Uint32 old_files = tags->image != NULL ? tags->header->files_count : 0;
+	Uint32 old_tags = tags->image != NULL ? tags->header->tags_count : 0;
+	Uint32 *order = SDL_malloc((files_count + 1) * sizeof *order);
+	Uint32 *new_files = SDL_malloc((files_count + 1) * sizeof *new_files); // By scanned file
+	Uint32 *old_map = SDL_malloc((old_files + 1) * sizeof *old_map); // By image file, (Uint32)-1 if it's gone
+	void *image = NULL;
+	bool result = false;
+	if (order == NULL || new_files == NULL || old_map == NULL) goto exit;
+	for (Uint32 i = 0; i < files_count; ++i) order[i] = i;
+	SDL_qsort_r(order, files_count, sizeof *order, tags_path_compare, tags->scanned);
+	for (Uint32 i = 0; i < old_files; ++i) old_map[i] = (Uint32)-1;
+	size_t strings_size = 0;
+	for (Uint32 i = 0; i < files_count; ++i) {
+		Tags_Scanned *file = &tags->scanned[order[i]];
+		new_files[order[i]] = i;
+		if (file->old != (Uint32)-1) old_map[file->old] = i;
+		strings_size += SDL_strlen(file->path) + 1;
 	}
-	if (!SDL_LockSurface(tab_surface)) {
-		SDL_LogWarn(0, "Can't lock tab surface: %s", SDL_GetError());
-		SDL_DestroySurface(tab_surface);
-		return false;
+	SDL_qsort_r(tags->added, tags->added_count, sizeof *tags->added, tags_name_compare, tags->chars);
+	Uint32 tags_count = tags->added_count;
+	for (Uint32 i = 0; i < old_tags; ++i) {
+		if (old_map[tags->tags[i].file] == (Uint32)-1) continue;
+		tags_count += 1;
+		strings_size += SDL_strlen(tags->strings + tags->tags[i].name) + 1;
 	}
-	for (int y = 0; y < tab_surface->h; ++y) {
-		for (int x = 0; x < tab_surface->w; ++x) {
-			float x0 = (x == 0) * 0xff;
-			float value = SDL_clamp(x0, 0x00, 0xff);
-			SDL_Color color = {value, value, value, value};
-			((Uint32 *)((Uint8 *)tab_surface->pixels + y * tab_surface->pitch))[x]
-				= SDL_MapSurfaceRGBA(tab_surface, color.r, color.g, color.b, color.a);
+	strings_size += tags->chars_size;
+	if (strings_size == 0) strings_size = 1;
+	if (strings_size > SDL_MAX_UINT32) goto exit;
+	size_t size = sizeof (Tags_Header) + (size_t)files_count * sizeof (Tags_File) + (size_t)tags_count * sizeof (Tag) + strings_size;
+	image = SDL_malloc(size);
+	if (image == NULL) goto exit;
+	memory_retag(image, Memory_Tag_layout);
+	Tags_Header *header = image;
+	*header = (Tags_Header){.magic = TAGS_MAGIC, .files_count = files_count, .tags_count = tags_count, .strings_size = strings_size};
+	Tags_File *files = (Tags_File *)(header + 1);
+	Tag *out = (Tag *)(files + files_count);
+	char *strings = (char *)(out + tags_count);
+	Uint32 used = 0;
+	strings[0] = '\0';
+	for (Uint32 i = 0; i < files_count; ++i) {
+		Tags_Scanned *file = &tags->scanned[order[i]];
+		size_t length = SDL_strlen(file->path) + 1;
+		files[i] = (Tags_File){.modify_time = file->modify_time, .size = file->size, .path = used};
+		SDL_memcpy(strings + used, file->path, length);
+		used += length;
+	}
+	// Both are sorted by name, so merging keeps the order
+	Uint32 old = 0, added = 0;
+	for (Uint32 i = 0; i < tags_count; ++i) {
+		while (old < old_tags && old_map[tags->tags[old].file] == (Uint32)-1) old += 1;
+		const char *name;
+		Uint32 file, line;
+		if (added >= tags->added_count
+			|| (old < old_tags && SDL_strcmp(tags->strings + tags->tags[old].name, tags->chars + tags->added[added].name) <= 0)) {
+			name = tags->strings + tags->tags[old].name;
+			file = old_map[tags->tags[old].file];
+			line = tags->tags[old].line;
+			old += 1;
+		} else {
+			name = tags->chars + tags->added[added].name;
+			file = new_files[tags->added[added].file];
+			line = tags->added[added].line;
+			added += 1;
 		}
+		size_t length = SDL_strlen(name) + 1;
+		out[i] = (Tag){.name = used, .file = file, .line = line};
+		SDL_memcpy(strings + used, name, length);
+		used += length;
 	}
-	SDL_UnlockSurface(tab_surface);
-	ctx->tab_texture = SDL_CreateTextureFromSurface(ctx->renderer, tab_surface);
-	SDL_DestroySurface(tab_surface);
-	if (ctx->tab_texture == NULL) {
-		SDL_LogWarn(0, "Can't convert tab surface into texture: %s", SDL_GetError());
-		return false;
+	if (!SDL_SaveFile(TAGS_PATH, image, size)) {
+		SDL_LogWarn(0, "Can't save definitions into %s: %s", TAGS_PATH, SDL_GetError());
 	}
-	return true;
+	result = tags_set_image(tags, image, size);
+	if (result) image = NULL;
+exit:
+	SDL_free(image);
+	SDL_free(order);
+	SDL_free(new_files);
+	SDL_free(old_map);
+	return result;
 }
 
-static bool handle_frame_mouse_click(Ctx *ctx, Uint32 frame, SDL_FPoint point) {
-	SDL_FRect bounds;
-	Frame *draw_frame = &ctx->frames[frame];
-	get_frame_render_text_rect(ctx, frame, &bounds);
-	draw_frame->scroll_lock = true;
-	if (point.y < bounds.y) {
-		draw_frame->cursor = 0;
-		return true;
+static void tags_start(Ctx *ctx) {
+	Tag_Index *tags = &ctx->tags;
+	if (tags->started) return;
+	tags->started = true;
+	tags->next_scan = 0;
+	size_t size;
+	void *image = SDL_LoadFile(TAGS_PATH, &size);
+	if (image == NULL) return;
+	if (!tags_set_image(tags, image, size)) {
+		SDL_LogWarn(0, "Definitions in %s are broken, indexing again", TAGS_PATH);
+		SDL_free(image);
+	}
+}
+
+static void tags_scan_end(Tag_Index *tags, Uint64 ticks) {
+	tags->scanning = false;
+	tags->next_scan = ticks + TAGS_RESCAN_MS;
+	Uint32 old_files = tags->image != NULL ? tags->header->files_count : 0;
+	if (tags->image == NULL || tags->kept != old_files || tags->kept != tags->scanned_count) {
+		Uint64 start = trace_begin();
+		if (tags_merge(tags)) {
+			SDL_LogInfo(0, "Indexed %" SDL_PRIu32 " definitions in %" SDL_PRIu32 " files",
+				tags->header->tags_count, tags->header->files_count);
+		} else {
+			SDL_LogWarn(0, "Can't merge definitions, not enough memory");
+		}
+		trace_end_arg("merge definitions", start, "files", tags->scanned_count - tags->kept);
 	}
-	Uint32 linenum = (point.y - bounds.y - SDL_min(0, draw_frame->scroll_interp.y)) / ctx->line_height;
-	String line = get_vis_line(ctx, bounds, draw_frame->buffer->text_size, draw_frame->buffer->text, (Uint32)linenum);
-	if (line.text == NULL) {
-		draw_frame->cursor = draw_frame->buffer->text_size;
-		return true;
+	tags_scan_free(tags);
+}
+
+// Walks the tree a step per idle tick: lists directories, then lexes new and changed files and merges them in the end
+static void tags_update(Ctx *ctx) {
+	Tag_Index *tags = &ctx->tags;
+	if (!tags->started) return;
+	if (!tags->scanning) {
+		if (ctx->ticks < tags->next_scan) return;
+		char *root = SDL_strdup("");
+		if (root == NULL || !tags_push_dir(tags, root)) {
+			SDL_free(root);
+			tags->next_scan = ctx->ticks + TAGS_RESCAN_MS;
+			return;
+		}
+		tags->scanning = true;
+		return;
 	}
-	// Don't fucking reallocate sized strings which only point is zero copy.
-	SDL_assert(line.text >= draw_frame->buffer->text && line.text <= draw_frame->buffer->text + draw_frame->buffer->text_size);
-	Uint32 char_ind = coords_to_text_index(ctx, line.size, line.text, point.x - bounds.x);
-	draw_frame->cursor = utf8_go_forward(line.size, line.text, char_ind) - draw_frame->buffer->text;
-	return true;
+	if (tags->dirs_count > 0) {
+		Uint64 start = trace_begin();
+		Tags_Listing listing = {.tags = tags};
+		while (listing.entries < TAGS_LIST_STEP && tags->dirs_count > 0) {
+			char *dir = tags->dirs[--tags->dirs_count];
+			listing.dir = dir;
+			if (!SDL_EnumerateDirectory(dir[0] == '\0' ? "." : dir, tags_list_entry, &listing)) {
+				SDL_LogWarn(0, "Can't list %s: %s", dir[0] == '\0' ? "." : dir, SDL_GetError());
+			}
+			SDL_free(dir);
+		}
+		trace_end_arg("list definitions", start, "files", tags->scanned_count);
+		return;
+	}
+	if (tags->lexed < tags->scanned_count) {
+		if (!tags_lex_step(ctx)) {
+			SDL_LogWarn(0, "Can't index definitions, not enough memory");
+			tags_scan_free(tags);
+			tags->scanning = false;
+			tags->next_scan = ctx->ticks + TAGS_RESCAN_MS;
+		}
+		return;
+	}
+	tags_scan_end(tags, ctx->ticks);
 }
 
-static Uint32 append_frame(Ctx *ctx, TextBuffer *buffer, SDL_FRect bounds) {
-	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
-		if (ctx->frames[i].taken) continue;
-		ctx->frames[i] = (Frame){
-			.taken = true,
-			.cursor = 0,
-			.scroll = 0,
-			.bounds = bounds,
-			.buffer = buffer,
-		};
-		buffer->refcount += 1;
-		return i;
+// Lexes a saved file of the index into the overlay lookups consult, the next scan merges and writes it. New files wait for that scan
+static void tags_file_saved(Ctx *ctx, const char *path, const char *text, size_t size) {
+	Tag_Index *tags = &ctx->tags;
+	// Merge of the running scan changes the file ids
+	if (tags->scanning) return;
+	Uint32 saved = tags_find_file(tags, path);
+	if (saved == (Uint32)-1) return;
+	Uint64 start = trace_begin();
+	Tags_Lex_Job job = {.path = path, .file = saved};
+	tags_lex(&job, text, size);
+	bool result = true;
+	if (tags->saved_count + job.tags_count > tags->saved_capacity) {
+		Uint32 new_cap = SDL_max(tags->saved_capacity * 2, tags->saved_count + job.tags_count);
+		Tag *new_saved = SDL_realloc(tags->saved, new_cap * sizeof *new_saved);
+		if (new_saved != NULL) {
+			memory_retag(new_saved, Memory_Tag_layout);
+			tags->saved = new_saved;
+			tags->saved_capacity = new_cap;
+		}
+		result = new_saved != NULL;
 	}
-	if (ctx->frames_capacity <= ctx->frames_count) {
-		size_t new_cap = ctx->frames_capacity * 2;
-		if (new_cap == 0) {
-			new_cap = 8;
+	if (result && tags->saved_chars_size + job.chars_size > tags->saved_chars_capacity) {
+		Uint32 new_cap = SDL_max(tags->saved_chars_capacity * 2, tags->saved_chars_size + job.chars_size);
+		char *new_chars = SDL_realloc(tags->saved_chars, new_cap);
+		if (new_chars != NULL) {
+			memory_retag(new_chars, Memory_Tag_layout);
+			tags->saved_chars = new_chars;
+			tags->saved_chars_capacity = new_cap;
 		}
-		Frame *new_frames = SDL_realloc(ctx->frames, new_cap * (sizeof *ctx->frames));
-		if (new_frames == NULL) {
-			SDL_Log("Can't reallocate frames array");
-			return -1;
+		result = new_chars != NULL;
+	}
+	if (result && !tags_file_is_saved(tags, saved)) {
+		result = index_list_push(&tags->saved_files, &tags->saved_files_count, &tags->saved_files_capacity, saved);
+	}
+	if (result) {
+		// Names of the previous save stay in saved_chars until the merge
+		Uint32 kept = 0;
+		for (Uint32 i = 0; i < tags->saved_count; ++i) {
+			if (tags->saved[i].file != saved) tags->saved[kept++] = tags->saved[i];
 		}
-		Uint32 *new_sorted_frames = SDL_realloc(ctx->sorted_frames, new_cap * (sizeof *ctx->sorted_frames));
-		if (new_sorted_frames == NULL) {
-			SDL_LogWarn(0, "Can't reallocate sorted frames index");
-			SDL_realloc(ctx->frames, ctx->frames_count * (sizeof *ctx->frames));
-			return -1;
+		tags->saved_count = kept;
+		for (Uint32 i = 0; i < job.tags_count; ++i) {
+			Tag tag = job.tags[i];
+			tag.name += tags->saved_chars_size;
+			tags->saved[tags->saved_count++] = tag;
 		}
-		ctx->frames = new_frames;
-		ctx->sorted_frames = new_sorted_frames;
-		ctx->frames_capacity = new_cap;
+		SDL_memcpy(tags->saved_chars + tags->saved_chars_size, job.chars, job.chars_size);
+		tags->saved_chars_size += job.chars_size;
+		SDL_qsort_r(tags->saved, tags->saved_count, sizeof *tags->saved, tags_name_compare, tags->saved_chars);
+	} else {
+		SDL_LogWarn(0, "Can't index definitions of %s, not enough memory", path);
 	}
-	Uint32 frame_ind = ctx->frames_count++;
-	ctx->frames[frame_ind] = (Frame){
-		.taken = true,
-		.cursor = 0,
-		.selection = 0,
-		.active_selection = false,
-		.scroll = 0,
-		.bounds = bounds,
-		.buffer = buffer,
-	};
-	buffer->refcount += 1;
-	ctx->sorted_frames[frame_ind] = frame_ind;
-	return frame_ind;
+	SDL_free(job.tags);
+	SDL_free(job.chars);
+	trace_end_arg("lex saved definitions", start, "tags", job.tags_count);
 }
 
-static Uint32 find_any_frame(Ctx *ctx) {
+// Start of the line, end of text if there are fewer lines
+static size_t buffer_line_offset(TextBuffer *buffer, Uint32 line) {
+	const Line_Index *index = &buffer->line_index;
+	if (index->valid) return line < index->lines_count ? index->starts[line] : buffer->text_size;
+	size_t pos = 0;
+	for (; line > 0 && pos < buffer->text_size; ++pos) {
+		if (buffer->text[pos] == '\n') line -= 1;
+	}
+	return pos;
+}
+
+// Frame showing the buffer, the most recently focused first
+static Uint32 frame_find_buffer(Ctx *ctx, Uint32 bufid) {
 	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
-		if (ctx->frames[ctx->sorted_frames[i]].taken) return ctx->sorted_frames[i];
+		Frame *frame = &ctx->frames[ctx->sorted_frames[i]];
+		if (frame->taken && frame->buffer.index == bufid) return ctx->sorted_frames[i];
 	}
-	SDL_LogError(0, "No more frames, creating one");
-	TextBuffer *buffer = allocate_buffer(ctx, "scratch");
-	if (buffer == NULL) {
-		SDL_LogError(0, "Can't allocate buffer");
-		return -1;
+	return (Uint32)-1;
+}
+
+static void jump_show(Ctx *ctx, Uint32 framei, size_t cursor) {
+	set_focused_frame(ctx, framei);
+	Frame *frame = &ctx->frames[framei];
+	TextBuffer *buffer = frame_buffer(ctx, frame);
+	frame->cursor = SDL_min(cursor, buffer->text_size);
+	frame->active_selection = false;
+	frame_clear_cursors(ctx, framei);
+	Uint32 line = buffer_count_lines(ctx, buffer, frame->cursor);
+	frame_scroll_to_line_centered(ctx, framei, line);
+	ctx->should_render = true;
+}
+
+// Goes to the definition of the identifier at the cursor, again on the spot it landed goes to the next one
+static void tags_jump(Ctx *ctx) {
+	Tag_Index *tags = &ctx->tags;
+	Jumps *jumps = &ctx->jumps;
+	tags_start(ctx);
+	Frame *frame = &ctx->frames[ctx->focused_frame];
+	TextBuffer *buffer = frame_buffer(ctx, frame);
+	if (buffer->prompt) return;
+	bool again = jumps->name[0] != '\0' && frame_resolve(ctx, jumps->frame) == ctx->focused_frame && frame->cursor == jumps->cursor;
+	if (!again) {
+		size_t start = frame->cursor, end = frame->cursor;
+		while (start > 0 && syntax_word_char(buffer->text[start - 1])) start -= 1;
+		while (end < buffer->text_size && syntax_word_char(buffer->text[end])) end += 1;
+		if (start == end || end - start >= TAGS_NAME_MAX) return;
+		SDL_memcpy(jumps->name, buffer->text + start, end - start);
+		jumps->name[end - start] = '\0';
+		jumps->match = 0;
+	}
+	if (tags->image == NULL) {
+		SDL_LogInfo(0, "Definitions are still being indexed");
+		return;
+	}
+	Tag tag;
+	Uint32 count = tags_find(tags, jumps->name, 0, &tag);
+	if (count == 0) {
+		SDL_LogInfo(0, "No definition of %s", jumps->name);
+		jumps->name[0] = '\0';
+		return;
+	}
+	if (again) {
+		jumps->match = (jumps->match + 1) % count;
+		tags_find(tags, jumps->name, jumps->match, &tag);
+	} else {
+		if (jumps->count == JUMPS_MAX) {
+			buffer_release(ctx, &ctx->buffers[jumps->stack[0].buffer.index]);
+			SDL_free(jumps->stack[0].filename);
+			SDL_memmove(&jumps->stack[0], &jumps->stack[1], (JUMPS_MAX - 1) * sizeof *jumps->stack);
+			jumps->count -= 1;
+		}
+		const char *filename = frame_cold(ctx, frame)->filename;
+		buffer->refcount += 1;
+		jumps->stack[jumps->count++] = (Jump){
+			.buffer = frame->buffer,
+			.filename = filename != NULL ? SDL_strdup(filename) : NULL,
+			.cursor = frame->cursor,
+		};
+	}
+	const char *path = tags_file_path(tags, tag.file);
+	Uint32 line = tag.line;
+	Uint32 target = buffer_find_file(ctx, path);
+	if (target != (Uint32)-1) target = frame_find_buffer(ctx, target);
+	if (target == (Uint32)-1) {
+		target = ctx->focused_frame;
+		// Path is in the image, which stays until the next idle tick
+		if (!frame_open_file(ctx, target, path)) return;
+	}
+	buffer = frame_buffer(ctx, &ctx->frames[target]);
+	size_t cursor = buffer_line_offset(buffer, line);
+	size_t line_end = cursor;
+	while (line_end < buffer->text_size && buffer->text[line_end] != '\n') line_end += 1;
+	size_t length = SDL_strlen(jumps->name);
+	for (size_t pos = cursor; pos + length <= line_end; ++pos) {
+		if (SDL_memcmp(buffer->text + pos, jumps->name, length) == 0 && (pos == 0 || !syntax_word_char(buffer->text[pos - 1]))) {
+			cursor = pos;
+			break;
+		}
+	}
+	jump_show(ctx, target, cursor);
+	jumps->frame = frame_handle(ctx, target);
+	jumps->cursor = ctx->frames[target].cursor;
+	if (count > 1) {
+		SDL_LogInfo(0, "Definition %" SDL_PRIu32 " of %" SDL_PRIu32 " for %s", jumps->match + 1, count, jumps->name);
 	}
-	return append_frame(ctx, buffer, (SDL_FRect){0, 0, ctx->win_w, ctx->win_h});
 }
 
-static Uint32 create_ask_frame(Ctx *ctx, Ask_Option option, Uint32 parent, char *prefix) {
-	TextBuffer *buffer = allocate_buffer(ctx, "ask buffer");
-	if (buffer == NULL) {
-		SDL_Log("Error, can't allocate ask buffer");
-		return -1;
+// Goes back to where the last jump was made from
+static void jump_back(Ctx *ctx) {
+	Jumps *jumps = &ctx->jumps;
+	if (jumps->count == 0) return;
+	TextBuffer *buffer = &ctx->buffers[jumps->stack[jumps->count - 1].buffer.index];
+	// Packed while only the jump had it, stays on the stack to try again
+	if (!buffer_touch(ctx, buffer)) {
+		SDL_LogWarn(0, "Can't go back to %s, not enough memory to unpack it", buffer->name);
+		return;
 	}
-	Uint32 frame = append_frame(ctx, buffer, (SDL_FRect){0, ctx->win_h - ctx->line_height, ctx->win_w, ctx->line_height});
-	if (frame == (Uint32)-1) {
-		SDL_Log("Error, can't append ask buffer");
-		return -1;
+	Jump jump = jumps->stack[--jumps->count];
+	jumps->name[0] = '\0';
+	Uint32 target = frame_find_buffer(ctx, jump.buffer.index);
+	if (target == (Uint32)-1) {
+		// No frame shows it anymore, it comes back with its edits in the focused one
+		target = ctx->focused_frame;
+		Frame *frame = &ctx->frames[target];
+		buffer->refcount += 1;
+		buffer_release(ctx, frame_buffer(ctx, frame));
+		frame->buffer = jump.buffer;
+		SDL_free(frame_cold(ctx, frame)->filename);
+		frame_cold(ctx, frame)->filename = jump.filename;
+		jump.filename = NULL;
 	}
-	ctx->frames[frame].frame_type = Frame_Type_ask;
-	ctx->frames[frame].is_global = true;
-	ctx->frames[frame].parent_frame = parent;
-	ctx->frames[frame].ask_option = option;
-	ctx->frames[frame].line_prefix = prefix;
-	return frame;
+	jump_show(ctx, target, jump.cursor);
+	buffer_release(ctx, buffer);
+	SDL_free(jump.filename);
 }
 
-#ifndef DISABLE_LOG_BUFFER
-static void log_handler(void *userdata, int category, SDL_LogPriority priority, const char *message) {
-	(void) category;
-	(void) priority;
-	Ctx *ctx = (Ctx *)userdata;
-	if (ctx->log_buffer == NULL) return;
-	if (ctx->log_buffer->refcount <= 0) return;
-	buffer_insert_text_no_undo(ctx, ctx->log_buffer, message, SDL_strlen(message), ctx->log_buffer->text_size);
-	buffer_insert_text_no_undo(ctx, ctx->log_buffer, "\n", 1, ctx->log_buffer->text_size);
+// Doesn't leave running process after the editor is closed
+static void command_stop(Ctx *ctx) {
+	Command_Runner *runner = ctx->command;
+	if (runner == NULL) return;
+	SDL_SetAtomicInt(&runner->cancel, 1);
+	command_kill(runner, true);
+	if (runner->reader != NULL) {
+		SDL_SignalSemaphore(runner->free_chunks);
+		SDL_WaitThread(runner->reader, NULL);
+	}
+	SDL_WaitProcess(runner->process, true, NULL);
+	command_free(runner);
+	ctx->command = NULL;
 }
-#endif
 
 // Returns framei on fail
 static Uint32 frame_search_create(Ctx *ctx, Uint32 framei, bool search_backwards) {
 	Frame *frame = &ctx->frames[framei];
 	SDL_assert(frame->taken);
-	SDL_assert(!frame->searching_mode);
-	frame->searching_mode = true;
-	frame->search_cursor = frame->cursor;
-	char *buffer_name;
-	SDL_asprintf(&buffer_name, "%d search", framei);
-	TextBuffer *search_buffer = allocate_buffer(ctx, buffer_name);
+	SDL_assert(!frame_cold(ctx, frame)->searching_mode);
+	frame_cold(ctx, frame)->searching_mode = true;
+	frame_cold(ctx, frame)->search_cursor = frame->cursor;
+	TextBuffer *search_buffer = allocate_prompt_buffer(ctx, "search buffer");
 	if (search_buffer == NULL) {
 		SDL_LogError(0, "Can't create buffer for ask frame\n");
 		return framei;
@@ -1599,15 +8192,65 @@ static Uint32 frame_search_create(Ctx *ctx, Uint32 framei, bool search_backwards
 		.h = ctx->font_size,
 	};
 	Uint32 search_frame = append_frame(ctx, search_buffer, bounds);
+	if (search_frame == (Uint32)-1) {
+		frame_cold(ctx, &ctx->frames[framei])->searching_mode = false;
+		return framei;
+	}
+	// Frames could have moved
 	ctx->frames[search_frame].frame_type = Frame_Type_search;
-	ctx->frames[search_frame].parent_frame = framei;
-	ctx->frames[search_frame].search_status = Search_Status_not_found;
-	ctx->frames[search_frame].search_backwards = search_backwards;
-	frame->search_frame = search_frame;
+	ctx->frames_cold[search_frame].parent_frame = frame_handle(ctx, framei);
+	ctx->frames_cold[search_frame].search_status = Search_Status_not_found;
+	ctx->frames_cold[search_frame].search_backwards = search_backwards;
+	ctx->frames_cold[framei].search_frame = frame_handle(ctx, search_frame);
 	ctx->should_render = true;
 	return search_frame;
 }
 
+// Completion is over once the focused frame or its cursor moves
+static bool completion_valid(Ctx *ctx) {
+	Completion *completion = &ctx->completion;
+	if (!completion->active) return false;
+	Uint32 frame = frame_resolve(ctx, completion->frame);
+	if (frame != ctx->focused_frame || ctx->frames[frame].cursor != completion->end || ctx->frames[frame].cursors_count > 0) {
+		completion->active = false;
+	}
+	return completion->active;
+}
+
+// Candidates in a box under the cursor, the selected one highlighted
+static void render_completion(Ctx *ctx) {
+	if (!completion_valid(ctx)) return;
+	const Completion *completion = &ctx->completion;
+	const Word_Table *table = &ctx->words;
+	Uint32 longest = 0;
+	for (Uint32 i = 0; i < completion->count; ++i) {
+		longest = SDL_max(longest, table->words[completion->candidates[i]].length);
+	}
+	SDL_FRect box = {
+		.x = ctx->active_cursor_pos.x,
+		.y = ctx->active_cursor_pos.y + ctx->line_height,
+		.w = (longest + 2) * ctx->font_width,
+		.h = completion->count * ctx->line_height,
+	};
+	if (box.x + box.w > ctx->win_w) box.x = SDL_max(0, ctx->win_w - box.w);
+	if (box.y + box.h > ctx->win_h) box.y = ctx->active_cursor_pos.y - box.h;
+	set_color(ctx, background_color);
+	SDL_RenderFillRect(ctx->renderer, &box);
+	for (Uint32 i = 0; i < completion->count; ++i) {
+		const Word *word = &table->words[completion->candidates[i]];
+		float y = box.y + i * ctx->line_height;
+		if (i + 1 == completion->selected) {
+			set_color(ctx, selection_color);
+			SDL_RenderFillRect(ctx->renderer, &(SDL_FRect){box.x, y, box.w, ctx->line_height});
+		}
+		float x = box.x + ctx->font_width;
+		x += draw_text(ctx, x, y, prefix_color, completion->prefix_length, table->chars + word->offset);
+		draw_text(ctx, x, y, text_color, word->length - completion->prefix_length, table->chars + word->offset + completion->prefix_length);
+	}
+	set_color(ctx, line_number_color);
+	SDL_RenderRect(ctx->renderer, &box);
+}
+
 static void render_background(Ctx *ctx) {
 	set_color(ctx, background_color);
 	SDL_RenderClear(ctx->renderer);
@@ -1620,6 +8263,153 @@ static void render_background(Ctx *ctx) {
 	}
 }
 
+// Inputs that asked for a render wait for the next present. Motion counts only if it
+// caused the render, most of it changes nothing
+static void replay_input_handled(Ctx *ctx, const SDL_Event *event, bool should_render_before) {
+	Replay *replay = &ctx->replay;
+	if (replay->record == NULL && replay->input == NULL) return;
+	if (!ctx->should_render) return;
+	switch (event->type) {
+		case SDL_EVENT_KEY_DOWN:
+		case SDL_EVENT_TEXT_INPUT:
+		case SDL_EVENT_MOUSE_BUTTON_DOWN:
+		case SDL_EVENT_MOUSE_WHEEL: break;
+		case SDL_EVENT_MOUSE_MOTION: {
+			if (should_render_before) return;
+		} break;
+		default: return;
+	}
+	if (replay->pending_count >= REPLAY_PENDING_MAX) return;
+	replay->pending[replay->pending_count++] = event->common.timestamp;
+}
+
+static void replay_presented(Ctx *ctx) {
+	Replay *replay = &ctx->replay;
+	if (replay->pending_count == 0) return;
+	Uint64 now = SDL_GetTicksNS();
+	if (replay->latencies_count + replay->pending_count > replay->latencies_capacity) {
+		Uint32 new_cap = SDL_max(replay->latencies_capacity * 2, replay->latencies_count + replay->pending_count + 1024);
+		Uint64 *new_latencies = SDL_realloc(replay->latencies, new_cap * sizeof *new_latencies);
+		if (new_latencies == NULL) {
+			SDL_Log("Error, can't reallocate latencies");
+			replay->pending_count = 0;
+			return;
+		}
+		replay->latencies = new_latencies;
+		replay->latencies_capacity = new_cap;
+	}
+	for (Uint32 i = 0; i < replay->pending_count; ++i) {
+		replay->latencies[replay->latencies_count++] = now > replay->pending[i] ? now - replay->pending[i] : 0;
+	}
+	replay->pending_count = 0;
+}
+
+// Written by the default output, so it reaches stderr when logs go into the log buffer too
+static void replay_report(Ctx *ctx) {
+	Replay *replay = &ctx->replay;
+	if (replay->latencies_count == 0) return;
+	Uint32 count = replay->latencies_count;
+	SDL_qsort(replay->latencies, count, sizeof *replay->latencies, compare_times);
+	char message[256];
+	SDL_snprintf(message, sizeof message, "Input to present latency over %" SDL_PRIu32 " inputs: p50 %.2f ms, p99 %.2f ms, max %.2f ms",
+		count, replay->latencies[count / 2] / 1e6, replay->latencies[count * 99 / 100] / 1e6, replay->latencies[count - 1] / 1e6);
+	SDL_GetDefaultLogOutputFunction()(NULL, 0, SDL_LOG_PRIORITY_INFO, message);
+	SDL_free(replay->latencies);
+	replay->latencies = NULL;
+	replay->latencies_count = 0;
+	replay->latencies_capacity = 0;
+}
+
+// Adds one render_frame call to the render_frame phase and remembers the slowest frame
+static inline void profile_frame_end(Ctx *ctx, Uint32 frame, Uint64 start) {
+#ifdef DEBUG_PROFILE
+	Uint64 time = SDL_GetPerformanceCounter() - start;
+	Profile_Frame *current = &ctx->profiler.current;
+	current->phases[Profile_Phase_render_frame] += time;
+	if (time >= current->slowest_time) {
+		current->slowest_time = time;
+		current->slowest_frame = frame;
+		current->slowest_buffer = ctx->frames[frame].buffer;
+	}
+#else
+	(void) ctx;
+	(void) frame;
+	(void) start;
+#endif
+}
+
+#ifdef DEBUG_PROFILE
+static inline double profile_ms(Ctx *ctx, Uint64 time) {
+	return time * 1000.0 / ctx->perf_freq;
+}
+
+// Events handled since the last rendered frame are counted into this one
+static void profile_tick_end(Ctx *ctx) {
+	Profiler *profiler = &ctx->profiler;
+	profiler->current.total = profiler->current.phases[Profile_Phase_events] + SDL_GetPerformanceCounter() - profiler->tick_start;
+	profiler->frames[profiler->position] = profiler->current;
+	profiler->position = (profiler->position + 1) % PROFILE_HISTORY;
+	profiler->frames_count = SDL_min(profiler->frames_count + 1, PROFILE_HISTORY);
+	profiler->current = (Profile_Frame){0};
+}
+
+static void profile_draw_hud(Ctx *ctx) {
+	const Profiler *profiler = &ctx->profiler;
+	if (profiler->frames_count == 0) return;
+	Uint32 count = profiler->frames_count;
+	Uint32 oldest = (profiler->position + PROFILE_HISTORY - count) % PROFILE_HISTORY;
+	const Profile_Frame *last = &profiler->frames[(profiler->position + PROFILE_HISTORY - 1) % PROFILE_HISTORY];
+	Uint64 *totals = arena_alloc(&ctx->frame_arena, count * sizeof *totals);
+	Uint64 phases[Profile_Phase_count] = {0};
+	if (totals == NULL) return;
+	for (Uint32 i = 0; i < count; ++i) {
+		const Profile_Frame *frame = &profiler->frames[(oldest + i) % PROFILE_HISTORY];
+		totals[i] = frame->total;
+		for (Uint32 phase = 0; phase < Profile_Phase_count; ++phase) {
+			phases[phase] += frame->phases[phase];
+		}
+	}
+	SDL_qsort(totals, count, sizeof *totals, compare_times);
+	float x = ctx->win_w - 0x180;
+	float y = 0;
+	set_color(ctx, debug_black);
+	SDL_RenderFillRect(ctx->renderer, &(SDL_FRect) {
+		x, y, 0x180, ctx->line_height * (Profile_Phase_count + Profile_Counter_count + 3) + 0x40,
+	});
+	draw_text_fmt(ctx, x, y, debug_yellow, "frame ms p50 %.2f p95 %.2f p99 %.2f max %.2f",
+		profile_ms(ctx, totals[count / 2]), profile_ms(ctx, totals[count * 95 / 100]),
+		profile_ms(ctx, totals[count * 99 / 100]), profile_ms(ctx, totals[count - 1]));
+	y += ctx->line_height;
+	for (Uint32 phase = 0; phase < Profile_Phase_count; ++phase) {
+		draw_text_fmt(ctx, x, y, debug_yellow, "%s %.2f ms, average %.2f", profile_phase_names[phase],
+			profile_ms(ctx, last->phases[phase]), profile_ms(ctx, phases[phase]) / count);
+		y += ctx->line_height;
+	}
+	for (Uint32 counter = 0; counter < Profile_Counter_count; ++counter) {
+		draw_text_fmt(ctx, x, y, debug_yellow, "%s %" SDL_PRIu64, profile_counter_names[counter], last->counters[counter]);
+		y += ctx->line_height;
+	}
+	if (last->slowest_time != 0) {
+		TextBuffer *buffer = buffer_resolve(ctx, last->slowest_buffer);
+		draw_text_fmt(ctx, x, y, debug_yellow, "slowest frame %" SDL_PRIu32 " %.2f ms, %s", last->slowest_frame,
+			profile_ms(ctx, last->slowest_time), buffer != NULL ? buffer->name : "closed buffer");
+	}
+	y += ctx->line_height;
+	// One bar per rendered frame, budget is the middle of the graph
+	float graph_h = 0x40;
+	float bar_w = 0x180 / (float)PROFILE_HISTORY;
+	for (Uint32 i = 0; i < count; ++i) {
+		const Profile_Frame *frame = &profiler->frames[(oldest + i) % PROFILE_HISTORY];
+		double ms = profile_ms(ctx, frame->total);
+		float bar_h = SDL_min(graph_h, ms / PROFILE_BUDGET_MS * graph_h / 2);
+		set_color(ctx, ms > PROFILE_BUDGET_MS ? (SDL_Color){0xff, 0x33, 0x33, 0xff} : (SDL_Color){0x33, 0xcc, 0x33, 0xff});
+		SDL_RenderFillRect(ctx->renderer, &(SDL_FRect) {x + i * bar_w, y + graph_h - bar_h, bar_w, bar_h});
+	}
+	set_color(ctx, debug_yellow);
+	SDL_RenderLine(ctx->renderer, x, y + graph_h / 2, x + 0x180, y + graph_h / 2);
+}
+#endif
+
 static void render(Ctx *ctx, bool debug_screen) {
 	ctx->should_render = false;
 	if (debug_screen) {
@@ -1629,6 +8419,7 @@ static void render(Ctx *ctx, bool debug_screen) {
 			SDL_LogWarn(0, "Can't create texture for debug screen: %s", SDL_GetError());
 			goto debug_screen_exit;
 		}
+		profile_count(ctx, Profile_Counter_textures, 1);
 		SDL_SetRenderTarget(ctx->renderer, texture);
 		SDL_Rect viewport = {
 			.x = ctx->win_w * 3/4,
@@ -1664,20 +8455,63 @@ static void render(Ctx *ctx, bool debug_screen) {
 		Uint32 sorted_frame = ctx->sorted_frames[i];
 		if (!ctx->frames[sorted_frame].taken) continue;
 		if (ctx->frames[sorted_frame].is_global) continue;
+		if (!frame_on_screen(ctx, sorted_frame)) continue;
+		Uint64 start = profile_begin();
+		Uint64 trace_start = trace_begin();
 		render_frame(ctx, sorted_frame);
+		trace_end_arg("render_frame", trace_start, "frame", sorted_frame);
+		profile_frame_end(ctx, sorted_frame, start);
 	}
 	// First render default frames, then global, so global always on top
 	for (Uint32 i = ctx->frames_count - 1; i != (Uint32)-1; --i) {
 		Uint32 sorted_frame = ctx->sorted_frames[i];
 		if (!ctx->frames[sorted_frame].taken) continue;
 		if (!ctx->frames[sorted_frame].is_global) continue;
+		Uint64 start = profile_begin();
+		Uint64 trace_start = trace_begin();
 		render_frame(ctx, sorted_frame);
+		trace_end_arg("render_frame", trace_start, "frame", sorted_frame);
+		profile_frame_end(ctx, sorted_frame, start);
 	}
+	render_completion(ctx);
 #ifdef DEBUG_BUFFERS
+	size_t resident = 0, packed = 0, unpacked = 0;
 	for (Uint32 i = 0; i < ctx->buffers_count; ++i) {
-		draw_text_fmt(ctx, 200, ctx->line_height * i, (SDL_Color) {0xff, 0x00, 0xff, 0xff}, "%" SDL_PRIu32 " %" SDL_PRIs32 " %s", i, ctx->buffers[i].refcount, ctx->buffers[i].name);
+		const Line_Index *index = &ctx->buffers[i].line_index;
+		Buffer_Memory memory = buffer_memory(&ctx->buffers[i]);
+		float x = 200 + draw_text_fmt(ctx, 200, ctx->line_height * i, debug_yellow, "text %zu undo %zu index %zu ", memory.text, memory.undo, memory.index);
+		if (ctx->buffers[i].refcount > 0) {
+			resident += ctx->buffers[i].text_capacity + ctx->buffers[i].packed_size;
+			if (ctx->buffers[i].packed != NULL) {
+				packed += ctx->buffers[i].packed_size;
+				unpacked += ctx->buffers[i].text_size;
+			}
+		}
+		if (ctx->buffers[i].packed != NULL) {
+			draw_text_fmt(ctx, x, ctx->line_height * i, (SDL_Color) {0xff, 0x00, 0xff, 0xff}, "%" SDL_PRIu32 " %" SDL_PRIs32 " %s packed %zu of %zu",
+				i, ctx->buffers[i].refcount, ctx->buffers[i].name, ctx->buffers[i].packed_size, ctx->buffers[i].text_size);
+		} else if (index->valid) {
+			draw_text_fmt(ctx, x, ctx->line_height * i, (SDL_Color) {0xff, 0x00, 0xff, 0xff},
+				"%" SDL_PRIu32 " %" SDL_PRIs32 " %s lines %zu longest %" SDL_PRIu32 "%s%s", i, ctx->buffers[i].refcount, ctx->buffers[i].name,
+				index->lines_count, index->longest_line, index->utf8_valid ? "" : " bad-utf8", index->has_tabs ? " tabs" : "");
+		} else {
+			draw_text_fmt(ctx, x, ctx->line_height * i, (SDL_Color) {0xff, 0x00, 0xff, 0xff}, "%" SDL_PRIu32 " %" SDL_PRIs32 " %s", i, ctx->buffers[i].refcount, ctx->buffers[i].name);
+		}
+	}
+	draw_text_fmt(ctx, 200, ctx->line_height * ctx->buffers_count, (SDL_Color) {0xff, 0x00, 0xff, 0xff},
+		"text resident %zu, packed %zu to %zu, saved %zu", resident, unpacked, packed, unpacked - packed);
+#endif
+#ifdef DEBUG_MEMORY
+	Memory_Stats stats = memory_stats_get();
+	for (Uint32 tag = 0; tag < Memory_Tag_count; ++tag) {
+		draw_text_fmt(ctx, 0, ctx->win_h - ctx->line_height * (Memory_Tag_count + 1 - tag), debug_yellow, "%s %zu in %zu, peak %zu",
+			memory_tag_names[tag], stats.bytes[tag], stats.count[tag], stats.peak[tag]);
 	}
 #endif
+#ifdef DEBUG_ARENA
+	draw_text_fmt(ctx, 0, ctx->win_h - ctx->line_height, debug_yellow, "arena %zu high %zu glyphs %" SDL_PRIu32,
+		ctx->frame_arena.used, SDL_max(ctx->frame_arena.high_water, ctx->frame_arena.used), ctx->glyphs_used);
+#endif
 #ifdef DEBUG_SORT
 	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
 		SDL_Color color = {0x00, 0xff, 0xff, 0xff};
@@ -1706,20 +8540,80 @@ static void render(Ctx *ctx, bool debug_screen) {
 	SDL_RenderFillRect(ctx->renderer, &test_pos);
 	SDL_RenderTexture(ctx->renderer, ctx->tab_texture, NULL, &test_pos);
 #endif
+#ifdef DEBUG_PROFILE
+	if (ctx->profiler.hud) {
+		profile_draw_hud(ctx);
+	}
+#endif
+	Uint64 present_start = profile_begin();
+	Uint64 trace_start = trace_begin();
 	SDL_RenderPresent(ctx->renderer);
+	trace_end("present", trace_start);
+	replay_presented(ctx);
+	profile_end(ctx, Profile_Phase_present, present_start);
 #ifdef DEBUG_RENDER_FAN
 	ctx->render_rotate_fan = (ctx->render_rotate_fan + 1) % 4;
 #endif
 }
 
+// Lexes ahead of what frames on screen show, so scrolling down finds it highlighted
+static void syntax_lookahead(Ctx *ctx) {
+	for (Uint32 i = 0; i < ctx->frames_count && ctx->syntax_budget > 0; ++i) {
+		Frame *frame = &ctx->frames[i];
+		if (!frame->taken || !frame_on_screen(ctx, i)) continue;
+		TextBuffer *buffer = frame_buffer(ctx, frame);
+		if (buffer->text == NULL || syntax_prepare(buffer) == NULL) continue;
+		size_t last_visible = (SDL_max(0, -frame->scroll.y) + frame->bounds.h) / ctx->line_height;
+		syntax_lex_to(ctx, buffer, last_visible + SYNTAX_LOOKAHEAD);
+	}
+}
+
+// Indexes structure of buffers on screen, rendering again once one is done so its block shows up
+static void structure_index(Ctx *ctx) {
+	size_t budget = STRUCTURE_BUDGET;
+	for (Uint32 i = 0; i < ctx->frames_count && budget > 0; ++i) {
+		Frame *frame = &ctx->frames[i];
+		if (!frame->taken || !frame_on_screen(ctx, i)) continue;
+		TextBuffer *buffer = frame_buffer(ctx, frame);
+		if (buffer->prompt || buffer->text == NULL || buffer->structure.built >= buffer->text_size) continue;
+		size_t step = SDL_min(budget, buffer->text_size - buffer->structure.built);
+		if (!structure_build(buffer, step)) {
+			SDL_LogWarn(0, "Can't index structure of %s, not enough memory", buffer->name);
+			continue;
+		}
+		budget -= step;
+		if (buffer->structure.built >= buffer->text_size) ctx->should_render = true;
+	}
+}
+
+static bool replay_record_start(Ctx *ctx, const char *path);
+static bool replay_start(Ctx *ctx, const char *path);
+static bool replay_update(Ctx *ctx);
+static void input_batch_flush(Ctx *ctx);
+
 SDL_AppResult SDL_AppIterate(void *appstate) {
 	Ctx *ctx = (Ctx *)appstate;
 	Uint64 current_time = SDL_GetPerformanceCounter();
+#ifdef DEBUG_PROFILE
+	ctx->profiler.tick_start = current_time;
+#endif
 	ctx->deltatime = (current_time - ctx->last_render) / ctx->perf_freq;
+	ctx->ticks = SDL_GetTicks();
+	ctx->syntax_budget = SYNTAX_BUDGET;
 	if (!SDL_TextInputActive(ctx->window)) {
 		SDL_StartTextInput(ctx->window);
 	}
 	ctx->keymod = SDL_GetModState();
+	if (!replay_update(ctx)) {
+		return SDL_APP_SUCCESS;
+	}
+	input_batch_flush(ctx);
+#ifndef DISABLE_LOG_BUFFER
+	log_drain(ctx);
+#endif
+	command_drain(ctx);
+	watch_update(ctx);
+	buffers_pack_idle(ctx);
 	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
 		if (!ctx->frames[i].taken) continue;
 		if (SDL_fabs(ctx->frames[i].bounds_interp.x - ctx->frames[i].bounds.x) >= 0.01 ||
@@ -1734,39 +8628,567 @@ SDL_AppResult SDL_AppIterate(void *appstate) {
 			ctx->should_render = true;
 		}
 	}
-	if (ctx->should_render) {
+	if (ctx->should_render) {
+		Uint64 render_start = profile_begin();
+		Uint64 trace_start = trace_begin();
+		render(ctx, false);
+		trace_end("render", trace_start);
+		profile_end(ctx, Profile_Phase_render, render_start);
+#ifdef DEBUG_PROFILE
+		profile_tick_end(ctx);
+#endif
+	} else {
+		syntax_lookahead(ctx);
+		words_index(ctx);
+		tags_update(ctx);
+		structure_index(ctx);
+		SDL_Delay(1);
+	}
+	arena_reset(&ctx->frame_arena);
+	ctx->last_render = current_time;
+	return SDL_APP_CONTINUE;
+}
+
+#ifdef NO_MAIN
+typedef enum {
+	Bench_Corpus_long_lines,
+	Bench_Corpus_short_lines,
+	Bench_Corpus_tabs,
+	Bench_Corpus_utf8,
+	Bench_Corpus_log,
+	Bench_Corpus_count,
+} Bench_Corpus;
+
+static const char *bench_corpus_names[Bench_Corpus_count] = {"long_lines", "short_lines", "tabs", "utf8", "log"};
+
+typedef struct Bench {
+	Ctx *ctx;
+	Uint32 buffer;
+	Uint32 frame;
+	Uint64 random;
+	const char *corpus;
+	const char *filter; // Substring of "corpus/benchmark", NULL runs everything
+	SDL_IOStream *out; // Results as JSON lines
+	size_t line_offset; // Of the next line for wrap and highlight
+	Uint32 syntax_state; // At line_offset
+} Bench;
+
+// Returns bytes processed by one operation
+typedef Uint64 (*Bench_Op)(Bench *bench);
+
+static const char *bench_words[] = {
+	"buffer", "frame", "cursor", "render", "static", "return", "while", "for", "if", "size_t",
+	"text", "line", "undo", "a", "of", "the", "SDL_memcpy", "ctx", "=", "+=", "{", "}", "(void)",
+};
+static const char *bench_wide[] = {"ü", "ж", "λ", "日本", "語", "テキスト", "😀", "𝔘", "→", "ä", "ß", "한국어"};
+static const char *bench_levels[] = {"DEBUG", "INFO", "INFO", "INFO", "WARN", "ERROR"};
+
+// xorshift64, same sequence on every run
+static inline Uint64 bench_next(Bench *bench) {
+	bench->random ^= bench->random << 13;
+	bench->random ^= bench->random >> 7;
+	bench->random ^= bench->random << 17;
+	return bench->random;
+}
+
+static inline size_t bench_put(char *text, size_t pos, size_t size, const char *word) {
+	size_t length = SDL_strlen(word);
+	if (pos + length > size) return pos;
+	SDL_memcpy(text + pos, word, length);
+	return pos + length;
+}
+
+// Synthetic text of exactly size bytes, never contains BENCH_NEEDLE
+static char *bench_corpus(Bench *bench, Bench_Corpus corpus, size_t size) {
+	char *text = SDL_malloc(size + 1);
+	if (text == NULL) return NULL;
+	size_t pos = 0;
+	Uint64 line = 0;
+	while (pos < size) {
+		size_t start = pos;
+		switch (corpus) {
+			case Bench_Corpus_long_lines: {
+				size_t length = 4000 + bench_next(bench) % 8000;
+				while (pos < size && pos - start < length) {
+					pos = bench_put(text, pos, size, bench_words[bench_next(bench) % SDL_arraysize(bench_words)]);
+					if (pos < size) text[pos++] = ' ';
+				}
+			} break;
+			case Bench_Corpus_short_lines: {
+				size_t words = bench_next(bench) % 6;
+				for (size_t i = 0; i < words && pos < size; ++i) {
+					pos = bench_put(text, pos, size, bench_words[bench_next(bench) % SDL_arraysize(bench_words)]);
+					if (pos < size) text[pos++] = ' ';
+				}
+			} break;
+			case Bench_Corpus_tabs: {
+				size_t indent = 1 + bench_next(bench) % 6;
+				for (size_t i = 0; i < indent && pos < size; ++i) text[pos++] = '\t';
+				size_t words = 2 + bench_next(bench) % 8;
+				for (size_t i = 0; i < words && pos < size; ++i) {
+					pos = bench_put(text, pos, size, bench_words[bench_next(bench) % SDL_arraysize(bench_words)]);
+					if (pos < size) text[pos++] = bench_next(bench) % 3 == 0 ? '\t' : ' ';
+				}
+			} break;
+			case Bench_Corpus_utf8: {
+				size_t words = 8 + bench_next(bench) % 24;
+				for (size_t i = 0; i < words && pos < size; ++i) {
+					pos = bench_put(text, pos, size, bench_wide[bench_next(bench) % SDL_arraysize(bench_wide)]);
+					if (pos < size) text[pos++] = ' ';
+				}
+			} break;
+			case Bench_Corpus_log: {
+				char entry[160];
+				int length = SDL_snprintf(entry, sizeof entry, "2025-01-%02d %02d:%02d:%02d.%03d %s worker-%d request %" SDL_PRIu64 " took %d ms",
+					(int)(line / 86400000 % 28 + 1), (int)(line / 3600000 % 24), (int)(line / 60000 % 60), (int)(line / 1000 % 60), (int)(line % 1000),
+					bench_levels[bench_next(bench) % SDL_arraysize(bench_levels)], (int)(bench_next(bench) % 16), line, (int)(bench_next(bench) % 500));
+				pos = bench_put(text, pos, size, entry);
+				if (length <= 0 || pos == start) {
+					while (pos < size) text[pos++] = ' ';
+				}
+			} break;
+			default: break;
+		}
+		if (pos < size) text[pos++] = '\n';
+		line += 1;
+	}
+	text[size] = '\0';
+	return text;
+}
+
+static inline bool bench_selected(Bench *bench, const char *name) {
+	if (bench->filter == NULL) return true;
+	char id[64];
+	SDL_snprintf(id, sizeof id, "%s/%s", bench->corpus, name);
+	return SDL_strstr(id, bench->filter) != NULL;
+}
+
+// Calls op until BENCH_MIN_MS pass, batches grow so timer reads don't dominate fast operations
+static void bench_run(Bench *bench, const char *name, Bench_Op op) {
+	if (!bench_selected(bench, name)) return;
+	Uint64 frequency = SDL_GetPerformanceFrequency();
+	Uint64 min_time = frequency * BENCH_MIN_MS / 1000;
+	Uint64 ops = 0, bytes = 0, time = 0;
+	Uint32 batch = 1;
+	Uint64 start = SDL_GetPerformanceCounter();
+	while (time < min_time) {
+		for (Uint32 i = 0; i < batch; ++i) {
+			bytes += op(bench);
+		}
+		ops += batch;
+		batch = SDL_min(batch * 2, BENCH_BATCH_MAX);
+		time = SDL_GetPerformanceCounter() - start;
+	}
+	double seconds = (double)time / frequency;
+	double ns_per_op = seconds * 1e9 / ops;
+	double bytes_per_s = bytes / seconds;
+	SDL_Log("%s/%-16s %12.1f ns/op %10.2f MB/s %10" SDL_PRIu64 " ops", bench->corpus, name, ns_per_op, bytes_per_s / 1e6, ops);
+	if (bench->out != NULL) {
+		SDL_IOprintf(bench->out, "{\"corpus\":\"%s\",\"bench\":\"%s\",\"size\":%zu,\"ops\":%" SDL_PRIu64 ",\"ns_per_op\":%.1f,\"bytes_per_s\":%.0f}\n",
+			bench->corpus, name, bench->ctx->buffers[bench->buffer].text_size, ops, ns_per_op, bytes_per_s);
+	}
+}
+
+static Uint64 bench_count_lines(Bench *bench) {
+	TextBuffer *buffer = &bench->ctx->buffers[bench->buffer];
+	Uint32 lines = count_lines(bench->ctx, buffer->text_size, buffer->text);
+	SDL_assert(lines > 0);
+	return buffer->text_size;
+}
+
+static Uint64 bench_search_forward(Bench *bench) {
+	TextBuffer *buffer = &bench->ctx->buffers[bench->buffer];
+	const char *found = text_search_forward(buffer->text, buffer->text_size, BENCH_NEEDLE, SDL_strlen(BENCH_NEEDLE));
+	SDL_assert(found == NULL);
+	return buffer->text_size;
+}
+
+static Uint64 bench_search_backward(Bench *bench) {
+	TextBuffer *buffer = &bench->ctx->buffers[bench->buffer];
+	const char *found = strnstr_r(buffer->text, buffer->text_size, BENCH_NEEDLE);
+	SDL_assert(found == NULL);
+	return buffer->text_size;
+}
+
+// Layout of the next logical line, wraps around at the end of text
+static Uint64 bench_wrap(Bench *bench) {
+	TextBuffer *buffer = &bench->ctx->buffers[bench->buffer];
+	if (bench->line_offset >= buffer->text_size) bench->line_offset = 0;
+	char *begin = buffer->text + bench->line_offset;
+	size_t length = text_kernels->find_newline(begin, buffer->text_size - bench->line_offset);
+	String vislines[BENCH_VISLINES];
+	SDL_FRect bounds = {0, 0, bench->ctx->font_width * BENCH_COLUMNS, bench->ctx->line_height * BENCH_VISLINES};
+	split_into_vis_lines(bench->ctx, bounds, (String){.size = length, .text = begin}, BENCH_VISLINES, vislines);
+	bench->line_offset += length + 1;
+	return length + 1;
+}
+
+// C highlighting spans of the next logical line, carrying the lexer state like the cache does
+static Uint64 bench_highlight(Bench *bench) {
+	TextBuffer *buffer = &bench->ctx->buffers[bench->buffer];
+	if (bench->line_offset >= buffer->text_size) {
+		bench->line_offset = 0;
+		bench->syntax_state = 0;
+	}
+	char *begin = buffer->text + bench->line_offset;
+	size_t length = text_kernels->find_newline(begin, buffer->text_size - bench->line_offset);
+	Syntax_Spans spans = {.line = begin};
+	bench->syntax_state = syntax_c_line(bench->syntax_state, begin, length, &spans);
+	bench->line_offset += length + 1;
+	return length + 1;
+}
+
+static Uint64 bench_vis_line(Bench *bench) {
+	TextBuffer *buffer = &bench->ctx->buffers[bench->buffer];
+	SDL_FRect bounds = {0, 0, bench->ctx->font_width * BENCH_COLUMNS, bench->ctx->line_height * BENCH_VISLINES};
+	Uint32 lines = buffer->line_index.valid ? buffer->line_index.lines_count : 1;
+	String line = buffer_get_vis_line(bench->ctx, buffer, bounds, bench_next(bench) % lines);
+	return line.size;
+}
+
+static Uint64 bench_cursor(Bench *bench, void (*move)(Ctx *ctx, Uint32 frame), Uint32 restart) {
+	Frame *frame = &bench->ctx->frames[bench->frame];
+	Uint32 before = frame->cursor;
+	frame_move_cursors(bench->ctx, bench->frame, move);
+	if (frame->cursor == before) {
+		frame->cursor = restart;
+		bench->ctx->moving_col = false;
+	}
+	return before > frame->cursor ? before - frame->cursor : frame->cursor - before;
+}
+
+static Uint64 bench_cursor_down(Bench *bench) {
+	return bench_cursor(bench, frame_next_line, 0);
+}
+
+static Uint64 bench_cursor_up(Bench *bench) {
+	return bench_cursor(bench, frame_previous_line, bench->ctx->buffers[bench->buffer].text_size);
+}
+
+static Uint64 bench_paragraph(Bench *bench) {
+	return bench_cursor(bench, frame_forward_paragraph, 0);
+}
+
+// Innermost bracket pair around a random position
+static Uint64 bench_enclosing(Bench *bench) {
+	TextBuffer *buffer = &bench->ctx->buffers[bench->buffer];
+	Uint32 open, close;
+	if (!structure_enclosing(buffer, bench_next(bench) % (buffer->text_size + 1), &open, &close)) return 0;
+	return close - open;
+}
+
+static Uint64 bench_insert(Bench *bench) {
+	TextBuffer *buffer = &bench->ctx->buffers[bench->buffer];
+	Uint32 pos = bench_next(bench) % (buffer->text_size + 1);
+	buffer_insert_text(bench->ctx, buffer, "inserted ", 9, pos, Undo_Group_none);
+	return 9;
+}
+
+static Uint64 bench_delete(Bench *bench) {
+	TextBuffer *buffer = &bench->ctx->buffers[bench->buffer];
+	if (buffer->text_size == 0) return 0;
+	Uint32 pos = bench_next(bench) % buffer->text_size;
+	Uint32 end = SDL_min(buffer->text_size, pos + 9);
+	buffer_delete_text(bench->ctx, bench->buffer, pos, end, Undo_Group_none);
+	return end - pos;
+}
+
+// Undo and redo step over the edits left by insert and delete, turning around at either end
+static Uint64 bench_undo(Bench *bench) {
+	if (!buffer_undo(bench->ctx, bench->buffer)) {
+		while (buffer_redo(bench->ctx, bench->buffer));
+	}
+	return 0;
+}
+
+static Uint64 bench_redo(Bench *bench) {
+	if (!buffer_redo(bench->ctx, bench->buffer)) {
+		while (buffer_undo(bench->ctx, bench->buffer));
+	}
+	return 0;
+}
+
+typedef struct Bench_Case {
+	const char *name;
+	Bench_Op op;
+} Bench_Case;
+
+// In this order, read-only ones first, edits last
+static const Bench_Case bench_cases[] = {
+	{"count_lines", bench_count_lines},
+	{"search_forward", bench_search_forward},
+	{"search_backward", bench_search_backward},
+	{"wrap", bench_wrap},
+	{"highlight", bench_highlight},
+	{"vis_line", bench_vis_line},
+	{"cursor_down", bench_cursor_down},
+	{"cursor_up", bench_cursor_up},
+	{"paragraph", bench_paragraph},
+	{"enclosing", bench_enclosing},
+	{"insert", bench_insert},
+	{"delete", bench_delete},
+	{"undo", bench_undo},
+	{"redo", bench_redo},
+};
+
+static void bench_corpus_run(Bench *bench, Bench_Corpus corpus, size_t size) {
+	Ctx *ctx = bench->ctx;
+	bench->corpus = bench_corpus_names[corpus];
+	bool selected = false;
+	for (Uint32 i = 0; i < SDL_arraysize(bench_cases); ++i) {
+		selected = selected || bench_selected(bench, bench_cases[i].name);
+	}
+	if (!selected) return;
+	Uint64 start = SDL_GetPerformanceCounter();
+	char *text = bench_corpus(bench, corpus, size);
+	if (text == NULL) {
+		SDL_Log("Error, can't allocate %zu bytes for %s corpus", size, bench->corpus);
+		return;
+	}
+	TextBuffer *buffer = &ctx->buffers[bench->buffer];
+	buffer_free_undos(buffer);
+	structure_free(buffer);
+	SDL_free(buffer->text);
+	buffer->text = text;
+	buffer->text_size = size;
+	buffer->text_capacity = size;
+	buffer_reindex(ctx, buffer);
+	structure_ensure(buffer);
+	ctx->frames[bench->frame].cursor = 0;
+	bench->line_offset = 0;
+	bench->syntax_state = 0;
+	SDL_Log("%s: %zu bytes, %zu lines, generated and indexed in %.1f ms", bench->corpus, size, buffer->line_index.lines_count,
+		(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
+	for (Uint32 i = 0; i < SDL_arraysize(bench_cases); ++i) {
+		bench_run(bench, bench_cases[i].name, bench_cases[i].op);
+	}
+}
+
+// Canvas of frames_count frames tiled over the window with jittered sizes, showing buffers_count buffers
+// of the non-log corpora, all with active selections and search highlighting
+static bool bench_canvas(Bench *bench, Ctx *ctx, Uint32 frames_count, Uint32 buffers_count) {
+	Uint32 first_buffer = ctx->buffers_count;
+	for (Uint32 i = 0; i < buffers_count; ++i) {
+		Bench_Corpus corpus = i % Bench_Corpus_log;
+		TextBuffer *buffer = allocate_buffer(ctx, (char *)bench_corpus_names[corpus]);
+		if (buffer == NULL) return false;
+		size_t size = BENCH_RENDER_BUFFER_MB << 20;
+		char *text = bench_corpus(bench, corpus, size);
+		if (text == NULL) return false;
+		SDL_free(buffer->text);
+		buffer->text = text;
+		buffer->text_size = size;
+		buffer->text_capacity = size;
+		buffer_reindex(ctx, buffer);
+	}
+	Uint32 columns = SDL_ceil(SDL_sqrt(frames_count));
+	Uint32 rows = (frames_count + columns - 1) / columns;
+	float cell_w = (float)ctx->win_w / columns;
+	float cell_h = (float)ctx->win_h / rows;
+	for (Uint32 i = 0; i < frames_count; ++i) {
+		TextBuffer *buffer = &ctx->buffers[first_buffer + i % buffers_count];
+		SDL_FRect bounds = {
+			.x = (i % columns) * cell_w,
+			.y = (i / columns) * cell_h,
+			.w = cell_w * (60 + bench_next(bench) % 41) / 100,
+			.h = cell_h * (60 + bench_next(bench) % 41) / 100,
+		};
+		Uint32 framei = append_frame(ctx, buffer, bounds);
+		if (framei == (Uint32)-1) return false;
+		Frame *frame = &ctx->frames[framei];
+		frame->bounds_interp = bounds;
+		// Far enough from the end to scroll a line per rendered frame
+		Uint32 line = bench_next(bench) % (buffer->line_index.lines_count / 2 + 1);
+		frame->scroll.y = frame->scroll_interp.y = -(float)line * ctx->line_height;
+		Uint32 cursor = buffer_get_vis_line(ctx, buffer, bounds, line + 2).text - buffer->text;
+		frame->cursor = SDL_min(cursor, buffer->text_size);
+		frame->selection = SDL_min(frame->cursor + 200 + bench_next(bench) % 2000, buffer->text_size);
+		frame->active_selection = true;
+	}
+	// One search prompt shared by every frame
+	Uint32 search_frame = frame_search_create(ctx, 0, false);
+	if (search_frame == 0) return false;
+	TextBuffer *search_buffer = frame_buffer(ctx, &ctx->frames[search_frame]);
+	buffer_insert_text(ctx, search_buffer, BENCH_RENDER_SEARCH, SDL_strlen(BENCH_RENDER_SEARCH), 0, Undo_Group_none);
+	ctx->frames[search_frame].bounds_interp = ctx->frames[search_frame].bounds;
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		if (i == search_frame) continue;
+		ctx->frames_cold[i].searching_mode = true;
+		ctx->frames_cold[i].search_frame = frame_handle(ctx, search_frame);
+	}
+	ctx->focused_frame = 0;
+	return true;
+}
+
+// Renders a synthetic canvas with the software renderer into a surface, every frame scrolls by a line.
+// Phases and draw calls are only counted with DEBUG_PROFILE
+static void bench_render(Bench *bench, Uint32 frames_count, Uint32 buffers_count, Uint32 render_count) {
+	bench->corpus = "canvas";
+	if (!bench_selected(bench, "render")) return;
+	static Ctx _ctx;
+	Ctx *ctx = &_ctx;
+	ctx->win_w = BENCH_RENDER_W;
+	ctx->win_h = BENCH_RENDER_H;
+	ctx->command_buffer = (Uint32)-1;
+	ctx->inotify = -1;
+	ctx->perf_freq = (double)SDL_GetPerformanceFrequency();
+	SDL_Surface *surface = SDL_CreateSurface(ctx->win_w, ctx->win_h, SDL_PIXELFORMAT_RGBA8888);
+	if (surface == NULL) {
+		SDL_Log("Error, can't create render target: %s", SDL_GetError());
+		return;
+	}
+	ctx->renderer = SDL_CreateSoftwareRenderer(surface);
+	if (ctx->renderer == NULL) {
+		SDL_Log("Error, can't create software renderer: %s", SDL_GetError());
+		SDL_DestroySurface(surface);
+		return;
+	}
+	if (!TTF_Init() || !font_open(ctx, 12)) {
+		SDL_Log("Error, can't open font: %s", SDL_GetError());
+		goto exit;
+	}
+	Uint64 start = SDL_GetPerformanceCounter();
+	if (!bench_canvas(bench, ctx, frames_count, buffers_count)) {
+		SDL_Log("Error, can't build canvas of %" SDL_PRIu32 " frames", frames_count);
+		goto exit;
+	}
+	SDL_Log("canvas: %" SDL_PRIu32 " frames over %" SDL_PRIu32 " buffers at %dx%d, built in %.1f ms", frames_count, buffers_count,
+		ctx->win_w, ctx->win_h, (SDL_GetPerformanceCounter() - start) * 1000.0 / ctx->perf_freq);
+	// Warmup fills the glyph cache
+	ctx->syntax_budget = SYNTAX_BUDGET;
+	render(ctx, false);
+	arena_reset(&ctx->frame_arena);
+#ifdef DEBUG_PROFILE
+	ctx->profiler.current = (Profile_Frame){0};
+#endif
+	start = SDL_GetPerformanceCounter();
+	for (Uint32 i = 0; i < render_count; ++i) {
+		for (Uint32 framei = 0; framei < ctx->frames_count; ++framei) {
+			if (ctx->frames[framei].frame_type == Frame_Type_search) continue;
+			ctx->frames[framei].scroll.y -= ctx->line_height;
+			ctx->frames[framei].scroll_interp.y = ctx->frames[framei].scroll.y;
+		}
+		ctx->syntax_budget = SYNTAX_BUDGET;
+		Uint64 render_start = profile_begin();
 		render(ctx, false);
-	} else {
-		SDL_Delay(1);
+		profile_end(ctx, Profile_Phase_render, render_start);
+		arena_reset(&ctx->frame_arena);
 	}
-	ctx->last_render = current_time;
-	return SDL_APP_CONTINUE;
+	double seconds = (SDL_GetPerformanceCounter() - start) / ctx->perf_freq;
+	double fps = render_count / seconds;
+	double ms_per_frame = seconds * 1000 / render_count;
+	SDL_Log("canvas/render %10.1f frames/s %8.2f ms/frame", fps, ms_per_frame);
+	char phases[256] = "";
+#ifdef DEBUG_PROFILE
+	const Profile_Frame *total = &ctx->profiler.current;
+	double draw_calls = (double)total->counters[Profile_Counter_draw_calls] / render_count;
+	size_t length = 0;
+	for (Uint32 phase = Profile_Phase_render; phase < Profile_Phase_count; ++phase) {
+		double ms = profile_ms(ctx, total->phases[phase]) / render_count;
+		SDL_Log("canvas/render %-12s %8.3f ms/frame", profile_phase_names[phase], ms);
+		length += SDL_snprintf(phases + length, sizeof phases - length, ",\"%s_ms\":%.3f", profile_phase_names[phase], ms);
+		length = SDL_min(length, sizeof phases - 1);
+	}
+	SDL_Log("canvas/render %-12s %8.0f per frame", "draw calls", draw_calls);
+	SDL_snprintf(phases + length, sizeof phases - length, ",\"draw_calls\":%.0f", draw_calls);
+#endif
+	if (bench->out != NULL) {
+		SDL_IOprintf(bench->out, "{\"corpus\":\"canvas\",\"bench\":\"render\",\"frames\":%" SDL_PRIu32 ",\"buffers\":%" SDL_PRIu32
+			",\"rendered\":%" SDL_PRIu32 ",\"fps\":%.1f,\"ms_per_frame\":%.3f%s}\n", frames_count, buffers_count, render_count, fps, ms_per_frame, phases);
+	}
+	exit:
+	glyphs_free(ctx);
+	if (ctx->font != NULL) TTF_CloseFont(ctx->font);
+	SDL_DestroyRenderer(ctx->renderer);
+	SDL_DestroySurface(surface);
 }
 
-#ifdef NO_MAIN
-int main(void) {
-	Ctx _ctx;
+// editor_bench [-o results.jsonl] [-s corpus MB] [-l log MB] [-f canvas frames] [-b canvas buffers] [-k rendered frames] [filter]
+int main(int argc, char **argv) {
+	const char *out_path = NULL;
+	size_t corpus_size = BENCH_CORPUS_MB << 20;
+	size_t log_size = BENCH_LOG_MB << 20;
+	Uint32 render_frames = BENCH_RENDER_FRAMES;
+	Uint32 render_buffers = BENCH_RENDER_BUFFERS;
+	Uint32 render_count = BENCH_RENDER_COUNT;
+	const char *filter = NULL;
+	for (int i = 1; i < argc; ++i) {
+		if (SDL_strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			out_path = argv[++i];
+		} else if (SDL_strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			corpus_size = SDL_strtoull(argv[++i], NULL, 10) << 20;
+		} else if (SDL_strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+			log_size = SDL_strtoull(argv[++i], NULL, 10) << 20;
+		} else if (SDL_strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			render_frames = SDL_strtoul(argv[++i], NULL, 10);
+		} else if (SDL_strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			render_buffers = SDL_strtoul(argv[++i], NULL, 10);
+		} else if (SDL_strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+			render_count = SDL_strtoul(argv[++i], NULL, 10);
+		} else {
+			filter = argv[i];
+		}
+	}
+	// Empty corpora have nothing to measure
+	corpus_size = SDL_max(corpus_size, 1 << 20);
+	log_size = SDL_max(log_size, 1 << 20);
+	render_frames = SDL_max(render_frames, 1);
+	render_buffers = SDL_max(render_buffers, 1);
+	render_count = SDL_max(render_count, 1);
+	static Ctx _ctx;
 	Ctx *ctx = &_ctx;
 	ctx->font_width = 7;
-	SDL_FRect bounds = {.x = 28.00, .y = 230.39, .w = 131.27, .h = 232.04};
-#if 0
-	char *text;
-	size_t text_size;
-	text = SDL_LoadFile(__FILE__, &text_size);
-#else
-	char text[] = "ointer for buffers.\n\nsaoteuh";
-	size_t text_size = SDL_arraysize(text);
-#endif
-	for (Uint32 linenum = 0; linenum < 0x10; ++linenum) {
-		String visline = get_vis_line(ctx, bounds, text_size, text, linenum);
-		SDL_Log("%u: [%lu]|%.*s|", linenum, visline.size, (int)visline.size, visline.text);
+	ctx->font_size = 14;
+	ctx->line_height = 16;
+	ctx->win_w = 0x300;
+	ctx->win_h = 0x200;
+	ctx->command_buffer = (Uint32)-1;
+	ctx->inotify = -1;
+	ctx->perf_freq = (double)SDL_GetPerformanceFrequency();
+	text_kernels_init();
+	TextBuffer *buffer = allocate_buffer(ctx, "bench");
+	if (buffer == NULL) {
+		SDL_Log("Error, can't allocate bench buffer");
+		return 1;
+	}
+	Bench bench = {
+		.ctx = ctx,
+		.buffer = buffer - ctx->buffers,
+		.random = 0x9e3779b97f4a7c15,
+		.filter = filter,
+	};
+	bench.frame = append_frame(ctx, buffer, (SDL_FRect){0, 0, ctx->win_w, ctx->win_h});
+	if (bench.frame == (Uint32)-1) {
+		SDL_Log("Error, can't allocate bench frame");
+		return 1;
+	}
+	if (out_path != NULL) {
+		bench.out = SDL_IOFromFile(out_path, "w");
+		if (bench.out == NULL) {
+			SDL_Log("Error, can't open %s: %s", out_path, SDL_GetError());
+			return 1;
+		}
+	}
+	for (Bench_Corpus corpus = 0; corpus < Bench_Corpus_count; ++corpus) {
+		bench_corpus_run(&bench, corpus, corpus == Bench_Corpus_log ? log_size : corpus_size);
+	}
+	bench_render(&bench, render_frames, render_buffers, render_count);
+	if (bench.out != NULL && !SDL_CloseIO(bench.out)) {
+		SDL_Log("Error, can't write %s: %s", out_path, SDL_GetError());
+		return 1;
 	}
+	return 0;
 }
 #endif
 
 SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv) {
 	(void) argc;
 	(void) argv;
+#ifdef DEBUG_MEMORY
+	if (!memory_tracking_install()) {
+		SDL_LogWarn(0, "Can't install memory tracking: %s", SDL_GetError());
+	}
+#endif
 	Ctx *ctx;
 	ctx = *appstate = SDL_malloc(sizeof *ctx);
 	if (ctx == NULL) {
@@ -1774,6 +9196,19 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv) {
 		return SDL_APP_FAILURE;
 	}
 	*ctx = (Ctx) {0};
+	ctx->command_buffer = (Uint32)-1;
+	ctx->inotify = -1;
+	ctx->ticks = SDL_GetTicks();
+	trace_thread_name = "main";
+	const char *trace_path = SDL_getenv("EDITOR_TRACE");
+	if (trace_path != NULL) {
+		trace_toggle(trace_path);
+	}
+	ctx->pack_budget = PACK_BUDGET;
+	const char *pack_budget = SDL_getenv("EDITOR_PACK_BUDGET");
+	if (pack_budget != NULL) {
+		ctx->pack_budget = SDL_strtoul(pack_budget, NULL, 10);
+	}
 	ctx->win_w = 0x300;
 	ctx->win_h = 0x200;
 	ctx->debug_screen_rect = (SDL_FRect){
@@ -1788,6 +9223,8 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv) {
 		SDL_LogCritical(0, "Couldn't initialize SDL: %s", SDL_GetError());
 		return SDL_APP_FAILURE;
 	}
+	text_kernels_init();
+	SDL_LogDebug(0, "Using %s text kernels", text_kernels->name);
 	if (!TTF_Init()) {
 		SDL_LogCritical(0, "Can't init TTF: %s\n", SDL_GetError());
 		return SDL_APP_FAILURE;
@@ -1806,13 +9243,15 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv) {
 			SDL_Log("Error, can't allocate buffer for file");
 			return SDL_APP_FAILURE;
 		}
-		buffer->text = SDL_LoadFile(filepath, &buffer->text_capacity);
-		buffer->text_size = buffer->text_capacity;
-		if (buffer->text == NULL) {
+		if (!buffer_load_file(ctx, buffer, filepath)) {
 			SDL_LogInfo(0, "First file %s doesn't exists, creating", filepath);
 		} else {
 			SDL_LogInfo(0, "Opening first file %s", filepath);
+			if (!buffer->line_index.utf8_valid) {
+				SDL_LogWarn(0, "File %s isn't valid utf8", filepath);
+			}
 		}
+		buffer_watch_file(ctx, buffer - ctx->buffers, filepath);
 	}
 #ifndef DISABLE_LOG_BUFFER
 	Uint32 main_frame = append_frame(ctx, buffer, (SDL_FRect){0, 0, ctx->win_w / 2, ctx->win_h});
@@ -1824,17 +9263,18 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv) {
 		return SDL_APP_FAILURE;
 	}
 	if (argc > 1) {
-		ctx->frames[main_frame].filename = SDL_strdup(argv[1]);
+		ctx->frames_cold[main_frame].filename = SDL_strdup(argv[1]);
 		ctx->frames[main_frame].scroll_lock = true;
 	}
 #ifndef DISABLE_LOG_BUFFER
-	ctx->log_buffer = allocate_buffer(ctx, "logs");
-	if (ctx->log_buffer == NULL) {
+	TextBuffer *log_buffer = allocate_buffer(ctx, "logs");
+	if (log_buffer == NULL) {
 		SDL_LogError(0, "Can't create buffer for logs");
 		return SDL_APP_FAILURE;
 	}
-	ctx->log_buffer->refcount += 1;
-	Uint32 log_frame = append_frame(ctx, ctx->log_buffer, (SDL_FRect){0x300 / 2, 0, 0x300 / 2, 0x200});
+	log_buffer->refcount += 1;
+	ctx->log_buffer = buffer_handle(ctx, log_buffer);
+	Uint32 log_frame = append_frame(ctx, log_buffer, (SDL_FRect){0x300 / 2, 0, 0x300 / 2, 0x200});
 	if (log_frame == (Uint32)-1) {
 		SDL_LogError(0, "Can't create log frame");
 	}
@@ -1844,38 +9284,531 @@ SDL_AppResult SDL_AppInit(void **appstate, int argc, char **argv) {
 		SDL_Log("Error, can't init renderer: %s", SDL_GetError());
 		return SDL_APP_FAILURE;
 	}
-	ctx->font_size = 12;
-	ctx->line_height = ctx->font_size * 1.2;
-	SDL_IOStream *font_stream = SDL_IOFromConstMem(_binary_LiberationMono_Regular_ttf_start, (size_t)&_binary_LiberationMono_Regular_ttf_size);
-	if (font_stream == NULL) {
-		SDL_LogCritical(0, "Can't create iostream for font: %s", SDL_GetError());
-		return SDL_APP_FAILURE;
-	}
-	ctx->font = TTF_OpenFontIO(font_stream, true, ctx->font_size);
-	if (ctx->font == NULL) {
-		SDL_LogCritical(0, "Can't open font: %s", SDL_GetError());
+	if (!font_open(ctx, 12)) {
 		return SDL_APP_FAILURE;
 	}
-	int font_width_int;
-	TTF_GetGlyphMetrics(ctx->font, 'w', NULL, NULL, NULL, NULL, &font_width_int);
-	ctx->font_width = (float)font_width_int;
-	generate_overflow_cursor(ctx);
-	generate_tab_texture(ctx);
-	generate_space_texture(ctx);
 	if (!SDL_SetRenderVSync(ctx->renderer, 1)) {
 		SDL_Log("Warning, can't enable vsync: %s", SDL_GetError());
 	}
+	if (SDL_GetPathInfo(TAGS_PATH, NULL)) tags_start(ctx);
 	ctx->perf_freq = (double)SDL_GetPerformanceFrequency();
 	ctx->last_render = SDL_GetPerformanceCounter();
 	ctx->should_render = true;
+	// Replay under SDL_VIDEO_DRIVER=offscreen or dummy needs no display
+	const char *replay_path = SDL_getenv("EDITOR_REPLAY");
+	const char *record_path = SDL_getenv("EDITOR_RECORD");
+	if (replay_path != NULL) {
+		if (!replay_start(ctx, replay_path)) return SDL_APP_FAILURE;
+	} else if (record_path != NULL) {
+		replay_record_start(ctx, record_path);
+	}
 #ifndef DISABLE_LOG_BUFFER
-	SDL_SetLogOutputFunction(log_handler, ctx);
+	if (log_ring_create(ctx)) {
+		SDL_SetLogOutputFunction(log_handler, ctx->log_ring);
+	} else {
+		SDL_Log("Error, can't allocate log ring, logging to stdout");
+	}
 #endif
 	return SDL_APP_CONTINUE;
 }
 
+static SDL_AppResult handle_event(Ctx *ctx, SDL_Event *event);
+
+static void macro_clear(Ctx *ctx) {
+	for (Uint32 i = 0; i < ctx->macro_events_count; ++i) {
+		if (ctx->macro_events[i].event.type == SDL_EVENT_TEXT_INPUT) {
+			SDL_free((char *)ctx->macro_events[i].event.text.text);
+		}
+	}
+	ctx->macro_events_count = 0;
+}
+
+static void macro_record_event(Ctx *ctx, const SDL_Event *event) {
+	if (event->type == SDL_EVENT_KEY_DOWN) {
+		// Macro keys themselves
+		if (event->key.scancode == SDL_SCANCODE_F3 || event->key.scancode == SDL_SCANCODE_F4) return;
+	} else if (event->type != SDL_EVENT_TEXT_INPUT) {
+		return;
+	}
+	if (ctx->macro_events_count >= ctx->macro_events_capacity) {
+		Uint32 new_cap = ctx->macro_events_capacity * 2;
+		if (new_cap == 0) new_cap = 64;
+		Macro_Event *new_events = SDL_realloc(ctx->macro_events, new_cap * sizeof *new_events);
+		if (new_events == NULL) {
+			SDL_Log("Can't reallocate macro events, recording stopped");
+			ctx->macro_recording = false;
+			return;
+		}
+		ctx->macro_events = new_events;
+		ctx->macro_events_capacity = new_cap;
+	}
+	Macro_Event *recorded = &ctx->macro_events[ctx->macro_events_count++];
+	recorded->event = *event;
+	recorded->keymod = ctx->keymod;
+	if (event->type == SDL_EVENT_TEXT_INPUT) {
+		recorded->event.text.text = SDL_strdup(event->text.text);
+	}
+}
+
+// Feeds recorded events straight into the handler, 0 times means until a search fails.
+// Nothing is rendered in between, view fixups and undo are done once at the end.
+static void macro_replay(Ctx *ctx, Uint32 times) {
+	if (ctx->macro_recording || ctx->macro_replaying) return;
+	if (ctx->macro_events_count == 0) {
+		SDL_LogInfo(0, "No macro recorded");
+		return;
+	}
+	Uint32 bufid = frame_buffer(ctx, &ctx->frames[ctx->focused_frame]) - ctx->buffers;
+	size_t snapshot_size = ctx->buffers[bufid].text_size;
+	char *snapshot = SDL_malloc(snapshot_size + 1);
+	if (snapshot == NULL) {
+		SDL_Log("Error, can't snapshot buffer for macro");
+		return;
+	}
+	if (snapshot_size > 0) SDL_memcpy(snapshot, ctx->buffers[bufid].text, snapshot_size);
+	SDL_Keymod keymod = ctx->keymod;
+	ctx->macro_replaying = true;
+	ctx->macro_search_failed = false;
+	ctx->macro_buffer = bufid;
+	Uint32 iteration;
+	for (iteration = 0; times == 0 || iteration < times; ++iteration) {
+		Frame *frame = &ctx->frames[ctx->focused_frame];
+		size_t size_before = frame_buffer(ctx, frame)->text_size;
+		Uint32 cursor_before = frame->cursor;
+		for (Uint32 i = 0; i < ctx->macro_events_count && !ctx->macro_search_failed; ++i) {
+			SDL_Event event = ctx->macro_events[i].event;
+			ctx->keymod = ctx->macro_events[i].keymod;
+			if (handle_event(ctx, &event) != SDL_APP_CONTINUE) {
+				ctx->macro_search_failed = true;
+			}
+		}
+		if (ctx->macro_search_failed) break;
+		if (times == 0) {
+			frame = &ctx->frames[ctx->focused_frame];
+			if (frame_buffer(ctx, frame)->text_size == size_before && frame->cursor == cursor_before) break;
+			if (iteration >= MACRO_REPLAY_LIMIT) break;
+		}
+	}
+	ctx->macro_replaying = false;
+	ctx->keymod = keymod;
+	Frame *focused = &ctx->frames[ctx->focused_frame];
+	if (ctx->macro_search_failed && focused->frame_type == Frame_Type_search) {
+		// Don't leave the failed search open
+		Uint32 parent = frame_parent(ctx, focused);
+		frame_close(ctx, ctx->focused_frame);
+		ctx->frames_cold[parent].searching_mode = false;
+		ctx->focused_frame = parent;
+	}
+	if (ctx->buffers[bufid].refcount > 0) {
+		buffer_push_snapshot_undo(ctx, bufid, snapshot, snapshot_size, Undo_Group_keyboard);
+	}
+	SDL_free(snapshot);
+	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
+		if (!ctx->frames[i].taken) continue;
+		frame_follow_tail(ctx, i);
+	}
+	if (ctx->frames[ctx->focused_frame].frame_type == Frame_Type_search) {
+		update_search(ctx, ctx->focused_frame);
+	} else {
+		frame_cursor_moved(ctx, ctx->focused_frame);
+	}
+	SDL_LogInfo(0, "Macro replayed %" SDL_PRIu32 " times", iteration);
+	ctx->should_render = true;
+}
+
+static inline Uint32 replay_float_bits(float value) {
+	Uint32 bits;
+	SDL_memcpy(&bits, &value, sizeof bits);
+	return bits;
+}
+
+static inline float replay_bits_float(Uint32 bits) {
+	float value;
+	SDL_memcpy(&value, &bits, sizeof value);
+	return value;
+}
+
+// Header is magic, version and window size. Every event is microseconds since the previous one,
+// type and keymod, then only the fields handle_event reads
+static bool replay_record_start(Ctx *ctx, const char *path) {
+	Replay *replay = &ctx->replay;
+	replay->record = SDL_IOFromFile(path, "wb");
+	if (replay->record == NULL) {
+		SDL_LogWarn(0, "Can't open %s for input recording: %s", path, SDL_GetError());
+		return false;
+	}
+	replay->record_last = SDL_GetTicksNS();
+	SDL_IOStream *io = replay->record;
+	if (SDL_WriteIO(io, REPLAY_MAGIC, 8) != 8 || !SDL_WriteU32LE(io, REPLAY_VERSION)
+		|| !SDL_WriteS32LE(io, ctx->win_w) || !SDL_WriteS32LE(io, ctx->win_h)) {
+		SDL_LogWarn(0, "Can't write input recording %s: %s", path, SDL_GetError());
+		SDL_CloseIO(io);
+		replay->record = NULL;
+		return false;
+	}
+	SDL_LogInfo(0, "Recording input to %s", path);
+	return true;
+}
+
+static void replay_write_header(SDL_IOStream *io, Replay *replay, Uint64 timestamp, Uint32 type, SDL_Keymod keymod) {
+	Uint64 delta = timestamp > replay->record_last ? (timestamp - replay->record_last) / 1000 : 0;
+	replay->record_last = SDL_max(replay->record_last, timestamp);
+	SDL_WriteU32LE(io, (Uint32)SDL_min(delta, (Uint32)-1));
+	SDL_WriteU16LE(io, (Uint16)type);
+	SDL_WriteU16LE(io, keymod);
+}
+
+static void replay_record_event(Ctx *ctx, const SDL_Event *event) {
+	Replay *replay = &ctx->replay;
+	SDL_IOStream *io = replay->record;
+	Uint64 timestamp = event->common.timestamp;
+	switch (event->type) {
+		case SDL_EVENT_QUIT: {
+			replay_write_header(io, replay, timestamp, event->type, ctx->keymod);
+		} break;
+		case SDL_EVENT_KEY_DOWN:
+		case SDL_EVENT_KEY_UP: {
+			replay_write_header(io, replay, timestamp, event->type, event->key.mod);
+			SDL_WriteU32LE(io, event->key.scancode);
+			SDL_WriteU32LE(io, event->key.key);
+			SDL_WriteU8(io, event->key.repeat);
+		} break;
+		case SDL_EVENT_TEXT_INPUT: {
+			// Split on codepoint borders, so every part is valid text
+			const char *text = event->text.text;
+			size_t size = SDL_strlen(text);
+			while (size > 0) {
+				size_t part = SDL_min(size, REPLAY_TEXT_SIZE - 1);
+				while (part < size && part > 0 && ((Uint8)text[part] & 0xc0) == 0x80) part -= 1;
+				replay_write_header(io, replay, timestamp, event->type, ctx->keymod);
+				SDL_WriteU16LE(io, (Uint16)part);
+				SDL_WriteIO(io, text, part);
+				text += part;
+				size -= part;
+			}
+		} break;
+		case SDL_EVENT_MOUSE_BUTTON_DOWN:
+		case SDL_EVENT_MOUSE_BUTTON_UP: {
+			replay_write_header(io, replay, timestamp, event->type, ctx->keymod);
+			SDL_WriteU8(io, event->button.button);
+			SDL_WriteU8(io, event->button.clicks);
+			SDL_WriteU32LE(io, replay_float_bits(event->button.x));
+			SDL_WriteU32LE(io, replay_float_bits(event->button.y));
+		} break;
+		case SDL_EVENT_MOUSE_MOTION: {
+			replay_write_header(io, replay, timestamp, event->type, ctx->keymod);
+			SDL_WriteU32LE(io, event->motion.state);
+			SDL_WriteU32LE(io, replay_float_bits(event->motion.x));
+			SDL_WriteU32LE(io, replay_float_bits(event->motion.y));
+			SDL_WriteU32LE(io, replay_float_bits(event->motion.xrel));
+			SDL_WriteU32LE(io, replay_float_bits(event->motion.yrel));
+		} break;
+		case SDL_EVENT_MOUSE_WHEEL: {
+			replay_write_header(io, replay, timestamp, event->type, ctx->keymod);
+			SDL_WriteU32LE(io, replay_float_bits(event->wheel.x));
+			SDL_WriteU32LE(io, replay_float_bits(event->wheel.y));
+		} break;
+		case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED: {
+			replay_write_header(io, replay, timestamp, event->type, ctx->keymod);
+			SDL_WriteS32LE(io, event->window.data1);
+			SDL_WriteS32LE(io, event->window.data2);
+		} break;
+		default: break;
+	}
+}
+
+static inline bool input_batch_arrow(SDL_Scancode scancode) {
+	return scancode == SDL_SCANCODE_LEFT || scancode == SDL_SCANCODE_RIGHT || scancode == SDL_SCANCODE_UP || scancode == SDL_SCANCODE_DOWN;
+}
+
+// Key releases and plain printable keys only update ctx->keys, so they don't need to wait for the batch.
+// Modifiers are the event's own, ctx->keymod is still the one of the batch
+static inline bool input_batch_commutes(const SDL_Event *event) {
+	if (event->type == SDL_EVENT_KEY_UP) return true;
+	if (event->type != SDL_EVENT_KEY_DOWN) return false;
+	if (event->key.mod & (SDL_KMOD_CTRL | SDL_KMOD_ALT | SDL_KMOD_GUI)) return false;
+	return event->key.key > SDLK_SPACE && event->key.key < SDLK_DELETE;
+}
+
+// Handles everything batched so far as one event
+static void input_batch_flush(Ctx *ctx) {
+	Input_Batch *batch = &ctx->input_batch;
+	if (batch->event.type == 0) return;
+	SDL_Event event = batch->event;
+	SDL_Keymod keymod = ctx->keymod;
+	ctx->keymod = batch->keymod;
+	Uint64 start = profile_begin();
+	Uint64 trace_start = trace_begin();
+	if (event.type == SDL_EVENT_TEXT_INPUT) {
+		event.text.text = batch->text;
+		handle_event(ctx, &event);
+	} else {
+		ctx->batching_moves = true;
+		for (Uint32 i = 0; i < batch->count; ++i) {
+			if (i + 1 == batch->count) ctx->batching_moves = false;
+			handle_event(ctx, &event);
+		}
+	}
+	trace_end_arg("event_batch", trace_start, "count", batch->count);
+	profile_end(ctx, Profile_Phase_events, start);
+	ctx->keymod = keymod;
+	batch->event.type = 0;
+	batch->count = 0;
+	batch->text_size = 0;
+}
+
+// False if the event can't be batched, then whatever was batched must be handled before it
+static bool input_batch_add(Ctx *ctx, const SDL_Event *event) {
+	Input_Batch *batch = &ctx->input_batch;
+	bool text = event->type == SDL_EVENT_TEXT_INPUT;
+	bool move = event->type == SDL_EVENT_KEY_DOWN && event->key.repeat && input_batch_arrow(event->key.scancode);
+	if (!text && !move) return false;
+	if (batch->event.type != 0) {
+		bool same = batch->event.type == event->type && batch->keymod == ctx->keymod
+			&& (text || batch->event.key.scancode == event->key.scancode);
+		if (!same) input_batch_flush(ctx);
+	}
+	if (text) {
+		size_t size = SDL_strlen(event->text.text);
+		if (batch->text_size + size + 1 > batch->text_capacity) {
+			Uint32 new_cap = SDL_max(batch->text_capacity * 2, batch->text_size + size + 0x100);
+			char *new_text = SDL_realloc(batch->text, new_cap);
+			if (new_text == NULL) {
+				SDL_Log("Error, can't grow text input batch to %" SDL_PRIu32 " bytes", new_cap);
+				input_batch_flush(ctx);
+				return false;
+			}
+			batch->text = new_text;
+			batch->text_capacity = new_cap;
+		}
+		SDL_memcpy(batch->text + batch->text_size, event->text.text, size + 1);
+		batch->text_size += size;
+	}
+	if (batch->event.type == 0) {
+		batch->event = *event;
+		batch->keymod = ctx->keymod;
+	}
+	batch->count += 1;
+	return true;
+}
+
 SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 	Ctx *ctx = (Ctx *)appstate;
+	if (ctx->macro_recording) {
+		macro_record_event(ctx, event);
+	}
+	if (ctx->replay.record != NULL) {
+		replay_record_event(ctx, event);
+	}
+	bool should_render = ctx->should_render;
+	// Batch is handled once per tick, before rendering
+	if (input_batch_add(ctx, event)) {
+		ctx->should_render = true;
+		replay_input_handled(ctx, event, should_render);
+		return SDL_APP_CONTINUE;
+	}
+	if (!input_batch_commutes(event)) {
+		input_batch_flush(ctx);
+	}
+	Uint64 start = profile_begin();
+	Uint64 trace_start = trace_begin();
+	SDL_AppResult result = handle_event(ctx, event);
+	trace_end_arg("event", trace_start, "type", event->type);
+	profile_end(ctx, Profile_Phase_events, start);
+	replay_input_handled(ctx, event, should_render);
+	return result;
+}
+
+// Reads the next event into replay->next, false at the end of recording
+static bool replay_read_event(Ctx *ctx) {
+	Replay *replay = &ctx->replay;
+	SDL_IOStream *io = replay->input;
+	Uint32 delta;
+	Uint16 type, keymod;
+	if (!SDL_ReadU32LE(io, &delta) || !SDL_ReadU16LE(io, &type) || !SDL_ReadU16LE(io, &keymod)) return false;
+	SDL_WindowID window = SDL_GetWindowID(ctx->window);
+	SDL_Event *event = &replay->next;
+	*event = (SDL_Event){.type = type};
+	replay->next_time += (Uint64)delta * 1000;
+	replay->next_keymod = keymod;
+	bool ok = true;
+	switch (type) {
+		case SDL_EVENT_QUIT: break;
+		case SDL_EVENT_KEY_DOWN:
+		case SDL_EVENT_KEY_UP: {
+			Uint32 scancode, key;
+			Uint8 repeat;
+			ok = SDL_ReadU32LE(io, &scancode) && SDL_ReadU32LE(io, &key) && SDL_ReadU8(io, &repeat);
+			event->key.windowID = window;
+			event->key.scancode = (SDL_Scancode)scancode;
+			event->key.key = key;
+			event->key.mod = keymod;
+			event->key.down = type == SDL_EVENT_KEY_DOWN;
+			event->key.repeat = repeat;
+		} break;
+		case SDL_EVENT_TEXT_INPUT: {
+			Uint16 size;
+			ok = SDL_ReadU16LE(io, &size) && size < REPLAY_TEXT_SIZE && SDL_ReadIO(io, replay->next_text, size) == size;
+			if (ok) replay->next_text[size] = '\0';
+			event->text.windowID = window;
+			event->text.text = replay->next_text;
+		} break;
+		case SDL_EVENT_MOUSE_BUTTON_DOWN:
+		case SDL_EVENT_MOUSE_BUTTON_UP: {
+			Uint32 x, y;
+			ok = SDL_ReadU8(io, &event->button.button) && SDL_ReadU8(io, &event->button.clicks)
+				&& SDL_ReadU32LE(io, &x) && SDL_ReadU32LE(io, &y);
+			event->button.windowID = window;
+			event->button.down = type == SDL_EVENT_MOUSE_BUTTON_DOWN;
+			event->button.x = replay_bits_float(x);
+			event->button.y = replay_bits_float(y);
+		} break;
+		case SDL_EVENT_MOUSE_MOTION: {
+			Uint32 x, y, xrel, yrel;
+			ok = SDL_ReadU32LE(io, &event->motion.state) && SDL_ReadU32LE(io, &x) && SDL_ReadU32LE(io, &y)
+				&& SDL_ReadU32LE(io, &xrel) && SDL_ReadU32LE(io, &yrel);
+			event->motion.windowID = window;
+			event->motion.x = replay_bits_float(x);
+			event->motion.y = replay_bits_float(y);
+			event->motion.xrel = replay_bits_float(xrel);
+			event->motion.yrel = replay_bits_float(yrel);
+		} break;
+		case SDL_EVENT_MOUSE_WHEEL: {
+			Uint32 x, y;
+			ok = SDL_ReadU32LE(io, &x) && SDL_ReadU32LE(io, &y);
+			event->wheel.windowID = window;
+			event->wheel.x = replay_bits_float(x);
+			event->wheel.y = replay_bits_float(y);
+		} break;
+		case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED: {
+			ok = SDL_ReadS32LE(io, &event->window.data1) && SDL_ReadS32LE(io, &event->window.data2);
+			event->window.windowID = window;
+		} break;
+		default: ok = false; break;
+	}
+	if (!ok) SDL_LogWarn(0, "Input recording is corrupted, replay stopped");
+	return ok;
+}
+
+static bool replay_start(Ctx *ctx, const char *path) {
+	Replay *replay = &ctx->replay;
+	replay->input = SDL_IOFromFile(path, "rb");
+	if (replay->input == NULL) {
+		SDL_LogWarn(0, "Can't open input recording %s: %s", path, SDL_GetError());
+		return false;
+	}
+	char magic[8];
+	Uint32 version;
+	Sint32 win_w, win_h;
+	if (SDL_ReadIO(replay->input, magic, 8) != 8 || SDL_memcmp(magic, REPLAY_MAGIC, 8) != 0
+		|| !SDL_ReadU32LE(replay->input, &version) || version != REPLAY_VERSION
+		|| !SDL_ReadS32LE(replay->input, &win_w) || !SDL_ReadS32LE(replay->input, &win_h)) {
+		SDL_LogWarn(0, "File %s isn't an input recording", path);
+		SDL_CloseIO(replay->input);
+		replay->input = NULL;
+		return false;
+	}
+	// Same layout as when recorded, even if the window can't be resized
+	SDL_SetWindowSize(ctx->window, win_w, win_h);
+	ctx->win_w = win_w;
+	ctx->win_h = win_h;
+	replay->input_start = SDL_GetTicksNS();
+	replay->next_time = 0;
+	replay->has_next = replay_read_event(ctx);
+	SDL_LogInfo(0, "Replaying input from %s", path);
+	return true;
+}
+
+// Feeds events that are due into SDL_AppEvent, stamped with the time they were fed.
+// Returns false when replay is over and every input was presented
+static bool replay_update(Ctx *ctx) {
+	Replay *replay = &ctx->replay;
+	if (replay->input == NULL) return true;
+	Uint64 now = SDL_GetTicksNS();
+	while (replay->has_next && replay->input_start + replay->next_time <= now) {
+		SDL_Event event = replay->next;
+		event.common.timestamp = SDL_GetTicksNS();
+		ctx->keymod = replay->next_keymod;
+		SDL_SetModState(replay->next_keymod);
+		if (SDL_AppEvent(ctx, &event) != SDL_APP_CONTINUE) return false;
+		replay->has_next = replay_read_event(ctx);
+	}
+	return replay->has_next || replay->pending_count > 0 || ctx->should_render;
+}
+
+// Stops recording and replay, reports latency of what was measured
+static void replay_finish(Ctx *ctx) {
+	Replay *replay = &ctx->replay;
+	if (replay->record != NULL && !SDL_CloseIO(replay->record)) {
+		SDL_LogWarn(0, "Can't write input recording: %s", SDL_GetError());
+	}
+	replay->record = NULL;
+	if (replay->input != NULL) SDL_CloseIO(replay->input);
+	replay->input = NULL;
+	replay_report(ctx);
+}
+
+// Looks up words for the one before the cursor, false if there are none
+static bool completion_query(Ctx *ctx) {
+	Completion *completion = &ctx->completion;
+	Frame *frame = &ctx->frames[ctx->focused_frame];
+	TextBuffer *buffer = frame_buffer(ctx, frame);
+	completion->active = false;
+	if (frame->cursors_count > 0) return false;
+	size_t start = text_word_start(buffer->text, frame->cursor);
+	Uint32 length = frame->cursor - start;
+	if (length == 0 || length > WORDS_LENGTH_MAX) return false;
+	Uint64 trace_start = trace_begin();
+	completion->count = words_complete(&ctx->words, buffer->text + start, length, COMPLETION_MAX, completion->candidates);
+	trace_end_arg("complete", trace_start, "candidates", completion->count);
+	if (completion->count == 0) return false;
+	SDL_memcpy(completion->prefix, buffer->text + start, length);
+	completion->prefix_length = length;
+	completion->start = start;
+	completion->end = frame->cursor;
+	completion->selected = 0;
+	completion->frame = frame_handle(ctx, ctx->focused_frame);
+	completion->active = true;
+	return true;
+}
+
+// Puts the next candidate in place of the completed word, after the last one it's what was typed again
+static void completion_next(Ctx *ctx) {
+	Completion *completion = &ctx->completion;
+	if (!completion_valid(ctx) && !completion_query(ctx)) return;
+	Frame *frame = &ctx->frames[ctx->focused_frame];
+	TextBuffer *buffer = frame_buffer(ctx, frame);
+	Uint32 typed_end = completion->start + completion->prefix_length;
+	completion->selected = (completion->selected + 1) % (completion->count + 1);
+	if (completion->end > typed_end) {
+		buffer_delete_text(ctx, buffer - ctx->buffers, typed_end, completion->end, Undo_Group_keyboard);
+	}
+	if (completion->selected > 0) {
+		// Inserting may grow the word table under the candidate
+		const Word *word = &ctx->words.words[completion->candidates[completion->selected - 1]];
+		char rest[WORDS_LENGTH_MAX];
+		Uint32 rest_length = word->length - completion->prefix_length;
+		SDL_memcpy(rest, ctx->words.chars + word->offset + completion->prefix_length, rest_length);
+		buffer_insert_text(ctx, buffer, rest, rest_length, typed_end, Undo_Group_keyboard);
+	}
+	completion->end = frame->cursor;
+	ctx->should_render = true;
+}
+
+// While the same word is typed, candidates follow it on every key
+static void completion_update(Ctx *ctx) {
+	Completion *completion = &ctx->completion;
+	if (!completion->active) return;
+	Frame *frame = &ctx->frames[ctx->focused_frame];
+	if (frame_resolve(ctx, completion->frame) != ctx->focused_frame
+		|| text_word_start(frame_buffer(ctx, frame)->text, frame->cursor) != completion->start) {
+		completion->active = false;
+		return;
+	}
+	completion_query(ctx);
+}
+
+static SDL_AppResult handle_event(Ctx *ctx, SDL_Event *event) {
 	Frame *current_frame = &ctx->frames[ctx->focused_frame];
 	switch (event->type) {
 		case SDL_EVENT_QUIT: {
@@ -1885,36 +9818,41 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 			switch (event->key.scancode) {
 				case SDL_SCANCODE_LEFT: {
 					ctx->debug_screen_rect.x -= 10;
-					frame_previous_char(ctx, ctx->focused_frame);
+					frame_move_cursors(ctx, ctx->focused_frame, frame_previous_char);
 				}; break;
 				case SDL_SCANCODE_RIGHT: {
 					ctx->debug_screen_rect.x += 10;
-					frame_next_char(ctx, ctx->focused_frame);
+					frame_move_cursors(ctx, ctx->focused_frame, frame_next_char);
 				}; break;
 				case SDL_SCANCODE_BACKSPACE: {
-					if (ctx->keymod & (SDL_KMOD_CTRL | SDL_KMOD_ALT)) {
-						frame_delete_previous_word(ctx, ctx->focused_frame, Undo_Group_keyboard);
-					} else {
-						frame_delete_previous_char(ctx, ctx->focused_frame, Undo_Group_keyboard);
-					}
+					bool word = ctx->keymod & (SDL_KMOD_CTRL | SDL_KMOD_ALT);
+					frame_delete_before_cursors(ctx, ctx->focused_frame, word, Undo_Group_keyboard);
+					completion_update(ctx);
 					if (current_frame->frame_type == Frame_Type_search) {
 						update_search(ctx, ctx->focused_frame);
 						ctx->should_render = true;
 					}
 				}; break;
 				case SDL_SCANCODE_ESCAPE: {
+					if (completion_valid(ctx)) {
+						ctx->completion.active = false;
+						ctx->should_render = true;
+						break;
+					}
 					if (current_frame->frame_type == Frame_Type_ask) {
-						current_frame->taken = false;
-						current_frame->buffer->refcount -= 1;
-						ctx->focused_frame = find_any_frame(ctx);
+						frame_close(ctx, ctx->focused_frame);
+						if (frame_cold(ctx, current_frame)->ask_option == Ask_Option_replace) {
+							ctx->focused_frame = frame_parent(ctx, current_frame);
+						} else {
+							ctx->focused_frame = find_any_frame(ctx);
+						}
 						current_frame = &ctx->frames[ctx->focused_frame];
 						ctx->should_render = true;
 						break;
 					} else if (current_frame->frame_type == Frame_Type_search) {
-						current_frame->taken = false;
-						current_frame->buffer->refcount -= 1;
-						ctx->frames[current_frame->parent_frame].searching_mode = false;
-						ctx->focused_frame = current_frame->parent_frame;
+						frame_close(ctx, ctx->focused_frame);
+						ctx->frames_cold[frame_parent(ctx, current_frame)].searching_mode = false;
+						ctx->focused_frame = frame_parent(ctx, current_frame);
 						current_frame = &ctx->frames[ctx->focused_frame];
 						ctx->should_render = true;
 						break;
@@ -1924,83 +9862,163 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 					ctx->moving_col = false;
 					char nl = '\n';
 					if (current_frame->frame_type == Frame_Type_ask) {
-						if (current_frame->ask_option == Ask_Option_save) {
-							Frame *parent_frame = &ctx->frames[current_frame->parent_frame];
-							parent_frame->filename =
-								SDL_strndup(current_frame->buffer->text, current_frame->buffer->text_size);
-							current_frame->buffer->refcount -= 1;
-							current_frame->taken = false;
-							ctx->focused_frame = current_frame->parent_frame;
+						if (frame_cold(ctx, current_frame)->ask_option == Ask_Option_save) {
+							Frame *parent_frame = &ctx->frames[frame_parent(ctx, current_frame)];
+							SDL_free(frame_cold(ctx, parent_frame)->filename);
+							frame_cold(ctx, parent_frame)->filename =
+								SDL_strndup(frame_buffer(ctx, current_frame)->text, frame_buffer(ctx, current_frame)->text_size);
+							frame_close(ctx, ctx->focused_frame);
+							ctx->focused_frame = frame_parent(ctx, current_frame);
 							current_frame = &ctx->frames[ctx->focused_frame];
-							if (!SDL_SaveFile(current_frame->filename, current_frame->buffer->text, current_frame->buffer->text_size)) {
-								SDL_LogWarn(0, "Can't save buffer into %s: %s", current_frame->filename, SDL_GetError());
+							if (!buffer_save_file(frame_buffer(ctx, current_frame), frame_cold(ctx, current_frame)->filename)) {
+								SDL_LogWarn(0, "Can't save buffer into %s: %s", frame_cold(ctx, current_frame)->filename, SDL_GetError());
 							} else {
-								SDL_LogInfo(0, "Saved buffer into %s", current_frame->filename);
+								SDL_LogInfo(0, "Saved buffer into %s", frame_cold(ctx, current_frame)->filename);
+								buffer_watch_file(ctx, frame_buffer(ctx, current_frame) - ctx->buffers, frame_cold(ctx, current_frame)->filename);
+								tags_file_saved(ctx, frame_cold(ctx, current_frame)->filename, frame_buffer(ctx, current_frame)->text, frame_buffer(ctx, current_frame)->text_size);
 							}
 							ctx->should_render = true;
-						} else if (current_frame->ask_option == Ask_Option_open) {
-							Frame *parent_frame = &ctx->frames[current_frame->parent_frame];
-							parent_frame->filename =
-								SDL_strndup(current_frame->buffer->text, current_frame->buffer->text_size);
-							parent_frame->buffer->refcount -= 1;
-							parent_frame->buffer = allocate_buffer(ctx, SDL_strdup(parent_frame->filename));
-							if (parent_frame->buffer == NULL) {
-								SDL_LogError(0, "Can't allocate buffer for this file");
-								return SDL_APP_FAILURE;
+						} else if (frame_cold(ctx, current_frame)->ask_option == Ask_Option_open) {
+							char *path = SDL_strndup(frame_buffer(ctx, current_frame)->text, frame_buffer(ctx, current_frame)->text_size);
+							bool opened = path != NULL && frame_open_file(ctx, frame_parent(ctx, current_frame), path);
+							// Frame keeps what it showed
+							if (!opened) SDL_LogWarn(0, "Can't open %s", path != NULL ? path : "file");
+							SDL_free(path);
+							frame_close(ctx, ctx->focused_frame);
+							ctx->focused_frame = frame_parent(ctx, current_frame);
+							current_frame = &ctx->frames[ctx->focused_frame];
+							if (opened) {
+								Uint32 line = buffer_count_lines(ctx, frame_buffer(ctx, current_frame), current_frame->cursor);
+								frame_scroll_to_line_centered(ctx, ctx->focused_frame, line);
 							}
-							SDL_free(parent_frame->buffer->text);
-							parent_frame->buffer->text = SDL_LoadFile(parent_frame->filename, &parent_frame->buffer->text_capacity);
-							if (parent_frame->buffer->text == NULL) {
-								SDL_LogInfo(0, "File %s doesn't exists, creating", parent_frame->filename);
-							} else {
-								SDL_LogInfo(0, "Opened file %s", parent_frame->filename);
+							ctx->should_render = true;
+						} else if (frame_cold(ctx, current_frame)->ask_option == Ask_Option_macro) {
+							Uint32 times = 0;
+							if (frame_buffer(ctx, current_frame)->text_size > 0) {
+								char *count = SDL_strndup(frame_buffer(ctx, current_frame)->text, frame_buffer(ctx, current_frame)->text_size);
+								if (count != NULL) times = SDL_strtoul(count, NULL, 10);
+								SDL_free(count);
+							}
+							frame_close(ctx, ctx->focused_frame);
+							ctx->focused_frame = frame_parent(ctx, current_frame);
+							macro_replay(ctx, times);
+							current_frame = &ctx->frames[ctx->focused_frame];
+						} else if (frame_cold(ctx, current_frame)->ask_option == Ask_Option_command) {
+							char *command = SDL_strndup(frame_buffer(ctx, current_frame)->text, frame_buffer(ctx, current_frame)->text_size);
+							frame_close(ctx, ctx->focused_frame);
+							ctx->focused_frame = frame_parent(ctx, current_frame);
+							current_frame = &ctx->frames[ctx->focused_frame];
+							if (command != NULL && !is_space_only(ctx, SDL_strlen(command), command)) {
+								command_start(ctx, ctx->focused_frame, command);
 							}
-							parent_frame->scroll_lock = true;
-							parent_frame->cursor = 0;
-							parent_frame->buffer->text_size = parent_frame->buffer->text_capacity;
-							parent_frame->buffer->refcount += 1;
-							parent_frame->scroll.x = 0;
-							current_frame->taken = false;
-							current_frame->buffer->refcount -= 1;
-							ctx->focused_frame = current_frame->parent_frame;
+							SDL_free(command);
+							ctx->should_render = true;
+						} else if (frame_cold(ctx, current_frame)->ask_option == Ask_Option_replace) {
+							Frame *search_frame = &ctx->frames[frame_parent(ctx, current_frame)];
+							Uint32 target_frame = frame_parent(ctx, search_frame);
+							Uint32 replaced = frame_replace_all(ctx, target_frame,
+								frame_buffer(ctx, search_frame)->text, frame_buffer(ctx, search_frame)->text_size,
+								frame_buffer(ctx, current_frame)->text, frame_buffer(ctx, current_frame)->text_size);
+							SDL_LogInfo(0, "Replaced %" SDL_PRIu32 " occurrences", replaced);
+							frame_close(ctx, ctx->focused_frame);
+							frame_close(ctx, search_frame - ctx->frames);
+							ctx->frames_cold[target_frame].searching_mode = false;
+							ctx->focused_frame = target_frame;
 							current_frame = &ctx->frames[ctx->focused_frame];
-							Uint32 line = count_lines(ctx, current_frame->cursor, current_frame->buffer->text);
+							Uint32 line = buffer_count_lines(ctx, frame_buffer(ctx, current_frame), current_frame->cursor);
 							frame_scroll_to_line_centered(ctx, ctx->focused_frame, line);
 							ctx->should_render = true;
 						} else {
-							SDL_LogError(0, ("Unknown ask option: %" SDL_PRIu32), (Uint32)current_frame->ask_option);
+							SDL_LogError(0, ("Unknown ask option: %" SDL_PRIu32), (Uint32)frame_cold(ctx, current_frame)->ask_option);
 						}
 						break;
 					} else if (current_frame->frame_type == Frame_Type_search) {
-						current_frame->buffer->refcount -= 1;
-						current_frame->taken = false;
-						ctx->frames[current_frame->parent_frame].searching_mode = false;
-						if (current_frame->search_status == Search_Status_found) {
-							ctx->frames[current_frame->parent_frame].cursor = ctx->frames[current_frame->parent_frame].search_cursor;
+						Uint32 parent = frame_parent(ctx, current_frame);
+						frame_close(ctx, ctx->focused_frame);
+						ctx->frames_cold[parent].searching_mode = false;
+						if (frame_cold(ctx, current_frame)->search_status == Search_Status_found) {
+							ctx->frames[parent].cursor = ctx->frames_cold[parent].search_cursor;
 						}
-						ctx->focused_frame = current_frame->parent_frame;
+						ctx->focused_frame = parent;
 						current_frame = &ctx->frames[ctx->focused_frame];
 						ctx->should_render = true;
 						break;
 					}
 					if (frame_is_multiline(ctx, ctx->focused_frame)) {
-						buffer_insert_text(ctx, current_frame->buffer, &nl, 1, current_frame->cursor, Undo_Group_keyboard);
+						frame_insert_text(ctx, ctx->focused_frame, &nl, 1, Undo_Group_keyboard);
 						ctx->should_render = true;
 					}
 				}; break;
 				case SDL_SCANCODE_TAB: {
 					ctx->moving_col = false;
 					char nl = '\t';
-					buffer_insert_text(ctx, current_frame->buffer, &nl, 1, current_frame->cursor, Undo_Group_keyboard);
+					frame_insert_text(ctx, ctx->focused_frame, &nl, 1, Undo_Group_keyboard);
 					ctx->should_render = true;
 				}; break;
 				case SDL_SCANCODE_UP: {
 					ctx->debug_screen_rect.y -= 10;
-					frame_previous_line(ctx, ctx->focused_frame);
+					frame_move_cursors(ctx, ctx->focused_frame, frame_previous_line);
 				}; break;
 				case SDL_SCANCODE_DOWN: {
 					ctx->debug_screen_rect.y += 10;
-					frame_next_line(ctx, ctx->focused_frame);
+					frame_move_cursors(ctx, ctx->focused_frame, frame_next_line);
+				}; break;
+				case SDL_SCANCODE_F3: {
+					if (ctx->macro_replaying) break;
+					macro_clear(ctx);
+					ctx->macro_recording = true;
+					SDL_LogInfo(0, "Recording macro");
+				}; break;
+				case SDL_SCANCODE_F4: {
+					if (ctx->macro_replaying) break;
+					if (ctx->macro_recording) {
+						ctx->macro_recording = false;
+						SDL_LogInfo(0, "Macro recorded, %" SDL_PRIu32 " events", ctx->macro_events_count);
+					} else if (ctx->keymod & SDL_KMOD_SHIFT) {
+						Uint32 ask_frame = create_ask_frame(ctx, Ask_Option_macro, ctx->focused_frame, "Repeat macro (empty until fail): ");
+						if (ask_frame == (Uint32)-1) {
+							SDL_Log("Error, can't open ask frame");
+							break;
+						}
+						ctx->focused_frame = ask_frame;
+						current_frame = &ctx->frames[ask_frame];
+						ctx->should_render = true;
+					} else {
+						macro_replay(ctx, 1);
+						current_frame = &ctx->frames[ctx->focused_frame];
+					}
+				}; break;
+				case SDL_SCANCODE_F6: {
+					if (!frame_is_multiline(ctx, ctx->focused_frame)) break;
+					frame_toggle_follow(ctx, ctx->focused_frame);
+				}; break;
+				case SDL_SCANCODE_F12: {
+					memory_dump(ctx);
+				}; break;
+				case SDL_SCANCODE_F10: {
+					const char *path = SDL_getenv("EDITOR_TRACE");
+					trace_toggle(path != NULL ? path : TRACE_DEFAULT_PATH);
+				}; break;
+#ifdef DEBUG_PROFILE
+				case SDL_SCANCODE_F11: {
+					ctx->profiler.hud = !ctx->profiler.hud;
+					ctx->should_render = true;
+				}; break;
+#endif
+				case SDL_SCANCODE_F5: {
+					if (ctx->keymod & SDL_KMOD_SHIFT) {
+						command_cancel(ctx);
+						break;
+					}
+					if (!frame_is_multiline(ctx, ctx->focused_frame)) break;
+					Uint32 ask_frame = create_ask_frame(ctx, Ask_Option_command, ctx->focused_frame, "Run: ");
+					if (ask_frame == (Uint32)-1) {
+						SDL_Log("Error, can't open ask frame");
+						break;
+					}
+					ctx->focused_frame = ask_frame;
+					current_frame = &ctx->frames[ask_frame];
+					ctx->should_render = true;
 				}; break;
 				default: {};
 			}
@@ -2014,14 +10032,14 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 				} break;
 				case SDLK_F: {
 					if (ctx->keymod & SDL_KMOD_CTRL) {
-						frame_next_char(ctx, ctx->focused_frame);
+						frame_move_cursors(ctx, ctx->focused_frame, frame_next_char);
 					} else if (ctx->keymod & SDL_KMOD_ALT) {
-						frame_next_word(ctx, ctx->focused_frame);
+						frame_move_cursors(ctx, ctx->focused_frame, frame_next_word);
 					}
 				}; break;
 				case SDLK_S: {
 					if (ctx->keymod & SDL_KMOD_CTRL) {
-						if (current_frame->filename == NULL || ctx->keymod & SDL_KMOD_SHIFT) {
+						if (frame_cold(ctx, current_frame)->filename == NULL || ctx->keymod & SDL_KMOD_SHIFT) {
 							Uint32 ask_frame = create_ask_frame(ctx, Ask_Option_save, ctx->focused_frame, "Save to: ");
 							if (ask_frame == (Uint32)-1) {
 								SDL_Log("Error, can't open ask frame");
@@ -2031,8 +10049,13 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 							current_frame = &ctx->frames[ctx->focused_frame];
 							ctx->should_render = true;
 						} else {
-							SDL_SaveFile(current_frame->filename, current_frame->buffer->text, current_frame->buffer->text_size);
-							SDL_LogInfo(0, "Saved buffer into %s", current_frame->filename);
+							if (!buffer_save_file(frame_buffer(ctx, current_frame), frame_cold(ctx, current_frame)->filename)) {
+								SDL_LogWarn(0, "Can't save buffer into %s: %s", frame_cold(ctx, current_frame)->filename, SDL_GetError());
+							} else {
+								SDL_LogInfo(0, "Saved buffer into %s", frame_cold(ctx, current_frame)->filename);
+								buffer_watch_file(ctx, frame_buffer(ctx, current_frame) - ctx->buffers, frame_cold(ctx, current_frame)->filename);
+								tags_file_saved(ctx, frame_cold(ctx, current_frame)->filename, frame_buffer(ctx, current_frame)->text, frame_buffer(ctx, current_frame)->text_size);
+							}
 						}
 					}
 				}; break;
@@ -2046,14 +10069,19 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 						frame_forward_paragraph(ctx, ctx->focused_frame);
 					}
 				} break;
+				case SDLK_RIGHTBRACKET: {
+					if (ctx->keymod & SDL_KMOD_CTRL) {
+						frame_match_bracket(ctx, ctx->focused_frame);
+					}
+				} break;
 				case SDLK_R: {
 					if (ctx->keymod & SDL_KMOD_CTRL) {
 						if (current_frame->frame_type == Frame_Type_search) {
-							current_frame->search_backwards = true;
+							frame_cold(ctx, current_frame)->search_backwards = true;
 							update_search(ctx, ctx->focused_frame);
-							if (current_frame->search_status == Search_Status_not_found) break;
-							ctx->frames[current_frame->parent_frame].cursor =
-								ctx->frames[current_frame->parent_frame].search_cursor;
+							if (frame_cold(ctx, current_frame)->search_status == Search_Status_not_found) break;
+							Uint32 parent = frame_parent(ctx, current_frame);
+							ctx->frames[parent].cursor = ctx->frames_cold[parent].search_cursor;
 						} else {
 							Uint32 search_frame = frame_search_create(ctx, ctx->focused_frame, true);
 							SDL_assert(search_frame != ctx->focused_frame);
@@ -2061,17 +10089,28 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 							current_frame = &ctx->frames[ctx->focused_frame];
 							ctx->should_render = true;
 						}
+					} else if (ctx->keymod & SDL_KMOD_ALT) {
+						if (current_frame->frame_type != Frame_Type_search) break;
+						if (frame_buffer(ctx, current_frame)->text_size == 0) break;
+						Uint32 ask_frame = create_ask_frame(ctx, Ask_Option_replace, ctx->focused_frame, "Replace with: ");
+						if (ask_frame == (Uint32)-1) {
+							SDL_Log("Error, can't open ask frame");
+							break;
+						}
+						ctx->focused_frame = ask_frame;
+						current_frame = &ctx->frames[ask_frame];
+						ctx->should_render = true;
 					}
 				} break;
 				case SDLK_Q: {
 					if (ctx->keymod & SDL_KMOD_CTRL) {
 						if (current_frame->frame_type == Frame_Type_search) {
-							current_frame->search_backwards = false;
+							frame_cold(ctx, current_frame)->search_backwards = false;
 							update_search(ctx, ctx->focused_frame);
-							if (current_frame->search_status == Search_Status_not_found) break;
-							ctx->frames[current_frame->parent_frame].cursor =
-								ctx->frames[current_frame->parent_frame].search_cursor
-								+ current_frame->buffer->text_size;
+							if (frame_cold(ctx, current_frame)->search_status == Search_Status_not_found) break;
+							Uint32 parent = frame_parent(ctx, current_frame);
+							ctx->frames[parent].cursor = ctx->frames_cold[parent].search_cursor
+								+ frame_buffer(ctx, current_frame)->text_size;
 						} else {
 							Uint32 search_frame = frame_search_create(ctx, ctx->focused_frame, false);
 							SDL_assert(search_frame != ctx->focused_frame);
@@ -2082,71 +10121,67 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 					}
 				} break;
 				case SDLK_SLASH: {
-					if (ctx->keymod & SDL_KMOD_CTRL) {
+					if (ctx->keymod & SDL_KMOD_ALT) {
+						completion_next(ctx);
+					} else if (ctx->keymod & SDL_KMOD_CTRL) {
 						if (ctx->keymod & SDL_KMOD_SHIFT) {
-							if (current_frame->buffer->undos_cursor >= current_frame->buffer->undos_size) break;
-							Undo_Operation op = current_frame->buffer->undos[current_frame->buffer->undos_cursor];
-							if (op.type == Undo_Type_insert) {
-								buffer_insert_text_no_undo(ctx, current_frame->buffer, op.data, op.len, op.pos);
-								current_frame->buffer->undos_cursor += 1;
-							} else if (op.type == Undo_Type_delete) {
-								buffer_delete_text_no_undo(ctx, (current_frame->buffer - ctx->buffers), op.pos, op.pos + op.len);
-								current_frame->buffer->undos_cursor += 1;
-							} else {
-								SDL_assert(!"Unknown Undo type operation");
-							}
+							if (!buffer_redo(ctx, frame_buffer(ctx, current_frame) - ctx->buffers)) break;
 							ctx->should_render = true;
 						} else {
-							if (current_frame->buffer->undos_cursor <= 0) break;
-							Undo_Operation op = current_frame->buffer->undos[current_frame->buffer->undos_cursor - 1];
-							if (op.type == Undo_Type_insert) {
-								buffer_delete_text_no_undo(ctx, (current_frame->buffer - ctx->buffers), op.pos, op.pos + op.len);
-								current_frame->buffer->undos_cursor -= 1;
-							} else if (op.type == Undo_Type_delete) {
-								buffer_insert_text_no_undo(ctx, current_frame->buffer, op.data, op.len, op.pos);
-								current_frame->buffer->undos_cursor -= 1;
-							} else {
-								SDL_assert(!"Unknown Undo type operation");
-							}
+							if (!buffer_undo(ctx, frame_buffer(ctx, current_frame) - ctx->buffers)) break;
 							ctx->should_render = true;
 						}
 					}
 				} break;
+				case SDLK_PERIOD: {
+					if (ctx->keymod & SDL_KMOD_ALT) tags_jump(ctx);
+				} break;
+				case SDLK_COMMA: {
+					if (ctx->keymod & SDL_KMOD_ALT) jump_back(ctx);
+				} break;
 				case SDLK_L: {
-					Uint32 line = count_lines(ctx, current_frame->cursor, current_frame->buffer->text);
+					if (ctx->keymod & SDL_KMOD_ALT) {
+						frame_cursors_from_selection(ctx, ctx->focused_frame);
+						break;
+					}
+					Uint32 line = buffer_count_lines(ctx, frame_buffer(ctx, current_frame), current_frame->cursor);
 					frame_scroll_to_line_centered(ctx, ctx->focused_frame, line);
 					ctx->should_render = true;
 				} break;
 				case SDLK_P: {
-					if (ctx->keymod & SDL_KMOD_CTRL) {
-						frame_previous_line(ctx, ctx->focused_frame);
+					if ((ctx->keymod & SDL_KMOD_CTRL) && (ctx->keymod & SDL_KMOD_ALT)) {
+						frame_add_cursor_line(ctx, ctx->focused_frame, false);
+					} else if (ctx->keymod & SDL_KMOD_CTRL) {
+						frame_move_cursors(ctx, ctx->focused_frame, frame_previous_line);
 					}
 				}; break;
 				case SDLK_A: {
 					if (ctx->keymod & SDL_KMOD_CTRL) {
-						frame_beggining_line(ctx, ctx->focused_frame);
+						frame_move_cursors(ctx, ctx->focused_frame, frame_beggining_line);
 					}
 				}; break;
 				case SDLK_E: {
 					if (ctx->keymod & SDL_KMOD_CTRL) {
-						frame_end_line(ctx, ctx->focused_frame);
+						frame_move_cursors(ctx, ctx->focused_frame, frame_end_line);
 					}
 				}; break;
 				case SDLK_M: {
 					if (ctx->keymod & SDL_KMOD_ALT) {
-						frame_beggining_spaced_line(ctx, ctx->focused_frame);
+						frame_move_cursors(ctx, ctx->focused_frame, frame_beggining_spaced_line);
 					}
 				}; break;
 				case SDLK_N: {
-					if (ctx->keymod & SDL_KMOD_CTRL) {
-						frame_next_line(ctx, ctx->focused_frame);
+					if ((ctx->keymod & SDL_KMOD_CTRL) && (ctx->keymod & SDL_KMOD_ALT)) {
+						frame_add_cursor_line(ctx, ctx->focused_frame, true);
+					} else if (ctx->keymod & SDL_KMOD_CTRL) {
+						frame_move_cursors(ctx, ctx->focused_frame, frame_next_line);
 					}
 				}; break;
 				case SDLK_B: {
 					if (ctx->keymod & SDL_KMOD_CTRL) {
-						frame_previous_char(ctx, ctx->focused_frame);
+						frame_move_cursors(ctx, ctx->focused_frame, frame_previous_char);
 					} else if (ctx->keymod & SDL_KMOD_ALT) {
-						frame_previous_word(ctx, ctx->focused_frame);
+						frame_move_cursors(ctx, ctx->focused_frame, frame_previous_word);
 					}
 				}; break;
 				case SDLK_W: {
@@ -2155,20 +10190,20 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 						ctx->moving_col = false;
 						Uint32 selection_min = SDL_min(current_frame->cursor, current_frame->selection);
 						Uint32 selection_max = SDL_max(current_frame->cursor, current_frame->selection);
-						char ch = current_frame->buffer->text[selection_max];
-						current_frame->buffer->text[selection_max] = '\0';
-						SDL_SetClipboardText(current_frame->buffer->text + selection_min);
-						current_frame->buffer->text[selection_max] = ch;
-						buffer_delete_text(ctx, (current_frame->buffer - ctx->buffers), selection_min, selection_max, Undo_Group_clipboard);
+						char ch = frame_buffer(ctx, current_frame)->text[selection_max];
+						frame_buffer(ctx, current_frame)->text[selection_max] = '\0';
+						SDL_SetClipboardText(frame_buffer(ctx, current_frame)->text + selection_min);
+						frame_buffer(ctx, current_frame)->text[selection_max] = ch;
+						buffer_delete_text(ctx, (frame_buffer(ctx, current_frame) - ctx->buffers), selection_min, selection_max, Undo_Group_clipboard);
 					} else if (ctx->keymod & SDL_KMOD_ALT) {
 						current_frame->active_selection = false;
 						ctx->moving_col = false;
 						Uint32 selection_min = SDL_min(current_frame->cursor, current_frame->selection);
 						Uint32 selection_max = SDL_max(current_frame->cursor, current_frame->selection);
-						char ch = current_frame->buffer->text[selection_max];
-						current_frame->buffer->text[selection_max] = '\0';
-						SDL_SetClipboardText(current_frame->buffer->text + selection_min);
-						current_frame->buffer->text[selection_max] = ch;
+						char ch = frame_buffer(ctx, current_frame)->text[selection_max];
+						frame_buffer(ctx, current_frame)->text[selection_max] = '\0';
+						SDL_SetClipboardText(frame_buffer(ctx, current_frame)->text + selection_min);
+						frame_buffer(ctx, current_frame)->text[selection_max] = ch;
 					}
 					ctx->should_render = true;
 				} break;
@@ -2176,7 +10211,7 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 					if (ctx->keymod & SDL_KMOD_CTRL) {
 						current_frame->active_selection = false;
 						char *text = SDL_GetClipboardText();
-						buffer_insert_text(ctx, current_frame->buffer, text, SDL_strlen(text), current_frame->cursor, Undo_Group_clipboard);
+						frame_insert_text(ctx, ctx->focused_frame, text, SDL_strlen(text), Undo_Group_clipboard);
 						SDL_free(text);
 					}
 				} break;
@@ -2185,7 +10220,7 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 						current_frame->bounds.h /= 2;
 						SDL_FRect bounds = current_frame->bounds;
 						bounds.y += bounds.h;
-						Uint32 frame = append_frame(ctx, current_frame->buffer, bounds);
+						Uint32 frame = append_frame(ctx, frame_buffer(ctx, current_frame), bounds);
 						if (frame == (Uint32)-1) {
 							SDL_Log("Error, can't open new frame");
 							break;
@@ -2202,12 +10237,14 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 							current_frame->active_selection = false;
 							ctx->should_render = true;
 							break;
+						} else if (current_frame->cursors_count > 0) {
+							frame_clear_cursors(ctx, ctx->focused_frame);
+							break;
 						} else {
 							if (current_frame->frame_type == Frame_Type_search) {
-								current_frame->taken = false;
-								current_frame->buffer->refcount -= 1;
-								ctx->frames[current_frame->parent_frame].searching_mode = false;
-								ctx->focused_frame = current_frame->parent_frame;
+								frame_close(ctx, ctx->focused_frame);
+								ctx->frames_cold[frame_parent(ctx, current_frame)].searching_mode = false;
+								ctx->focused_frame = frame_parent(ctx, current_frame);
 								current_frame = &ctx->frames[ctx->focused_frame];
 								ctx->should_render = true;
 								break;
@@ -2221,12 +10258,11 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 						current_frame->selection = current_frame->cursor;
 						current_frame->cursor = temp;
 						ctx->moving_col = false;
-						Uint32 line = count_lines(ctx, current_frame->cursor, current_frame->buffer->text);
+						Uint32 line = buffer_count_lines(ctx, frame_buffer(ctx, current_frame), current_frame->cursor);
 						frame_scroll_to_line_centered(ctx, ctx->focused_frame, line);
 						ctx->should_render = true;
 					} else if (ctx->keymod & SDL_KMOD_ALT) {
-						current_frame->buffer->refcount -= 1;
-						current_frame->taken = false;
+						frame_close(ctx, ctx->focused_frame);
 						ctx->focused_frame = find_any_frame(ctx);
 						current_frame = &ctx->frames[ctx->focused_frame];
 						ctx->should_render = true;
@@ -2244,7 +10280,7 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 						ctx->should_render = true;
 					} else if (ctx->keymod & SDL_KMOD_ALT) {
 						for (Uint32 i = ctx->focused_frame + 1; i != ctx->focused_frame; ++i) {
-							if (i > ctx->frames_count) i = 0;
+							if (i >= ctx->frames_count) i = 0;
 							if (!ctx->frames[i].taken) continue;
 							set_focused_frame(ctx, i);
 							current_frame = &ctx->frames[ctx->focused_frame];
@@ -2342,7 +10378,8 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 			if (ctx->keymod & (SDL_KMOD_CTRL | SDL_KMOD_ALT)) break;
 			current_frame->active_selection = false;
 			ctx->moving_col = false;
-			buffer_insert_text(ctx, current_frame->buffer, event->text.text, SDL_strlen(event->text.text), current_frame->cursor, Undo_Group_keyboard);
+			frame_insert_text(ctx, ctx->focused_frame, event->text.text, SDL_strlen(event->text.text), Undo_Group_keyboard);
+			completion_update(ctx);
 			if (current_frame->frame_type == Frame_Type_search) {
 				update_search(ctx, ctx->focused_frame);
 			}
@@ -2365,37 +10402,77 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event) {
 #ifdef DEBUG_QUIT
 static void buffer_deallocate(Ctx *ctx, Uint32 bufid) {
 	TextBuffer *buffer = &ctx->buffers[bufid];
-	buffer->undos_cursor = 0;
-	undo_clear_after_cursor(ctx, bufid);
+	buffer_free_undos(buffer);
 	if (buffer->text != NULL)
 		SDL_free(buffer->text);
+	SDL_free(buffer->packed);
+	buffer_drop_line_index(buffer);
+	syntax_cache_free(buffer);
+	buffer_words_free(ctx, buffer);
+	structure_free(buffer);
 	buffer->refcount = 0;
 }
 
 static void frame_deallocate(Ctx *ctx, Frame *frame) {
-	(void)ctx;
-	if (frame->filename != NULL)
-		SDL_free(frame->filename);
-	frame->buffer->refcount -= 1;
+	if (frame_cold(ctx, frame)->filename != NULL)
+		SDL_free(frame_cold(ctx, frame)->filename);
+	SDL_free(frame->cursors);
+	// Closed frames already gave their reference back
+	if (frame->taken) frame_buffer(ctx, frame)->refcount -= 1;
 	frame->taken = false;
 }
 #endif
 
 void SDL_AppQuit(void *appstate, SDL_AppResult result) {
 	Ctx *ctx = (Ctx *)appstate;
-	(void) ctx;
 	(void) result;
+	command_stop(ctx);
+	trace_shutdown();
+	replay_finish(ctx);
 #ifdef DEBUG_QUIT
+	glyphs_free(ctx);
+	arena_free(&ctx->frame_arena);
 	TTF_CloseFont(ctx->font);
 	for (Uint32 i = 0; i < ctx->frames_count; ++i) {
 		frame_deallocate(ctx, &ctx->frames[i]);
 	}
 	SDL_free(ctx->frames);
+	SDL_free(ctx->frames_cold);
 	SDL_free(ctx->sorted_frames);
+	SDL_free(ctx->free_frames);
 	for (Uint32 i = 0; i < ctx->buffers_count; ++i) {
 		buffer_deallocate(ctx, i);
 	}
 	SDL_free(ctx->buffers);
+	SDL_free(ctx->free_buffers);
+	SDL_free(ctx->prompt_buffers);
+	words_table_free(&ctx->words);
+	tags_scan_free(&ctx->tags);
+	SDL_free(ctx->tags.image);
+	SDL_free(ctx->tags.dirs);
+	SDL_free(ctx->tags.scanned);
+	SDL_free(ctx->tags.added);
+	SDL_free(ctx->tags.chars);
+	SDL_free(ctx->tags.saved_files);
+	SDL_free(ctx->tags.saved);
+	SDL_free(ctx->tags.saved_chars);
+	for (Uint32 i = 0; i < ctx->jumps.count; ++i) SDL_free(ctx->jumps.stack[i].filename);
+	macro_clear(ctx);
+	SDL_free(ctx->macro_events);
+	SDL_free(ctx->input_batch.text);
+	worker_pool_stop(&ctx->pool);
+#ifndef DISABLE_LOG_BUFFER
+	SDL_SetLogOutputFunction(SDL_GetDefaultLogOutputFunction(), NULL);
+	SDL_free(ctx->log_ring);
+	SDL_free(ctx->log_batch);
+#endif
+	for (Uint32 i = 0; i < ctx->watches_count; ++i) {
+		if (ctx->watches[i].taken) SDL_free(ctx->watches[i].path);
+	}
+	SDL_free(ctx->watches);
+#ifdef SDL_PLATFORM_LINUX
+	if (ctx->inotify >= 0) close(ctx->inotify);
+#endif
 	SDL_DestroyTexture(ctx->space_texture);
 	SDL_DestroyTexture(ctx->tab_texture);
 	SDL_DestroyTexture(ctx->overflow_cursor_texture);